@@ -0,0 +1,404 @@
+/*
+    Copyright (C) 2015-2020 Tomas Flouri, Diego Darriba, Alexey Kozlov
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "pll.h"
+#include "pll_private.h"
+
+/* Memory-saving mode (PLL_ATTRIB_LIMIT_MEMORY). Inner CLVs are not allocated
+   per node; instead a bounded number of slots is shared among them. The
+   entries of partition->clv (or clv_float) of inner nodes point to the slot
+   currently holding the CLV, or are NULL if the CLV is not resident. When a
+   slot is needed, the least recently used CLV that is not pinned is evicted.
+   The operation that last computed each CLV is recorded, such that evicted
+   CLVs can be recomputed from their children, see pll_clv_require() */
+
+#define CLV_NONE ((unsigned int)-1)
+
+struct pll_clv_manager
+{
+  unsigned int slots;             /* maximum number of slots */
+  unsigned int allocated;         /* number of slots allocated so far */
+  size_t clv_size;                /* size of a slot in bytes */
+
+  void ** slot_clv;               /* slot -> buffer */
+  unsigned int * slot_owner;      /* slot -> CLV index, or CLV_NONE */
+  unsigned long * slot_used;      /* slot -> time of last use */
+  unsigned long clock;
+
+  unsigned int * clv_slot;        /* CLV index -> slot, or CLV_NONE */
+  unsigned int * clv_pinned;      /* CLV index -> pin count */
+  pll_operation_t * clv_operation;  /* CLV index -> last operation */
+  unsigned int * clv_height;      /* CLV index -> height of its subtree */
+};
+
+static void set_clv_pointer(pll_partition_t * partition,
+                            unsigned int clv_index,
+                            void * clv)
+{
+  if (partition->attributes & PLL_ATTRIB_FLOAT)
+    partition->clv_float[clv_index] = (float *)clv;
+  else
+    partition->clv[clv_index] = (double *)clv;
+}
+
+static void evict(pll_partition_t * partition, unsigned int slot)
+{
+  pll_clv_manager_t * manager = partition->clv_manager;
+  unsigned int owner = manager->slot_owner[slot];
+
+  if (owner == CLV_NONE) return;
+
+  set_clv_pointer(partition, owner, NULL);
+  manager->clv_slot[owner] = CLV_NONE;
+  manager->slot_owner[slot] = CLV_NONE;
+}
+
+int pll_clv_manager_init(pll_partition_t * partition)
+{
+  unsigned int i;
+  unsigned int sites_alloc = partition->sites +
+                             (unsigned int)partition->asc_additional_sites;
+  size_t elem_size = (partition->attributes & PLL_ATTRIB_FLOAT) ?
+                     sizeof(float) : sizeof(double);
+
+  pll_clv_manager_t * manager = (pll_clv_manager_t *)
+                                calloc(1, sizeof(pll_clv_manager_t));
+  if (!manager)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return PLL_FAILURE;
+  }
+
+  /* by default every inner CLV may be resident; the slots are allocated on
+     first use */
+  manager->slots = partition->clv_buffers;
+  manager->clv_size = (size_t)sites_alloc * partition->states_padded *
+                      partition->rate_cats * elem_size;
+
+  manager->slot_clv = (void **)calloc(manager->slots, sizeof(void *));
+  manager->slot_owner = (unsigned int *)malloc(manager->slots *
+                                               sizeof(unsigned int));
+  manager->slot_used = (unsigned long *)calloc(manager->slots,
+                                               sizeof(unsigned long));
+  manager->clv_slot = (unsigned int *)malloc(partition->nodes *
+                                             sizeof(unsigned int));
+  manager->clv_pinned = (unsigned int *)calloc(partition->nodes,
+                                               sizeof(unsigned int));
+  manager->clv_operation = (pll_operation_t *)calloc(partition->nodes,
+                                                     sizeof(pll_operation_t));
+  manager->clv_height = (unsigned int *)calloc(partition->nodes,
+                                               sizeof(unsigned int));
+
+  partition->clv_manager = manager;
+
+  if (!manager->slot_clv || !manager->slot_owner || !manager->slot_used ||
+      !manager->clv_slot || !manager->clv_pinned || !manager->clv_operation ||
+      !manager->clv_height)
+  {
+    pll_clv_manager_destroy(partition);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return PLL_FAILURE;
+  }
+
+  for (i = 0; i < manager->slots; ++i)
+    manager->slot_owner[i] = CLV_NONE;
+
+  /* no CLV has been computed yet */
+  for (i = 0; i < partition->nodes; ++i)
+  {
+    manager->clv_slot[i] = CLV_NONE;
+    manager->clv_operation[i].parent_clv_index = CLV_NONE;
+  }
+
+  return PLL_SUCCESS;
+}
+
+void pll_clv_manager_destroy(pll_partition_t * partition)
+{
+  unsigned int i;
+  pll_clv_manager_t * manager = partition->clv_manager;
+
+  if (!manager) return;
+
+  if (manager->slot_clv)
+    for (i = 0; i < manager->allocated; ++i)
+      pll_aligned_free(manager->slot_clv[i]);
+
+  free(manager->slot_clv);
+  free(manager->slot_owner);
+  free(manager->slot_used);
+  free(manager->clv_slot);
+  free(manager->clv_pinned);
+  free(manager->clv_operation);
+  free(manager->clv_height);
+  free(manager);
+
+  partition->clv_manager = NULL;
+}
+
+static unsigned int subtree_height(const pll_partition_t * partition,
+                                   unsigned int clv_index)
+{
+  if (clv_index < partition->tips)
+    return 0;
+
+  return partition->clv_manager->clv_height[clv_index];
+}
+
+/* checks that the slots suffice to execute op and to recompute the CLVs it
+   reads. Recomputing an evicted subtree pins up to one CLV per level; one
+   more slot holds the CLV pinned by a likelihood function at the other end
+   of the edge */
+int pll_clv_check_slots(const pll_partition_t * partition,
+                        const pll_operation_t * op)
+{
+  unsigned int height = 1 + PLL_MAX(subtree_height(partition,
+                                                   op->child1_clv_index),
+                                    subtree_height(partition,
+                                                   op->child2_clv_index));
+  unsigned int required = PLL_MAX(3, height + 2);
+
+  /* nothing is evicted if every inner CLV has a slot */
+  required = PLL_MIN(required, partition->clv_buffers);
+
+  if (!partition->clv_manager || partition->clv_manager->slots >= required)
+    return PLL_SUCCESS;
+
+  pll_errno = PLL_ERROR_CLV_SLOTS;
+  snprintf(pll_errmsg, 200,
+           "CLV %u requires %u CLV slots, only %u are available.",
+           op->parent_clv_index, required, partition->clv_manager->slots);
+  return PLL_FAILURE;
+}
+
+/* limits the number of inner CLVs held in memory. Slots past the new limit
+   are released, evicting their CLVs. At least three slots are required, one
+   for the parent and one for each child of an operation, and at least the
+   height of the tree plus two once operations have been recorded, see
+   pll_clv_check_slots() */
+PLL_EXPORT int pll_set_clv_slots(pll_partition_t * partition,
+                                 unsigned int slots)
+{
+  unsigned int i;
+  unsigned int required = 3;
+  pll_clv_manager_t * manager = partition->clv_manager;
+
+  if (!manager)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "CLV slots require a partition created with "
+             "PLL_ATTRIB_LIMIT_MEMORY.");
+    return PLL_FAILURE;
+  }
+
+  for (i = partition->tips; i < partition->nodes; ++i)
+    if (manager->clv_operation[i].parent_clv_index == i)
+      required = PLL_MAX(required, manager->clv_height[i] + 2);
+  required = PLL_MIN(required, partition->clv_buffers);
+
+  if (slots < required)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "At least %u CLV slots are required.", required);
+    return PLL_FAILURE;
+  }
+
+  slots = PLL_MIN(slots, partition->clv_buffers);
+
+  for (i = slots; i < manager->allocated; ++i)
+  {
+    unsigned int owner = manager->slot_owner[i];
+    if (owner != CLV_NONE && manager->clv_pinned[owner])
+    {
+      pll_errno = PLL_ERROR_PARAM_INVALID;
+      snprintf(pll_errmsg, 200, "CLV %u is pinned to slot %u.", owner, i);
+      return PLL_FAILURE;
+    }
+  }
+
+  for (i = slots; i < manager->allocated; ++i)
+  {
+    evict(partition, i);
+    pll_aligned_free(manager->slot_clv[i]);
+    manager->slot_clv[i] = NULL;
+  }
+
+  manager->allocated = PLL_MIN(manager->allocated, slots);
+  manager->slots = slots;
+
+  return PLL_SUCCESS;
+}
+
+PLL_EXPORT int pll_clv_resident(const pll_partition_t * partition,
+                                unsigned int clv_index)
+{
+  const pll_clv_manager_t * manager = partition->clv_manager;
+
+  if (!manager || clv_index < partition->tips)
+    return 1;
+
+  return manager->clv_slot[clv_index] != CLV_NONE;
+}
+
+/* makes a slot available to the CLV, if it is not resident already. The
+   contents of a newly assigned slot are undefined */
+int pll_clv_assign_slot(pll_partition_t * partition, unsigned int clv_index)
+{
+  unsigned int i;
+  unsigned int slot = CLV_NONE;
+  pll_clv_manager_t * manager = partition->clv_manager;
+
+  if (!manager || clv_index < partition->tips)
+    return PLL_SUCCESS;
+
+  if (manager->clv_slot[clv_index] != CLV_NONE)
+  {
+    manager->slot_used[manager->clv_slot[clv_index]] = ++manager->clock;
+    return PLL_SUCCESS;
+  }
+
+  if (manager->allocated < manager->slots)
+  {
+    slot = manager->allocated;
+    manager->slot_clv[slot] = pll_aligned_alloc(manager->clv_size,
+                                                partition->alignment);
+    if (!manager->slot_clv[slot])
+    {
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Unable to allocate enough memory for CLVs.");
+      return PLL_FAILURE;
+    }
+    /* zero-out the padding, see pll_partition_create() */
+    memset(manager->slot_clv[slot], 0, manager->clv_size);
+    manager->allocated++;
+  }
+  else
+  {
+    /* least recently used slot whose CLV is not pinned */
+    for (i = 0; i < manager->allocated; ++i)
+    {
+      unsigned int owner = manager->slot_owner[i];
+      if (owner != CLV_NONE && manager->clv_pinned[owner])
+        continue;
+      if (slot == CLV_NONE || manager->slot_used[i] < manager->slot_used[slot])
+        slot = i;
+    }
+
+    if (slot == CLV_NONE)
+    {
+      pll_errno = PLL_ERROR_CLV_SLOTS;
+      snprintf(pll_errmsg, 200,
+               "All %u CLV slots are pinned.", manager->slots);
+      return PLL_FAILURE;
+    }
+
+    evict(partition, slot);
+  }
+
+  manager->slot_owner[slot] = clv_index;
+  manager->slot_used[slot] = ++manager->clock;
+  manager->clv_slot[clv_index] = slot;
+  set_clv_pointer(partition, clv_index, manager->slot_clv[slot]);
+
+  return PLL_SUCCESS;
+}
+
+/* pinned CLVs are never evicted */
+void pll_clv_pin(pll_partition_t * partition, unsigned int clv_index)
+{
+  if (partition->clv_manager && clv_index >= partition->tips)
+    partition->clv_manager->clv_pinned[clv_index]++;
+}
+
+void pll_clv_unpin(pll_partition_t * partition, unsigned int clv_index)
+{
+  if (partition->clv_manager && clv_index >= partition->tips &&
+      partition->clv_manager->clv_pinned[clv_index])
+    partition->clv_manager->clv_pinned[clv_index]--;
+}
+
+/* evicts the CLV unless it is pinned, e.g. because its contents are
+   outdated; it is recomputed from the recorded operation once required */
+void pll_clv_release(pll_partition_t * partition, unsigned int clv_index)
+{
+  pll_clv_manager_t * manager = partition->clv_manager;
+
+  if (!manager || clv_index < partition->tips)
+    return;
+
+  if (manager->clv_slot[clv_index] != CLV_NONE &&
+      !manager->clv_pinned[clv_index])
+    evict(partition, manager->clv_slot[clv_index]);
+}
+
+void pll_clv_set_operation(pll_partition_t * partition,
+                           const pll_operation_t * op)
+{
+  pll_clv_manager_t * manager = partition->clv_manager;
+
+  if (!manager)
+    return;
+
+  manager->clv_operation[op->parent_clv_index] = *op;
+  manager->clv_height[op->parent_clv_index] =
+      1 + PLL_MAX(subtree_height(partition, op->child1_clv_index),
+                  subtree_height(partition, op->child2_clv_index));
+}
+
+/* forgets the operation that last computed the CLV, e.g. because it was not
+   executed; the CLV cannot be recomputed until it is computed again */
+void pll_clv_clear_operation(pll_partition_t * partition,
+                             unsigned int clv_index)
+{
+  pll_clv_manager_t * manager = partition->clv_manager;
+
+  if (!manager || clv_index < partition->tips)
+    return;
+
+  manager->clv_operation[clv_index].parent_clv_index = CLV_NONE;
+  manager->clv_height[clv_index] = 0;
+}
+
+/* retrieves the operation that last computed the CLV; fails if the CLV has
+   never been computed */
+int pll_clv_get_operation(const pll_partition_t * partition,
+                          unsigned int clv_index,
+                          pll_operation_t * op)
+{
+  const pll_clv_manager_t * manager = partition->clv_manager;
+
+  if (!manager ||
+      clv_index < partition->tips ||
+      manager->clv_operation[clv_index].parent_clv_index != clv_index)
+  {
+    pll_errno = PLL_ERROR_CLV_SLOTS;
+    snprintf(pll_errmsg, 200,
+             "CLV %u is not available and cannot be recomputed.", clv_index);
+    return PLL_FAILURE;
+  }
+
+  *op = manager->clv_operation[clv_index];
+  return PLL_SUCCESS;
+}
@@ -0,0 +1,833 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include <limits.h>
+#include "pll.h"
+#include "pll_private.h"
+
+/* Kernels for 61-state (codon) models. Every row of a CLV or matrix spans
+   64 doubles. The matrix-vector products of a block of sites are computed
+   as one matrix-matrix product with the transposed, zero-padded matrix
+   using the register tiles of pll_core_update_partial_ii_blocked_avx2,
+   which also handles the inner-inner partials of codon models */
+
+#define CODON_STATES 61
+#define CODON_PADDED 64
+#define CODON_MATRIX (CODON_PADDED * CODON_PADDED)
+
+/* set up the CLV pointers of rate category k for the sites of a block,
+   sites past the end of the alignment point to dummy CLVs */
+static unsigned int codon_block_clvs(const double ** c,
+                                     const double * clv,
+                                     unsigned int n,
+                                     unsigned int sites,
+                                     unsigned int k,
+                                     unsigned int span,
+                                     const double * dummy)
+{
+  unsigned int s;
+  unsigned int count = PLL_MIN(PLL_II_BLOCK_SITES, sites - n);
+  unsigned int block_sites = (count + PLL_II_TILE_SITES - 1) &
+                             ~(PLL_II_TILE_SITES - 1);
+
+  for (s = 0; s < block_sites; ++s)
+    c[s] = (s < count) ?
+           clv + (size_t)(n+s)*span + k*CODON_PADDED : dummy;
+
+  return block_sites;
+}
+
+static void codon_block_parent(double ** p,
+                               double * clv,
+                               unsigned int n,
+                               unsigned int sites,
+                               unsigned int k,
+                               unsigned int span,
+                               double * dummy)
+{
+  unsigned int s;
+  unsigned int count = PLL_MIN(PLL_II_BLOCK_SITES, sites - n);
+
+  for (s = 0; s < PLL_II_BLOCK_SITES; ++s)
+    p[s] = (s < count) ?
+           clv + (size_t)(n+s)*span + k*CODON_PADDED : dummy;
+}
+
+/* lookup[c][k][i] = sum of mat_k[i][j] over the states j of tip code c,
+   optionally weighted by the frequencies of state i */
+static void codon_tip_lookup(double * lookup,
+                             const double * mat,
+                             unsigned int rate_cats,
+                             const pll_state_t * tipmap,
+                             unsigned int tipmap_size,
+                             double * const * frequencies,
+                             const unsigned int * freqs_indices)
+{
+  unsigned int c,i,j,k;
+
+  memset(lookup, 0,
+         (size_t)tipmap_size * rate_cats * CODON_PADDED * sizeof(double));
+
+  for (c = 0; c < tipmap_size; ++c)
+  {
+    pll_state_t state = tipmap[c];
+    const double * m = mat;
+
+    for (k = 0; k < rate_cats; ++k)
+    {
+      const double * freqs = frequencies ?
+                             frequencies[freqs_indices[k]] : NULL;
+
+      for (i = 0; i < CODON_STATES; ++i)
+      {
+        double term = 0;
+        for (j = 0; j < CODON_STATES; ++j)
+          if ((state >> j) & 1)
+            term += m[j];
+
+        lookup[i] = freqs ? term * freqs[i] : term;
+        m += CODON_PADDED;
+      }
+      lookup += CODON_PADDED;
+    }
+  }
+}
+
+/* sum of a[i]*b[i]*c[i], or of a[i]*b[i] if c is NULL */
+static double codon_dot_avx2(const double * a,
+                             const double * b,
+                             const double * c)
+{
+  unsigned int i;
+  __m256d v_acc = _mm256_setzero_pd();
+
+  for (i = 0; i < CODON_PADDED; i += 4)
+  {
+    __m256d v_prod = _mm256_load_pd(a+i);
+    if (c)
+      v_prod = _mm256_mul_pd(v_prod, _mm256_load_pd(c+i));
+    v_acc = _mm256_fmadd_pd(v_prod, _mm256_load_pd(b+i), v_acc);
+  }
+
+  __m128d xmm0 = _mm_add_pd(_mm256_castpd256_pd128(v_acc),
+                            _mm256_extractf128_pd(v_acc, 1));
+  xmm0 = _mm_hadd_pd(xmm0, xmm0);
+
+  return _mm_cvtsd_f64(xmm0);
+}
+
+static void codon_scale_minlh(double * scale_minlh)
+{
+  unsigned int i;
+  double scale_factor = 1.0;
+
+  /* powers of scale threshold for undoing the scaling */
+  for (i = 0; i < PLL_SCALE_RATE_MAXDIFF; ++i)
+  {
+    scale_factor *= PLL_SCALE_THRESHOLD;
+    scale_minlh[i] = scale_factor;
+  }
+}
+
+/* scaler of rate category k at site n relative to the minimum scaler of the
+   site, or the minimum scaler itself if k == rate_cats */
+static unsigned int codon_rate_scaling(unsigned int n,
+                                       unsigned int k,
+                                       unsigned int rate_cats,
+                                       const unsigned int * parent_scaler,
+                                       const unsigned int * child_scaler)
+{
+  unsigned int i;
+  unsigned int min_scaler = UINT_MAX;
+  unsigned int rate_scaler = 0;
+
+  for (i = 0; i < rate_cats; ++i)
+  {
+    unsigned int scaler = (parent_scaler) ? parent_scaler[n*rate_cats+i] : 0;
+    scaler += (child_scaler) ? child_scaler[n*rate_cats+i] : 0;
+    if (scaler < min_scaler)
+      min_scaler = scaler;
+    if (i == k)
+      rate_scaler = scaler;
+  }
+
+  if (k == rate_cats)
+    return min_scaler;
+
+  return PLL_MIN(rate_scaler - min_scaler, PLL_SCALE_RATE_MAXDIFF);
+}
+
+/* combine the per-rate terms of site n into the site likelihood, using the
+   same scaling and invariant sites semantics as the generic kernels */
+static void codon_site_push(pll_logl_block_t * block,
+                            const double * terms,
+                            unsigned int n,
+                            unsigned int rate_cats,
+                            const unsigned int * parent_scaler,
+                            const unsigned int * child_scaler,
+                            const double * scale_minlh,
+                            double * const * frequencies,
+                            const double * rate_weights,
+                            const double * invar_proportion,
+                            const int * invar_indices,
+                            const unsigned int * freqs_indices,
+                            unsigned int attrib)
+{
+  unsigned int i;
+  unsigned int site_scalings;
+  double terma = 0;
+  double terminv = 0;
+  int per_rate_scaling = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 1 : 0;
+
+  if (per_rate_scaling)
+  {
+    /* minimum per-rate scaler -> common per-site scaler */
+    site_scalings = codon_rate_scaling(n,
+                                       rate_cats,
+                                       rate_cats,
+                                       parent_scaler,
+                                       child_scaler);
+  }
+  else
+  {
+    /* count number of scaling factors to account for */
+    site_scalings =  (parent_scaler) ? parent_scaler[n] : 0;
+    site_scalings += (child_scaler) ? child_scaler[n] : 0;
+  }
+
+  for (i = 0; i < rate_cats; ++i)
+  {
+    double terma_r = terms[i];
+
+    /* apply per-rate scalers, if necessary */
+    if (per_rate_scaling)
+    {
+      unsigned int rate_scalings = codon_rate_scaling(n,
+                                                      i,
+                                                      rate_cats,
+                                                      parent_scaler,
+                                                      child_scaler);
+      if (rate_scalings > 0)
+        terma_r *= scale_minlh[rate_scalings-1];
+    }
+
+    /* account for invariant sites */
+    double prop_invar = invar_proportion ?
+                        invar_proportion[freqs_indices[i]] : 0;
+    if (prop_invar > 0)
+    {
+      terma += rate_weights[i] * terma_r * (1. - prop_invar);
+      if (invar_indices[n] != -1)
+      {
+        double inv_site_lk = frequencies[freqs_indices[i]][invar_indices[n]];
+        terminv += rate_weights[i] * inv_site_lk * prop_invar;
+      }
+    }
+    else
+    {
+      terma += terma_r * rate_weights[i];
+    }
+  }
+
+  if (site_scalings && terminv > 0.)
+  {
+    /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
+    unsigned int capped_scalings = PLL_MIN(site_scalings,
+                                           PLL_SCALE_RATE_MAXDIFF);
+    double scale_factor = scale_minlh[capped_scalings-1];
+    pll_core_logl_push(block, terma * scale_factor + terminv, 0,
+                       pll_core_logl_flush_avx);
+  }
+  else
+    pll_core_logl_push(block, terma + terminv, site_scalings,
+                       pll_core_logl_flush_avx);
+}
+
+/* undo the per-rate scaling of the sumtable entries of site n */
+static void codon_sumtable_scale_avx2(double * sum,
+                                      unsigned int n,
+                                      unsigned int rate_cats,
+                                      const unsigned int * parent_scaler,
+                                      const unsigned int * child_scaler,
+                                      const double * scale_minlh)
+{
+  unsigned int k;
+
+  for (k = 0; k < rate_cats; ++k)
+  {
+    unsigned int rate_scalings = codon_rate_scaling(n,
+                                                    k,
+                                                    rate_cats,
+                                                    parent_scaler,
+                                                    child_scaler);
+    if (rate_scalings > 0)
+      pll_core_scale_clv_avx2(sum + k*CODON_PADDED,
+                              CODON_PADDED,
+                              scale_minlh[rate_scalings-1]);
+  }
+}
+
+PLL_EXPORT void pll_core_update_partial_ti_61x61_avx2(unsigned int sites,
+                                                      unsigned int rate_cats,
+                                                      double * parent_clv,
+                                                      unsigned int * parent_scaler,
+                                                      const unsigned char * left_tipchars,
+                                                      const double * right_clv,
+                                                      const double * left_matrix,
+                                                      const double * right_matrix,
+                                                      const unsigned int * right_scaler,
+                                                      const pll_state_t * tipmap,
+                                                      unsigned int tipmap_size,
+                                                      unsigned int attrib)
+{
+  unsigned int k,n,s;
+  unsigned int const span = CODON_PADDED * rate_cats;
+
+  const double * rc[PLL_II_BLOCK_SITES];
+  double * pc[PLL_II_BLOCK_SITES];
+
+  /* transposed right matrix, the left-side values for every tip code and
+     two dummy CLVs for the sites past the end of the last block */
+  size_t alloc_size = (size_t)rate_cats * CODON_MATRIX +
+                      (size_t)tipmap_size * span + 2*CODON_PADDED;
+  double * rt = (double *)pll_aligned_alloc(alloc_size * sizeof(double),
+                                            PLL_ALIGNMENT_AVX);
+  if (!rt)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate space for precomputation.");
+    return;
+  }
+  double * lookup = rt + rate_cats*CODON_MATRIX;
+  double * dummy = lookup + tipmap_size*span;
+
+  pll_core_transpose_matrices_avx2(rt, right_matrix, CODON_STATES,
+                                   CODON_PADDED, rate_cats);
+  codon_tip_lookup(lookup, left_matrix, rate_cats, tipmap, tipmap_size,
+                   NULL, NULL);
+  memset(dummy, 0, 2*CODON_PADDED*sizeof(double));
+
+  if (parent_scaler)
+  {
+    size_t scaler_size = (attrib & PLL_ATTRIB_RATE_SCALERS) ?
+                         sites * rate_cats : sites;
+    pll_fill_parent_scaler(scaler_size, parent_scaler, NULL, right_scaler);
+  }
+
+  for (n = 0; n < sites; n += PLL_II_BLOCK_SITES)
+  {
+    for (k = 0; k < rate_cats; ++k)
+    {
+      unsigned int block_sites = codon_block_clvs(rc, right_clv, n, sites, k,
+                                                  span, dummy);
+      codon_block_parent(pc, parent_clv, n, sites, k, span,
+                         dummy + CODON_PADDED);
+      /* start from the left-side values, the product of the right matrix
+         with the right CLV is multiplied in */
+      for (s = 0; s < block_sites; ++s)
+        memcpy(pc[s],
+               (n+s < sites) ?
+                 lookup + left_tipchars[n+s]*span + k*CODON_PADDED : dummy,
+               CODON_PADDED * sizeof(double));
+
+      pll_core_block_product_avx2(CODON_STATES, CODON_PADDED, block_sites,
+                                  rt + k*CODON_MATRIX, rc, pc, 1);
+    }
+
+    if (parent_scaler)
+    {
+      for (s = n; s < PLL_MIN(n + PLL_II_BLOCK_SITES, sites); ++s)
+        pll_core_scale_site_avx2(parent_clv + (size_t)s*span,
+                                 s,
+                                 CODON_PADDED,
+                                 rate_cats,
+                                 parent_scaler,
+                                 attrib);
+    }
+  }
+
+  pll_aligned_free(rt);
+}
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_ii_61x61_avx2(unsigned int sites,
+                                                 unsigned int rate_cats,
+                                                 const double * parent_clv,
+                                                 const unsigned int * parent_scaler,
+                                                 const double * child_clv,
+                                                 const unsigned int * child_scaler,
+                                                 const double * pmatrix,
+                                                 double * const * frequencies,
+                                                 const double * rate_weights,
+                                                 const unsigned int * pattern_weights,
+                                                 const double * invar_proportion,
+                                                 const int * invar_indices,
+                                                 const unsigned int * freqs_indices,
+                                                 double * persite_lnl,
+                                                 unsigned int attrib)
+{
+  unsigned int k,n,s;
+  unsigned int const span = CODON_PADDED * rate_cats;
+  pll_logl_block_t logl_block;
+  double scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+
+  const double * cc[PLL_II_BLOCK_SITES];
+  double * tc[PLL_II_BLOCK_SITES];
+
+  /* transposed matrices, the products of the matrices with the child CLVs
+     of a block, the per-rate terms of a block and a dummy CLV */
+  size_t alloc_size = (size_t)rate_cats * CODON_MATRIX +
+                      PLL_II_BLOCK_SITES * (CODON_PADDED + rate_cats) +
+                      CODON_PADDED;
+  double * mt = (double *)pll_aligned_alloc(alloc_size * sizeof(double),
+                                            PLL_ALIGNMENT_AVX);
+  if (!mt)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return -INFINITY;
+  }
+  double * tmp = mt + rate_cats*CODON_MATRIX;
+  double * dummy = tmp + PLL_II_BLOCK_SITES*CODON_PADDED;
+  double * terms = dummy + CODON_PADDED;
+
+  pll_core_transpose_matrices_avx2(mt, pmatrix, CODON_STATES, CODON_PADDED,
+                                   rate_cats);
+  memset(dummy, 0, CODON_PADDED*sizeof(double));
+  codon_scale_minlh(scale_minlh);
+
+  for (s = 0; s < PLL_II_BLOCK_SITES; ++s)
+    tc[s] = tmp + s*CODON_PADDED;
+
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
+  for (n = 0; n < sites; n += PLL_II_BLOCK_SITES)
+  {
+    unsigned int count = PLL_MIN(PLL_II_BLOCK_SITES, sites - n);
+
+    for (k = 0; k < rate_cats; ++k)
+    {
+      const double * freqs = frequencies[freqs_indices[k]];
+      unsigned int block_sites = codon_block_clvs(cc, child_clv, n, sites, k,
+                                                  span, dummy);
+
+      pll_core_block_product_avx2(CODON_STATES, CODON_PADDED, block_sites,
+                                  mt + k*CODON_MATRIX, cc, tc, 0);
+
+      for (s = 0; s < count; ++s)
+        terms[s*rate_cats + k] = codon_dot_avx2(freqs,
+                                                tc[s],
+                                                parent_clv +
+                                                  (size_t)(n+s)*span +
+                                                  k*CODON_PADDED);
+    }
+
+    for (s = 0; s < count; ++s)
+    {
+      codon_site_push(&logl_block,
+                      terms + s*rate_cats,
+                      n+s,
+                      rate_cats,
+                      parent_scaler,
+                      child_scaler,
+                      scale_minlh,
+                      frequencies,
+                      rate_weights,
+                      invar_proportion,
+                      invar_indices,
+                      freqs_indices,
+                      attrib);
+    }
+  }
+
+  pll_aligned_free(mt);
+
+  return pll_core_logl_flush_avx(&logl_block);
+}
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_ti_61x61_avx2(unsigned int sites,
+                                                 unsigned int rate_cats,
+                                                 const double * parent_clv,
+                                                 const unsigned int * parent_scaler,
+                                                 const unsigned char * tipchars,
+                                                 const pll_state_t * tipmap,
+                                                 unsigned int tipmap_size,
+                                                 const double * pmatrix,
+                                                 double * const * frequencies,
+                                                 const double * rate_weights,
+                                                 const unsigned int * pattern_weights,
+                                                 const double * invar_proportion,
+                                                 const int * invar_indices,
+                                                 const unsigned int * freqs_indices,
+                                                 double * persite_lnl,
+                                                 unsigned int attrib)
+{
+  unsigned int k,n;
+  unsigned int const span = CODON_PADDED * rate_cats;
+  pll_logl_block_t logl_block;
+  double scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+
+  /* frequency-weighted tip terms for every tip code, followed by the
+     per-rate terms of a site */
+  size_t alloc_size = (size_t)tipmap_size * span + rate_cats;
+  double * lookup = (double *)pll_aligned_alloc(alloc_size * sizeof(double),
+                                                PLL_ALIGNMENT_AVX);
+  if (!lookup)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate space for precomputation.");
+    return -INFINITY;
+  }
+  double * terms = lookup + tipmap_size*span;
+
+  codon_tip_lookup(lookup, pmatrix, rate_cats, tipmap, tipmap_size,
+                   frequencies, freqs_indices);
+  codon_scale_minlh(scale_minlh);
+
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
+  for (n = 0; n < sites; ++n)
+  {
+    const double * ltab = lookup + tipchars[n]*span;
+    const double * clvp = parent_clv + (size_t)n*span;
+
+    for (k = 0; k < rate_cats; ++k)
+      terms[k] = codon_dot_avx2(ltab + k*CODON_PADDED,
+                                clvp + k*CODON_PADDED,
+                                NULL);
+
+    codon_site_push(&logl_block,
+                    terms,
+                    n,
+                    rate_cats,
+                    parent_scaler,
+                    NULL,
+                    scale_minlh,
+                    frequencies,
+                    rate_weights,
+                    invar_proportion,
+                    invar_indices,
+                    freqs_indices,
+                    attrib);
+  }
+
+  pll_aligned_free(lookup);
+
+  return pll_core_logl_flush_avx(&logl_block);
+}
+
+/* the sumtable entries are the products of the frequency-weighted inverse
+   eigenvectors with the parent CLV and of the eigenvectors with the child
+   CLV, see pll_core_update_sumtable_ii_avx2 */
+static void codon_sumtable_matrices(double * lt,
+                                    double * rt,
+                                    unsigned int rate_cats,
+                                    double * const * eigenvecs,
+                                    double * const * inv_eigenvecs,
+                                    double * const * freqs)
+{
+  unsigned int i,j,k;
+
+  if (lt)
+    memset(lt, 0, (size_t)rate_cats * CODON_MATRIX * sizeof(double));
+  memset(rt, 0, (size_t)rate_cats * CODON_MATRIX * sizeof(double));
+
+  for (k = 0; k < rate_cats; ++k)
+  {
+    for (j = 0; j < CODON_STATES; ++j)
+      for (i = 0; i < CODON_STATES; ++i)
+      {
+        if (lt)
+          lt[j*CODON_PADDED + i] = inv_eigenvecs[k][j*CODON_PADDED + i] *
+                                   freqs[k][j];
+        rt[j*CODON_PADDED + i] = eigenvecs[k][i*CODON_PADDED + j];
+      }
+
+    if (lt)
+      lt += CODON_MATRIX;
+    rt += CODON_MATRIX;
+  }
+}
+
+PLL_EXPORT int pll_core_update_sumtable_ii_61x61_avx2(unsigned int sites,
+                                                      unsigned int rate_cats,
+                                                      const double * clvp,
+                                                      const double * clvc,
+                                                      const unsigned int * parent_scaler,
+                                                      const unsigned int * child_scaler,
+                                                      double * const * eigenvecs,
+                                                      double * const * inv_eigenvecs,
+                                                      double * const * freqs,
+                                                      double * sumtable,
+                                                      unsigned int attrib)
+{
+  unsigned int k,n,s;
+  unsigned int const span = CODON_PADDED * rate_cats;
+  double scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+
+  const double * pc[PLL_II_BLOCK_SITES];
+  const double * cc[PLL_II_BLOCK_SITES];
+  double * sc[PLL_II_BLOCK_SITES];
+
+  size_t alloc_size = 2 * (size_t)rate_cats * CODON_MATRIX + 2*CODON_PADDED;
+  double * lt = (double *)pll_aligned_alloc(alloc_size * sizeof(double),
+                                            PLL_ALIGNMENT_AVX);
+  if (!lt)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for tt_eigenvecs");
+    return PLL_FAILURE;
+  }
+  double * rt = lt + rate_cats*CODON_MATRIX;
+  double * dummy = rt + rate_cats*CODON_MATRIX;
+
+  codon_sumtable_matrices(lt, rt, rate_cats, eigenvecs, inv_eigenvecs, freqs);
+  memset(dummy, 0, 2*CODON_PADDED*sizeof(double));
+  codon_scale_minlh(scale_minlh);
+
+  for (n = 0; n < sites; n += PLL_II_BLOCK_SITES)
+  {
+    for (k = 0; k < rate_cats; ++k)
+    {
+      unsigned int block_sites = codon_block_clvs(pc, clvp, n, sites, k,
+                                                  span, dummy);
+      codon_block_clvs(cc, clvc, n, sites, k, span, dummy);
+      codon_block_parent(sc, sumtable, n, sites, k, span,
+                         dummy + CODON_PADDED);
+
+      pll_core_block_product_avx2(CODON_STATES, CODON_PADDED, block_sites,
+                                  lt + k*CODON_MATRIX, pc, sc, 0);
+      pll_core_block_product_avx2(CODON_STATES, CODON_PADDED, block_sites,
+                                  rt + k*CODON_MATRIX, cc, sc, 1);
+    }
+
+    /* apply per-rate scalers */
+    if (attrib & PLL_ATTRIB_RATE_SCALERS)
+    {
+      for (s = n; s < PLL_MIN(n + PLL_II_BLOCK_SITES, sites); ++s)
+        codon_sumtable_scale_avx2(sumtable + (size_t)s*span,
+                                  s,
+                                  rate_cats,
+                                  parent_scaler,
+                                  child_scaler,
+                                  scale_minlh);
+    }
+  }
+
+  pll_aligned_free(lt);
+
+  return PLL_SUCCESS;
+}
+
+PLL_EXPORT int pll_core_update_sumtable_ti_61x61_avx2(unsigned int sites,
+                                                      unsigned int rate_cats,
+                                                      const double * parent_clv,
+                                                      const unsigned char * left_tipchars,
+                                                      const unsigned int * parent_scaler,
+                                                      double * const * eigenvecs,
+                                                      double * const * inv_eigenvecs,
+                                                      double * const * freqs,
+                                                      const pll_state_t * tipmap,
+                                                      unsigned int tipmap_size,
+                                                      double * sumtable,
+                                                      unsigned int attrib)
+{
+  unsigned int c,i,j,k,n,s;
+  unsigned int const span = CODON_PADDED * rate_cats;
+  double scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+
+  const double * pc[PLL_II_BLOCK_SITES];
+  double * sc[PLL_II_BLOCK_SITES];
+
+  /* transposed eigenvectors, the left terms for every tip code and two
+     dummy CLVs */
+  size_t alloc_size = (size_t)rate_cats * CODON_MATRIX +
+                      (size_t)tipmap_size * span + 2*CODON_PADDED;
+  double * rt = (double *)pll_aligned_alloc(alloc_size * sizeof(double),
+                                            PLL_ALIGNMENT_AVX);
+  if (!rt)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for tt_inv_eigenvecs");
+    return PLL_FAILURE;
+  }
+  double * precomp = rt + rate_cats*CODON_MATRIX;
+  double * dummy = precomp + tipmap_size*span;
+
+  codon_sumtable_matrices(NULL, rt, rate_cats, eigenvecs, inv_eigenvecs,
+                          freqs);
+  memset(dummy, 0, 2*CODON_PADDED*sizeof(double));
+  codon_scale_minlh(scale_minlh);
+
+  /* precompute left terms since they are the same for every site */
+  memset(precomp, 0, (size_t)tipmap_size * span * sizeof(double));
+  for (c = 0; c < tipmap_size; ++c)
+  {
+    pll_state_t state = tipmap ? tipmap[c] : c;
+    double * t_precomp = precomp + c*span;
+
+    for (k = 0; k < rate_cats; ++k)
+    {
+      for (j = 0; j < CODON_STATES; ++j)
+      {
+        if (!((state >> j) & 1))
+          continue;
+
+        for (i = 0; i < CODON_STATES; ++i)
+          t_precomp[i] += freqs[k][j] * inv_eigenvecs[k][j*CODON_PADDED + i];
+      }
+      t_precomp += CODON_PADDED;
+    }
+  }
+
+  for (n = 0; n < sites; n += PLL_II_BLOCK_SITES)
+  {
+    for (k = 0; k < rate_cats; ++k)
+    {
+      unsigned int block_sites = codon_block_clvs(pc, parent_clv, n, sites, k,
+                                                  span, dummy);
+      codon_block_parent(sc, sumtable, n, sites, k, span,
+                         dummy + CODON_PADDED);
+      for (s = 0; s < block_sites; ++s)
+        memcpy(sc[s],
+               (n+s < sites) ?
+                 precomp + left_tipchars[n+s]*span + k*CODON_PADDED : dummy,
+               CODON_PADDED * sizeof(double));
+
+      pll_core_block_product_avx2(CODON_STATES, CODON_PADDED, block_sites,
+                                  rt + k*CODON_MATRIX, pc, sc, 1);
+    }
+
+    /* apply per-rate scalers */
+    if (attrib & PLL_ATTRIB_RATE_SCALERS)
+    {
+      for (s = n; s < PLL_MIN(n + PLL_II_BLOCK_SITES, sites); ++s)
+        codon_sumtable_scale_avx2(sumtable + (size_t)s*span,
+                                  s,
+                                  rate_cats,
+                                  parent_scaler,
+                                  NULL,
+                                  scale_minlh);
+    }
+  }
+
+  pll_aligned_free(rt);
+
+  return PLL_SUCCESS;
+}
+
+PLL_EXPORT int pll_core_update_pmatrix_61x61_avx2(double ** pmatrix,
+                                                  unsigned int rate_cats,
+                                                  const double * rates,
+                                                  const double * branch_lengths,
+                                                  const unsigned int * matrix_indices,
+                                                  const unsigned int * params_indices,
+                                                  const double * prop_invar,
+                                                  double * const * eigenvals,
+                                                  double * const * eigenvecs,
+                                                  double * const * inv_eigenvecs,
+                                                  unsigned int count)
+{
+  unsigned int i,j,k,n;
+
+  double * expd = (double *)pll_aligned_alloc((2*CODON_MATRIX + CODON_PADDED) *
+                                              sizeof(double),
+                                              PLL_ALIGNMENT_AVX);
+  if (!expd)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return PLL_FAILURE;
+  }
+  double * temp = expd + CODON_PADDED;
+  double * prod = temp + CODON_MATRIX;
+
+  const double * trows[CODON_PADDED];
+  double * prows[CODON_PADDED];
+  for (j = 0; j < CODON_PADDED; ++j)
+  {
+    trows[j] = temp + j*CODON_PADDED;
+    prows[j] = prod + j*CODON_PADDED;
+  }
+
+  /* rows and columns past the last state stay zero */
+  memset(temp, 0, CODON_MATRIX*sizeof(double));
+
+  for (i = 0; i < count; ++i)
+  {
+    assert(branch_lengths[i] >= 0);
+
+    for (n = 0; n < rate_cats; ++n)
+    {
+      double * pmat = pmatrix[matrix_indices[i]] +
+                      n*CODON_STATES*CODON_PADDED;
+      double pinvar = prop_invar[params_indices[n]];
+      const double * evecs = eigenvecs[params_indices[n]];
+      const double * inv_evecs = inv_eigenvecs[params_indices[n]];
+      const double * evals = eigenvals[params_indices[n]];
+
+      /* if branch length is zero then set the p-matrix to identity matrix */
+      if (!branch_lengths[i])
+      {
+        for (j = 0; j < CODON_STATES; ++j)
+          for (k = 0; k < CODON_STATES; ++k)
+            pmat[j*CODON_PADDED + k] = (j == k) ? 1 : 0;
+        continue;
+      }
+
+      /* exponentiate eigenvalues; as in pll_core_update_pmatrix, we compute
+         exp(Qt) - I and add the identity matrix in the end */
+      if (pinvar > PLL_MISC_EPSILON)
+      {
+        for (j = 0; j < CODON_STATES; ++j)
+          expd[j] = expm1(evals[j] * rates[n] * branch_lengths[i]
+                                     / (1.0 - pinvar));
+      }
+      else
+      {
+        for (j = 0; j < CODON_STATES; ++j)
+          expd[j] = expm1(evals[j] * rates[n] * branch_lengths[i]);
+      }
+
+      for (j = 0; j < CODON_STATES; ++j)
+        for (k = 0; k < CODON_STATES; ++k)
+          temp[j*CODON_PADDED + k] = inv_evecs[j*CODON_PADDED + k] * expd[k];
+
+      /* prod = temp * evecs, i.e. the rows of temp are the CLVs and the
+         eigenvectors the transposed matrix of a block product */
+      pll_core_block_product_avx2(CODON_STATES, CODON_PADDED, CODON_PADDED,
+                                  evecs, trows, prows, 0);
+
+      /* add identity matrix */
+      for (j = 0; j < CODON_STATES; ++j)
+      {
+        for (k = 0; k < CODON_STATES; ++k)
+          pmat[j*CODON_PADDED + k] = prod[j*CODON_PADDED + k];
+        pmat[j*CODON_PADDED + j] += 1.0;
+      }
+    }
+  }
+
+  pll_aligned_free(expd);
+
+  return PLL_SUCCESS;
+}
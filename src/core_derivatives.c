@@ -84,11 +84,23 @@ PLL_EXPORT int pll_core_update_sumtable_repeats(unsigned int states,
     core_update_sumtable = pll_core_update_sumtable_repeats_generic_avx2;
     if (states == 4)
     {
-      // avx is good enough
       if (use_bclv)
-        core_update_sumtable = pll_core_update_sumtable_repeatsbclv_4x4_avx;
+        core_update_sumtable = pll_core_update_sumtable_repeatsbclv_4x4_avx2;
       else
-        core_update_sumtable = pll_core_update_sumtable_repeats_4x4_avx;
+        core_update_sumtable = pll_core_update_sumtable_repeats_4x4_avx2;
+    }
+  }
+#endif
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 &&  PLL_STAT(avx512f_present))
+  {
+    core_update_sumtable = pll_core_update_sumtable_repeats_generic_avx2;
+    if (states == 4)
+    {
+      if (use_bclv)
+        core_update_sumtable = pll_core_update_sumtable_repeatsbclv_4x4_avx2;
+      else
+        core_update_sumtable = pll_core_update_sumtable_repeats_4x4_avx2;
     }
   }
 #endif
@@ -395,6 +407,23 @@ PLL_EXPORT int pll_core_update_sumtable_ii(unsigned int states,
                                            attrib);
   }
 #endif
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    return pll_core_update_sumtable_ii_avx512(states,
+                                              sites,
+                                              rate_cats,
+                                              parent_clv,
+                                              child_clv,
+                                              parent_scaler,
+                                              child_scaler,
+                                              eigenvecs,
+                                              inv_eigenvecs,
+                                              freqs,
+                                              sumtable,
+                                              attrib);
+  }
+#endif
 
   unsigned int min_scaler;
   unsigned int * rate_scalings = NULL;
@@ -550,6 +579,24 @@ PLL_EXPORT int pll_core_update_sumtable_ti(unsigned int states,
                                            attrib);
   }
 #endif
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    return pll_core_update_sumtable_ti_avx512(states,
+                                              sites,
+                                              rate_cats,
+                                              parent_clv,
+                                              left_tipchars,
+                                              parent_scaler,
+                                              eigenvecs,
+                                              inv_eigenvecs,
+                                              freqs,
+                                              tipmap,
+                                              tipmap_size,
+                                              sumtable,
+                                              attrib);
+  }
+#endif
 
   /* non-vectorized version, special case for 4 states */
   if (states == 4)
@@ -693,6 +740,47 @@ static void core_site_likelihood_derivatives(unsigned int states,
   }
 }
 
+static double * create_diagptable(unsigned int states,
+                                  unsigned int rate_cats,
+                                  double branch_length,
+                                  const double * prop_invar,
+                                  const double * rates,
+                                  double * const * eigenvals)
+{
+  unsigned int i, j;
+  double ki;
+  const double * t_eigenvals;
+  double * diagp;
+
+  double * diagptable = (double *) pll_aligned_alloc(
+                                      rate_cats * states * 4 * sizeof(double),
+                                      PLL_ALIGNMENT_AVX);
+  if (!diagptable)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf (pll_errmsg, 200, "Cannot allocate memory for diagptable");
+    return NULL;
+  }
+
+  /* pre-compute the derivatives of the P matrix for all discrete GAMMA rates */
+  diagp = diagptable;
+  for(i = 0; i < rate_cats; ++i)
+  {
+    t_eigenvals = eigenvals[i];
+    ki = rates[i]/(1.0 - prop_invar[i]);
+    for(j = 0; j < states; ++j)
+    {
+      diagp[0] = exp(t_eigenvals[j] * ki * branch_length);
+      diagp[1] = t_eigenvals[j] * ki * diagp[0];
+      diagp[2] = t_eigenvals[j] * ki * t_eigenvals[j] * ki * diagp[0];
+      diagp[3] = 0;
+      diagp += 4;
+    }
+  }
+
+  return diagptable;
+}
+
 PLL_EXPORT int pll_core_likelihood_derivatives(unsigned int states,
                                                unsigned int sites,
                                                unsigned int rate_cats,
@@ -713,20 +801,17 @@ PLL_EXPORT int pll_core_likelihood_derivatives(unsigned int states,
                                                double * dd_f,
                                                unsigned int attrib)
 {
-  unsigned int n, i, j;
+  unsigned int n, i;
   unsigned int ef_sites;
 
   const double * sum;
   double deriv1, deriv2;
   double site_lk[3];
 
-  const double * t_eigenvals;
-  double t_branch_length;
   unsigned int scale_factors;
 
-  double *diagptable, *diagp;
+  double *diagptable;
   const int * invariant_ptr;
-  double ki;
 
   unsigned int states_padded = states;
 
@@ -744,32 +829,14 @@ PLL_EXPORT int pll_core_likelihood_derivatives(unsigned int states,
   *d_f = 0.0;
   *dd_f = 0.0;
 
-  diagptable = (double *) pll_aligned_alloc(
-                                      rate_cats * states * 4 * sizeof(double),
-                                      PLL_ALIGNMENT_AVX);
+  diagptable = create_diagptable(states,
+                                 rate_cats,
+                                 branch_length,
+                                 prop_invar,
+                                 rates,
+                                 eigenvals);
   if (!diagptable)
-  {
-    pll_errno = PLL_ERROR_MEM_ALLOC;
-    snprintf (pll_errmsg, 200, "Cannot allocate memory for diagptable");
     return PLL_FAILURE;
-  }
-
-  /* pre-compute the derivatives of the P matrix for all discrete GAMMA rates */
-  diagp = diagptable;
-  for(i = 0; i < rate_cats; ++i)
-  {
-    t_eigenvals = eigenvals[i];
-    ki = rates[i]/(1.0 - prop_invar[i]);
-    t_branch_length = branch_length;
-    for(j = 0; j < states; ++j)
-    {
-      diagp[0] = exp(t_eigenvals[j] * ki * t_branch_length);
-      diagp[1] = t_eigenvals[j] * ki * diagp[0];
-      diagp[2] = t_eigenvals[j] * ki * t_eigenvals[j] * ki * diagp[0];
-      diagp[3] = 0;
-      diagp += 4;
-    }
-  }
 
 // SSE3 vectorization in missing as of now
 #ifdef HAVE_SSE3
@@ -800,6 +867,27 @@ PLL_EXPORT int pll_core_likelihood_derivatives(unsigned int states,
   }
   else
 #endif
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    states_padded = (states+3) & 0xFFFFFFFC;
+
+    pll_core_likelihood_derivatives_avx512(states,
+                                           states_padded,
+                                           rate_cats,
+                                           ef_sites,
+                                           pattern_weights,
+                                           rate_weights,
+                                           invariant,
+                                           prop_invar,
+                                           freqs,
+                                           sumtable,
+                                           diagptable,
+                                           d_f,
+                                           dd_f);
+  }
+  else
+#endif
 #ifdef HAVE_AVX
   if (attrib & PLL_ATTRIB_ARCH_AVX && PLL_STAT(avx_present))
   {
@@ -877,9 +965,25 @@ PLL_EXPORT int pll_core_likelihood_derivatives(unsigned int states,
                                          site_lk);
         sum += rate_cats * states_padded;
 
-        /* apply scaling */
-        scale_factors = (parent_scaler) ? parent_scaler[parent_sites + n] : 0;
-        scale_factors += (child_scaler) ? child_scaler[child_ids + n] : 0;
+        /* apply scaling; with per-rate scalers the sumtable holds the
+           factors relative to the minimum over the rate categories */
+        if (attrib & PLL_ATTRIB_RATE_SCALERS)
+        {
+          scale_factors = UINT_MAX;
+          for (i = 0; i < rate_cats; ++i)
+          {
+            unsigned int rate_factors = (parent_scaler) ?
+                      parent_scaler[(parent_sites + n)*rate_cats + i] : 0;
+            rate_factors += (child_scaler) ?
+                      child_scaler[(child_ids + n)*rate_cats + i] : 0;
+            scale_factors = PLL_MIN(scale_factors, rate_factors);
+          }
+        }
+        else
+        {
+          scale_factors = (parent_scaler) ? parent_scaler[parent_sites + n] : 0;
+          scale_factors += (child_scaler) ? child_scaler[child_ids + n] : 0;
+        }
         asc_scaling = pow(PLL_SCALE_THRESHOLD, (double)scale_factors);
 
         /* sum over likelihood and 1st and 2nd derivative / apply scaling */
@@ -927,3 +1031,77 @@ PLL_EXPORT int pll_core_likelihood_derivatives(unsigned int states,
 
   return PLL_SUCCESS;
 }
+
+/* Derivatives of -logL for each site separately, without pattern weights and
+   without the ascertainment bias correction. They are used to score many
+   site weightings (e.g. bootstrap replicates) from a single pass over the
+   sumtable. The sumtable is read with the padding it was built with by
+   pll_core_update_sumtable_*() for the given attributes */
+PLL_EXPORT int pll_core_likelihood_derivatives_persite(unsigned int states,
+                                                       unsigned int sites,
+                                                       unsigned int rate_cats,
+                                                       const double * rate_weights,
+                                                       const int * invariant,
+                                                       double branch_length,
+                                                       const double * prop_invar,
+                                                       double * const * freqs,
+                                                       const double * rates,
+                                                       double * const * eigenvals,
+                                                       const double * sumtable,
+                                                       double * persite_d_f,
+                                                       double * persite_dd_f,
+                                                       unsigned int attrib)
+{
+  unsigned int n;
+  unsigned int states_padded = states;
+  const double * sum = sumtable;
+  double site_lk[3];
+
+  double * diagptable = create_diagptable(states,
+                                          rate_cats,
+                                          branch_length,
+                                          prop_invar,
+                                          rates,
+                                          eigenvals);
+  if (!diagptable)
+    return PLL_FAILURE;
+
+#ifdef HAVE_SSE3
+  if (attrib & PLL_ATTRIB_ARCH_SSE && PLL_STAT(sse3_present))
+    states_padded = (states+1) & 0xFFFFFFFE;
+#endif
+#ifdef HAVE_AVX
+  if (attrib & PLL_ATTRIB_ARCH_AVX && PLL_STAT(avx_present))
+    states_padded = (states+3) & 0xFFFFFFFC;
+#endif
+#ifdef HAVE_AVX2
+  if (attrib & PLL_ATTRIB_ARCH_AVX2 && PLL_STAT(avx2_present))
+    states_padded = (states+3) & 0xFFFFFFFC;
+#endif
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+    states_padded = (states+3) & 0xFFFFFFFC;
+#endif
+
+  for (n = 0; n < sites; ++n)
+  {
+    core_site_likelihood_derivatives(states,
+                                     states_padded,
+                                     rate_cats,
+                                     rate_weights,
+                                     invariant ? invariant + n : NULL,
+                                     prop_invar,
+                                     freqs,
+                                     sum,
+                                     diagptable,
+                                     site_lk);
+    sum += rate_cats * states_padded;
+
+    persite_d_f[n] = -site_lk[1] / site_lk[0];
+    persite_dd_f[n] = persite_d_f[n] * persite_d_f[n] - site_lk[2] / site_lk[0];
+  }
+
+  pll_aligned_free(diagptable);
+
+  return PLL_SUCCESS;
+}
@@ -1839,9 +1839,9 @@ PLL_EXPORT int pll_core_likelihood_derivatives_avx(unsigned int states,
       __m256d v_deriv2 = _mm256_sub_pd(_mm256_mul_pd(v_deriv1, v_deriv1),
                                        _mm256_mul_pd(v_term2, v_recip0));
 
-      /* assumption: no zero weights */
-      if ((pattern_weights[n-3] | pattern_weights[n-2] |
-           pattern_weights[n-1] | pattern_weights[n]) == 1)
+      /* zero weights (e.g. bootstrap replicates) fail the test too */
+      if (pattern_weights[n-3] == 1 && pattern_weights[n-2] == 1 &&
+          pattern_weights[n-1] == 1 && pattern_weights[n] == 1)
       {
         /* all 4 weights are 1 -> no multiplication needed */
         v_df = _mm256_sub_pd (v_df, v_deriv1);
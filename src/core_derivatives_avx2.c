@@ -280,7 +280,7 @@ PLL_EXPORT int pll_core_update_sumtable_ii_avx2(unsigned int states,
   const double * t_clvc = clvc;
   double * t_freqs;
 
-  /* dedicated functions for 4x4 and 20x20 matrices */
+  /* dedicated functions for 4x4, 20x20 and 61x61 matrices */
   if (states == 4)
   {
     /* call AVX variant */
@@ -312,6 +312,20 @@ PLL_EXPORT int pll_core_update_sumtable_ii_avx2(unsigned int states,
                                                  sumtable,
                                                  attrib);
   }
+  else if (states == 61)
+  {
+    return pll_core_update_sumtable_ii_61x61_avx2(sites,
+                                                  rate_cats,
+                                                  clvp,
+                                                  clvc,
+                                                  parent_scaler,
+                                                  child_scaler,
+                                                  eigenvecs,
+                                                  inv_eigenvecs,
+                                                  freqs,
+                                                  sumtable,
+                                                  attrib);
+  }
 
 
   unsigned int states_padded = (states+3) & 0xFFFFFFFC;
@@ -748,6 +762,320 @@ PLL_EXPORT int pll_core_update_sumtable_repeats_20x20_avx2(unsigned int sites,
 }
 
 
+/* sumtable matrices of the 4x4 site-repeats kernels, stored by columns: the
+   first rate_cats matrices form the left term (inverse eigenvectors weighted
+   by the frequencies) and the next rate_cats ones the right term
+   (eigenvectors). Both terms are then sums of columns scaled by CLV entries */
+static double * sumtable_matrices_4x4_avx2(unsigned int rate_cats,
+                                           double * const * eigenvecs,
+                                           double * const * inv_eigenvecs,
+                                           double * const * freqs)
+{
+  unsigned int i,j,k;
+  double * matrices = (double *)pll_aligned_alloc(2 * rate_cats * 16 *
+                                                  sizeof(double),
+                                                  PLL_ALIGNMENT_AVX);
+  if (!matrices)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for tt_inv_eigenvecs");
+    return NULL;
+  }
+
+  double * lmat = matrices;
+  double * rmat = matrices + rate_cats * 16;
+  for (i = 0; i < rate_cats; ++i)
+  {
+    for (j = 0; j < 4; ++j)
+      for (k = 0; k < 4; ++k)
+      {
+        lmat[j*4 + k] = inv_eigenvecs[i][j*4 + k] * freqs[i][j];
+        rmat[j*4 + k] = eigenvecs[i][k*4 + j];
+      }
+    lmat += 16;
+    rmat += 16;
+  }
+
+  return matrices;
+}
+
+/* sum of the columns of mat scaled by the entries of clv */
+static inline __m256d colsum_4x4_avx2(const double * mat, const double * clv)
+{
+  __m256d v_terma = _mm256_mul_pd(_mm256_load_pd(mat),
+                                  _mm256_broadcast_sd(clv));
+  __m256d v_termb = _mm256_mul_pd(_mm256_load_pd(mat+4),
+                                  _mm256_broadcast_sd(clv+1));
+  v_terma = _mm256_fmadd_pd(_mm256_load_pd(mat+8),
+                            _mm256_broadcast_sd(clv+2),
+                            v_terma);
+  v_termb = _mm256_fmadd_pd(_mm256_load_pd(mat+12),
+                            _mm256_broadcast_sd(clv+3),
+                            v_termb);
+
+  return _mm256_add_pd(v_terma, v_termb);
+}
+
+PLL_EXPORT int pll_core_update_sumtable_repeats_4x4_avx2(unsigned int states,
+                                                         unsigned int sites,
+                                                         unsigned int parent_sites,
+                                                         unsigned int rate_cats,
+                                                         const double * clvp,
+                                                         const double * clvc,
+                                                         const unsigned int * parent_scaler,
+                                                         const unsigned int * child_scaler,
+                                                         double * const * eigenvecs,
+                                                         double * const * inv_eigenvecs,
+                                                         double * const * freqs,
+                                                         double *sumtable,
+                                                         const unsigned int * parent_site_id,
+                                                         const unsigned int * child_site_id,
+                                                         double * bclv_buffer,
+                                                         unsigned int inv,
+                                                         unsigned int attrib)
+{
+  unsigned int i, n;
+
+  /* build sumtable */
+  double * sum = sumtable;
+
+  unsigned int span_padded = rate_cats * 4;
+
+  /* scaling stuff*/
+  unsigned int min_scaler = 0;
+  unsigned int * rate_scalings = NULL;
+  int per_rate_scaling = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 1 : 0;
+
+  /* powers of scale threshold for undoing the scaling */
+  __m256d v_scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+  if (per_rate_scaling)
+  {
+    rate_scalings = (unsigned int*) calloc(rate_cats, sizeof(unsigned int));
+
+    if (!rate_scalings)
+    {
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf (pll_errmsg, 200, "Cannot allocate memory for rate scalers");
+      return PLL_FAILURE;
+    }
+
+    double scale_factor = 1.0;
+    for (i = 0; i < PLL_SCALE_RATE_MAXDIFF; ++i)
+    {
+      scale_factor *= PLL_SCALE_THRESHOLD;
+      v_scale_minlh[i] = _mm256_set1_pd(scale_factor);
+    }
+  }
+
+  double * matrices = sumtable_matrices_4x4_avx2(rate_cats,
+                                                 eigenvecs,
+                                                 inv_eigenvecs,
+                                                 freqs);
+  if (!matrices)
+  {
+    if (rate_scalings)
+      free(rate_scalings);
+    return PLL_FAILURE;
+  }
+
+  for (n = 0; n < sites; n++)
+  {
+    unsigned int pid = PLL_GET_ID(parent_site_id, n);
+    unsigned int cid = PLL_GET_ID(child_site_id, n);
+    const double * t_clvp = &clvp[pid * span_padded];
+    const double * t_clvc = &clvc[cid * span_padded];
+    const double * lmat = matrices;
+    const double * rmat = matrices + rate_cats * 16;
+
+    /* compute per-rate scalers and obtain minimum value (within site) */
+    if (per_rate_scaling)
+    {
+      min_scaler = UINT_MAX;
+      for (i = 0; i < rate_cats; ++i)
+      {
+        rate_scalings[i] = (parent_scaler) ? parent_scaler[pid*rate_cats+i] : 0;
+        rate_scalings[i] += (child_scaler) ? child_scaler[cid*rate_cats+i] : 0;
+        if (rate_scalings[i] < min_scaler)
+          min_scaler = rate_scalings[i];
+      }
+
+      /* compute relative capped per-rate scalers */
+      for (i = 0; i < rate_cats; ++i)
+      {
+        rate_scalings[i] = PLL_MIN(rate_scalings[i] - min_scaler,
+                                   PLL_SCALE_RATE_MAXDIFF);
+      }
+    }
+
+    for (i = 0; i < rate_cats; ++i)
+    {
+      __m256d v_sum = _mm256_mul_pd(colsum_4x4_avx2(lmat, t_clvp),
+                                    colsum_4x4_avx2(rmat, t_clvc));
+
+      /* apply per-rate scalers */
+      if (rate_scalings && rate_scalings[i] > 0)
+      {
+        v_sum = _mm256_mul_pd(v_sum, v_scale_minlh[rate_scalings[i]-1]);
+      }
+
+      _mm256_store_pd (sum, v_sum);
+
+      t_clvc += 4;
+      t_clvp += 4;
+      lmat += 16;
+      rmat += 16;
+      sum += 4;
+    }
+  }
+
+  pll_aligned_free(matrices);
+
+  if (rate_scalings)
+    free(rate_scalings);
+
+  return PLL_SUCCESS;
+}
+
+/* the terms of the (fewer) parent repeat classes are precomputed in
+   bclv_buffer */
+PLL_EXPORT int pll_core_update_sumtable_repeatsbclv_4x4_avx2(unsigned int states,
+                                                             unsigned int sites,
+                                                             unsigned int parent_sites,
+                                                             unsigned int rate_cats,
+                                                             const double * clvp,
+                                                             const double * clvc,
+                                                             const unsigned int * parent_scaler,
+                                                             const unsigned int * child_scaler,
+                                                             double * const * eigenvecs,
+                                                             double * const * inv_eigenvecs,
+                                                             double * const * freqs,
+                                                             double *sumtable,
+                                                             const unsigned int * parent_site_id,
+                                                             const unsigned int * child_site_id,
+                                                             double * bclv_buffer,
+                                                             unsigned int inv,
+                                                             unsigned int attrib)
+{
+  unsigned int i, n;
+
+  /* build sumtable */
+  double * sum = sumtable;
+
+  unsigned int span_padded = rate_cats * 4;
+  double * lbclv = bclv_buffer;
+
+  /* scaling stuff*/
+  unsigned int min_scaler = 0;
+  unsigned int * rate_scalings = NULL;
+  int per_rate_scaling = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 1 : 0;
+
+  /* powers of scale threshold for undoing the scaling */
+  __m256d v_scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+  if (per_rate_scaling)
+  {
+    rate_scalings = (unsigned int*) calloc(rate_cats, sizeof(unsigned int));
+
+    if (!rate_scalings)
+    {
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf (pll_errmsg, 200, "Cannot allocate memory for rate scalers");
+      return PLL_FAILURE;
+    }
+
+    double scale_factor = 1.0;
+    for (i = 0; i < PLL_SCALE_RATE_MAXDIFF; ++i)
+    {
+      scale_factor *= PLL_SCALE_THRESHOLD;
+      v_scale_minlh[i] = _mm256_set1_pd(scale_factor);
+    }
+  }
+
+  double * matrices = sumtable_matrices_4x4_avx2(rate_cats,
+                                                 eigenvecs,
+                                                 inv_eigenvecs,
+                                                 freqs);
+  if (!matrices)
+  {
+    if (rate_scalings)
+      free(rate_scalings);
+    return PLL_FAILURE;
+  }
+
+  /* hack to avoid numerical deviations: with swapped parent and child, the
+     parent side uses the eigenvectors */
+  const double * pmatrices = matrices + (inv ? rate_cats * 16 : 0);
+  const double * cmatrices = matrices + (inv ? 0 : rate_cats * 16);
+
+  /* bclv computation */
+  const double * t_clvp = clvp;
+  for (n = 0; n < parent_sites; n++)
+  {
+    const double * pmat = pmatrices;
+    for (i = 0; i < rate_cats; ++i)
+    {
+      _mm256_store_pd(lbclv, colsum_4x4_avx2(pmat, t_clvp));
+      t_clvp += 4;
+      lbclv += 4;
+      pmat += 16;
+    }
+  }
+
+  for (n = 0; n < sites; n++)
+  {
+    unsigned int cid = PLL_GET_ID(child_site_id, n);
+    unsigned int pid = parent_site_id[n];
+    const double * t_clvc = &clvc[cid * span_padded];
+    const double * cmat = cmatrices;
+    lbclv = &bclv_buffer[pid * span_padded];
+
+    /* compute per-rate scalers and obtain minimum value (within site) */
+    if (per_rate_scaling)
+    {
+      min_scaler = UINT_MAX;
+      for (i = 0; i < rate_cats; ++i)
+      {
+        rate_scalings[i] = (parent_scaler) ? parent_scaler[pid*rate_cats+i] : 0;
+        rate_scalings[i] += (child_scaler) ? child_scaler[cid*rate_cats+i] : 0;
+        if (rate_scalings[i] < min_scaler)
+          min_scaler = rate_scalings[i];
+      }
+
+      /* compute relative capped per-rate scalers */
+      for (i = 0; i < rate_cats; ++i)
+      {
+        rate_scalings[i] = PLL_MIN(rate_scalings[i] - min_scaler,
+                                   PLL_SCALE_RATE_MAXDIFF);
+      }
+    }
+
+    for (i = 0; i < rate_cats; ++i)
+    {
+      __m256d v_prod = _mm256_mul_pd(_mm256_load_pd(lbclv),
+                                     colsum_4x4_avx2(cmat, t_clvc));
+
+      /* apply per-rate scalers */
+      if (rate_scalings && rate_scalings[i] > 0)
+      {
+        v_prod = _mm256_mul_pd(v_prod, v_scale_minlh[rate_scalings[i]-1]);
+      }
+
+      _mm256_store_pd (sum, v_prod);
+
+      t_clvc += 4;
+      lbclv += 4;
+      cmat += 16;
+      sum += 4;
+    }
+  }
+
+  pll_aligned_free(matrices);
+
+  if (rate_scalings)
+    free(rate_scalings);
+
+  return PLL_SUCCESS;
+}
+
 PLL_EXPORT int pll_core_update_sumtable_repeats_generic_avx2(unsigned int states,
                                                              unsigned int sites,
                                                              unsigned int parent_sites,
@@ -1307,6 +1635,21 @@ PLL_EXPORT int pll_core_update_sumtable_ti_avx2(unsigned int states,
                                            sumtable,
                                            attrib);
   }
+  else if (states == 61)
+  {
+    return pll_core_update_sumtable_ti_61x61_avx2(sites,
+                                                  rate_cats,
+                                                  parent_clv,
+                                                  left_tipchars,
+                                                  parent_scaler,
+                                                  eigenvecs,
+                                                  inv_eigenvecs,
+                                                  freqs,
+                                                  tipmap,
+                                                  tipmap_size,
+                                                  sumtable,
+                                                  attrib);
+  }
 
   unsigned int states_padded = (states+3) & 0xFFFFFFFC;
   unsigned int span = states_padded * rate_cats;
@@ -1763,9 +2106,9 @@ int pll_core_likelihood_derivatives_avx2(unsigned int states,
       __m256d v_deriv2 = _mm256_sub_pd(_mm256_mul_pd(v_deriv1, v_deriv1),
                                        _mm256_mul_pd(v_term2, v_recip0));
 
-      /* assumption: no zero weights */
-      if ((pattern_weights[n-3] | pattern_weights[n-2] |
-           pattern_weights[n-1] | pattern_weights[n]) == 1)
+      /* zero weights (e.g. bootstrap replicates) fail the test too */
+      if (pattern_weights[n-3] == 1 && pattern_weights[n-2] == 1 &&
+          pattern_weights[n-1] == 1 && pattern_weights[n] == 1)
       {
         /* all 4 weights are 1 -> no multiplication needed */
         v_df = _mm256_sub_pd (v_df, v_deriv1);
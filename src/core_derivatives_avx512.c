@@ -0,0 +1,484 @@
+/*
+    Copyright (C) 2015-2020 Tomas Flouri, Diego Darriba, Alexey Kozlov
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include <limits.h>
+#include "pll.h"
+
+/* The sumtable keeps the layout of the AVX/AVX2 kernels (states padded to a
+   multiple of four), such that it can be consumed by any of them. The eigen
+   vector matrices are padded to blocks of eight states and stored such that
+   a block of eight output states is contiguous for each input state. */
+
+static inline __mmask8 block_mask(unsigned int remaining)
+{
+  return (remaining >= 8) ? 0xFF : (__mmask8)((1u << remaining) - 1);
+}
+
+static unsigned int * alloc_rate_scalings(unsigned int rate_cats,
+                                          unsigned int attrib,
+                                          double * scale_minlh)
+{
+  unsigned int i;
+  unsigned int * rate_scalings;
+  double scale_factor = 1.0;
+
+  for (i = 0; i < PLL_SCALE_RATE_MAXDIFF; ++i)
+  {
+    scale_factor *= PLL_SCALE_THRESHOLD;
+    scale_minlh[i] = scale_factor;
+  }
+
+  if (!(attrib & PLL_ATTRIB_RATE_SCALERS))
+    return NULL;
+
+  rate_scalings = (unsigned int*) calloc(rate_cats, sizeof(unsigned int));
+  if (!rate_scalings)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf (pll_errmsg, 200, "Cannot allocate memory for rate scalers");
+  }
+
+  return rate_scalings;
+}
+
+static void site_rate_scalings(unsigned int n,
+                               unsigned int rate_cats,
+                               const unsigned int * parent_scaler,
+                               const unsigned int * child_scaler,
+                               unsigned int * rate_scalings)
+{
+  unsigned int i;
+  unsigned int min_scaler = UINT_MAX;
+
+  /* compute per-rate scalers and obtain minimum value (within site) */
+  for (i = 0; i < rate_cats; ++i)
+  {
+    rate_scalings[i] = (parent_scaler) ? parent_scaler[n*rate_cats+i] : 0;
+    rate_scalings[i] += (child_scaler) ? child_scaler[n*rate_cats+i] : 0;
+    if (rate_scalings[i] < min_scaler)
+      min_scaler = rate_scalings[i];
+  }
+
+  /* compute relative capped per-rate scalers */
+  for (i = 0; i < rate_cats; ++i)
+  {
+    rate_scalings[i] = PLL_MIN(rate_scalings[i] - min_scaler,
+                               PLL_SCALE_RATE_MAXDIFF);
+  }
+}
+
+PLL_EXPORT int pll_core_update_sumtable_ii_avx512(unsigned int states,
+                                                  unsigned int sites,
+                                                  unsigned int rate_cats,
+                                                  const double * clvp,
+                                                  const double * clvc,
+                                                  const unsigned int * parent_scaler,
+                                                  const unsigned int * child_scaler,
+                                                  double * const * eigenvecs,
+                                                  double * const * inv_eigenvecs,
+                                                  double * const * freqs,
+                                                  double * sumtable,
+                                                  unsigned int attrib)
+{
+  unsigned int i, j, k, n;
+
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int block_padded = (states+7) & 0xFFFFFFF8;
+  unsigned int matrix_size = states * block_padded;
+
+  double * sum = sumtable;
+
+  /* scaling stuff */
+  double scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+  unsigned int * rate_scalings = alloc_rate_scalings(rate_cats,
+                                                     attrib,
+                                                     scale_minlh);
+
+  if ((attrib & PLL_ATTRIB_RATE_SCALERS) && !rate_scalings)
+    return PLL_FAILURE;
+
+  /* inv_eigenvecs multiplied by frequencies, and transposed eigenvecs */
+  double * tt_inv_eigenvecs = (double *) pll_aligned_alloc (
+      (matrix_size * rate_cats) * sizeof(double),
+      PLL_ALIGNMENT_AVX512);
+  double * tt_eigenvecs = (double *) pll_aligned_alloc (
+      (matrix_size * rate_cats) * sizeof(double),
+      PLL_ALIGNMENT_AVX512);
+
+  if (!tt_eigenvecs || !tt_inv_eigenvecs)
+  {
+    if (tt_eigenvecs)
+      pll_aligned_free(tt_eigenvecs);
+    if (tt_inv_eigenvecs)
+      pll_aligned_free(tt_inv_eigenvecs);
+    if (rate_scalings)
+      free(rate_scalings);
+
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf (pll_errmsg, 200, "Cannot allocate memory for tt_eigenvecs");
+    return PLL_FAILURE;
+  }
+
+  memset(tt_eigenvecs, 0, (matrix_size * rate_cats) * sizeof(double));
+  memset(tt_inv_eigenvecs, 0, (matrix_size * rate_cats) * sizeof(double));
+
+  for (i = 0; i < rate_cats; ++i)
+  {
+    for (k = 0; k < states; ++k)
+      for (j = 0; j < states; ++j)
+      {
+        tt_inv_eigenvecs[i*matrix_size + k*block_padded + j] =
+            inv_eigenvecs[i][k*states_padded + j] * freqs[i][k];
+        tt_eigenvecs[i*matrix_size + k*block_padded + j] =
+            eigenvecs[i][j*states_padded + k];
+      }
+  }
+
+  for (n = 0; n < sites; n++)
+  {
+    if (rate_scalings)
+      site_rate_scalings(n, rate_cats, parent_scaler, child_scaler,
+                         rate_scalings);
+
+    for (i = 0; i < rate_cats; ++i)
+    {
+      /* iterate over blocks of eight states of the sumtable */
+      for (j = 0; j < states_padded; j += 8)
+      {
+        const double * im = tt_inv_eigenvecs + i*matrix_size + j;
+        const double * em = tt_eigenvecs + i*matrix_size + j;
+
+        __m512d v_lefterm = _mm512_setzero_pd();
+        __m512d v_righterm = _mm512_setzero_pd();
+
+        for (k = 0; k < states; ++k)
+        {
+          v_lefterm = _mm512_fmadd_pd(_mm512_load_pd(im),
+                                      _mm512_set1_pd(clvp[k]),
+                                      v_lefterm);
+          v_righterm = _mm512_fmadd_pd(_mm512_load_pd(em),
+                                       _mm512_set1_pd(clvc[k]),
+                                       v_righterm);
+          im += block_padded;
+          em += block_padded;
+        }
+
+        __m512d v_prod = _mm512_mul_pd(v_lefterm, v_righterm);
+
+        /* apply per-rate scalers */
+        if (rate_scalings && rate_scalings[i] > 0)
+          v_prod = _mm512_mul_pd(v_prod,
+                          _mm512_set1_pd(scale_minlh[rate_scalings[i]-1]));
+
+        _mm512_mask_storeu_pd(sum + j, block_mask(states_padded - j), v_prod);
+      }
+
+      clvc += states_padded;
+      clvp += states_padded;
+      sum  += states_padded;
+    }
+  }
+
+  pll_aligned_free (tt_inv_eigenvecs);
+  pll_aligned_free (tt_eigenvecs);
+  if (rate_scalings)
+    free(rate_scalings);
+
+  return PLL_SUCCESS;
+}
+
+PLL_EXPORT int pll_core_update_sumtable_ti_avx512(unsigned int states,
+                                                  unsigned int sites,
+                                                  unsigned int rate_cats,
+                                                  const double * parent_clv,
+                                                  const unsigned char * left_tipchars,
+                                                  const unsigned int * parent_scaler,
+                                                  double * const * eigenvecs,
+                                                  double * const * inv_eigenvecs,
+                                                  double * const * freqs,
+                                                  const pll_state_t * tipmap,
+                                                  unsigned int tipmap_size,
+                                                  double *sumtable,
+                                                  unsigned int attrib)
+{
+  if (states == 4)
+  {
+    /* tipchars are state codes in the 4x4 case, call the AVX version */
+    return pll_core_update_sumtable_ti_avx(states,
+                                           sites,
+                                           rate_cats,
+                                           parent_clv,
+                                           left_tipchars,
+                                           parent_scaler,
+                                           eigenvecs,
+                                           inv_eigenvecs,
+                                           freqs,
+                                           tipmap,
+                                           tipmap_size,
+                                           sumtable,
+                                           attrib);
+  }
+
+  unsigned int i, j, k, n;
+
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int block_padded = (states+7) & 0xFFFFFFF8;
+  unsigned int matrix_size = states * block_padded;
+  unsigned int span = block_padded * rate_cats;
+  unsigned int maxstates = tipmap_size;
+
+  const double * t_clvc = parent_clv;
+  double * sum = sumtable;
+
+  /* scaling stuff */
+  double scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+  unsigned int * rate_scalings = alloc_rate_scalings(rate_cats,
+                                                     attrib,
+                                                     scale_minlh);
+
+  if ((attrib & PLL_ATTRIB_RATE_SCALERS) && !rate_scalings)
+    return PLL_FAILURE;
+
+  /* transposed eigenvecs */
+  double * tt_eigenvecs = (double *) pll_aligned_alloc (
+      (matrix_size * rate_cats) * sizeof(double),
+      PLL_ALIGNMENT_AVX512);
+
+  /* left terms of all tip states */
+  double * precomp_left = (double *) pll_aligned_alloc (
+      (maxstates * span) * sizeof(double),
+      PLL_ALIGNMENT_AVX512);
+
+  if (!tt_eigenvecs || !precomp_left)
+  {
+    if (tt_eigenvecs)
+      pll_aligned_free(tt_eigenvecs);
+    if (precomp_left)
+      pll_aligned_free(precomp_left);
+    if (rate_scalings)
+      free(rate_scalings);
+
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf (pll_errmsg, 200, "Cannot allocate memory for tt_inv_eigenvecs");
+    return PLL_FAILURE;
+  }
+
+  memset(tt_eigenvecs, 0, (matrix_size * rate_cats) * sizeof(double));
+  memset(precomp_left, 0, (maxstates * span) * sizeof(double));
+
+  for (i = 0; i < rate_cats; ++i)
+    for (k = 0; k < states; ++k)
+      for (j = 0; j < states; ++j)
+        tt_eigenvecs[i*matrix_size + k*block_padded + j] =
+            eigenvecs[i][j*states_padded + k];
+
+  /* precompute left terms since they are the same for every site */
+  for (n = 0; n < maxstates; ++n)
+  {
+    pll_state_t state = tipmap ? tipmap[n] : n;
+
+    for (i = 0; i < rate_cats; ++i)
+    {
+      double * t_precomp = precomp_left + n*span + i*block_padded;
+
+      for (k = 0; k < states; ++k)
+      {
+        if ((state >> k) & 1)
+        {
+          for (j = 0; j < states; ++j)
+            t_precomp[j] += inv_eigenvecs[i][k*states_padded + j] *
+                            freqs[i][k];
+        }
+      }
+    }
+  }
+
+  /* build sumtable */
+  for (n = 0; n < sites; n++)
+  {
+    if (rate_scalings)
+      site_rate_scalings(n, rate_cats, parent_scaler, NULL, rate_scalings);
+
+    const double * t_precomp = precomp_left + left_tipchars[n] * span;
+
+    for (i = 0; i < rate_cats; ++i)
+    {
+      for (j = 0; j < states_padded; j += 8)
+      {
+        const double * em = tt_eigenvecs + i*matrix_size + j;
+
+        __m512d v_righterm = _mm512_setzero_pd();
+
+        for (k = 0; k < states; ++k)
+        {
+          v_righterm = _mm512_fmadd_pd(_mm512_load_pd(em),
+                                       _mm512_set1_pd(t_clvc[k]),
+                                       v_righterm);
+          em += block_padded;
+        }
+
+        __m512d v_lefterm = _mm512_load_pd(t_precomp + j);
+        __m512d v_sum = _mm512_mul_pd(v_lefterm, v_righterm);
+
+        /* apply per-rate scalers */
+        if (rate_scalings && rate_scalings[i] > 0)
+          v_sum = _mm512_mul_pd(v_sum,
+                          _mm512_set1_pd(scale_minlh[rate_scalings[i]-1]));
+
+        _mm512_mask_storeu_pd(sum + j, block_mask(states_padded - j), v_sum);
+      }
+
+      t_clvc += states_padded;
+      t_precomp += block_padded;
+      sum += states_padded;
+    }
+  }
+
+  pll_aligned_free(tt_eigenvecs);
+  pll_aligned_free(precomp_left);
+  if (rate_scalings)
+    free(rate_scalings);
+
+  return PLL_SUCCESS;
+}
+
+PLL_EXPORT
+int pll_core_likelihood_derivatives_avx512(unsigned int states,
+                                           unsigned int states_padded,
+                                           unsigned int rate_cats,
+                                           unsigned int ef_sites,
+                                           const unsigned int * pattern_weights,
+                                           const double * rate_weights,
+                                           const int * invariant,
+                                           const double * prop_invar,
+                                           double * const * freqs,
+                                           const double * sumtable,
+                                           const double * diagptable,
+                                           double * d_f,
+                                           double * dd_f)
+{
+  unsigned int i,j,k,n;
+  unsigned int span_padded = rate_cats * states_padded;
+
+  double * invar_lk = NULL;
+
+  int use_pinv = 0;
+  for (i = 0; i < rate_cats; ++i)
+    use_pinv |= (prop_invar[i] > 0);
+
+  /* diagptable transposed into three rows (likelihood, 1st and 2nd
+     derivative) spanning all rate categories, with rate weights and
+     proportion of invariant sites folded in */
+  double * t_diagp = (double *) pll_aligned_alloc(
+                                      3 * span_padded * sizeof(double),
+                                      PLL_ALIGNMENT_AVX512);
+
+  if (!t_diagp)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return PLL_FAILURE;
+  }
+
+  memset(t_diagp, 0, 3 * span_padded * sizeof(double));
+
+  for (i = 0; i < rate_cats; ++i)
+  {
+    double weight = rate_weights[i];
+    if (prop_invar[i] > 0)
+      weight *= (1. - prop_invar[i]);
+
+    for (j = 0; j < states; ++j)
+      for (k = 0; k < 3; ++k)
+        t_diagp[k*span_padded + i*states_padded + j] =
+            diagptable[i*states*4 + j*4 + k] * weight;
+  }
+
+  if (use_pinv)
+  {
+    invar_lk = (double *) calloc(states, sizeof(double));
+
+    if (!invar_lk)
+    {
+      pll_aligned_free(t_diagp);
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+      return PLL_FAILURE;
+    }
+
+    /* pre-compute invariant site likelihoods, weighted over rates */
+    for (i = 0; i < states; ++i)
+      for (j = 0; j < rate_cats; ++j)
+        if (prop_invar[j] > 0)
+          invar_lk[i] += freqs[j][i] * prop_invar[j] * rate_weights[j];
+  }
+
+  const double * r0 = t_diagp;
+  const double * r1 = r0 + span_padded;
+  const double * r2 = r1 + span_padded;
+
+  double df = 0.;
+  double ddf = 0.;
+
+  const double * sum = sumtable;
+  for (n = 0; n < ef_sites; ++n)
+  {
+    __m512d v_lk0 = _mm512_setzero_pd();
+    __m512d v_lk1 = _mm512_setzero_pd();
+    __m512d v_lk2 = _mm512_setzero_pd();
+
+    /* the sumtable entries of a site are contiguous over all rates */
+    for (j = 0; j < span_padded; j += 8)
+    {
+      __mmask8 m = block_mask(span_padded - j);
+      __m512d v_sum = _mm512_maskz_loadu_pd(m, sum + j);
+
+      v_lk0 = _mm512_fmadd_pd(v_sum, _mm512_maskz_loadu_pd(m, r0 + j), v_lk0);
+      v_lk1 = _mm512_fmadd_pd(v_sum, _mm512_maskz_loadu_pd(m, r1 + j), v_lk1);
+      v_lk2 = _mm512_fmadd_pd(v_sum, _mm512_maskz_loadu_pd(m, r2 + j), v_lk2);
+    }
+
+    double lk0 = _mm512_reduce_add_pd(v_lk0);
+    double lk1 = _mm512_reduce_add_pd(v_lk1);
+    double lk2 = _mm512_reduce_add_pd(v_lk2);
+
+    /* account for invariant sites */
+    if (use_pinv && invariant && invariant[n] != -1)
+      lk0 += invar_lk[invariant[n]];
+
+    double deriv1 = -lk1 / lk0;
+    double deriv2 = deriv1 * deriv1 - lk2 / lk0;
+
+    df  += pattern_weights[n] * deriv1;
+    ddf += pattern_weights[n] * deriv2;
+
+    sum += span_padded;
+  }
+
+  *d_f = df;
+  *dd_f = ddf;
+
+  pll_aligned_free(t_diagp);
+  if (invar_lk)
+    free(invar_lk);
+
+  return PLL_SUCCESS;
+}
@@ -0,0 +1,1038 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include <limits.h>
+#include "pll.h"
+
+/* Kernels for partitions created with PLL_ATTRIB_FLOAT. CLVs are stored in
+   single precision, whereas probability matrices, frequencies and the
+   log-likelihood remain in double precision. Before each call, the
+   probability matrices are converted into single-precision tables:
+
+   - for inner children, the transposed matrix mt[k][j][i] = P_k(i,j), such
+     that the product P_k * clv can be computed by broadcasting clv[j] and
+     accumulating whole rows of mt;
+
+   - for tip children, the lookup tab[c][k][i] = sum_{j in c} P_k(i,j) for
+     every tip code c.
+
+   Both tables use the same padding (states_padded) as the CLVs. Site terms
+   of the likelihood are computed in chunks and combined in double
+   precision. */
+
+#define FLOAT_TERMS_CHUNK 1024
+
+static unsigned int float_states_padded(unsigned int states,
+                                        unsigned int attrib)
+{
+#ifdef HAVE_SSE3
+  if (attrib & PLL_ATTRIB_ARCH_SSE && PLL_STAT(sse3_present))
+    return (states+1) & 0xFFFFFFFE;
+#endif
+#ifdef HAVE_AVX
+  if (attrib & PLL_ATTRIB_ARCH_AVX && PLL_STAT(avx_present))
+    return (states+3) & 0xFFFFFFFC;
+#endif
+#ifdef HAVE_AVX2
+  if (attrib & PLL_ATTRIB_ARCH_AVX2 && PLL_STAT(avx2_present))
+    return (states+3) & 0xFFFFFFFC;
+#endif
+  return states;
+}
+
+static void fill_parent_scaler(unsigned int scaler_size,
+                               unsigned int * parent_scaler,
+                               const unsigned int * left_scaler,
+                               const unsigned int * right_scaler)
+{
+  unsigned int i;
+
+  if (!left_scaler && !right_scaler)
+    memset(parent_scaler, 0, sizeof(unsigned int) * scaler_size);
+  else if (left_scaler && right_scaler)
+  {
+    memcpy(parent_scaler, left_scaler, sizeof(unsigned int) * scaler_size);
+    for (i = 0; i < scaler_size; ++i)
+      parent_scaler[i] += right_scaler[i];
+  }
+  else
+  {
+    if (left_scaler)
+      memcpy(parent_scaler, left_scaler, sizeof(unsigned int) * scaler_size);
+    else
+      memcpy(parent_scaler, right_scaler, sizeof(unsigned int) * scaler_size);
+  }
+}
+
+static float * alloc_float_table(size_t size)
+{
+  float * table = (float *)pll_aligned_alloc(size * sizeof(float),
+                                             PLL_ALIGNMENT_AVX);
+  if (!table)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return NULL;
+  }
+  memset(table, 0, size * sizeof(float));
+  return table;
+}
+
+/* mt[k][j][i] = P_k(i,j) */
+static float * create_transposed_matrix(unsigned int states,
+                                        unsigned int states_padded,
+                                        unsigned int rate_cats,
+                                        const double * pmatrix)
+{
+  unsigned int i,j,k;
+
+  float * mt = alloc_float_table((size_t)rate_cats * states * states_padded);
+  if (!mt) return NULL;
+
+  for (k = 0; k < rate_cats; ++k)
+  {
+    const double * pmat = pmatrix + k*states*states_padded;
+    float * m = mt + k*states*states_padded;
+    for (i = 0; i < states; ++i)
+      for (j = 0; j < states; ++j)
+        m[j*states_padded + i] = (float)pmat[i*states_padded + j];
+  }
+
+  return mt;
+}
+
+/* tab[c][k][i] = sum of P_k(i,j) over all states j of tip code c. For four
+   states the tip codes are the state bitmasks themselves, otherwise they
+   index the tipmap */
+static float * create_tip_lookup(unsigned int states,
+                                 unsigned int states_padded,
+                                 unsigned int rate_cats,
+                                 const double * pmatrix,
+                                 const pll_state_t * tipmap,
+                                 unsigned int tipmap_size)
+{
+  unsigned int c,i,j,k;
+  unsigned int ncodes = (states == 4) ? 16 : tipmap_size;
+
+  float * tab = alloc_float_table((size_t)ncodes*rate_cats*states_padded);
+  if (!tab) return NULL;
+
+  for (c = 0; c < ncodes; ++c)
+  {
+    pll_state_t code = (states == 4) ? c : tipmap[c];
+    for (k = 0; k < rate_cats; ++k)
+    {
+      const double * pmat = pmatrix + k*states*states_padded;
+      float * t = tab + (c*rate_cats + k)*states_padded;
+      for (i = 0; i < states; ++i)
+      {
+        double term = 0;
+        for (j = 0; j < states; ++j)
+          if ((code >> j) & 1)
+            term += pmat[i*states_padded + j];
+        t[i] = (float)term;
+      }
+    }
+  }
+
+  return tab;
+}
+
+/* ff[k][i] = pi_k(i) of the frequency vector used by rate category k */
+static float * create_float_frequencies(unsigned int states,
+                                        unsigned int states_padded,
+                                        unsigned int rate_cats,
+                                        double * const * frequencies,
+                                        const unsigned int * freqs_indices)
+{
+  unsigned int i,k;
+
+  float * ff = alloc_float_table((size_t)rate_cats * states_padded);
+  if (!ff) return NULL;
+
+  for (k = 0; k < rate_cats; ++k)
+    for (i = 0; i < states; ++i)
+      ff[k*states_padded + i] = (float)frequencies[freqs_indices[k]][i];
+
+  return ff;
+}
+
+/* check whether all entries of a rate category fell below the threshold */
+static unsigned int rate_below_threshold(unsigned int states_padded,
+                                         const float * clv)
+{
+  unsigned int i;
+  const float threshold = (float)PLL_SCALE_THRESHOLD_FLOAT;
+
+  for (i = 0; i < states_padded; ++i)
+    if (!(clv[i] < threshold))
+      return 0;
+
+  return 1;
+}
+
+static void scale_float(unsigned int size, float * clv)
+{
+  unsigned int i;
+  const float factor = (float)PLL_SCALE_FACTOR_FLOAT;
+
+  for (i = 0; i < size; ++i)
+    clv[i] *= factor;
+}
+
+/* apply per-rate (scale_mode 2) or per-site (scale_mode 1) scaling to the
+   CLV of site n, the same way as the double precision kernels do */
+static void scale_site_float(unsigned int states_padded,
+                             unsigned int rate_cats,
+                             unsigned int n,
+                             float * site_clv,
+                             unsigned int * parent_scaler,
+                             unsigned int scale_mode)
+{
+  unsigned int k;
+
+  if (scale_mode == 2)
+  {
+    for (k = 0; k < rate_cats; ++k)
+    {
+      float * clv = site_clv + k*states_padded;
+      if (rate_below_threshold(states_padded, clv))
+      {
+        scale_float(states_padded, clv);
+        parent_scaler[n*rate_cats + k] += 1;
+      }
+    }
+  }
+  else if (scale_mode == 1)
+  {
+    if (rate_below_threshold(states_padded*rate_cats, site_clv))
+    {
+      scale_float(states_padded*rate_cats, site_clv);
+      parent_scaler[n] += 1;
+    }
+  }
+}
+
+static void update_partial_ii_float_cpu(unsigned int states,
+                                        unsigned int states_padded,
+                                        unsigned int sites,
+                                        unsigned int rate_cats,
+                                        float * parent_clv,
+                                        unsigned int * parent_scaler,
+                                        const float * left_clv,
+                                        const float * right_clv,
+                                        const float * left_matrix,
+                                        const float * right_matrix,
+                                        unsigned int attrib)
+{
+  unsigned int i,j,k,n;
+  unsigned int scale_mode = parent_scaler ?
+                  ((attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1) : 0;
+  unsigned int span = states_padded * rate_cats;
+
+  for (n = 0; n < sites; ++n)
+  {
+    for (k = 0; k < rate_cats; ++k)
+    {
+      const float * lmat = left_matrix + k*states*states_padded;
+      const float * rmat = right_matrix + k*states*states_padded;
+      const float * lclv = left_clv + k*states_padded;
+      const float * rclv = right_clv + k*states_padded;
+      float * pclv = parent_clv + k*states_padded;
+
+      for (i = 0; i < states_padded; ++i)
+      {
+        float terma = 0;
+        float termb = 0;
+        for (j = 0; j < states; ++j)
+        {
+          terma += lmat[j*states_padded + i] * lclv[j];
+          termb += rmat[j*states_padded + i] * rclv[j];
+        }
+        pclv[i] = terma*termb;
+      }
+    }
+
+    scale_site_float(states_padded, rate_cats, n,
+                     parent_clv, parent_scaler, scale_mode);
+
+    parent_clv += span;
+    left_clv += span;
+    right_clv += span;
+  }
+}
+
+static void update_partial_ti_float_cpu(unsigned int states,
+                                        unsigned int states_padded,
+                                        unsigned int sites,
+                                        unsigned int rate_cats,
+                                        float * parent_clv,
+                                        unsigned int * parent_scaler,
+                                        const unsigned char * left_tipchars,
+                                        const float * right_clv,
+                                        const float * left_lookup,
+                                        const float * right_matrix,
+                                        unsigned int attrib)
+{
+  unsigned int i,j,k,n;
+  unsigned int scale_mode = parent_scaler ?
+                  ((attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1) : 0;
+  unsigned int span = states_padded * rate_cats;
+
+  for (n = 0; n < sites; ++n)
+  {
+    const float * lookup = left_lookup + left_tipchars[n]*span;
+
+    for (k = 0; k < rate_cats; ++k)
+    {
+      const float * rmat = right_matrix + k*states*states_padded;
+      const float * rclv = right_clv + k*states_padded;
+      const float * ltab = lookup + k*states_padded;
+      float * pclv = parent_clv + k*states_padded;
+
+      for (i = 0; i < states_padded; ++i)
+      {
+        float termb = 0;
+        for (j = 0; j < states; ++j)
+          termb += rmat[j*states_padded + i] * rclv[j];
+        pclv[i] = ltab[i]*termb;
+      }
+    }
+
+    scale_site_float(states_padded, rate_cats, n,
+                     parent_clv, parent_scaler, scale_mode);
+
+    parent_clv += span;
+    right_clv += span;
+  }
+}
+
+/* terms[n][k] = sum_i pi_k(i) * parent(i) * (P_k * child)(i), where the
+   child factor is the tip lookup for tips and is omitted at the root */
+static void site_terms_float_cpu(unsigned int states,
+                                 unsigned int states_padded,
+                                 unsigned int sites,
+                                 unsigned int rate_cats,
+                                 const float * parent_clv,
+                                 const float * child_clv,
+                                 const unsigned char * child_tipchars,
+                                 const float * child_matrix,
+                                 const float * frequencies,
+                                 double * terms)
+{
+  unsigned int i,j,k,n;
+  unsigned int span = states_padded * rate_cats;
+
+  for (n = 0; n < sites; ++n)
+  {
+    const float * lookup = child_tipchars ?
+                           child_matrix + child_tipchars[n]*span : NULL;
+
+    for (k = 0; k < rate_cats; ++k)
+    {
+      const float * pclv = parent_clv + k*states_padded;
+      const float * freqs = frequencies + k*states_padded;
+      double term = 0;
+
+      for (i = 0; i < states; ++i)
+      {
+        float y = 1;
+        if (child_clv)
+        {
+          const float * cmat = child_matrix + k*states*states_padded;
+          const float * cclv = child_clv + k*states_padded;
+          y = 0;
+          for (j = 0; j < states; ++j)
+            y += cmat[j*states_padded + i] * cclv[j];
+        }
+        else if (lookup)
+          y = lookup[k*states_padded + i];
+
+        term += (double)(freqs[i] * y) * pclv[i];
+      }
+
+      terms[n*rate_cats + k] = term;
+    }
+
+    parent_clv += span;
+    if (child_clv)
+      child_clv += span;
+  }
+}
+
+static void site_terms_float(unsigned int states,
+                             unsigned int sites,
+                             unsigned int rate_cats,
+                             const float * parent_clv,
+                             const float * child_clv,
+                             const unsigned char * child_tipchars,
+                             const float * child_matrix,
+                             const float * frequencies,
+                             double * terms,
+                             unsigned int attrib)
+{
+#ifdef HAVE_SSE3
+  if (attrib & PLL_ATTRIB_ARCH_SSE && PLL_STAT(sse3_present))
+  {
+    if (float_states_padded(states, attrib) % 4 == 0)
+      pll_core_site_terms_float_sse(states,
+                                    sites,
+                                    rate_cats,
+                                    parent_clv,
+                                    child_clv,
+                                    child_tipchars,
+                                    child_matrix,
+                                    frequencies,
+                                    terms);
+    else
+      site_terms_float_cpu(states,
+                           float_states_padded(states, attrib),
+                           sites,
+                           rate_cats,
+                           parent_clv,
+                           child_clv,
+                           child_tipchars,
+                           child_matrix,
+                           frequencies,
+                           terms);
+    return;
+  }
+#endif
+#ifdef HAVE_AVX
+  if (attrib & PLL_ATTRIB_ARCH_AVX && PLL_STAT(avx_present))
+  {
+    pll_core_site_terms_float_avx(states,
+                                  sites,
+                                  rate_cats,
+                                  parent_clv,
+                                  child_clv,
+                                  child_tipchars,
+                                  child_matrix,
+                                  frequencies,
+                                  terms);
+    return;
+  }
+#endif
+#ifdef HAVE_AVX2
+  if (attrib & PLL_ATTRIB_ARCH_AVX2 && PLL_STAT(avx2_present))
+  {
+    pll_core_site_terms_float_avx2(states,
+                                   sites,
+                                   rate_cats,
+                                   parent_clv,
+                                   child_clv,
+                                   child_tipchars,
+                                   child_matrix,
+                                   frequencies,
+                                   terms);
+    return;
+  }
+#endif
+
+  site_terms_float_cpu(states,
+                       states,
+                       sites,
+                       rate_cats,
+                       parent_clv,
+                       child_clv,
+                       child_tipchars,
+                       child_matrix,
+                       frequencies,
+                       terms);
+}
+
+/* combine the per-rate site terms into the log-likelihood. Scaling is undone
+   in the same way as for double precision CLVs, but with the single
+   precision scaling threshold */
+static double combine_site_terms(unsigned int sites,
+                                 unsigned int rate_cats,
+                                 const double * terms,
+                                 const unsigned int * parent_scaler,
+                                 const unsigned int * child_scaler,
+                                 double * const * frequencies,
+                                 const double * rate_weights,
+                                 const unsigned int * pattern_weights,
+                                 const double * invar_proportion,
+                                 const int * invar_indices,
+                                 const unsigned int * freqs_indices,
+                                 double * persite_lnl,
+                                 const double * scale_minlh,
+                                 unsigned int * rate_scalings)
+{
+  unsigned int i,n;
+  double logl = 0;
+
+  for (n = 0; n < sites; ++n)
+  {
+    unsigned int site_scalings;
+    double terma = 0;
+    double terminv = 0;
+    double site_lk;
+
+    if (rate_scalings)
+    {
+      /* compute minimum per-rate scaler -> common per-site scaler */
+      site_scalings = UINT_MAX;
+      for (i = 0; i < rate_cats; ++i)
+      {
+        rate_scalings[i] = (parent_scaler) ? parent_scaler[n*rate_cats+i] : 0;
+        rate_scalings[i] += (child_scaler) ? child_scaler[n*rate_cats+i] : 0;
+        if (rate_scalings[i] < site_scalings)
+          site_scalings = rate_scalings[i];
+      }
+
+      /* compute relative capped per-rate scalers */
+      for (i = 0; i < rate_cats; ++i)
+        rate_scalings[i] = PLL_MIN(rate_scalings[i] - site_scalings,
+                                   PLL_SCALE_RATE_MAXDIFF);
+    }
+    else
+    {
+      site_scalings =  (parent_scaler) ? parent_scaler[n] : 0;
+      site_scalings += (child_scaler) ? child_scaler[n] : 0;
+    }
+
+    for (i = 0; i < rate_cats; ++i)
+    {
+      double terma_r = terms[n*rate_cats + i];
+
+      /* apply per-rate scalers, if necessary */
+      if (rate_scalings && rate_scalings[i] > 0)
+        terma_r *= scale_minlh[rate_scalings[i]-1];
+
+      /* account for invariant sites */
+      double prop_invar = invar_proportion ?
+                                invar_proportion[freqs_indices[i]] : 0;
+      if (prop_invar > 0)
+      {
+        terma += rate_weights[i] * terma_r * (1. - prop_invar);
+        if (invar_indices[n] != -1)
+        {
+          double inv_site_lk = frequencies[freqs_indices[i]][invar_indices[n]];
+          terminv += rate_weights[i] * inv_site_lk * prop_invar;
+        }
+      }
+      else
+        terma += terma_r * rate_weights[i];
+    }
+
+    /* compute site log-likelihood and scale if necessary */
+    if (site_scalings)
+    {
+      if (terminv > 0.)
+      {
+        /* undo the scaling for the non-variant likelihood term only */
+        unsigned int capped_scalings = PLL_MIN(site_scalings,
+                                               PLL_SCALE_RATE_MAXDIFF);
+        site_lk = log(terma * scale_minlh[capped_scalings-1] + terminv);
+      }
+      else
+      {
+        site_lk = log(terma);
+        site_lk += site_scalings * log(PLL_SCALE_THRESHOLD_FLOAT);
+      }
+    }
+    else
+      site_lk = log(terma + terminv);
+
+    site_lk *= pattern_weights[n];
+
+    /* store per-site log-likelihood */
+    if (persite_lnl)
+      persite_lnl[n] = site_lk;
+
+    logl += site_lk;
+  }
+
+  return logl;
+}
+
+static double loglikelihood_float(unsigned int states,
+                                  unsigned int sites,
+                                  unsigned int rate_cats,
+                                  const float * parent_clv,
+                                  const unsigned int * parent_scaler,
+                                  const float * child_clv,
+                                  const unsigned char * child_tipchars,
+                                  const unsigned int * child_scaler,
+                                  const float * child_matrix,
+                                  double * const * frequencies,
+                                  const double * rate_weights,
+                                  const unsigned int * pattern_weights,
+                                  const double * invar_proportion,
+                                  const int * invar_indices,
+                                  const unsigned int * freqs_indices,
+                                  double * persite_lnl,
+                                  unsigned int attrib)
+{
+  unsigned int i,n;
+  double logl = 0;
+  unsigned int states_padded = float_states_padded(states, attrib);
+  size_t span = (size_t)states_padded * rate_cats;
+  unsigned int * rate_scalings = NULL;
+
+  /* powers of scale threshold for undoing the scaling */
+  double scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+  double scale_factor = 1.0;
+  for (i = 0; i < PLL_SCALE_RATE_MAXDIFF; ++i)
+  {
+    scale_factor *= PLL_SCALE_THRESHOLD_FLOAT;
+    scale_minlh[i] = scale_factor;
+  }
+
+  float * ff = create_float_frequencies(states,
+                                        states_padded,
+                                        rate_cats,
+                                        frequencies,
+                                        freqs_indices);
+  double * terms = (double *)malloc((size_t)FLOAT_TERMS_CHUNK * rate_cats *
+                                    sizeof(double));
+  if (attrib & PLL_ATTRIB_RATE_SCALERS)
+    rate_scalings = (unsigned int *)calloc(rate_cats, sizeof(unsigned int));
+
+  if (!ff || !terms || ((attrib & PLL_ATTRIB_RATE_SCALERS) && !rate_scalings))
+  {
+    if (ff) pll_aligned_free(ff);
+    free(terms);
+    free(rate_scalings);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return -INFINITY;
+  }
+
+  for (n = 0; n < sites; n += FLOAT_TERMS_CHUNK)
+  {
+    unsigned int chunk = PLL_MIN(FLOAT_TERMS_CHUNK, sites - n);
+    size_t soff = (attrib & PLL_ATTRIB_RATE_SCALERS) ?
+                        (size_t)n * rate_cats : n;
+
+    site_terms_float(states,
+                     chunk,
+                     rate_cats,
+                     parent_clv + n*span,
+                     child_clv ? child_clv + n*span : NULL,
+                     child_tipchars ? child_tipchars + n : NULL,
+                     child_matrix,
+                     ff,
+                     terms,
+                     attrib);
+
+    logl += combine_site_terms(chunk,
+                               rate_cats,
+                               terms,
+                               parent_scaler ? parent_scaler + soff : NULL,
+                               child_scaler ? child_scaler + soff : NULL,
+                               frequencies,
+                               rate_weights,
+                               pattern_weights + n,
+                               invar_proportion,
+                               invar_indices ? invar_indices + n : NULL,
+                               freqs_indices,
+                               persite_lnl ? persite_lnl + n : NULL,
+                               scale_minlh,
+                               rate_scalings);
+  }
+
+  pll_aligned_free(ff);
+  free(terms);
+  free(rate_scalings);
+
+  return logl;
+}
+
+PLL_EXPORT void pll_core_update_partial_tt_float(unsigned int states,
+                                                 unsigned int sites,
+                                                 unsigned int rate_cats,
+                                                 float * parent_clv,
+                                                 unsigned int * parent_scaler,
+                                                 const unsigned char * left_tipchars,
+                                                 const unsigned char * right_tipchars,
+                                                 const double * left_matrix,
+                                                 const double * right_matrix,
+                                                 const pll_state_t * tipmap,
+                                                 unsigned int tipmap_size,
+                                                 unsigned int attrib)
+{
+  unsigned int i,n;
+  unsigned int states_padded = float_states_padded(states, attrib);
+  unsigned int span = states_padded * rate_cats;
+  unsigned int scale_mode = parent_scaler ?
+                  ((attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1) : 0;
+
+  float * ltab = create_tip_lookup(states, states_padded, rate_cats,
+                                   left_matrix, tipmap, tipmap_size);
+  float * rtab = create_tip_lookup(states, states_padded, rate_cats,
+                                   right_matrix, tipmap, tipmap_size);
+  if (!ltab || !rtab)
+  {
+    if (ltab) pll_aligned_free(ltab);
+    if (rtab) pll_aligned_free(rtab);
+    return;
+  }
+
+  if (parent_scaler)
+    fill_parent_scaler((scale_mode == 2) ? sites * rate_cats : sites,
+                       parent_scaler, NULL, NULL);
+
+  for (n = 0; n < sites; ++n)
+  {
+    const float * l = ltab + left_tipchars[n]*span;
+    const float * r = rtab + right_tipchars[n]*span;
+
+    for (i = 0; i < span; ++i)
+      parent_clv[i] = l[i] * r[i];
+
+    scale_site_float(states_padded, rate_cats, n,
+                     parent_clv, parent_scaler, scale_mode);
+
+    parent_clv += span;
+  }
+
+  pll_aligned_free(ltab);
+  pll_aligned_free(rtab);
+}
+
+PLL_EXPORT void pll_core_update_partial_ti_float(unsigned int states,
+                                                 unsigned int sites,
+                                                 unsigned int rate_cats,
+                                                 float * parent_clv,
+                                                 unsigned int * parent_scaler,
+                                                 const unsigned char * left_tipchars,
+                                                 const float * right_clv,
+                                                 const double * left_matrix,
+                                                 const double * right_matrix,
+                                                 const unsigned int * right_scaler,
+                                                 const pll_state_t * tipmap,
+                                                 unsigned int tipmap_size,
+                                                 unsigned int attrib)
+{
+  unsigned int states_padded = float_states_padded(states, attrib);
+
+  float * ltab = create_tip_lookup(states, states_padded, rate_cats,
+                                   left_matrix, tipmap, tipmap_size);
+  float * rmat = create_transposed_matrix(states, states_padded, rate_cats,
+                                          right_matrix);
+  if (!ltab || !rmat)
+  {
+    if (ltab) pll_aligned_free(ltab);
+    if (rmat) pll_aligned_free(rmat);
+    return;
+  }
+
+  if (parent_scaler)
+    fill_parent_scaler((attrib & PLL_ATTRIB_RATE_SCALERS) ?
+                                                sites * rate_cats : sites,
+                       parent_scaler, right_scaler, NULL);
+
+#ifdef HAVE_SSE3
+  if (attrib & PLL_ATTRIB_ARCH_SSE && PLL_STAT(sse3_present) &&
+      states_padded % 4 == 0)
+  {
+    pll_core_update_partial_ti_float_sse(states,
+                                         sites,
+                                         rate_cats,
+                                         parent_clv,
+                                         parent_scaler,
+                                         left_tipchars,
+                                         right_clv,
+                                         ltab,
+                                         rmat,
+                                         attrib);
+  }
+  else
+#endif
+#ifdef HAVE_AVX
+  if (attrib & PLL_ATTRIB_ARCH_AVX && PLL_STAT(avx_present))
+  {
+    pll_core_update_partial_ti_float_avx(states,
+                                         sites,
+                                         rate_cats,
+                                         parent_clv,
+                                         parent_scaler,
+                                         left_tipchars,
+                                         right_clv,
+                                         ltab,
+                                         rmat,
+                                         attrib);
+  }
+  else
+#endif
+#ifdef HAVE_AVX2
+  if (attrib & PLL_ATTRIB_ARCH_AVX2 && PLL_STAT(avx2_present))
+  {
+    pll_core_update_partial_ti_float_avx2(states,
+                                          sites,
+                                          rate_cats,
+                                          parent_clv,
+                                          parent_scaler,
+                                          left_tipchars,
+                                          right_clv,
+                                          ltab,
+                                          rmat,
+                                          attrib);
+  }
+  else
+#endif
+  {
+    update_partial_ti_float_cpu(states,
+                                states_padded,
+                                sites,
+                                rate_cats,
+                                parent_clv,
+                                parent_scaler,
+                                left_tipchars,
+                                right_clv,
+                                ltab,
+                                rmat,
+                                attrib);
+  }
+
+  pll_aligned_free(ltab);
+  pll_aligned_free(rmat);
+}
+
+PLL_EXPORT void pll_core_update_partial_ii_float(unsigned int states,
+                                                 unsigned int sites,
+                                                 unsigned int rate_cats,
+                                                 float * parent_clv,
+                                                 unsigned int * parent_scaler,
+                                                 const float * left_clv,
+                                                 const float * right_clv,
+                                                 const double * left_matrix,
+                                                 const double * right_matrix,
+                                                 const unsigned int * left_scaler,
+                                                 const unsigned int * right_scaler,
+                                                 unsigned int attrib)
+{
+  unsigned int states_padded = float_states_padded(states, attrib);
+
+  float * lmat = create_transposed_matrix(states, states_padded, rate_cats,
+                                          left_matrix);
+  float * rmat = create_transposed_matrix(states, states_padded, rate_cats,
+                                          right_matrix);
+  if (!lmat || !rmat)
+  {
+    if (lmat) pll_aligned_free(lmat);
+    if (rmat) pll_aligned_free(rmat);
+    return;
+  }
+
+  if (parent_scaler)
+    fill_parent_scaler((attrib & PLL_ATTRIB_RATE_SCALERS) ?
+                                                sites * rate_cats : sites,
+                       parent_scaler, left_scaler, right_scaler);
+
+#ifdef HAVE_SSE3
+  if (attrib & PLL_ATTRIB_ARCH_SSE && PLL_STAT(sse3_present) &&
+      states_padded % 4 == 0)
+  {
+    pll_core_update_partial_ii_float_sse(states,
+                                         sites,
+                                         rate_cats,
+                                         parent_clv,
+                                         parent_scaler,
+                                         left_clv,
+                                         right_clv,
+                                         lmat,
+                                         rmat,
+                                         attrib);
+  }
+  else
+#endif
+#ifdef HAVE_AVX
+  if (attrib & PLL_ATTRIB_ARCH_AVX && PLL_STAT(avx_present))
+  {
+    pll_core_update_partial_ii_float_avx(states,
+                                         sites,
+                                         rate_cats,
+                                         parent_clv,
+                                         parent_scaler,
+                                         left_clv,
+                                         right_clv,
+                                         lmat,
+                                         rmat,
+                                         attrib);
+  }
+  else
+#endif
+#ifdef HAVE_AVX2
+  if (attrib & PLL_ATTRIB_ARCH_AVX2 && PLL_STAT(avx2_present))
+  {
+    pll_core_update_partial_ii_float_avx2(states,
+                                          sites,
+                                          rate_cats,
+                                          parent_clv,
+                                          parent_scaler,
+                                          left_clv,
+                                          right_clv,
+                                          lmat,
+                                          rmat,
+                                          attrib);
+  }
+  else
+#endif
+  {
+    update_partial_ii_float_cpu(states,
+                                states_padded,
+                                sites,
+                                rate_cats,
+                                parent_clv,
+                                parent_scaler,
+                                left_clv,
+                                right_clv,
+                                lmat,
+                                rmat,
+                                attrib);
+  }
+
+  pll_aligned_free(lmat);
+  pll_aligned_free(rmat);
+}
+
+PLL_EXPORT double pll_core_root_loglikelihood_float(unsigned int states,
+                                                    unsigned int sites,
+                                                    unsigned int rate_cats,
+                                                    const float * clv,
+                                                    const unsigned int * scaler,
+                                                    double * const * frequencies,
+                                                    const double * rate_weights,
+                                                    const unsigned int * pattern_weights,
+                                                    const double * invar_proportion,
+                                                    const int * invar_indices,
+                                                    const unsigned int * freqs_indices,
+                                                    double * persite_lnl,
+                                                    unsigned int attrib)
+{
+  return loglikelihood_float(states,
+                             sites,
+                             rate_cats,
+                             clv,
+                             scaler,
+                             NULL,
+                             NULL,
+                             NULL,
+                             NULL,
+                             frequencies,
+                             rate_weights,
+                             pattern_weights,
+                             invar_proportion,
+                             invar_indices,
+                             freqs_indices,
+                             persite_lnl,
+                             attrib);
+}
+
+PLL_EXPORT double pll_core_edge_loglikelihood_ti_float(unsigned int states,
+                                                       unsigned int sites,
+                                                       unsigned int rate_cats,
+                                                       const float * parent_clv,
+                                                       const unsigned int * parent_scaler,
+                                                       const unsigned char * tipchars,
+                                                       const pll_state_t * tipmap,
+                                                       unsigned int tipmap_size,
+                                                       const double * pmatrix,
+                                                       double * const * frequencies,
+                                                       const double * rate_weights,
+                                                       const unsigned int * pattern_weights,
+                                                       const double * invar_proportion,
+                                                       const int * invar_indices,
+                                                       const unsigned int * freqs_indices,
+                                                       double * persite_lnl,
+                                                       unsigned int attrib)
+{
+  double logl;
+  unsigned int states_padded = float_states_padded(states, attrib);
+
+  float * tab = create_tip_lookup(states, states_padded, rate_cats,
+                                  pmatrix, tipmap, tipmap_size);
+  if (!tab)
+    return -INFINITY;
+
+  logl = loglikelihood_float(states,
+                             sites,
+                             rate_cats,
+                             parent_clv,
+                             parent_scaler,
+                             NULL,
+                             tipchars,
+                             NULL,
+                             tab,
+                             frequencies,
+                             rate_weights,
+                             pattern_weights,
+                             invar_proportion,
+                             invar_indices,
+                             freqs_indices,
+                             persite_lnl,
+                             attrib);
+
+  pll_aligned_free(tab);
+
+  return logl;
+}
+
+PLL_EXPORT double pll_core_edge_loglikelihood_ii_float(unsigned int states,
+                                                       unsigned int sites,
+                                                       unsigned int rate_cats,
+                                                       const float * parent_clv,
+                                                       const unsigned int * parent_scaler,
+                                                       const float * child_clv,
+                                                       const unsigned int * child_scaler,
+                                                       const double * pmatrix,
+                                                       double * const * frequencies,
+                                                       const double * rate_weights,
+                                                       const unsigned int * pattern_weights,
+                                                       const double * invar_proportion,
+                                                       const int * invar_indices,
+                                                       const unsigned int * freqs_indices,
+                                                       double * persite_lnl,
+                                                       unsigned int attrib)
+{
+  double logl;
+  unsigned int states_padded = float_states_padded(states, attrib);
+
+  float * mt = create_transposed_matrix(states, states_padded, rate_cats,
+                                        pmatrix);
+  if (!mt)
+    return -INFINITY;
+
+  logl = loglikelihood_float(states,
+                             sites,
+                             rate_cats,
+                             parent_clv,
+                             parent_scaler,
+                             child_clv,
+                             NULL,
+                             child_scaler,
+                             mt,
+                             frequencies,
+                             rate_weights,
+                             pattern_weights,
+                             invar_proportion,
+                             invar_indices,
+                             freqs_indices,
+                             persite_lnl,
+                             attrib);
+
+  pll_aligned_free(mt);
+
+  return logl;
+}
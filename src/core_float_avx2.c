@@ -0,0 +1,316 @@
+/*
+    Copyright (C) 2015 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "pll.h"
+
+/* Single-precision kernels, identical to the ones in core_float_avx.c except
+   for the use of fused multiply-add instructions */
+
+/* entries i..i+7 of P_k * clv, mat points to column i of the transposed
+   matrix */
+static inline __m256 matvec8(const float * mat,
+                             const float * clv,
+                             unsigned int states,
+                             unsigned int states_padded)
+{
+  unsigned int j;
+  __m256 acc = _mm256_setzero_ps();
+
+  for (j = 0; j < states; ++j)
+  {
+    __m256 ymm0 = _mm256_loadu_ps(mat + j*states_padded);
+    acc = _mm256_fmadd_ps(ymm0, _mm256_set1_ps(clv[j]), acc);
+  }
+
+  return acc;
+}
+
+static inline __m128 matvec4(const float * mat,
+                             const float * clv,
+                             unsigned int states,
+                             unsigned int states_padded)
+{
+  unsigned int j;
+  __m128 acc = _mm_setzero_ps();
+
+  for (j = 0; j < states; ++j)
+  {
+    __m128 xmm0 = _mm_load_ps(mat + j*states_padded);
+    acc = _mm_fmadd_ps(xmm0, _mm_set1_ps(clv[j]), acc);
+  }
+
+  return acc;
+}
+
+static void scale_float_avx2(float * clv, unsigned int size)
+{
+  unsigned int i;
+  __m128 factor = _mm_set1_ps((float)PLL_SCALE_FACTOR_FLOAT);
+
+  for (i = 0; i < size; i += 4)
+    _mm_store_ps(clv+i, _mm_mul_ps(_mm_load_ps(clv+i), factor));
+}
+
+/* apply per-rate scaling right away or record whether the rate category
+   qualifies for per-site scaling */
+static inline void scale_rate_float_avx2(float * clv,
+                                        unsigned int states_padded,
+                                        unsigned int rate_scale,
+                                        unsigned int scale_mode,
+                                        unsigned int * rate_scaler,
+                                        unsigned int * site_scale)
+{
+  if (scale_mode == 2)
+  {
+    if (rate_scale)
+    {
+      scale_float_avx2(clv, states_padded);
+      *rate_scaler += 1;
+    }
+  }
+  else
+    *site_scale = *site_scale && rate_scale;
+}
+
+PLL_EXPORT void pll_core_update_partial_ii_float_avx2(unsigned int states,
+                                                     unsigned int sites,
+                                                     unsigned int rate_cats,
+                                                     float * parent_clv,
+                                                     unsigned int * parent_scaler,
+                                                     const float * left_clv,
+                                                     const float * right_clv,
+                                                     const float * left_matrix,
+                                                     const float * right_matrix,
+                                                     unsigned int attrib)
+{
+  unsigned int i,k,n;
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int span = states_padded * rate_cats;
+  unsigned int displacement = states * states_padded;
+  unsigned int scale_mode = parent_scaler ?
+                  ((attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1) : 0;
+
+  __m256 ythr = _mm256_set1_ps((float)PLL_SCALE_THRESHOLD_FLOAT);
+  __m128 xthr = _mm_set1_ps((float)PLL_SCALE_THRESHOLD_FLOAT);
+
+  for (n = 0; n < sites; ++n)
+  {
+    unsigned int site_scale = (scale_mode == 1);
+
+    for (k = 0; k < rate_cats; ++k)
+    {
+      const float * lmat = left_matrix + k*displacement;
+      const float * rmat = right_matrix + k*displacement;
+      const float * lclv = left_clv + k*states_padded;
+      const float * rclv = right_clv + k*states_padded;
+      float * pclv = parent_clv + k*states_padded;
+      unsigned int rate_scale = 1;
+
+      for (i = 0; i + 8 <= states_padded; i += 8)
+      {
+        __m256 ymm0 = matvec8(lmat+i, lclv, states, states_padded);
+        __m256 ymm1 = matvec8(rmat+i, rclv, states, states_padded);
+        ymm0 = _mm256_mul_ps(ymm0,ymm1);
+        _mm256_storeu_ps(pclv+i, ymm0);
+
+        ymm1 = _mm256_cmp_ps(ymm0, ythr, _CMP_LT_OS);
+        rate_scale &= (_mm256_movemask_ps(ymm1) == 0xFF);
+      }
+      if (i < states_padded)
+      {
+        __m128 xmm0 = matvec4(lmat+i, lclv, states, states_padded);
+        __m128 xmm1 = matvec4(rmat+i, rclv, states, states_padded);
+        xmm0 = _mm_mul_ps(xmm0,xmm1);
+        _mm_store_ps(pclv+i, xmm0);
+
+        xmm1 = _mm_cmplt_ps(xmm0, xthr);
+        rate_scale &= (_mm_movemask_ps(xmm1) == 0xF);
+      }
+
+      if (scale_mode)
+        scale_rate_float_avx2(pclv,
+                             states_padded,
+                             rate_scale,
+                             scale_mode,
+                             parent_scaler + n*rate_cats + k,
+                             &site_scale);
+    }
+
+    if (site_scale)
+    {
+      scale_float_avx2(parent_clv, span);
+      parent_scaler[n] += 1;
+    }
+
+    parent_clv += span;
+    left_clv += span;
+    right_clv += span;
+  }
+}
+
+PLL_EXPORT void pll_core_update_partial_ti_float_avx2(unsigned int states,
+                                                     unsigned int sites,
+                                                     unsigned int rate_cats,
+                                                     float * parent_clv,
+                                                     unsigned int * parent_scaler,
+                                                     const unsigned char * left_tipchars,
+                                                     const float * right_clv,
+                                                     const float * left_lookup,
+                                                     const float * right_matrix,
+                                                     unsigned int attrib)
+{
+  unsigned int i,k,n;
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int span = states_padded * rate_cats;
+  unsigned int displacement = states * states_padded;
+  unsigned int scale_mode = parent_scaler ?
+                  ((attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1) : 0;
+
+  __m256 ythr = _mm256_set1_ps((float)PLL_SCALE_THRESHOLD_FLOAT);
+  __m128 xthr = _mm_set1_ps((float)PLL_SCALE_THRESHOLD_FLOAT);
+
+  for (n = 0; n < sites; ++n)
+  {
+    unsigned int site_scale = (scale_mode == 1);
+    const float * lookup = left_lookup + left_tipchars[n]*span;
+
+    for (k = 0; k < rate_cats; ++k)
+    {
+      const float * ltab = lookup + k*states_padded;
+      const float * rmat = right_matrix + k*displacement;
+      const float * rclv = right_clv + k*states_padded;
+      float * pclv = parent_clv + k*states_padded;
+      unsigned int rate_scale = 1;
+
+      for (i = 0; i + 8 <= states_padded; i += 8)
+      {
+        __m256 ymm0 = _mm256_loadu_ps(ltab+i);
+        __m256 ymm1 = matvec8(rmat+i, rclv, states, states_padded);
+        ymm0 = _mm256_mul_ps(ymm0,ymm1);
+        _mm256_storeu_ps(pclv+i, ymm0);
+
+        ymm1 = _mm256_cmp_ps(ymm0, ythr, _CMP_LT_OS);
+        rate_scale &= (_mm256_movemask_ps(ymm1) == 0xFF);
+      }
+      if (i < states_padded)
+      {
+        __m128 xmm0 = _mm_load_ps(ltab+i);
+        __m128 xmm1 = matvec4(rmat+i, rclv, states, states_padded);
+        xmm0 = _mm_mul_ps(xmm0,xmm1);
+        _mm_store_ps(pclv+i, xmm0);
+
+        xmm1 = _mm_cmplt_ps(xmm0, xthr);
+        rate_scale &= (_mm_movemask_ps(xmm1) == 0xF);
+      }
+
+      if (scale_mode)
+        scale_rate_float_avx2(pclv,
+                             states_padded,
+                             rate_scale,
+                             scale_mode,
+                             parent_scaler + n*rate_cats + k,
+                             &site_scale);
+    }
+
+    if (site_scale)
+    {
+      scale_float_avx2(parent_clv, span);
+      parent_scaler[n] += 1;
+    }
+
+    parent_clv += span;
+    right_clv += span;
+  }
+}
+
+/* the products are formed in single precision and accumulated in double
+   precision */
+PLL_EXPORT void pll_core_site_terms_float_avx2(unsigned int states,
+                                              unsigned int sites,
+                                              unsigned int rate_cats,
+                                              const float * parent_clv,
+                                              const float * child_clv,
+                                              const unsigned char * child_tipchars,
+                                              const float * child_matrix,
+                                              const float * frequencies,
+                                              double * terms)
+{
+  unsigned int i,k,n;
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int span = states_padded * rate_cats;
+  unsigned int displacement = states * states_padded;
+
+  for (n = 0; n < sites; ++n)
+  {
+    const float * lookup = child_tipchars ?
+                           child_matrix + child_tipchars[n]*span : NULL;
+
+    for (k = 0; k < rate_cats; ++k)
+    {
+      const float * pclv = parent_clv + k*states_padded;
+      const float * freqs = frequencies + k*states_padded;
+      const float * cmat = child_matrix + k*displacement;
+      const float * cclv = child_clv ? child_clv + k*states_padded : NULL;
+      const float * ctab = lookup ? lookup + k*states_padded : NULL;
+      __m256d acc = _mm256_setzero_pd();
+
+      for (i = 0; i + 8 <= states_padded; i += 8)
+      {
+        __m256 ymm0 = _mm256_loadu_ps(freqs+i);
+        if (cclv)
+          ymm0 = _mm256_mul_ps(ymm0, matvec8(cmat+i, cclv,
+                                             states, states_padded));
+        else if (ctab)
+          ymm0 = _mm256_mul_ps(ymm0, _mm256_loadu_ps(ctab+i));
+        __m256 ymm1 = _mm256_loadu_ps(pclv+i);
+
+        acc = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(ymm0)),
+                              _mm256_cvtps_pd(_mm256_castps256_ps128(ymm1)),
+                              acc);
+        acc = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(ymm0,1)),
+                              _mm256_cvtps_pd(_mm256_extractf128_ps(ymm1,1)),
+                              acc);
+      }
+      if (i < states_padded)
+      {
+        __m128 xmm0 = _mm_load_ps(freqs+i);
+        if (cclv)
+          xmm0 = _mm_mul_ps(xmm0, matvec4(cmat+i, cclv,
+                                          states, states_padded));
+        else if (ctab)
+          xmm0 = _mm_mul_ps(xmm0, _mm_load_ps(ctab+i));
+        __m128 xmm1 = _mm_load_ps(pclv+i);
+
+        acc = _mm256_fmadd_pd(_mm256_cvtps_pd(xmm0), _mm256_cvtps_pd(xmm1), acc);
+      }
+
+      /* add up the elements of acc */
+      __m128d xmm2 = _mm_add_pd(_mm256_castpd256_pd128(acc),
+                                _mm256_extractf128_pd(acc,1));
+      xmm2 = _mm_hadd_pd(xmm2,xmm2);
+      terms[n*rate_cats + k] = _mm_cvtsd_f64(xmm2);
+    }
+
+    parent_clv += span;
+    if (child_clv)
+      child_clv += span;
+  }
+}
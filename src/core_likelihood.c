@@ -21,6 +21,99 @@
 
 #include <limits.h>
 #include "pll.h"
+#include "pll_private.h"
+
+void pll_core_logl_init(pll_logl_block_t * block,
+                        const unsigned int * pattern_weights,
+                        double * persite_lnl)
+{
+  block->count = 0;
+  block->site = 0;
+  block->pattern_weights = pattern_weights;
+  block->persite_lnl = persite_lnl;
+  block->sum = 0;
+  block->comp = 0;
+}
+
+/* Adds the buffered site log-likelihoods (the logarithms are already stored
+   in block->lk) to the total, undoing the scaling and applying the pattern
+   weights. The sites of a block are summed up in four interleaved partial
+   sums (the order only depends on the position of a site) and the block
+   sums are accumulated with compensation (Neumaier), such that the total
+   does not depend on the vector width of the kernels */
+double pll_core_logl_accumulate(pll_logl_block_t * block)
+{
+  unsigned int k;
+  unsigned int count = block->count;
+  const double * lk = block->lk;
+  const unsigned int * scalings = block->scalings;
+  const unsigned int * weights = block->pattern_weights + block->site;
+  double * persite_lnl = block->persite_lnl ?
+                         block->persite_lnl + block->site : NULL;
+  const double log_scale = log(PLL_SCALE_THRESHOLD);
+  double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  double v0, v1, v2, v3;
+  double block_lk, t;
+
+  for (k = 0; k + 4 <= count; k += 4)
+  {
+    v0 = (lk[k]   + scalings[k]   * log_scale) * weights[k];
+    v1 = (lk[k+1] + scalings[k+1] * log_scale) * weights[k+1];
+    v2 = (lk[k+2] + scalings[k+2] * log_scale) * weights[k+2];
+    v3 = (lk[k+3] + scalings[k+3] * log_scale) * weights[k+3];
+
+    if (persite_lnl)
+    {
+      persite_lnl[k]   = v0;
+      persite_lnl[k+1] = v1;
+      persite_lnl[k+2] = v2;
+      persite_lnl[k+3] = v3;
+    }
+
+    s0 += v0;
+    s1 += v1;
+    s2 += v2;
+    s3 += v3;
+  }
+  for (; k < count; ++k)
+  {
+    v0 = (lk[k] + scalings[k] * log_scale) * weights[k];
+    if (persite_lnl)
+      persite_lnl[k] = v0;
+
+    switch (k & 3)
+    {
+      case 0: s0 += v0; break;
+      case 1: s1 += v0; break;
+      default: s2 += v0; break;
+    }
+  }
+
+  block_lk = (s0 + s1) + (s2 + s3);
+  t = block->sum + block_lk;
+  if (fabs(block->sum) >= fabs(block_lk))
+    block->comp += (block->sum - t) + block_lk;
+  else
+    block->comp += (block_lk - t) + block->sum;
+  block->sum = t;
+
+  block->site += count;
+  block->count = 0;
+
+  return block->sum + block->comp;
+}
+
+/* takes the logarithms of the buffered site likelihoods and accumulates them;
+   returns the log-likelihood of all sites flushed so far */
+double pll_core_logl_flush(pll_logl_block_t * block)
+{
+  unsigned int k;
+
+  for (k = 0; k < block->count; ++k)
+    block->lk[k] = log(block->lk[k]);
+
+  return pll_core_logl_accumulate(block);
+}
 
 PLL_EXPORT double pll_core_root_loglikelihood(unsigned int states,
                                               unsigned int sites,
@@ -37,7 +130,7 @@ PLL_EXPORT double pll_core_root_loglikelihood(unsigned int states,
                                               unsigned int attrib)
 {
   unsigned int i,j,k;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   const double * freqs = NULL;
 
   double prop_invar = 0;
@@ -158,7 +251,46 @@ PLL_EXPORT double pll_core_root_loglikelihood(unsigned int states,
     states_padded = (states+3) & 0xFFFFFFFC;
   }
   #endif
+  #ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    if (states == 4)
+    {
+      return pll_core_root_loglikelihood_4x4_avx(sites,
+                                                 rate_cats,
+                                                 clv,
+                                                 scaler,
+                                                 frequencies,
+                                                 rate_weights,
+                                                 pattern_weights,
+                                                 invar_proportion,
+                                                 invar_indices,
+                                                 freqs_indices,
+                                                 persite_lnl);
+    }
+    else
+    {
+      return pll_core_root_loglikelihood_avx512(states,
+                                                sites,
+                                                rate_cats,
+                                                clv,
+                                                scaler,
+                                                frequencies,
+                                                rate_weights,
+                                                pattern_weights,
+                                                invar_proportion,
+                                                invar_indices,
+                                                freqs_indices,
+                                                persite_lnl);
+    }
+    /* this line is never called, but should we disable the else case above,
+       then states_padded must be set to this value */
+    states_padded = (states+3) & 0xFFFFFFFC;
+  }
+  #endif
+
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
 
   /* iterate through sites */
   for (i = 0; i < sites; ++i)
@@ -192,20 +324,10 @@ PLL_EXPORT double pll_core_root_loglikelihood(unsigned int states,
 
     site_lk = term;
 
-    /* compute site log-likelihood and scale if necessary */
-    site_lk = log(site_lk);
-    if (scaler && scaler[i])
-      site_lk += scaler[i] * log(PLL_SCALE_THRESHOLD);
-
-    site_lk *= pattern_weights[i];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[i] = site_lk;
-
-    logl += site_lk;
+    pll_core_logl_push(&logl_block, site_lk, scaler ? scaler[i] : 0,
+                       pll_core_logl_flush);
   }
-  return logl;
+  return pll_core_logl_flush(&logl_block);
 }
 
 PLL_EXPORT double pll_core_root_loglikelihood_repeats_generic(unsigned int states,
@@ -223,7 +345,7 @@ PLL_EXPORT double pll_core_root_loglikelihood_repeats_generic(unsigned int state
                                                               double * persite_lnl)
 {
   unsigned int i,j,k;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   const double * freqs = NULL;
 
   double prop_invar = 0;
@@ -234,6 +356,8 @@ PLL_EXPORT double pll_core_root_loglikelihood_repeats_generic(unsigned int state
   unsigned int states_padded = states;
   unsigned int span = states_padded * rate_cats;
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   /* iterate through sites */
   for (i = 0; i < sites; ++i)
   {
@@ -268,20 +392,10 @@ PLL_EXPORT double pll_core_root_loglikelihood_repeats_generic(unsigned int state
 
     site_lk = term;
 
-    /* compute site log-likelihood and scale if necessary */
-    site_lk = log(site_lk);
-    if (scaler && scaler[id])
-      site_lk += scaler[id] * log(PLL_SCALE_THRESHOLD);
-
-    site_lk *= pattern_weights[i];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[i] = site_lk;
-
-    logl += site_lk;
+    pll_core_logl_push(&logl_block, site_lk, scaler ? scaler[id] : 0,
+                       pll_core_logl_flush);
   }
-  return logl;
+  return pll_core_logl_flush(&logl_block);
 }
 
 PLL_EXPORT double pll_core_root_loglikelihood_repeats(unsigned int states,
@@ -332,6 +446,12 @@ PLL_EXPORT double pll_core_root_loglikelihood_repeats(unsigned int states,
     core_root_loglikelihood = pll_core_root_loglikelihood_repeats_avx2;
     // TODO call 4x4 avx (not avx2) functions when implemented
   }
+#endif
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    core_root_loglikelihood = pll_core_root_loglikelihood_repeats_avx2;
+  }
 #endif
     return core_root_loglikelihood(states,
                                   sites,
@@ -365,7 +485,7 @@ double pll_core_edge_loglikelihood_ti_4x4(unsigned int sites,
                                           unsigned int attrib)
 {
   unsigned int n,i,j,k;
-  double logl = 0;
+  pll_logl_block_t logl_block;
 
   const double * clvp = parent_clv;
   double prop_invar = 0;
@@ -373,7 +493,7 @@ double pll_core_edge_loglikelihood_ti_4x4(unsigned int sites,
   const double * freqs = NULL;
 
   double terma, terma_r, termb, terminv;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int cstate;
 
@@ -437,6 +557,25 @@ double pll_core_edge_loglikelihood_ti_4x4(unsigned int sites,
                                                   attrib);
   }
   #endif
+  #ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    return pll_core_edge_loglikelihood_ti_4x4_avx512(sites,
+                                                     rate_cats,
+                                                     parent_clv,
+                                                     parent_scaler,
+                                                     tipchars,
+                                                     pmatrix,
+                                                     frequencies,
+                                                     rate_weights,
+                                                     pattern_weights,
+                                                     invar_proportion,
+                                                     invar_indices,
+                                                     freqs_indices,
+                                                     persite_lnl,
+                                                     attrib);
+  }
+  #endif
 
   unsigned int site_scalings;
   unsigned int * rate_scalings = NULL;
@@ -465,6 +604,8 @@ double pll_core_edge_loglikelihood_ti_4x4(unsigned int sites,
     }
   }
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (n = 0; n < sites; ++n)
   {
     pmat = pmatrix;
@@ -539,34 +680,17 @@ double pll_core_edge_loglikelihood_ti_4x4(unsigned int sites,
       clvp += states_padded;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    if (site_scalings)
+    if (site_scalings && terminv > 0.)
     {
-      if (terminv > 0.)
-      {
-        /* IMPORTANT: undoing the scaling for non-invariant likelihood term only! */
-        unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
-        double scale_factor = scale_minlh[capped_scalings-1];
-        site_lk = log(terma * scale_factor + terminv);
-      }
-      else
-      {
-        site_lk = log(terma);
-        site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-      }
+      /* IMPORTANT: undoing the scaling for non-invariant likelihood term only! */
+      unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
+      double scale_factor = scale_minlh[capped_scalings-1];
+      pll_core_logl_push(&logl_block, terma * scale_factor + terminv, 0,
+                         pll_core_logl_flush);
     }
     else
-    {
-      site_lk = log(terma + terminv);
-    }
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+      pll_core_logl_push(&logl_block, terma + terminv, site_scalings,
+                         pll_core_logl_flush);
 
     tipchars++;
   }
@@ -574,7 +698,7 @@ double pll_core_edge_loglikelihood_ti_4x4(unsigned int sites,
   if (rate_scalings)
     free(rate_scalings);
 
-  return logl;
+  return pll_core_logl_flush(&logl_block);
 }
 
 PLL_EXPORT
@@ -597,7 +721,7 @@ double pll_core_edge_loglikelihood_ti(unsigned int states,
                                       unsigned int attrib)
 {
   unsigned int n,i,j,k;
-  double logl = 0;
+  pll_logl_block_t logl_block;
 
   const double * clvp = parent_clv;
   double prop_invar = 0;
@@ -605,7 +729,7 @@ double pll_core_edge_loglikelihood_ti(unsigned int states,
   const double * freqs = NULL;
 
   double terma, terma_r, termb, terminv;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   pll_state_t cstate;
 
@@ -757,6 +881,25 @@ double pll_core_edge_loglikelihood_ti(unsigned int states,
                                                       persite_lnl,
                                                       attrib);
     }
+    else if (states == 61)
+    {
+      return pll_core_edge_loglikelihood_ti_61x61_avx2(sites,
+                                                       rate_cats,
+                                                       parent_clv,
+                                                       parent_scaler,
+                                                       tipchars,
+                                                       tipmap,
+                                                       tipmap_size,
+                                                       pmatrix,
+                                                       frequencies,
+                                                       rate_weights,
+                                                       pattern_weights,
+                                                       invar_proportion,
+                                                       invar_indices,
+                                                       freqs_indices,
+                                                       persite_lnl,
+                                                       attrib);
+    }
     else
     {
       return pll_core_edge_loglikelihood_ti_avx(states,
@@ -781,6 +924,28 @@ double pll_core_edge_loglikelihood_ti(unsigned int states,
     states_padded = (states+3) & 0xFFFFFFFC;
   }
   #endif
+  #ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    return pll_core_edge_loglikelihood_ti_avx512(states,
+                                                 sites,
+                                                 rate_cats,
+                                                 parent_clv,
+                                                 parent_scaler,
+                                                 tipchars,
+                                                 tipmap,
+                                                 tipmap_size,
+                                                 pmatrix,
+                                                 frequencies,
+                                                 rate_weights,
+                                                 pattern_weights,
+                                                 invar_proportion,
+                                                 invar_indices,
+                                                 freqs_indices,
+                                                 persite_lnl,
+                                                 attrib);
+  }
+  #endif
 
   unsigned int site_scalings;
   unsigned int * rate_scalings = NULL;
@@ -809,6 +974,8 @@ double pll_core_edge_loglikelihood_ti(unsigned int states,
     }
   }
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (n = 0; n < sites; ++n)
   {
     if (per_rate_scaling)
@@ -882,34 +1049,17 @@ double pll_core_edge_loglikelihood_ti(unsigned int states,
       clvp += states_padded;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    if (site_scalings)
+    if (site_scalings && terminv > 0.)
     {
-      if (terminv > 0.)
-      {
-        /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
-        unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
-        double scale_factor = scale_minlh[capped_scalings-1];
-        site_lk = log(terma * scale_factor + terminv);
-      }
-      else
-      {
-        site_lk = log(terma);
-        site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-      }
+      /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
+      unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
+      double scale_factor = scale_minlh[capped_scalings-1];
+      pll_core_logl_push(&logl_block, terma * scale_factor + terminv, 0,
+                         pll_core_logl_flush);
     }
     else
-    {
-      site_lk = log(terma + terminv);
-    }
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+      pll_core_logl_push(&logl_block, terma + terminv, site_scalings,
+                         pll_core_logl_flush);
 
     tipchars++;
   }
@@ -917,7 +1067,7 @@ double pll_core_edge_loglikelihood_ti(unsigned int states,
   if (rate_scalings)
     free(rate_scalings);
 
-  return logl;
+  return pll_core_logl_flush(&logl_block);
 }
 
 PLL_EXPORT
@@ -989,6 +1139,26 @@ double pll_core_edge_loglikelihood_repeats(unsigned int states,
   if (attrib & PLL_ATTRIB_ARCH_AVX2 &&  PLL_STAT(avx2_present))
   {
     core_edge_loglikelihood = pll_core_edge_loglikelihood_repeats_generic_avx2;
+    if (states == 4)
+    {
+      if (use_bclv)
+        core_edge_loglikelihood = pll_core_edge_loglikelihood_repeatsbclv_4x4_avx2;
+      else
+        core_edge_loglikelihood = pll_core_edge_loglikelihood_repeats_4x4_avx2;
+    }
+  }
+#endif
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 &&  PLL_STAT(avx512f_present))
+  {
+    core_edge_loglikelihood = pll_core_edge_loglikelihood_repeats_generic_avx2;
+    if (states == 4)
+    {
+      if (use_bclv)
+        core_edge_loglikelihood = pll_core_edge_loglikelihood_repeatsbclv_4x4_avx2;
+      else
+        core_edge_loglikelihood = pll_core_edge_loglikelihood_repeats_4x4_avx2;
+    }
   }
 #endif
   return core_edge_loglikelihood(states,
@@ -1037,14 +1207,14 @@ double pll_core_edge_loglikelihood_repeats_generic(unsigned int states,
                                                    unsigned int attrib)
 {
   unsigned int n,i,j,k;
-  double logl = 0;
+  pll_logl_block_t logl_block;
 
   double prop_invar = 0;
   const double * pmat;
   const double * freqs = NULL;
 
   double terma, terma_r, termb,terminv;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int span = states * rate_cats;
   unsigned int site_scalings;
@@ -1074,6 +1244,8 @@ double pll_core_edge_loglikelihood_repeats_generic(unsigned int states,
     }
   }
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (n = 0; n < sites; ++n)
   {
     unsigned int pid = PLL_GET_ID(parent_site_id, n);
@@ -1152,40 +1324,23 @@ double pll_core_edge_loglikelihood_repeats_generic(unsigned int states,
       clvc += states;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    if (site_scalings)
+    if (site_scalings && terminv > 0.)
     {
-      if (terminv > 0.)
-      {
-        /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
-        unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
-        double scale_factor = scale_minlh[capped_scalings-1];
-        site_lk = log(terma * scale_factor + terminv);
-      }
-      else
-      {
-        site_lk = log(terma);
-        site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-      }
+      /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
+      unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
+      double scale_factor = scale_minlh[capped_scalings-1];
+      pll_core_logl_push(&logl_block, terma * scale_factor + terminv, 0,
+                         pll_core_logl_flush);
     }
     else
-    {
-      site_lk = log(terma + terminv);
-    }
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+      pll_core_logl_push(&logl_block, terma + terminv, site_scalings,
+                         pll_core_logl_flush);
   }
 
   if (rate_scalings)
     free(rate_scalings);
 
-  return logl;
+  return pll_core_logl_flush(&logl_block);
 }
 
 PLL_EXPORT
@@ -1207,7 +1362,7 @@ double pll_core_edge_loglikelihood_ii(unsigned int states,
                                       unsigned int attrib)
 {
   unsigned int n,i,j,k;
-  double logl = 0;
+  pll_logl_block_t logl_block;
 
   const double * clvp = parent_clv;
   const double * clvc = child_clv;
@@ -1216,7 +1371,7 @@ double pll_core_edge_loglikelihood_ii(unsigned int states,
   const double * freqs = NULL;
 
   double terma, terma_r, termb,terminv;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   /* TODO: We need states_padded in the AVX/SSE implementations
   */
@@ -1333,6 +1488,24 @@ double pll_core_edge_loglikelihood_ii(unsigned int states,
                                                     persite_lnl,
                                                     attrib);
     }
+    else if (states == 61)
+    {
+      return pll_core_edge_loglikelihood_ii_61x61_avx2(sites,
+                                                       rate_cats,
+                                                       clvp,
+                                                       parent_scaler,
+                                                       clvc,
+                                                       child_scaler,
+                                                       pmatrix,
+                                                       frequencies,
+                                                       rate_weights,
+                                                       pattern_weights,
+                                                       invar_proportion,
+                                                       invar_indices,
+                                                       freqs_indices,
+                                                       persite_lnl,
+                                                       attrib);
+    }
     else
     {
       return pll_core_edge_loglikelihood_ii_avx2(states,
@@ -1357,6 +1530,51 @@ double pll_core_edge_loglikelihood_ii(unsigned int states,
     states_padded = (states+3) & 0xFFFFFFFC;
   }
   #endif
+  #ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    if (states == 4)
+    {
+      return pll_core_edge_loglikelihood_ii_4x4_avx512(sites,
+                                                       rate_cats,
+                                                       clvp,
+                                                       parent_scaler,
+                                                       clvc,
+                                                       child_scaler,
+                                                       pmatrix,
+                                                       frequencies,
+                                                       rate_weights,
+                                                       pattern_weights,
+                                                       invar_proportion,
+                                                       invar_indices,
+                                                       freqs_indices,
+                                                       persite_lnl,
+                                                       attrib);
+    }
+    else
+    {
+      return pll_core_edge_loglikelihood_ii_avx512(states,
+                                                   sites,
+                                                   rate_cats,
+                                                   clvp,
+                                                   parent_scaler,
+                                                   clvc,
+                                                   child_scaler,
+                                                   pmatrix,
+                                                   frequencies,
+                                                   rate_weights,
+                                                   pattern_weights,
+                                                   invar_proportion,
+                                                   invar_indices,
+                                                   freqs_indices,
+                                                   persite_lnl,
+                                                   attrib);
+    }
+    /* this line is never called, but should we disable the else case above,
+       then states_padded must be set to this value */
+    states_padded = (states+3) & 0xFFFFFFFC;
+  }
+  #endif
 
   unsigned int site_scalings;
   unsigned int * rate_scalings = NULL;
@@ -1385,6 +1603,8 @@ double pll_core_edge_loglikelihood_ii(unsigned int states,
     }
   }
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (n = 0; n < sites; ++n)
   {
     if (per_rate_scaling)
@@ -1459,39 +1679,54 @@ double pll_core_edge_loglikelihood_ii(unsigned int states,
       clvc += states_padded;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    if (site_scalings)
+    if (site_scalings && terminv > 0.)
     {
-      if (terminv > 0.)
-      {
-        /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
-        unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
-        double scale_factor = scale_minlh[capped_scalings-1];
-        site_lk = log(terma * scale_factor + terminv);
-      }
-      else
-      {
-        site_lk = log(terma);
-        site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-      }
+      /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
+      unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
+      double scale_factor = scale_minlh[capped_scalings-1];
+      pll_core_logl_push(&logl_block, terma * scale_factor + terminv, 0,
+                         pll_core_logl_flush);
     }
     else
-    {
-      site_lk = log(terma + terminv);
-    }
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+      pll_core_logl_push(&logl_block, terma + terminv, site_scalings,
+                         pll_core_logl_flush);
   }
 
   if (rate_scalings)
     free(rate_scalings);
 
-  return logl;
+  return pll_core_logl_flush(&logl_block);
 }
 
+
+/* sums[r] = sum of weights[r*sites + n] * values[n] over the sites n, for the
+   count rows of the row-major weight matrix */
+PLL_EXPORT void pll_core_weighted_sums(unsigned int sites,
+                                       unsigned int count,
+                                       const unsigned int * weights,
+                                       const double * values,
+                                       double * sums,
+                                       unsigned int attrib)
+{
+  unsigned int n, r;
+
+#ifdef HAVE_AVX
+  if (attrib & (PLL_ATTRIB_ARCH_AVX | PLL_ATTRIB_ARCH_AVX2 |
+                PLL_ATTRIB_ARCH_AVX512) && PLL_STAT(avx_present))
+  {
+    pll_core_weighted_sums_avx(sites, count, weights, values, sums);
+    return;
+  }
+#endif
+
+  for (r = 0; r < count; ++r)
+  {
+    const unsigned int * w = weights + (size_t)r * sites;
+    double sum = 0;
+
+    for (n = 0; n < sites; ++n)
+      sum += w[n] * values[n];
+
+    sums[r] = sum;
+  }
+}
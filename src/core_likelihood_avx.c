@@ -20,7 +20,9 @@
 */
 
 #include <limits.h>
+#include <float.h>
 #include "pll.h"
+#include "pll_private.h"
 
 PLL_EXPORT double pll_core_root_loglikelihood_avx(unsigned int states,
                                                   unsigned int sites,
@@ -36,7 +38,7 @@ PLL_EXPORT double pll_core_root_loglikelihood_avx(unsigned int states,
                                                   double * persite_lnl)
 {
   unsigned int i,j,k;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   double prop_invar = 0;
 
   const double * freqs = NULL;
@@ -48,6 +50,8 @@ PLL_EXPORT double pll_core_root_loglikelihood_avx(unsigned int states,
 
   __m256d xmm0, xmm1, xmm2, xmm3;
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (i = 0; i < sites; ++i)
   {
     term = 0;
@@ -94,20 +98,10 @@ PLL_EXPORT double pll_core_root_loglikelihood_avx(unsigned int states,
       }
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    term = log(term);
-    if (scaler && scaler[i])
-      term += scaler[i] * log(PLL_SCALE_THRESHOLD);
-
-    term *= pattern_weights[i];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[i] = term;
-
-    logl += term;
+    pll_core_logl_push(&logl_block, term, scaler ? scaler[i] : 0,
+                       pll_core_logl_flush_avx);
   }
-  return logl;
+  return pll_core_logl_flush_avx(&logl_block);
 }
 
 PLL_EXPORT double pll_core_root_loglikelihood_repeats_avx(unsigned int states,
@@ -125,7 +119,7 @@ PLL_EXPORT double pll_core_root_loglikelihood_repeats_avx(unsigned int states,
                                                           double * persite_lnl)
 {
   unsigned int i,j,k;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   double prop_invar = 0;
 
   const double * freqs = NULL;
@@ -138,6 +132,8 @@ PLL_EXPORT double pll_core_root_loglikelihood_repeats_avx(unsigned int states,
 
   __m256d xmm0, xmm1, xmm2, xmm3;
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (i = 0; i < sites; ++i)
   {
     unsigned int id = PLL_GET_ID(site_id, i);
@@ -186,20 +182,10 @@ PLL_EXPORT double pll_core_root_loglikelihood_repeats_avx(unsigned int states,
       }
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    term = log(term);
-    if (scaler && scaler[id])
-      term += scaler[id] * log(PLL_SCALE_THRESHOLD);
-
-    term *= pattern_weights[i];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[i] = term;
-
-    logl += term;
+    pll_core_logl_push(&logl_block, term, scaler ? scaler[id] : 0,
+                       pll_core_logl_flush_avx);
   }
-  return logl;
+  return pll_core_logl_flush_avx(&logl_block);
 }
 
 PLL_EXPORT
@@ -216,7 +202,7 @@ double pll_core_root_loglikelihood_4x4_avx(unsigned int sites,
                                            double * persite_lnl)
 {
   unsigned int i,j;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   double prop_invar = 0;
 
   const double * freqs = NULL;
@@ -226,6 +212,8 @@ double pll_core_root_loglikelihood_4x4_avx(unsigned int sites,
 
   __m256d xmm0, xmm1, xmm2;
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (i = 0; i < sites; ++i)
   {
     term = 0;
@@ -264,20 +252,10 @@ double pll_core_root_loglikelihood_4x4_avx(unsigned int sites,
       clv += 4;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    term = log(term);
-    if (scaler && scaler[i])
-      term += scaler[i] * log(PLL_SCALE_THRESHOLD);
-
-    term *= pattern_weights[i];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[i] = term;
-
-    logl += term;
+    pll_core_logl_push(&logl_block, term, scaler ? scaler[i] : 0,
+                       pll_core_logl_flush_avx);
   }
-  return logl;
+  return pll_core_logl_flush_avx(&logl_block);
 }
 
 
@@ -299,7 +277,7 @@ double pll_core_edge_loglikelihood_ti_4x4_avx(unsigned int sites,
                                               unsigned int attrib)
 {
   unsigned int n,i;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   double prop_invar = 0;
 
   const double * clvp = parent_clv;
@@ -307,7 +285,7 @@ double pll_core_edge_loglikelihood_ti_4x4_avx(unsigned int sites,
   const double * freqs = NULL;
 
   double terma, terma_r, terminv;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int cstate;
   unsigned int states_padded = 4;
@@ -414,6 +392,8 @@ double pll_core_edge_loglikelihood_ti_4x4_avx(unsigned int sites,
     }
   }
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (n = 0; n < sites; ++n)
   {
     pmat = pmatrix;
@@ -489,41 +469,24 @@ double pll_core_edge_loglikelihood_ti_4x4_avx(unsigned int sites,
       coffset += 4;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    if (site_scalings)
+    if (site_scalings && terminv > 0.)
     {
-      if (terminv > 0.)
-      {
-        /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
-        unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
-        double scale_factor = scale_minlh[capped_scalings-1];
-        site_lk = log(terma * scale_factor + terminv);
-      }
-      else
-      {
-        site_lk = log(terma);
-        site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-      }
+      /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
+      unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
+      double scale_factor = scale_minlh[capped_scalings-1];
+      pll_core_logl_push(&logl_block, terma * scale_factor + terminv, 0,
+                         pll_core_logl_flush_avx);
     }
     else
-    {
-      site_lk = log(terma + terminv);
-    }
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+      pll_core_logl_push(&logl_block, terma + terminv, site_scalings,
+                         pll_core_logl_flush_avx);
   }
 
   pll_aligned_free(lookup);
   if (rate_scalings)
     free(rate_scalings);
 
-  return logl;
+  return pll_core_logl_flush_avx(&logl_block);
 }
 
 PLL_EXPORT
@@ -545,7 +508,7 @@ double pll_core_edge_loglikelihood_ti_20x20_avx(unsigned int sites,
                                                 unsigned int attrib)
 {
   unsigned int n,i,j,m;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   double prop_invar = 0;
 
   const double * clvp = parent_clv;
@@ -553,7 +516,7 @@ double pll_core_edge_loglikelihood_ti_20x20_avx(unsigned int sites,
   const double * freqs = NULL;
 
   double terma, terma_r,terminv;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int cstate;
   unsigned int states = 20;
@@ -654,6 +617,8 @@ double pll_core_edge_loglikelihood_ti_20x20_avx(unsigned int sites,
     }
   }
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (n = 0; n < sites; ++n)
   {
     terma = 0;
@@ -734,41 +699,24 @@ double pll_core_edge_loglikelihood_ti_20x20_avx(unsigned int sites,
       }
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    if (site_scalings)
+    if (site_scalings && terminv > 0.)
     {
-      if (terminv > 0.)
-      {
-        /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
-        unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
-        double scale_factor = scale_minlh[capped_scalings-1];
-        site_lk = log(terma * scale_factor + terminv);
-      }
-      else
-      {
-        site_lk = log(terma);
-        site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-      }
+      /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
+      unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
+      double scale_factor = scale_minlh[capped_scalings-1];
+      pll_core_logl_push(&logl_block, terma * scale_factor + terminv, 0,
+                         pll_core_logl_flush_avx);
     }
     else
-    {
-      site_lk = log(terma + terminv);
-    }
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+      pll_core_logl_push(&logl_block, terma + terminv, site_scalings,
+                         pll_core_logl_flush_avx);
   }
 
   pll_aligned_free(lookup);
   if (rate_scalings)
     free(rate_scalings);
 
-  return logl;
+  return pll_core_logl_flush_avx(&logl_block);
 }
 
 PLL_EXPORT
@@ -790,7 +738,7 @@ double pll_core_edge_loglikelihood_ti_avx(unsigned int states,
                                           unsigned int attrib)
 {
   unsigned int n,i,j,k;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   double prop_invar = 0;
 
   const double * clvp = parent_clv;
@@ -798,7 +746,7 @@ double pll_core_edge_loglikelihood_ti_avx(unsigned int states,
   const double * freqs = NULL;
 
   double terma, terma_r, terminv;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   pll_state_t cstate;
   unsigned int states_padded = (states+3) & 0xFFFFFFFC;
@@ -836,6 +784,8 @@ double pll_core_edge_loglikelihood_ti_avx(unsigned int states,
     }
   }
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (n = 0; n < sites; ++n)
   {
     pmat = pmatrix;
@@ -983,40 +933,23 @@ double pll_core_edge_loglikelihood_ti_avx(unsigned int states,
       pmat -= displacement;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    if (site_scalings)
+    if (site_scalings && terminv > 0.)
     {
-      if (terminv > 0.)
-      {
-        /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
-        unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
-        double scale_factor = scale_minlh[capped_scalings-1];
-        site_lk = log(terma * scale_factor + terminv);
-      }
-      else
-      {
-        site_lk = log(terma);
-        site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-      }
+      /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
+      unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
+      double scale_factor = scale_minlh[capped_scalings-1];
+      pll_core_logl_push(&logl_block, terma * scale_factor + terminv, 0,
+                         pll_core_logl_flush_avx);
     }
     else
-    {
-      site_lk = log(terma + terminv);
-    }
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+      pll_core_logl_push(&logl_block, terma + terminv, site_scalings,
+                         pll_core_logl_flush_avx);
   }
 
   if (rate_scalings)
     free(rate_scalings);
 
-  return logl;
+  return pll_core_logl_flush_avx(&logl_block);
 }
 
 PLL_EXPORT
@@ -1042,14 +975,14 @@ double pll_core_edge_loglikelihood_repeats_generic_avx(unsigned int states,
                                                        unsigned int attrib)
 {
   unsigned int n,i,j,k;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   double prop_invar = 0;
 
   const double * pmat;
   const double * freqs = NULL;
 
   double terma, terma_r, terminv;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int states_padded = (states+3) & 0xFFFFFFFC;
 
@@ -1086,6 +1019,8 @@ double pll_core_edge_loglikelihood_repeats_generic_avx(unsigned int states,
     }
   }
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (n = 0; n < sites; ++n)
   { 
     unsigned int pid = PLL_GET_ID(parent_site_id, n);
@@ -1231,40 +1166,23 @@ double pll_core_edge_loglikelihood_repeats_generic_avx(unsigned int states,
       pmat -= displacement;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    if (site_scalings)
+    if (site_scalings && terminv > 0.)
     {
-      if (terminv > 0.)
-      {
-        /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
-        unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
-        double scale_factor = scale_minlh[capped_scalings-1];
-        site_lk = log(terma * scale_factor + terminv);
-      }
-      else
-      {
-        site_lk = log(terma);
-        site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-      }
+      /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
+      unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
+      double scale_factor = scale_minlh[capped_scalings-1];
+      pll_core_logl_push(&logl_block, terma * scale_factor + terminv, 0,
+                         pll_core_logl_flush_avx);
     }
     else
-    {
-      site_lk = log(terma + terminv);
-    }
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+      pll_core_logl_push(&logl_block, terma + terminv, site_scalings,
+                         pll_core_logl_flush_avx);
   }
 
   if (rate_scalings)
     free(rate_scalings);
 
-  return logl;
+  return pll_core_logl_flush_avx(&logl_block);
 }
 
 PLL_EXPORT
@@ -1286,7 +1204,7 @@ double pll_core_edge_loglikelihood_ii_avx(unsigned int states,
                                           unsigned int attrib)
 {
   unsigned int n,i,j,k;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   double prop_invar = 0;
 
   const double * clvp = parent_clv;
@@ -1295,7 +1213,7 @@ double pll_core_edge_loglikelihood_ii_avx(unsigned int states,
   const double * freqs = NULL;
 
   double terma, terma_r, terminv;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int states_padded = (states+3) & 0xFFFFFFFC;
 
@@ -1331,6 +1249,8 @@ double pll_core_edge_loglikelihood_ii_avx(unsigned int states,
     }
   }
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (n = 0; n < sites; ++n)
   {
     pmat = pmatrix;
@@ -1472,40 +1392,23 @@ double pll_core_edge_loglikelihood_ii_avx(unsigned int states,
       pmat -= displacement;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    if (site_scalings)
+    if (site_scalings && terminv > 0.)
     {
-      if (terminv > 0.)
-      {
-        /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
-        unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
-        double scale_factor = scale_minlh[capped_scalings-1];
-        site_lk = log(terma * scale_factor + terminv);
-      }
-      else
-      {
-        site_lk = log(terma);
-        site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-      }
+      /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
+      unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
+      double scale_factor = scale_minlh[capped_scalings-1];
+      pll_core_logl_push(&logl_block, terma * scale_factor + terminv, 0,
+                         pll_core_logl_flush_avx);
     }
     else
-    {
-      site_lk = log(terma + terminv);
-    }
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+      pll_core_logl_push(&logl_block, terma + terminv, site_scalings,
+                         pll_core_logl_flush_avx);
   }
 
   if (rate_scalings)
     free(rate_scalings);
 
-  return logl;
+  return pll_core_logl_flush_avx(&logl_block);
 }
 
 
@@ -1527,7 +1430,7 @@ double pll_core_edge_loglikelihood_ii_4x4_avx(unsigned int sites,
                                               unsigned int attrib)
 {
   unsigned int n,i;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   double prop_invar = 0;
 
   const double * pmat;
@@ -1537,7 +1440,7 @@ double pll_core_edge_loglikelihood_ii_4x4_avx(unsigned int sites,
   const double * clvc = child_clv;
  
   double terma, terma_r, terminv;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int states = 4;
   unsigned int states_padded = 4;
@@ -1571,6 +1474,8 @@ double pll_core_edge_loglikelihood_ii_4x4_avx(unsigned int sites,
     }
   }
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (n = 0; n < sites; ++n)
   {
     pmat = pmatrix;
@@ -1687,40 +1592,23 @@ double pll_core_edge_loglikelihood_ii_4x4_avx(unsigned int sites,
       clvc += states_padded;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    if (site_scalings)
+    if (site_scalings && terminv > 0.)
     {
-      if (terminv > 0.)
-      {
-        /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
-        unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
-        double scale_factor = scale_minlh[capped_scalings-1];
-        site_lk = log(terma * scale_factor + terminv);
-      }
-      else
-      {
-        site_lk = log(terma);
-        site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-      }
+      /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
+      unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
+      double scale_factor = scale_minlh[capped_scalings-1];
+      pll_core_logl_push(&logl_block, terma * scale_factor + terminv, 0,
+                         pll_core_logl_flush_avx);
     }
     else
-    {
-      site_lk = log(terma + terminv);
-    }
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+      pll_core_logl_push(&logl_block, terma + terminv, site_scalings,
+                         pll_core_logl_flush_avx);
   }
 
   if (rate_scalings)
     free(rate_scalings);
 
-  return logl;
+  return pll_core_logl_flush_avx(&logl_block);
 }
 
 
@@ -1748,14 +1636,14 @@ double pll_core_edge_loglikelihood_repeats_4x4_avx(unsigned int states,
                                                    unsigned int attrib)
 {
   unsigned int n,i;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   double prop_invar = 0;
 
   const double * pmat;
   const double * freqs = NULL;
 
   double terma, terma_r, terminv;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int states_padded = 4;
   unsigned int span = states * rate_cats;
@@ -1789,6 +1677,8 @@ double pll_core_edge_loglikelihood_repeats_4x4_avx(unsigned int states,
     }
   }
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (n = 0; n < sites; ++n)
   {
     unsigned int pid = PLL_GET_ID(parent_site_id, n);
@@ -1909,40 +1799,23 @@ double pll_core_edge_loglikelihood_repeats_4x4_avx(unsigned int states,
       clvc += states_padded;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    if (site_scalings)
+    if (site_scalings && terminv > 0.)
     {
-      if (terminv > 0.)
-      {
-        /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
-        unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
-        double scale_factor = scale_minlh[capped_scalings-1];
-        site_lk = log(terma * scale_factor + terminv);
-      }
-      else
-      {
-        site_lk = log(terma);
-        site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-      }
+      /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
+      unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
+      double scale_factor = scale_minlh[capped_scalings-1];
+      pll_core_logl_push(&logl_block, terma * scale_factor + terminv, 0,
+                         pll_core_logl_flush_avx);
     }
     else
-    {
-      site_lk = log(terma + terminv);
-    }
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+      pll_core_logl_push(&logl_block, terma + terminv, site_scalings,
+                         pll_core_logl_flush_avx);
   }
 
   if (rate_scalings)
     free(rate_scalings);
 
-  return logl;
+  return pll_core_logl_flush_avx(&logl_block);
 }
 
 PLL_EXPORT
@@ -1968,14 +1841,14 @@ double pll_core_edge_loglikelihood_repeatsbclv_4x4_avx(unsigned int states,
                                                        unsigned int attrib)
 {
   unsigned int n,i;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   double prop_invar = 0;
 
   const double * pmat;
   const double * freqs = NULL;
 
   double terma, terma_r, terminv;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int states_padded = 4;
   unsigned int span = states * rate_cats;
@@ -2068,6 +1941,8 @@ double pll_core_edge_loglikelihood_repeatsbclv_4x4_avx(unsigned int states,
 
     }
   }
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (n = 0; n < sites; ++n)
   {
     unsigned int pid = PLL_GET_ID(parent_site_id, n);
@@ -2142,39 +2017,180 @@ double pll_core_edge_loglikelihood_repeatsbclv_4x4_avx(unsigned int states,
       child_res += states_padded;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    if (site_scalings)
+    if (site_scalings && terminv > 0.)
     {
-      if (terminv > 0.)
-      {
-        /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
-        unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
-        double scale_factor = scale_minlh[capped_scalings-1];
-        site_lk = log(terma * scale_factor + terminv);
-      }
-      else
-      {
-        site_lk = log(terma);
-        site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-      }
+      /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
+      unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
+      double scale_factor = scale_minlh[capped_scalings-1];
+      pll_core_logl_push(&logl_block, terma * scale_factor + terminv, 0,
+                         pll_core_logl_flush_avx);
+    }
+    else
+      pll_core_logl_push(&logl_block, terma + terminv, site_scalings,
+                         pll_core_logl_flush_avx);
+  }
+
+  if (rate_scalings)
+    free(rate_scalings);
+
+  return pll_core_logl_flush_avx(&logl_block);
+}
+
+
+static double hsum_avx(__m256d v)
+{
+  __m128d xmm0 = _mm_add_pd(_mm256_castpd256_pd128(v),
+                            _mm256_extractf128_pd(v, 1));
+  xmm0 = _mm_hadd_pd(xmm0, xmm0);
+
+  return _mm_cvtsd_f64(xmm0);
+}
+
+/* weighted sums of the values for each row of the weight matrix; four rows
+   are processed together so that each vector of values is loaded once for
+   all of them */
+PLL_EXPORT void pll_core_weighted_sums_avx(unsigned int sites,
+                                           unsigned int count,
+                                           const unsigned int * weights,
+                                           const double * values,
+                                           double * sums)
+{
+  unsigned int n, r, i;
+  unsigned int sites_vec = sites & 0xFFFFFFFC;
+
+  for (r = 0; r < count; r += 4)
+  {
+    unsigned int rows = PLL_MIN(4, count - r);
+    const unsigned int * w[4];
+    double acc[4];
+
+    /* missing rows of the last block repeat the first one */
+    for (i = 0; i < 4; ++i)
+      w[i] = weights + (size_t)(r + (i < rows ? i : 0)) * sites;
+
+    __m256d v_acc0 = _mm256_setzero_pd();
+    __m256d v_acc1 = _mm256_setzero_pd();
+    __m256d v_acc2 = _mm256_setzero_pd();
+    __m256d v_acc3 = _mm256_setzero_pd();
+
+    for (n = 0; n < sites_vec; n += 4)
+    {
+      __m256d v_values = _mm256_loadu_pd(values + n);
+      __m256d v_w0 = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)(w[0]+n)));
+      __m256d v_w1 = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)(w[1]+n)));
+      __m256d v_w2 = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)(w[2]+n)));
+      __m256d v_w3 = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)(w[3]+n)));
+
+      v_acc0 = _mm256_add_pd(v_acc0, _mm256_mul_pd(v_w0, v_values));
+      v_acc1 = _mm256_add_pd(v_acc1, _mm256_mul_pd(v_w1, v_values));
+      v_acc2 = _mm256_add_pd(v_acc2, _mm256_mul_pd(v_w2, v_values));
+      v_acc3 = _mm256_add_pd(v_acc3, _mm256_mul_pd(v_w3, v_values));
+    }
+
+    acc[0] = hsum_avx(v_acc0);
+    acc[1] = hsum_avx(v_acc1);
+    acc[2] = hsum_avx(v_acc2);
+    acc[3] = hsum_avx(v_acc3);
+
+    for (i = 0; i < rows; ++i)
+    {
+      for (n = sites_vec; n < sites; ++n)
+        acc[i] += w[i][n] * values[n];
+      sums[r+i] = acc[i];
     }
+  }
+}
+
+/* Natural logarithm of positive normal values, with the algorithm of fdlibm's
+   log(). The SSE and AVX versions perform the same sequence of operations
+   (without FMA), such that all vectorized builds obtain identical site
+   log-likelihoods */
+static __m256d log_avx(__m256d x)
+{
+  const __m256d v_one = _mm256_set1_pd(1.0);
+  const __m256d v_half = _mm256_set1_pd(0.5);
+
+  /* x = 2^e * m, with m in [sqrt(2)/2, sqrt(2)) */
+  __m256i v_bits = _mm256_castpd_si256(x);
+  __m128i v_exp_lo = _mm_srli_epi64(_mm256_castsi256_si128(v_bits), 52);
+  __m128i v_exp_hi = _mm_srli_epi64(_mm256_extractf128_si256(v_bits, 1), 52);
+  __m128i v_magic = _mm_set1_epi64x(0x4330000000000000LL);
+  __m256i v_exp = _mm256_insertf128_si256(
+                      _mm256_castsi128_si256(_mm_or_si128(v_exp_lo, v_magic)),
+                      _mm_or_si128(v_exp_hi, v_magic),
+                      1);
+  __m256d v_e = _mm256_sub_pd(_mm256_castsi256_pd(v_exp),
+                              _mm256_set1_pd(4503599627370496.0 + 1023));
+  __m256d v_m = _mm256_or_pd(_mm256_and_pd(x,
+            _mm256_castsi256_pd(_mm256_set1_epi64x(0x000FFFFFFFFFFFFFLL))),
+                             v_one);
+  __m256d v_big = _mm256_cmp_pd(v_m,
+                                _mm256_set1_pd(1.41421356237309504880),
+                                _CMP_GT_OQ);
+  v_m = _mm256_blendv_pd(v_m, _mm256_mul_pd(v_m, v_half), v_big);
+  v_e = _mm256_add_pd(v_e, _mm256_and_pd(v_big, v_one));
+
+  /* log(m) = 2s + s*R(s^2), with s = f / (2+f) */
+  __m256d v_f = _mm256_sub_pd(v_m, v_one);
+  __m256d v_s = _mm256_div_pd(v_f, _mm256_add_pd(_mm256_set1_pd(2.0), v_f));
+  __m256d v_z = _mm256_mul_pd(v_s, v_s);
+  __m256d v_w = _mm256_mul_pd(v_z, v_z);
+
+  __m256d v_t1 = _mm256_mul_pd(v_w, _mm256_set1_pd(PLL_LOG_LG7));
+  v_t1 = _mm256_mul_pd(v_w, _mm256_add_pd(_mm256_set1_pd(PLL_LOG_LG5), v_t1));
+  v_t1 = _mm256_mul_pd(v_w, _mm256_add_pd(_mm256_set1_pd(PLL_LOG_LG3), v_t1));
+  v_t1 = _mm256_mul_pd(v_z, _mm256_add_pd(_mm256_set1_pd(PLL_LOG_LG1), v_t1));
+  __m256d v_t2 = _mm256_mul_pd(v_w, _mm256_set1_pd(PLL_LOG_LG6));
+  v_t2 = _mm256_mul_pd(v_w, _mm256_add_pd(_mm256_set1_pd(PLL_LOG_LG4), v_t2));
+  v_t2 = _mm256_mul_pd(v_w, _mm256_add_pd(_mm256_set1_pd(PLL_LOG_LG2), v_t2));
+  __m256d v_r = _mm256_add_pd(v_t1, v_t2);
+  __m256d v_hfsq = _mm256_mul_pd(_mm256_mul_pd(v_half, v_f), v_f);
+
+  __m256d v_lo = _mm256_add_pd(
+                      _mm256_mul_pd(v_s, _mm256_add_pd(v_hfsq, v_r)),
+                      _mm256_mul_pd(v_e, _mm256_set1_pd(PLL_LOG_LN2_LO)));
+  return _mm256_sub_pd(_mm256_mul_pd(v_e, _mm256_set1_pd(PLL_LOG_LN2_HI)),
+                       _mm256_sub_pd(_mm256_sub_pd(v_hfsq, v_lo), v_f));
+}
+
+double pll_core_logl_flush_avx(pll_logl_block_t * block)
+{
+  unsigned int k, j;
+  unsigned int count = block->count;
+  double x[4] __attribute__ ((aligned (PLL_ALIGNMENT_AVX)));
+
+  for (k = 0; k < count; k += 4)
+  {
+    __m256d v_x;
+
+    /* the last sites are padded with ones */
+    if (k+4 <= count)
+      v_x = _mm256_loadu_pd(block->lk + k);
     else
     {
-      site_lk = log(terma + terminv);
+      for (j = 0; j < 4; ++j)
+        x[j] = (k+j < count) ? block->lk[k+j] : 1.0;
+      v_x = _mm256_load_pd(x);
     }
 
-    site_lk *= pattern_weights[n];
+    __m256d v_valid = _mm256_and_pd(
+                        _mm256_cmp_pd(v_x, _mm256_set1_pd(DBL_MIN), _CMP_GE_OQ),
+                        _mm256_cmp_pd(v_x, _mm256_set1_pd(DBL_MAX), _CMP_LE_OQ));
+    int valid = _mm256_movemask_pd(v_valid);
 
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
+    if (valid == 0xF && k+4 <= count)
+    {
+      _mm256_storeu_pd(block->lk + k, log_avx(v_x));
+      continue;
+    }
 
-    logl += site_lk;
-  }
+    /* zero, subnormal and non-finite values are left to the C library */
+    v_x = _mm256_blendv_pd(_mm256_set1_pd(1.0), v_x, v_valid);
+    _mm256_store_pd(x, log_avx(v_x));
 
-  if (rate_scalings)
-    free(rate_scalings);
+    for (j = 0; j < 4 && k+j < count; ++j)
+      block->lk[k+j] = (valid & (1 << j)) ? x[j] : log(block->lk[k+j]);
+  }
 
-  return logl;
+  return pll_core_logl_accumulate(block);
 }
-
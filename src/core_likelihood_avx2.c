@@ -21,6 +21,7 @@
 
 #include <limits.h>
 #include "pll.h"
+#include "pll_private.h"
 
 PLL_EXPORT double pll_core_root_loglikelihood_avx2(unsigned int states,
                                                    unsigned int sites,
@@ -36,7 +37,7 @@ PLL_EXPORT double pll_core_root_loglikelihood_avx2(unsigned int states,
                                                    double * persite_lnl)
 {
   unsigned int i,j,k;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   double prop_invar = 0;
 
   const double * freqs = NULL;
@@ -48,6 +49,8 @@ PLL_EXPORT double pll_core_root_loglikelihood_avx2(unsigned int states,
 
   __m256d xmm0, xmm1, xmm3;
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (i = 0; i < sites; ++i)
   {
     term = 0;
@@ -92,20 +95,10 @@ PLL_EXPORT double pll_core_root_loglikelihood_avx2(unsigned int states,
       }
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    term = log(term);
-    if (scaler && scaler[i])
-      term += scaler[i] * log(PLL_SCALE_THRESHOLD);
-
-    term *= pattern_weights[i];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[i] = term;
-
-    logl += term;
+    pll_core_logl_push(&logl_block, term, scaler ? scaler[i] : 0,
+                       pll_core_logl_flush_avx);
   }
-  return logl;
+  return pll_core_logl_flush_avx(&logl_block);
 }
 
 PLL_EXPORT double pll_core_root_loglikelihood_repeats_avx2(unsigned int states,
@@ -123,7 +116,7 @@ PLL_EXPORT double pll_core_root_loglikelihood_repeats_avx2(unsigned int states,
                                                   double * persite_lnl)
 {
   unsigned int i,j,k;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   double prop_invar = 0;
 
   const double * freqs = NULL;
@@ -136,6 +129,8 @@ PLL_EXPORT double pll_core_root_loglikelihood_repeats_avx2(unsigned int states,
 
   __m256d xmm0, xmm1, xmm3;
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (i = 0; i < sites; ++i)
   {
     unsigned int id = PLL_GET_ID(site_id, i);
@@ -182,20 +177,10 @@ PLL_EXPORT double pll_core_root_loglikelihood_repeats_avx2(unsigned int states,
       }
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    term = log(term);
-    if (scaler && scaler[id])
-      term += scaler[id] * log(PLL_SCALE_THRESHOLD);
-
-    term *= pattern_weights[i];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[i] = term;
-
-    logl += term;
+    pll_core_logl_push(&logl_block, term, scaler ? scaler[id] : 0,
+                       pll_core_logl_flush_avx);
   }
-  return logl;
+  return pll_core_logl_flush_avx(&logl_block);
 }
 
 PLL_EXPORT
@@ -217,7 +202,7 @@ double pll_core_edge_loglikelihood_ti_20x20_avx2(unsigned int sites,
                                                  unsigned int attrib)
 {
   unsigned int n,i,j,m = 0;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   double prop_invar = 0;
 
   const double * clvp = parent_clv;
@@ -225,7 +210,7 @@ double pll_core_edge_loglikelihood_ti_20x20_avx2(unsigned int sites,
   const double * freqs = NULL;
 
   double terma, terma_r, terminv;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int cstate;
   unsigned int states = 20;
@@ -328,6 +313,8 @@ double pll_core_edge_loglikelihood_ti_20x20_avx2(unsigned int sites,
     }
   }
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (n = 0; n < sites; ++n)
   {
     terma = 0;
@@ -408,41 +395,24 @@ double pll_core_edge_loglikelihood_ti_20x20_avx2(unsigned int sites,
       pmat -= displacement;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    if (site_scalings)
+    if (site_scalings && terminv > 0.)
     {
-      if (terminv > 0.)
-      {
-        /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
-        unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
-        double scale_factor = scale_minlh[capped_scalings-1];
-        site_lk = log(terma * scale_factor + terminv);
-      }
-      else
-      {
-        site_lk = log(terma);
-        site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-      }
+      /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
+      unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
+      double scale_factor = scale_minlh[capped_scalings-1];
+      pll_core_logl_push(&logl_block, terma * scale_factor + terminv, 0,
+                         pll_core_logl_flush_avx);
     }
     else
-    {
-      site_lk = log(terma + terminv);
-    }
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+      pll_core_logl_push(&logl_block, terma + terminv, site_scalings,
+                         pll_core_logl_flush_avx);
   }
 
   pll_aligned_free(lookup);
   if (rate_scalings)
     free(rate_scalings);
 
-  return logl;
+  return pll_core_logl_flush_avx(&logl_block);
 }
 
 PLL_EXPORT
@@ -464,7 +434,7 @@ double pll_core_edge_loglikelihood_ii_avx2(unsigned int states,
                                            unsigned int attrib)
 {
   unsigned int n,i,j,k;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   double prop_invar = 0;
 
   const double * clvp = parent_clv;
@@ -473,7 +443,7 @@ double pll_core_edge_loglikelihood_ii_avx2(unsigned int states,
   const double * freqs = NULL;
 
   double terma, terma_r, terminv;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int states_padded = (states+3) & 0xFFFFFFFC;
 
@@ -509,6 +479,8 @@ double pll_core_edge_loglikelihood_ii_avx2(unsigned int states,
     }
   }
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (n = 0; n < sites; ++n)
   {
     pmat = pmatrix;
@@ -646,39 +618,447 @@ double pll_core_edge_loglikelihood_ii_avx2(unsigned int states,
       pmat -= displacement;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    if (site_scalings)
+    if (site_scalings && terminv > 0.)
     {
-      if (terminv > 0.)
+      /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
+      unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
+      double scale_factor = scale_minlh[capped_scalings-1];
+      pll_core_logl_push(&logl_block, terma * scale_factor + terminv, 0,
+                         pll_core_logl_flush_avx);
+    }
+    else
+      pll_core_logl_push(&logl_block, terma + terminv, site_scalings,
+                         pll_core_logl_flush_avx);
+  }
+
+  if (rate_scalings)
+    free(rate_scalings);
+
+  return pll_core_logl_flush_avx(&logl_block);
+}
+
+/* The 4x4 and 20x20 site-repeats edge kernels store the p-matrices by
+   columns, weighted by the frequencies, such that the rate term of a site is
+   the dot product of the parent CLV with the sum of the columns scaled by the
+   child CLV entries. Only one horizontal addition is needed per rate */
+static double * edge_matrices_avx2(unsigned int states,
+                                   unsigned int rate_cats,
+                                   const double * pmatrix,
+                                   double ** frequencies,
+                                   const unsigned int * freqs_indices)
+{
+  unsigned int i,j,k;
+  size_t matrix_size = (size_t)states * states;
+  double * matrices = (double *)pll_aligned_alloc(rate_cats * matrix_size *
+                                                  sizeof(double),
+                                                  PLL_ALIGNMENT_AVX);
+  if (!matrices)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate space for precomputation.");
+    return NULL;
+  }
+
+  for (k = 0; k < rate_cats; ++k)
+  {
+    const double * freqs = frequencies[freqs_indices[k]];
+    const double * pmat = pmatrix + k*matrix_size;
+    double * tmat = matrices + k*matrix_size;
+
+    for (i = 0; i < states; ++i)
+      for (j = 0; j < states; ++j)
+        tmat[j*states + i] = pmat[i*states + j] * freqs[i];
+  }
+
+  return matrices;
+}
+
+static inline __m256d colsum_4x4_avx2(const double * tmat, const double * clv)
+{
+  __m256d v_terma = _mm256_mul_pd(_mm256_load_pd(tmat),
+                                  _mm256_broadcast_sd(clv));
+  __m256d v_termb = _mm256_mul_pd(_mm256_load_pd(tmat+4),
+                                  _mm256_broadcast_sd(clv+1));
+  v_terma = _mm256_fmadd_pd(_mm256_load_pd(tmat+8),
+                            _mm256_broadcast_sd(clv+2),
+                            v_terma);
+  v_termb = _mm256_fmadd_pd(_mm256_load_pd(tmat+12),
+                            _mm256_broadcast_sd(clv+3),
+                            v_termb);
+
+  return _mm256_add_pd(v_terma, v_termb);
+}
+
+/* elementwise products of clvp with the column sums of the 20x20 matrix */
+static inline __m256d colsum_20x20_avx2(const double * tmat,
+                                        const double * clvc,
+                                        const double * clvp)
+{
+  unsigned int j;
+  __m256d v_term0 = _mm256_setzero_pd();
+  __m256d v_term1 = _mm256_setzero_pd();
+  __m256d v_term2 = _mm256_setzero_pd();
+  __m256d v_term3 = _mm256_setzero_pd();
+  __m256d v_term4 = _mm256_setzero_pd();
+
+  for (j = 0; j < 20; ++j)
+  {
+    __m256d v_clvc = _mm256_broadcast_sd(clvc+j);
+    v_term0 = _mm256_fmadd_pd(_mm256_load_pd(tmat),    v_clvc, v_term0);
+    v_term1 = _mm256_fmadd_pd(_mm256_load_pd(tmat+4),  v_clvc, v_term1);
+    v_term2 = _mm256_fmadd_pd(_mm256_load_pd(tmat+8),  v_clvc, v_term2);
+    v_term3 = _mm256_fmadd_pd(_mm256_load_pd(tmat+12), v_clvc, v_term3);
+    v_term4 = _mm256_fmadd_pd(_mm256_load_pd(tmat+16), v_clvc, v_term4);
+    tmat += 20;
+  }
+
+  v_term0 = _mm256_mul_pd(v_term0, _mm256_load_pd(clvp));
+  v_term0 = _mm256_fmadd_pd(v_term1, _mm256_load_pd(clvp+4), v_term0);
+  v_term0 = _mm256_fmadd_pd(v_term2, _mm256_load_pd(clvp+8), v_term0);
+  v_term0 = _mm256_fmadd_pd(v_term3, _mm256_load_pd(clvp+12), v_term0);
+  return _mm256_fmadd_pd(v_term4, _mm256_load_pd(clvp+16), v_term0);
+}
+
+/* states is 4 or 20. If bclv is set, it holds the column sums of the child
+   repeat classes for 4 states */
+static double edge_loglikelihood_repeats_colsum_avx2(unsigned int states,
+                                                     unsigned int sites,
+                                                     unsigned int rate_cats,
+                                                     const double * parent_clv,
+                                                     const unsigned int * parent_scaler,
+                                                     const double * child_clv,
+                                                     const unsigned int * child_scaler,
+                                                     const double * matrices,
+                                                     double ** frequencies,
+                                                     const double * rate_weights,
+                                                     const unsigned int * pattern_weights,
+                                                     const double * invar_proportion,
+                                                     const int * invar_indices,
+                                                     const unsigned int * freqs_indices,
+                                                     double * persite_lnl,
+                                                     const unsigned int * parent_site_id,
+                                                     const unsigned int * child_site_id,
+                                                     const double * bclv,
+                                                     unsigned int attrib)
+{
+  unsigned int n,i;
+  pll_logl_block_t logl_block;
+  double prop_invar = 0;
+
+  const double * freqs = NULL;
+
+  double terma, terma_r, terminv;
+  double inv_site_lk;
+
+  unsigned int span = states * rate_cats;
+  size_t matrix_size = (size_t)states * states;
+
+  __m256d xmm0, xmm1;
+
+  /* scaling stuff */
+  unsigned int site_scalings;
+  unsigned int * rate_scalings = NULL;
+  int per_rate_scaling = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 1 : 0;
+
+  /* powers of scale threshold for undoing the scaling */
+  double scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+  if (per_rate_scaling || invar_proportion)
+  {
+    double scale_factor = 1.0;
+    for (i = 0; i < PLL_SCALE_RATE_MAXDIFF; ++i)
+    {
+      scale_factor *= PLL_SCALE_THRESHOLD;
+      scale_minlh[i] = scale_factor;
+    }
+  }
+  if (per_rate_scaling)
+  {
+    rate_scalings = (unsigned int*) calloc(rate_cats, sizeof(unsigned int));
+
+    if (!rate_scalings)
+    {
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Cannot allocate space for rate scalers.");
+      return -INFINITY;
+    }
+  }
+
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
+  for (n = 0; n < sites; ++n)
+  {
+    unsigned int pid = PLL_GET_ID(parent_site_id, n);
+    unsigned int cid = PLL_GET_ID(child_site_id, n);
+    const double * clvp = &parent_clv[pid * span];
+    const double * clvc = bclv ? &bclv[cid * span] : &child_clv[cid * span];
+    const double * tmat = matrices;
+    terma = 0;
+    terminv = 0;
+
+    if (per_rate_scaling)
+    {
+      /* compute minimum per-rate scaler -> common per-site scaler */
+      site_scalings = UINT_MAX;
+      for (i = 0; i < rate_cats; ++i)
       {
-        /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
-        unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
-        double scale_factor = scale_minlh[capped_scalings-1];
-        site_lk = log(terma * scale_factor + terminv);
+        rate_scalings[i] = (parent_scaler) ? parent_scaler[pid*rate_cats+i] : 0;
+        rate_scalings[i] += (child_scaler) ? child_scaler[cid*rate_cats+i] : 0;
+        if (rate_scalings[i] < site_scalings)
+          site_scalings = rate_scalings[i];
       }
-      else
+
+      /* compute relative capped per-rate scalers */
+      for (i = 0; i < rate_cats; ++i)
       {
-        site_lk = log(terma);
-        site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
+        rate_scalings[i] = PLL_MIN(rate_scalings[i] - site_scalings,
+                                   PLL_SCALE_RATE_MAXDIFF);
       }
     }
     else
     {
-      site_lk = log(terma + terminv);
+      /* count number of scaling factors to account for */
+      site_scalings =  (parent_scaler) ? parent_scaler[pid] : 0;
+      site_scalings += (child_scaler) ? child_scaler[cid] : 0;
     }
 
-    site_lk *= pattern_weights[n];
+    for (i = 0; i < rate_cats; ++i)
+    {
+      if (states == 4)
+      {
+        xmm1 = bclv ? _mm256_load_pd(clvc) : colsum_4x4_avx2(tmat, clvc);
+        xmm1 = _mm256_mul_pd(xmm1, _mm256_load_pd(clvp));
+      }
+      else
+        xmm1 = colsum_20x20_avx2(tmat, clvc, clvp);
+
+      /* add up the elements of xmm1 */
+      xmm0 = _mm256_hadd_pd(xmm1,xmm1);
+      terma_r = ((double *)&xmm0)[0] + ((double *)&xmm0)[2];
 
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
+      /* apply per-rate scalers, if necessary */
+      if (rate_scalings && rate_scalings[i] > 0)
+      {
+        terma_r *= scale_minlh[rate_scalings[i]-1];
+      }
 
-    logl += site_lk;
+      /* account for invariant sites */
+      prop_invar = invar_proportion ? invar_proportion[freqs_indices[i]] : 0;
+      if (prop_invar > 0)
+      {
+        terma += rate_weights[i] * terma_r * (1. - prop_invar);
+        if (invar_indices[n] != -1)
+        {
+          freqs = frequencies[freqs_indices[i]];
+          inv_site_lk = freqs[invar_indices[n]];
+          terminv += rate_weights[i] * inv_site_lk * prop_invar;
+        }
+      }
+      else
+      {
+        terma += terma_r * rate_weights[i];
+      }
+
+      clvp += states;
+      clvc += states;
+      tmat += matrix_size;
+    }
+
+    if (site_scalings && terminv > 0.)
+    {
+      /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
+      unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
+      double scale_factor = scale_minlh[capped_scalings-1];
+      pll_core_logl_push(&logl_block, terma * scale_factor + terminv, 0,
+                         pll_core_logl_flush_avx);
+    }
+    else
+      pll_core_logl_push(&logl_block, terma + terminv, site_scalings,
+                         pll_core_logl_flush_avx);
   }
 
   if (rate_scalings)
     free(rate_scalings);
 
+  return pll_core_logl_flush_avx(&logl_block);
+}
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_repeats_4x4_avx2(unsigned int states,
+                                                    unsigned int sites,
+                                                    const unsigned int child_sites,
+                                                    unsigned int rate_cats,
+                                                    const double * parent_clv,
+                                                    const unsigned int * parent_scaler,
+                                                    const double * child_clv,
+                                                    const unsigned int * child_scaler,
+                                                    const double * pmatrix,
+                                                    double ** frequencies,
+                                                    const double * rate_weights,
+                                                    const unsigned int * pattern_weights,
+                                                    const double * invar_proportion,
+                                                    const int * invar_indices,
+                                                    const unsigned int * freqs_indices,
+                                                    double * persite_lnl,
+                                                    const unsigned int * parent_site_id,
+                                                    const unsigned int * child_site_id,
+                                                    double * bclv,
+                                                    unsigned int attrib)
+{
+  double logl;
+  double * matrices = edge_matrices_avx2(4,
+                                         rate_cats,
+                                         pmatrix,
+                                         frequencies,
+                                         freqs_indices);
+  if (!matrices)
+    return -INFINITY;
+
+  logl = edge_loglikelihood_repeats_colsum_avx2(4,
+                                                sites,
+                                                rate_cats,
+                                                parent_clv,
+                                                parent_scaler,
+                                                child_clv,
+                                                child_scaler,
+                                                matrices,
+                                                frequencies,
+                                                rate_weights,
+                                                pattern_weights,
+                                                invar_proportion,
+                                                invar_indices,
+                                                freqs_indices,
+                                                persite_lnl,
+                                                parent_site_id,
+                                                child_site_id,
+                                                NULL,
+                                                attrib);
+
+  pll_aligned_free(matrices);
+  return logl;
+}
+
+/* the column sums of the (fewer) child repeat classes are precomputed in
+   bclv */
+PLL_EXPORT
+double pll_core_edge_loglikelihood_repeatsbclv_4x4_avx2(unsigned int states,
+                                                        unsigned int sites,
+                                                        const unsigned int child_sites,
+                                                        unsigned int rate_cats,
+                                                        const double * parent_clv,
+                                                        const unsigned int * parent_scaler,
+                                                        const double * child_clv,
+                                                        const unsigned int * child_scaler,
+                                                        const double * pmatrix,
+                                                        double ** frequencies,
+                                                        const double * rate_weights,
+                                                        const unsigned int * pattern_weights,
+                                                        const double * invar_proportion,
+                                                        const int * invar_indices,
+                                                        const unsigned int * freqs_indices,
+                                                        double * persite_lnl,
+                                                        const unsigned int * parent_site_id,
+                                                        const unsigned int * child_site_id,
+                                                        double * bclv,
+                                                        unsigned int attrib)
+{
+  unsigned int n,i;
+  double logl;
+  double * matrices = edge_matrices_avx2(4,
+                                         rate_cats,
+                                         pmatrix,
+                                         frequencies,
+                                         freqs_indices);
+  if (!matrices)
+    return -INFINITY;
+
+  double * child_res = bclv;
+  const double * clvc = child_clv;
+  for (n = 0; n < child_sites; ++n)
+  {
+    const double * tmat = matrices;
+    for (i = 0; i < rate_cats; ++i)
+    {
+      _mm256_store_pd(child_res, colsum_4x4_avx2(tmat, clvc));
+      tmat += 16;
+      clvc += 4;
+      child_res += 4;
+    }
+  }
+
+  logl = edge_loglikelihood_repeats_colsum_avx2(4,
+                                                sites,
+                                                rate_cats,
+                                                parent_clv,
+                                                parent_scaler,
+                                                child_clv,
+                                                child_scaler,
+                                                matrices,
+                                                frequencies,
+                                                rate_weights,
+                                                pattern_weights,
+                                                invar_proportion,
+                                                invar_indices,
+                                                freqs_indices,
+                                                persite_lnl,
+                                                parent_site_id,
+                                                child_site_id,
+                                                bclv,
+                                                attrib);
+
+  pll_aligned_free(matrices);
+  return logl;
+}
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_repeats_20x20_avx2(unsigned int sites,
+                                                      const unsigned int child_sites,
+                                                      unsigned int rate_cats,
+                                                      const double * parent_clv,
+                                                      const unsigned int * parent_scaler,
+                                                      const double * child_clv,
+                                                      const unsigned int * child_scaler,
+                                                      const double * pmatrix,
+                                                      double ** frequencies,
+                                                      const double * rate_weights,
+                                                      const unsigned int * pattern_weights,
+                                                      const double * invar_proportion,
+                                                      const int * invar_indices,
+                                                      const unsigned int * freqs_indices,
+                                                      double * persite_lnl,
+                                                      const unsigned int * parent_site_id,
+                                                      const unsigned int * child_site_id,
+                                                      unsigned int attrib)
+{
+  double logl;
+  double * matrices = edge_matrices_avx2(20,
+                                         rate_cats,
+                                         pmatrix,
+                                         frequencies,
+                                         freqs_indices);
+  if (!matrices)
+    return -INFINITY;
+
+  logl = edge_loglikelihood_repeats_colsum_avx2(20,
+                                                sites,
+                                                rate_cats,
+                                                parent_clv,
+                                                parent_scaler,
+                                                child_clv,
+                                                child_scaler,
+                                                matrices,
+                                                frequencies,
+                                                rate_weights,
+                                                pattern_weights,
+                                                invar_proportion,
+                                                invar_indices,
+                                                freqs_indices,
+                                                persite_lnl,
+                                                parent_site_id,
+                                                child_site_id,
+                                                NULL,
+                                                attrib);
+
+  pll_aligned_free(matrices);
   return logl;
 }
 
@@ -705,14 +1085,36 @@ double pll_core_edge_loglikelihood_repeats_generic_avx2(unsigned int states,
                                                         unsigned int attrib)
 {
   unsigned int n,i,j,k;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   double prop_invar = 0;
 
   const double * pmat;
   const double * freqs = NULL;
 
   double terma, terma_r, terminv;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
+
+  if (states == 20)
+  {
+    return pll_core_edge_loglikelihood_repeats_20x20_avx2(sites,
+                                                          child_sites,
+                                                          rate_cats,
+                                                          parent_clv,
+                                                          parent_scaler,
+                                                          child_clv,
+                                                          child_scaler,
+                                                          pmatrix,
+                                                          frequencies,
+                                                          rate_weights,
+                                                          pattern_weights,
+                                                          invar_proportion,
+                                                          invar_indices,
+                                                          freqs_indices,
+                                                          persite_lnl,
+                                                          parent_site_id,
+                                                          child_site_id,
+                                                          attrib);
+  }
 
   unsigned int states_padded = (states+3) & 0xFFFFFFFC;
   unsigned int span = states_padded * rate_cats;
@@ -749,6 +1151,8 @@ double pll_core_edge_loglikelihood_repeats_generic_avx2(unsigned int states,
     }
   }
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (n = 0; n < sites; ++n)
   {
     unsigned int pid = PLL_GET_ID(parent_site_id, n);
@@ -890,38 +1294,21 @@ double pll_core_edge_loglikelihood_repeats_generic_avx2(unsigned int states,
       pmat -= displacement;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    if (site_scalings)
+    if (site_scalings && terminv > 0.)
     {
-      if (terminv > 0.)
-      {
-        /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
-        unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
-        double scale_factor = scale_minlh[capped_scalings-1];
-        site_lk = log(terma * scale_factor + terminv);
-      }
-      else
-      {
-        site_lk = log(terma);
-        site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-      }
+      /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
+      unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
+      double scale_factor = scale_minlh[capped_scalings-1];
+      pll_core_logl_push(&logl_block, terma * scale_factor + terminv, 0,
+                         pll_core_logl_flush_avx);
     }
     else
-    {
-      site_lk = log(terma + terminv);
-    }
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+      pll_core_logl_push(&logl_block, terma + terminv, site_scalings,
+                         pll_core_logl_flush_avx);
   }
 
   if (rate_scalings)
     free(rate_scalings);
 
-  return logl;
+  return pll_core_logl_flush_avx(&logl_block);
 }
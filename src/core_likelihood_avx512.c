@@ -0,0 +1,817 @@
+/*
+    Copyright (C) 2015-2020 Tomas Flouri, Diego Darriba, Alexey Kozlov
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include <limits.h>
+#include "pll.h"
+#include "pll_private.h"
+
+/* The frequencies, rate weights and the (1 - proportion of invariant sites)
+   factor are folded into a single per-rate weight vector (or into the
+   p-matrix rows) once per call, such that the per-site likelihood is a plain
+   dot product which is reduced only once per site. */
+
+static inline __mmask8 block_mask(unsigned int remaining)
+{
+  return (remaining >= 8) ? 0xFF : (__mmask8)((1u << remaining) - 1);
+}
+
+static double rate_weight(const double * rate_weights,
+                          const double * invar_proportion,
+                          const unsigned int * freqs_indices,
+                          unsigned int rate)
+{
+  double prop_invar = invar_proportion ?
+                        invar_proportion[freqs_indices[rate]] : 0;
+
+  return (prop_invar > 0) ? rate_weights[rate] * (1. - prop_invar) :
+                            rate_weights[rate];
+}
+
+/* likelihood of an invariant site, weighted over all rate categories */
+static double site_invar_lk(unsigned int rate_cats,
+                            double * const * frequencies,
+                            const double * rate_weights,
+                            const double * invar_proportion,
+                            const unsigned int * freqs_indices,
+                            const int * invar_indices,
+                            unsigned int site)
+{
+  unsigned int i;
+  double terminv = 0;
+
+  if (!invar_proportion)
+    return 0;
+
+  for (i = 0; i < rate_cats; ++i)
+  {
+    double prop_invar = invar_proportion[freqs_indices[i]];
+    if (prop_invar > 0 && invar_indices[site] != -1)
+      terminv += rate_weights[i] * prop_invar *
+                 frequencies[freqs_indices[i]][invar_indices[site]];
+  }
+
+  return terminv;
+}
+
+/* compute the minimum scaler of a site and the per-rate scalers relative to
+   it, capped at PLL_SCALE_RATE_MAXDIFF; returns the site scaler */
+static unsigned int site_scalers(unsigned int n,
+                                 unsigned int rate_cats,
+                                 const unsigned int * parent_scaler,
+                                 const unsigned int * child_scaler,
+                                 unsigned int * rate_scalings)
+{
+  unsigned int i;
+  unsigned int site_scalings;
+
+  if (rate_scalings)
+  {
+    /* compute minimum per-rate scaler -> common per-site scaler */
+    site_scalings = UINT_MAX;
+    for (i = 0; i < rate_cats; ++i)
+    {
+      rate_scalings[i] = (parent_scaler) ? parent_scaler[n*rate_cats+i] : 0;
+      rate_scalings[i] += (child_scaler) ? child_scaler[n*rate_cats+i] : 0;
+      if (rate_scalings[i] < site_scalings)
+        site_scalings = rate_scalings[i];
+    }
+
+    /* compute relative capped per-rate scalers */
+    for (i = 0; i < rate_cats; ++i)
+    {
+      rate_scalings[i] = PLL_MIN(rate_scalings[i] - site_scalings,
+                                 PLL_SCALE_RATE_MAXDIFF);
+    }
+  }
+  else
+  {
+    /* count number of scaling factors to account for */
+    site_scalings =  (parent_scaler) ? parent_scaler[n] : 0;
+    site_scalings += (child_scaler) ? child_scaler[n] : 0;
+  }
+
+  return site_scalings;
+}
+
+static void site_likelihood_push(pll_logl_block_t * block,
+                                 double terma,
+                                 double terminv,
+                                 unsigned int site_scalings,
+                                 const double * scale_minlh)
+{
+  if (site_scalings && terminv > 0.)
+  {
+    /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
+    unsigned int capped_scalings = PLL_MIN(site_scalings,
+                                           PLL_SCALE_RATE_MAXDIFF);
+    double scale_factor = scale_minlh[capped_scalings-1];
+    pll_core_logl_push(block, terma * scale_factor + terminv, 0,
+                       pll_core_logl_flush_avx);
+  }
+  else
+    pll_core_logl_push(block, terma + terminv, site_scalings,
+                       pll_core_logl_flush_avx);
+}
+
+/* allocate the per-rate scalers and precompute the powers of the scaling
+   threshold used for undoing the scaling */
+static int init_scaling(unsigned int rate_cats,
+                        unsigned int attrib,
+                        unsigned int ** rate_scalings,
+                        double * scale_minlh)
+{
+  unsigned int i;
+  double scale_factor = 1.0;
+
+  for (i = 0; i < PLL_SCALE_RATE_MAXDIFF; ++i)
+  {
+    scale_factor *= PLL_SCALE_THRESHOLD;
+    scale_minlh[i] = scale_factor;
+  }
+
+  *rate_scalings = NULL;
+  if (attrib & PLL_ATTRIB_RATE_SCALERS)
+  {
+    *rate_scalings = (unsigned int*) calloc(rate_cats, sizeof(unsigned int));
+
+    if (!*rate_scalings)
+    {
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Cannot allocate space for rate scalers.");
+      return PLL_FAILURE;
+    }
+  }
+
+  return PLL_SUCCESS;
+}
+
+PLL_EXPORT double pll_core_root_loglikelihood_avx512(unsigned int states,
+                                                     unsigned int sites,
+                                                     unsigned int rate_cats,
+                                                     const double * clv,
+                                                     const unsigned int * scaler,
+                                                     double * const * frequencies,
+                                                     const double * rate_weights,
+                                                     const unsigned int * pattern_weights,
+                                                     const double * invar_proportion,
+                                                     const int * invar_indices,
+                                                     const unsigned int * freqs_indices,
+                                                     double * persite_lnl)
+{
+  unsigned int i,j,k;
+  pll_logl_block_t logl_block;
+
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int span_padded = states_padded * rate_cats;
+
+  /* frequencies of all rate categories, multiplied by the rate weights */
+  double * weights = pll_aligned_alloc(span_padded * sizeof(double),
+                                       PLL_ALIGNMENT_AVX512);
+  if (!weights)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate space for precomputation.");
+    return -INFINITY;
+  }
+
+  memset(weights, 0, span_padded * sizeof(double));
+  for (j = 0; j < rate_cats; ++j)
+  {
+    const double * freqs = frequencies[freqs_indices[j]];
+    double w = rate_weight(rate_weights, invar_proportion, freqs_indices, j);
+
+    for (k = 0; k < states; ++k)
+      weights[j*states_padded + k] = freqs[k] * w;
+  }
+
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
+  for (i = 0; i < sites; ++i)
+  {
+    __m512d v_term = _mm512_setzero_pd();
+
+    /* the CLV of a site is contiguous over all rate categories */
+    for (k = 0; k < span_padded; k += 8)
+    {
+      __mmask8 m = block_mask(span_padded - k);
+      __m512d v_clv = _mm512_maskz_loadu_pd(m, clv + k);
+      __m512d v_weight = _mm512_maskz_loadu_pd(m, weights + k);
+      v_term = _mm512_fmadd_pd(v_clv, v_weight, v_term);
+    }
+
+    double term = _mm512_reduce_add_pd(v_term);
+
+    /* account for invariant sites */
+    if (invar_proportion)
+      term += site_invar_lk(rate_cats,
+                            frequencies,
+                            rate_weights,
+                            invar_proportion,
+                            freqs_indices,
+                            invar_indices,
+                            i);
+
+    pll_core_logl_push(&logl_block, term, scaler ? scaler[i] : 0,
+                       pll_core_logl_flush_avx);
+
+    clv += span_padded;
+  }
+
+  pll_aligned_free(weights);
+
+  return pll_core_logl_flush_avx(&logl_block);
+}
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_ii_4x4_avx512(unsigned int sites,
+                                                 unsigned int rate_cats,
+                                                 const double * parent_clv,
+                                                 const unsigned int * parent_scaler,
+                                                 const double * child_clv,
+                                                 const unsigned int * child_scaler,
+                                                 const double * pmatrix,
+                                                 double * const * frequencies,
+                                                 const double * rate_weights,
+                                                 const unsigned int * pattern_weights,
+                                                 const double * invar_proportion,
+                                                 const int * invar_indices,
+                                                 const unsigned int * freqs_indices,
+                                                 double * persite_lnl,
+                                                 unsigned int attrib)
+{
+  unsigned int n,i,j,k;
+  pll_logl_block_t logl_block;
+
+  unsigned int states = 4;
+  unsigned int span = states * rate_cats;
+  unsigned int pairs = (rate_cats+1) / 2;
+
+  /* scaling stuff */
+  unsigned int site_scalings;
+  unsigned int * rate_scalings;
+  double scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+
+  if (!init_scaling(rate_cats, attrib, &rate_scalings, scale_minlh))
+    return -INFINITY;
+
+  /* p-matrix rows of two consecutive rate categories, multiplied by the
+     weighted frequencies, i.e. entry [p][i][j] is row i of the p-matrix of
+     rate 2p (j < 4) and 2p+1 (j >= 4) */
+  double * pmat = pll_aligned_alloc(pairs * 32 * sizeof(double),
+                                    PLL_ALIGNMENT_AVX512);
+  if (!pmat)
+  {
+    if (rate_scalings)
+      free(rate_scalings);
+
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate space for precomputation.");
+    return -INFINITY;
+  }
+
+  memset(pmat, 0, pairs * 32 * sizeof(double));
+  for (k = 0; k < rate_cats; ++k)
+  {
+    const double * freqs = frequencies[freqs_indices[k]];
+    double w = rate_weight(rate_weights, invar_proportion, freqs_indices, k);
+    double * pair = pmat + (k/2)*32 + (k & 1)*4;
+
+    for (i = 0; i < states; ++i)
+      for (j = 0; j < states; ++j)
+        pair[i*8 + j] = pmatrix[k*16 + i*4 + j] * freqs[i] * w;
+  }
+
+  __m512i v_perm0 = _mm512_set_epi64(4,4,4,4,0,0,0,0);
+  __m512i v_perm1 = _mm512_set_epi64(5,5,5,5,1,1,1,1);
+  __m512i v_perm2 = _mm512_set_epi64(6,6,6,6,2,2,2,2);
+  __m512i v_perm3 = _mm512_set_epi64(7,7,7,7,3,3,3,3);
+
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
+  for (n = 0; n < sites; ++n)
+  {
+    const double * clvp = parent_clv + n*span;
+    const double * clvc = child_clv + n*span;
+
+    site_scalings = site_scalers(n,
+                                 rate_cats,
+                                 parent_scaler,
+                                 child_scaler,
+                                 rate_scalings);
+
+    __m512d v_terma = _mm512_setzero_pd();
+
+    for (k = 0; k < pairs; ++k)
+    {
+      __mmask8 m = (2*k+1 < rate_cats) ? 0xFF : 0x0F;
+      const double * pm = pmat + k*32;
+
+      __m512d v_clvp = _mm512_maskz_loadu_pd(m, clvp + k*8);
+      __m512d v_clvc = _mm512_maskz_loadu_pd(m, clvc + k*8);
+
+      __m512d v_term = _mm512_mul_pd(_mm512_load_pd(pm),
+                                     _mm512_permutexvar_pd(v_perm0, v_clvp));
+      v_term = _mm512_fmadd_pd(_mm512_load_pd(pm+8),
+                               _mm512_permutexvar_pd(v_perm1, v_clvp),
+                               v_term);
+      v_term = _mm512_fmadd_pd(_mm512_load_pd(pm+16),
+                               _mm512_permutexvar_pd(v_perm2, v_clvp),
+                               v_term);
+      v_term = _mm512_fmadd_pd(_mm512_load_pd(pm+24),
+                               _mm512_permutexvar_pd(v_perm3, v_clvp),
+                               v_term);
+
+      /* apply per-rate scalers, if necessary */
+      if (rate_scalings)
+      {
+        unsigned int s0 = rate_scalings[2*k];
+        unsigned int s1 = (m & 0xF0) ? rate_scalings[2*k+1] : 0;
+
+        if (s0 || s1)
+        {
+          __m512d v_scale = _mm512_set_pd(s1 ? scale_minlh[s1-1] : 1.,
+                                          s1 ? scale_minlh[s1-1] : 1.,
+                                          s1 ? scale_minlh[s1-1] : 1.,
+                                          s1 ? scale_minlh[s1-1] : 1.,
+                                          s0 ? scale_minlh[s0-1] : 1.,
+                                          s0 ? scale_minlh[s0-1] : 1.,
+                                          s0 ? scale_minlh[s0-1] : 1.,
+                                          s0 ? scale_minlh[s0-1] : 1.);
+          v_clvc = _mm512_mul_pd(v_clvc, v_scale);
+        }
+      }
+
+      v_terma = _mm512_fmadd_pd(v_term, v_clvc, v_terma);
+    }
+
+    double terma = _mm512_reduce_add_pd(v_terma);
+    double terminv = site_invar_lk(rate_cats,
+                                   frequencies,
+                                   rate_weights,
+                                   invar_proportion,
+                                   freqs_indices,
+                                   invar_indices,
+                                   n);
+
+    site_likelihood_push(&logl_block,
+                         terma,
+                         terminv,
+                         site_scalings,
+                         scale_minlh);
+  }
+
+  pll_aligned_free(pmat);
+  if (rate_scalings)
+    free(rate_scalings);
+
+  return pll_core_logl_flush_avx(&logl_block);
+}
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_ii_avx512(unsigned int states,
+                                             unsigned int sites,
+                                             unsigned int rate_cats,
+                                             const double * parent_clv,
+                                             const unsigned int * parent_scaler,
+                                             const double * child_clv,
+                                             const unsigned int * child_scaler,
+                                             const double * pmatrix,
+                                             double * const * frequencies,
+                                             const double * rate_weights,
+                                             const unsigned int * pattern_weights,
+                                             const double * invar_proportion,
+                                             const int * invar_indices,
+                                             const unsigned int * freqs_indices,
+                                             double * persite_lnl,
+                                             unsigned int attrib)
+{
+  unsigned int n,i,j,k;
+  pll_logl_block_t logl_block;
+
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int block_padded = (states+7) & 0xFFFFFFF8;
+  unsigned int span_padded = states_padded * rate_cats;
+  unsigned int matrix_size = states * block_padded;
+
+  if (states == 4)
+  {
+    return pll_core_edge_loglikelihood_ii_4x4_avx512(sites,
+                                                     rate_cats,
+                                                     parent_clv,
+                                                     parent_scaler,
+                                                     child_clv,
+                                                     child_scaler,
+                                                     pmatrix,
+                                                     frequencies,
+                                                     rate_weights,
+                                                     pattern_weights,
+                                                     invar_proportion,
+                                                     invar_indices,
+                                                     freqs_indices,
+                                                     persite_lnl,
+                                                     attrib);
+  }
+
+  /* scaling stuff */
+  unsigned int site_scalings;
+  unsigned int * rate_scalings;
+  double scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+
+  if (!init_scaling(rate_cats, attrib, &rate_scalings, scale_minlh))
+    return -INFINITY;
+
+  /* zero-padded p-matrix rows multiplied by the weighted frequencies */
+  double * pmat = pll_aligned_alloc(rate_cats * matrix_size * sizeof(double),
+                                    PLL_ALIGNMENT_AVX512);
+  if (!pmat)
+  {
+    if (rate_scalings)
+      free(rate_scalings);
+
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate space for precomputation.");
+    return -INFINITY;
+  }
+
+  memset(pmat, 0, rate_cats * matrix_size * sizeof(double));
+  for (k = 0; k < rate_cats; ++k)
+  {
+    const double * freqs = frequencies[freqs_indices[k]];
+    double w = rate_weight(rate_weights, invar_proportion, freqs_indices, k);
+
+    for (i = 0; i < states; ++i)
+      for (j = 0; j < states; ++j)
+        pmat[k*matrix_size + i*block_padded + j] =
+          pmatrix[k*states*states_padded + i*states_padded + j] * freqs[i] * w;
+  }
+
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
+  for (n = 0; n < sites; ++n)
+  {
+    const double * clvp = parent_clv + n*span_padded;
+    const double * clvc = child_clv + n*span_padded;
+
+    site_scalings = site_scalers(n,
+                                 rate_cats,
+                                 parent_scaler,
+                                 child_scaler,
+                                 rate_scalings);
+
+    __m512d v_terma = _mm512_setzero_pd();
+
+    for (k = 0; k < rate_cats; ++k)
+    {
+      /* iterate over blocks of eight child states */
+      for (j = 0; j < states; j += 8)
+      {
+        const double * pm = pmat + k*matrix_size + j;
+
+        __m512d v_term = _mm512_setzero_pd();
+        for (i = 0; i < states; ++i)
+        {
+          v_term = _mm512_fmadd_pd(_mm512_load_pd(pm),
+                                   _mm512_set1_pd(clvp[i]),
+                                   v_term);
+          pm += block_padded;
+        }
+
+        __m512d v_clvc = _mm512_maskz_loadu_pd(block_mask(states - j),
+                                               clvc + j);
+
+        /* apply per-rate scalers, if necessary */
+        if (rate_scalings && rate_scalings[k] > 0)
+          v_clvc = _mm512_mul_pd(v_clvc,
+                          _mm512_set1_pd(scale_minlh[rate_scalings[k]-1]));
+
+        v_terma = _mm512_fmadd_pd(v_term, v_clvc, v_terma);
+      }
+
+      clvp += states_padded;
+      clvc += states_padded;
+    }
+
+    double terma = _mm512_reduce_add_pd(v_terma);
+    double terminv = site_invar_lk(rate_cats,
+                                   frequencies,
+                                   rate_weights,
+                                   invar_proportion,
+                                   freqs_indices,
+                                   invar_indices,
+                                   n);
+
+    site_likelihood_push(&logl_block,
+                         terma,
+                         terminv,
+                         site_scalings,
+                         scale_minlh);
+  }
+
+  pll_aligned_free(pmat);
+  if (rate_scalings)
+    free(rate_scalings);
+
+  return pll_core_logl_flush_avx(&logl_block);
+}
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_ti_4x4_avx512(unsigned int sites,
+                                                 unsigned int rate_cats,
+                                                 const double * parent_clv,
+                                                 const unsigned int * parent_scaler,
+                                                 const unsigned char * tipchars,
+                                                 const double * pmatrix,
+                                                 double * const * frequencies,
+                                                 const double * rate_weights,
+                                                 const unsigned int * pattern_weights,
+                                                 const double * invar_proportion,
+                                                 const int * invar_indices,
+                                                 const unsigned int * freqs_indices,
+                                                 double * persite_lnl,
+                                                 unsigned int attrib)
+{
+  unsigned int n,i,j,k;
+  pll_logl_block_t logl_block;
+
+  unsigned int states = 4;
+  unsigned int span = states * rate_cats;
+  unsigned int pairs = (rate_cats+1) / 2;
+
+  /* scaling stuff */
+  unsigned int site_scalings;
+  unsigned int * rate_scalings;
+  double scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+
+  if (!init_scaling(rate_cats, attrib, &rate_scalings, scale_minlh))
+    return -INFINITY;
+
+  /* precompute a lookup table of eight values per entry (four states for two
+     rate categories), for all 16 states (including ambiguities), which
+     already account for frequencies and rate weights */
+  double * lookup = pll_aligned_alloc(16 * pairs * 8 * sizeof(double),
+                                      PLL_ALIGNMENT_AVX512);
+  if (!lookup)
+  {
+    if (rate_scalings)
+      free(rate_scalings);
+
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate space for precomputation.");
+    return -INFINITY;
+  }
+
+  memset(lookup, 0, 16 * pairs * 8 * sizeof(double));
+  for (n = 1; n < 16; ++n)
+  {
+    for (k = 0; k < rate_cats; ++k)
+    {
+      const double * freqs = frequencies[freqs_indices[k]];
+      const double * pmat = pmatrix + k*16;
+      double w = rate_weight(rate_weights, invar_proportion, freqs_indices, k);
+      double * ptr = lookup + (n*pairs + k/2)*8 + (k & 1)*4;
+
+      for (i = 0; i < states; ++i)
+      {
+        double terml = 0;
+        for (j = 0; j < states; ++j)
+          if ((n >> j) & 1)
+            terml += pmat[i*4 + j];
+        ptr[i] = terml * freqs[i] * w;
+      }
+    }
+  }
+
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
+  for (n = 0; n < sites; ++n)
+  {
+    const double * clvp = parent_clv + n*span;
+    const double * lterm = lookup + tipchars[n]*pairs*8;
+
+    site_scalings = site_scalers(n,
+                                 rate_cats,
+                                 parent_scaler,
+                                 NULL,
+                                 rate_scalings);
+
+    __m512d v_terma = _mm512_setzero_pd();
+
+    for (k = 0; k < pairs; ++k)
+    {
+      __mmask8 m = (2*k+1 < rate_cats) ? 0xFF : 0x0F;
+      __m512d v_clvp = _mm512_maskz_loadu_pd(m, clvp + k*8);
+
+      /* apply per-rate scalers, if necessary */
+      if (rate_scalings)
+      {
+        unsigned int s0 = rate_scalings[2*k];
+        unsigned int s1 = (m & 0xF0) ? rate_scalings[2*k+1] : 0;
+
+        if (s0 || s1)
+        {
+          __m512d v_scale = _mm512_set_pd(s1 ? scale_minlh[s1-1] : 1.,
+                                          s1 ? scale_minlh[s1-1] : 1.,
+                                          s1 ? scale_minlh[s1-1] : 1.,
+                                          s1 ? scale_minlh[s1-1] : 1.,
+                                          s0 ? scale_minlh[s0-1] : 1.,
+                                          s0 ? scale_minlh[s0-1] : 1.,
+                                          s0 ? scale_minlh[s0-1] : 1.,
+                                          s0 ? scale_minlh[s0-1] : 1.);
+          v_clvp = _mm512_mul_pd(v_clvp, v_scale);
+        }
+      }
+
+      v_terma = _mm512_fmadd_pd(_mm512_load_pd(lterm + k*8), v_clvp, v_terma);
+    }
+
+    double terma = _mm512_reduce_add_pd(v_terma);
+    double terminv = site_invar_lk(rate_cats,
+                                   frequencies,
+                                   rate_weights,
+                                   invar_proportion,
+                                   freqs_indices,
+                                   invar_indices,
+                                   n);
+
+    site_likelihood_push(&logl_block,
+                         terma,
+                         terminv,
+                         site_scalings,
+                         scale_minlh);
+  }
+
+  pll_aligned_free(lookup);
+  if (rate_scalings)
+    free(rate_scalings);
+
+  return pll_core_logl_flush_avx(&logl_block);
+}
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_ti_avx512(unsigned int states,
+                                             unsigned int sites,
+                                             unsigned int rate_cats,
+                                             const double * parent_clv,
+                                             const unsigned int * parent_scaler,
+                                             const unsigned char * tipchars,
+                                             const pll_state_t * tipmap,
+                                             unsigned int tipmap_size,
+                                             const double * pmatrix,
+                                             double * const * frequencies,
+                                             const double * rate_weights,
+                                             const unsigned int * pattern_weights,
+                                             const double * invar_proportion,
+                                             const int * invar_indices,
+                                             const unsigned int * freqs_indices,
+                                             double * persite_lnl,
+                                             unsigned int attrib)
+{
+  unsigned int n,i,j,k;
+  pll_logl_block_t logl_block;
+
+  unsigned int states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int span_padded = states_padded * rate_cats;
+
+  if (states == 4)
+  {
+    return pll_core_edge_loglikelihood_ti_4x4_avx512(sites,
+                                                     rate_cats,
+                                                     parent_clv,
+                                                     parent_scaler,
+                                                     tipchars,
+                                                     pmatrix,
+                                                     frequencies,
+                                                     rate_weights,
+                                                     pattern_weights,
+                                                     invar_proportion,
+                                                     invar_indices,
+                                                     freqs_indices,
+                                                     persite_lnl,
+                                                     attrib);
+  }
+
+  /* scaling stuff */
+  unsigned int site_scalings;
+  unsigned int * rate_scalings;
+  double scale_minlh[PLL_SCALE_RATE_MAXDIFF];
+
+  if (!init_scaling(rate_cats, attrib, &rate_scalings, scale_minlh))
+    return -INFINITY;
+
+  /* precompute a lookup table with the tip-side values of all states
+     (including ambiguities) for each rate category, which already account for
+     frequencies and rate weights */
+  double * lookup = pll_aligned_alloc(tipmap_size * span_padded *
+                                      sizeof(double),
+                                      PLL_ALIGNMENT_AVX512);
+  if (!lookup)
+  {
+    if (rate_scalings)
+      free(rate_scalings);
+
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate space for precomputation.");
+    return -INFINITY;
+  }
+
+  memset(lookup, 0, tipmap_size * span_padded * sizeof(double));
+  for (n = 0; n < tipmap_size; ++n)
+  {
+    pll_state_t state = tipmap[n];
+
+    for (k = 0; k < rate_cats; ++k)
+    {
+      const double * freqs = frequencies[freqs_indices[k]];
+      const double * pmat = pmatrix + k*states*states_padded;
+      double w = rate_weight(rate_weights, invar_proportion, freqs_indices, k);
+      double * ptr = lookup + n*span_padded + k*states_padded;
+
+      for (i = 0; i < states; ++i)
+      {
+        double terml = 0;
+        for (j = 0; j < states; ++j)
+          if ((state >> j) & 1)
+            terml += pmat[i*states_padded + j];
+        ptr[i] = terml * freqs[i] * w;
+      }
+    }
+  }
+
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
+  for (n = 0; n < sites; ++n)
+  {
+    const double * clvp = parent_clv + n*span_padded;
+    const double * lterm = lookup + tipchars[n]*span_padded;
+
+    site_scalings = site_scalers(n,
+                                 rate_cats,
+                                 parent_scaler,
+                                 NULL,
+                                 rate_scalings);
+
+    __m512d v_terma = _mm512_setzero_pd();
+
+    for (k = 0; k < rate_cats; ++k)
+    {
+      __m512d v_rterma = _mm512_setzero_pd();
+
+      for (i = 0; i < states_padded; i += 8)
+      {
+        __mmask8 m = block_mask(states_padded - i);
+        __m512d v_clvp = _mm512_maskz_loadu_pd(m, clvp + i);
+        __m512d v_lterm = _mm512_maskz_loadu_pd(m, lterm + i);
+        v_rterma = _mm512_fmadd_pd(v_lterm, v_clvp, v_rterma);
+      }
+
+      /* apply per-rate scalers, if necessary */
+      if (rate_scalings && rate_scalings[k] > 0)
+        v_rterma = _mm512_mul_pd(v_rterma,
+                          _mm512_set1_pd(scale_minlh[rate_scalings[k]-1]));
+
+      v_terma = _mm512_add_pd(v_terma, v_rterma);
+
+      clvp  += states_padded;
+      lterm += states_padded;
+    }
+
+    double terma = _mm512_reduce_add_pd(v_terma);
+    double terminv = site_invar_lk(rate_cats,
+                                   frequencies,
+                                   rate_weights,
+                                   invar_proportion,
+                                   freqs_indices,
+                                   invar_indices,
+                                   n);
+
+    site_likelihood_push(&logl_block,
+                         terma,
+                         terminv,
+                         site_scalings,
+                         scale_minlh);
+  }
+
+  pll_aligned_free(lookup);
+  if (rate_scalings)
+    free(rate_scalings);
+
+  return pll_core_logl_flush_avx(&logl_block);
+}
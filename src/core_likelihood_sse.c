@@ -20,7 +20,9 @@
 */
 
 #include <limits.h>
+#include <float.h>
 #include "pll.h"
+#include "pll_private.h"
 
 PLL_EXPORT double pll_core_root_loglikelihood_sse(unsigned int states,
                                                   unsigned int sites,
@@ -36,7 +38,7 @@ PLL_EXPORT double pll_core_root_loglikelihood_sse(unsigned int states,
                                                   double * persite_lnl)
 {
   unsigned int i,j,k;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   double prop_invar = 0;
 
   const double * freqs = NULL;
@@ -48,6 +50,8 @@ PLL_EXPORT double pll_core_root_loglikelihood_sse(unsigned int states,
 
   __m128d xmm0, xmm1, xmm2, xmm3;
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (i = 0; i < sites; ++i)
   {
     term = 0;
@@ -91,20 +95,10 @@ PLL_EXPORT double pll_core_root_loglikelihood_sse(unsigned int states,
       }
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    term = log(term);
-    if (scaler && scaler[i])
-      term += scaler[i] * log(PLL_SCALE_THRESHOLD);
-
-    term *= pattern_weights[i];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[i] = term;
-
-    logl += term;
+    pll_core_logl_push(&logl_block, term, scaler ? scaler[i] : 0,
+                       pll_core_logl_flush_sse);
   }
-  return logl;
+  return pll_core_logl_flush_sse(&logl_block);
 }
 
 PLL_EXPORT double pll_core_root_loglikelihood_repeats_sse(unsigned int states,
@@ -122,7 +116,7 @@ PLL_EXPORT double pll_core_root_loglikelihood_repeats_sse(unsigned int states,
                                                           double * persite_lnl)
 {
   unsigned int i,j,k;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   double prop_invar = 0;
 
   const double * freqs = NULL;
@@ -135,6 +129,8 @@ PLL_EXPORT double pll_core_root_loglikelihood_repeats_sse(unsigned int states,
 
   __m128d xmm0, xmm1, xmm2, xmm3;
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (i = 0; i < sites; ++i)
   {
     unsigned int id = PLL_GET_ID(site_id, i);
@@ -180,20 +176,10 @@ PLL_EXPORT double pll_core_root_loglikelihood_repeats_sse(unsigned int states,
       }
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    term = log(term);
-    if (scaler && scaler[id])
-      term += scaler[id] * log(PLL_SCALE_THRESHOLD);
-
-    term *= pattern_weights[i];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[i] = term;
-
-    logl += term;
+    pll_core_logl_push(&logl_block, term, scaler ? scaler[id] : 0,
+                       pll_core_logl_flush_sse);
   }
-  return logl;
+  return pll_core_logl_flush_sse(&logl_block);
 }
 
 PLL_EXPORT double pll_core_root_loglikelihood_4x4_sse(unsigned int sites,
@@ -209,7 +195,7 @@ PLL_EXPORT double pll_core_root_loglikelihood_4x4_sse(unsigned int sites,
                                                       double * persite_lnl)
 {
   unsigned int i,j;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   double prop_invar = 0;
 
   const double * freqs = NULL;
@@ -219,6 +205,8 @@ PLL_EXPORT double pll_core_root_loglikelihood_4x4_sse(unsigned int sites,
 
   __m128d xmm0, xmm1, xmm2, xmm3, xmm4, xmm5;
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (i = 0; i < sites; ++i)
   {
     term = 0;
@@ -260,20 +248,10 @@ PLL_EXPORT double pll_core_root_loglikelihood_4x4_sse(unsigned int sites,
       clv += 4;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    term = log(term);
-    if (scaler && scaler[i])
-      term += scaler[i] * log(PLL_SCALE_THRESHOLD);
-
-    term *= pattern_weights[i];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[i] = term;
-
-    logl += term;
+    pll_core_logl_push(&logl_block, term, scaler ? scaler[i] : 0,
+                       pll_core_logl_flush_sse);
   }
-  return logl;
+  return pll_core_logl_flush_sse(&logl_block);
 }
 
 PLL_EXPORT
@@ -295,7 +273,7 @@ double pll_core_edge_loglikelihood_ti_sse(unsigned int states,
                                           unsigned int attrib)
 {
   unsigned int n,i,j,k;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   double prop_invar = 0;
 
   const double * clvp = parent_clv;
@@ -303,7 +281,7 @@ double pll_core_edge_loglikelihood_ti_sse(unsigned int states,
   const double * freqs = NULL;
 
   double terma, terma_r, terminv;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   pll_state_t cstate;
   unsigned int states_padded = (states+1) & 0xFFFFFFFE;
@@ -342,6 +320,8 @@ double pll_core_edge_loglikelihood_ti_sse(unsigned int states,
     }
   }
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (n = 0; n < sites; ++n)
   {
     pmat = pmatrix;
@@ -462,40 +442,23 @@ double pll_core_edge_loglikelihood_ti_sse(unsigned int states,
       pmat -= displacement;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    if (site_scalings)
+    if (site_scalings && terminv > 0.)
     {
-      if (terminv > 0.)
-      {
-        /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
-        unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
-        double scale_factor = scale_minlh[capped_scalings-1];
-        site_lk = log(terma * scale_factor + terminv);
-      }
-      else
-      {
-        site_lk = log(terma);
-        site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-      }
+      /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
+      unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
+      double scale_factor = scale_minlh[capped_scalings-1];
+      pll_core_logl_push(&logl_block, terma * scale_factor + terminv, 0,
+                         pll_core_logl_flush_sse);
     }
     else
-    {
-      site_lk = log(terma + terminv);
-    }
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+      pll_core_logl_push(&logl_block, terma + terminv, site_scalings,
+                         pll_core_logl_flush_sse);
   }
 
   if (rate_scalings)
     free(rate_scalings);
 
-  return logl;
+  return pll_core_logl_flush_sse(&logl_block);
 }
 
 PLL_EXPORT
@@ -517,7 +480,7 @@ double pll_core_edge_loglikelihood_ii_sse(unsigned int states,
                                           unsigned int attrib)
 {
   unsigned int n,i,j,k;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   double prop_invar = 0;
 
   const double * clvp = parent_clv;
@@ -526,7 +489,7 @@ double pll_core_edge_loglikelihood_ii_sse(unsigned int states,
   const double * freqs = NULL;
 
   double terma, terma_r, terminv;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int states_padded = (states+1) & 0xFFFFFFFE;
 
@@ -562,6 +525,8 @@ double pll_core_edge_loglikelihood_ii_sse(unsigned int states,
     }
   }
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (n = 0; n < sites; ++n)
   {
     pmat = pmatrix;
@@ -675,40 +640,23 @@ double pll_core_edge_loglikelihood_ii_sse(unsigned int states,
       pmat -= displacement;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    if (site_scalings)
+    if (site_scalings && terminv > 0.)
     {
-      if (terminv > 0.)
-      {
-        /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
-        unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
-        double scale_factor = scale_minlh[capped_scalings-1];
-        site_lk = log(terma * scale_factor + terminv);
-      }
-      else
-      {
-        site_lk = log(terma);
-        site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-      }
+      /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
+      unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
+      double scale_factor = scale_minlh[capped_scalings-1];
+      pll_core_logl_push(&logl_block, terma * scale_factor + terminv, 0,
+                         pll_core_logl_flush_sse);
     }
     else
-    {
-      site_lk = log(terma + terminv);
-    }
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+      pll_core_logl_push(&logl_block, terma + terminv, site_scalings,
+                         pll_core_logl_flush_sse);
   }
 
   if (rate_scalings)
     free(rate_scalings);
 
-  return logl;
+  return pll_core_logl_flush_sse(&logl_block);
 }
 
 PLL_EXPORT
@@ -734,14 +682,14 @@ double pll_core_edge_loglikelihood_repeats_generic_sse(unsigned int states,
                                                        unsigned int attrib)
 {
   unsigned int n,i,j,k;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   double prop_invar = 0;
 
   const double * pmat;
   const double * freqs = NULL;
 
   double terma, terma_r, terminv;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int states_padded = (states+1) & 0xFFFFFFFE;
   unsigned int span = rate_cats*states_padded;
@@ -778,6 +726,8 @@ double pll_core_edge_loglikelihood_repeats_generic_sse(unsigned int states,
     }
   }
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (n = 0; n < sites; ++n)
   {
     unsigned int pid = PLL_GET_ID(parent_site_id, n);
@@ -895,40 +845,23 @@ double pll_core_edge_loglikelihood_repeats_generic_sse(unsigned int states,
       pmat -= displacement;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    if (site_scalings)
+    if (site_scalings && terminv > 0.)
     {
-      if (terminv > 0.)
-      {
-        /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
-        unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
-        double scale_factor = scale_minlh[capped_scalings-1];
-        site_lk = log(terma * scale_factor + terminv);
-      }
-      else
-      {
-        site_lk = log(terma);
-        site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-      }
+      /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
+      unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
+      double scale_factor = scale_minlh[capped_scalings-1];
+      pll_core_logl_push(&logl_block, terma * scale_factor + terminv, 0,
+                         pll_core_logl_flush_sse);
     }
     else
-    {
-      site_lk = log(terma + terminv);
-    }
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+      pll_core_logl_push(&logl_block, terma + terminv, site_scalings,
+                         pll_core_logl_flush_sse);
   }
 
   if (rate_scalings)
     free(rate_scalings);
 
-  return logl;
+  return pll_core_logl_flush_sse(&logl_block);
 }
 
 PLL_EXPORT
@@ -949,7 +882,7 @@ double pll_core_edge_loglikelihood_ii_4x4_sse(unsigned int sites,
                                               unsigned int attrib)
 {
   unsigned int n,i;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   double prop_invar = 0;
 
   const double * clvp = parent_clv;
@@ -958,7 +891,7 @@ double pll_core_edge_loglikelihood_ii_4x4_sse(unsigned int sites,
   const double * freqs = NULL;
 
   double terma, terma_r, terminv;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int states = 4;
   unsigned int states_padded = 4;
@@ -992,6 +925,8 @@ double pll_core_edge_loglikelihood_ii_4x4_sse(unsigned int sites,
     }
   }
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (n = 0; n < sites; ++n)
   {
     pmat = pmatrix;
@@ -1137,40 +1072,23 @@ double pll_core_edge_loglikelihood_ii_4x4_sse(unsigned int sites,
       clvc += states_padded;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    if (site_scalings)
+    if (site_scalings && terminv > 0.)
     {
-      if (terminv > 0.)
-      {
-        /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
-        unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
-        double scale_factor = scale_minlh[capped_scalings-1];
-        site_lk = log(terma * scale_factor + terminv);
-      }
-      else
-      {
-        site_lk = log(terma);
-        site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-      }
+      /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
+      unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
+      double scale_factor = scale_minlh[capped_scalings-1];
+      pll_core_logl_push(&logl_block, terma * scale_factor + terminv, 0,
+                         pll_core_logl_flush_sse);
     }
     else
-    {
-      site_lk = log(terma + terminv);
-    }
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+      pll_core_logl_push(&logl_block, terma + terminv, site_scalings,
+                         pll_core_logl_flush_sse);
   }
 
   if (rate_scalings)
     free(rate_scalings);
 
-  return logl;
+  return pll_core_logl_flush_sse(&logl_block);
 }
 
 PLL_EXPORT
@@ -1190,7 +1108,7 @@ double pll_core_edge_loglikelihood_ti_4x4_sse(unsigned int sites,
                                               unsigned int attrib)
 {
   unsigned int i,k,n;
-  double logl = 0;
+  pll_logl_block_t logl_block;
   double prop_invar = 0;
 
   const double * clvp = parent_clv;
@@ -1198,7 +1116,7 @@ double pll_core_edge_loglikelihood_ti_4x4_sse(unsigned int sites,
   const double * freqs = NULL;
 
   double terma, terma_r, terminv;
-  double site_lk, inv_site_lk;
+  double inv_site_lk;
 
   unsigned int cstate;
   unsigned int states_padded = 4;
@@ -1338,6 +1256,8 @@ double pll_core_edge_loglikelihood_ti_4x4_sse(unsigned int sites,
     }
   }
 
+  pll_core_logl_init(&logl_block, pattern_weights, persite_lnl);
+
   for (n = 0; n < sites; ++n)
   {
     pmat = pmatrix;
@@ -1419,39 +1339,104 @@ double pll_core_edge_loglikelihood_ti_4x4_sse(unsigned int sites,
       coffset += 4;
     }
 
-    /* compute site log-likelihood and scale if necessary */
-    if (site_scalings)
+    if (site_scalings && terminv > 0.)
     {
-      if (terminv > 0.)
-      {
-        /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
-        unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
-        double scale_factor = scale_minlh[capped_scalings-1];
-        site_lk = log(terma * scale_factor + terminv);
-      }
-      else
-      {
-        site_lk = log(terma);
-        site_lk += site_scalings * log(PLL_SCALE_THRESHOLD);
-      }
+      /* IMPORTANT: undoing the scaling for non-variant likelihood term only! */
+      unsigned int capped_scalings = PLL_MIN(site_scalings, PLL_SCALE_RATE_MAXDIFF);
+      double scale_factor = scale_minlh[capped_scalings-1];
+      pll_core_logl_push(&logl_block, terma * scale_factor + terminv, 0,
+                         pll_core_logl_flush_sse);
     }
     else
-    {
-      site_lk = log(terma + terminv);
-    }
-
-    site_lk *= pattern_weights[n];
-
-    /* store per-site log-likelihood */
-    if (persite_lnl)
-      persite_lnl[n] = site_lk;
-
-    logl += site_lk;
+      pll_core_logl_push(&logl_block, terma + terminv, site_scalings,
+                         pll_core_logl_flush_sse);
   }
 
   pll_aligned_free(lookup);
   if (rate_scalings)
     free(rate_scalings);
 
-  return logl;
+  return pll_core_logl_flush_sse(&logl_block);
+}
+
+/* Natural logarithm of positive normal values, with the algorithm of fdlibm's
+   log(). The SSE and AVX versions perform the same sequence of operations
+   (without FMA), such that all vectorized builds obtain identical site
+   log-likelihoods */
+static __m128d log_sse(__m128d x)
+{
+  const __m128d v_one = _mm_set1_pd(1.0);
+  const __m128d v_half = _mm_set1_pd(0.5);
+
+  /* x = 2^e * m, with m in [sqrt(2)/2, sqrt(2)) */
+  __m128i v_exp = _mm_srli_epi64(_mm_castpd_si128(x), 52);
+  v_exp = _mm_or_si128(v_exp, _mm_set1_epi64x(0x4330000000000000LL));
+  __m128d v_e = _mm_sub_pd(_mm_castsi128_pd(v_exp),
+                           _mm_set1_pd(4503599627370496.0 + 1023));
+  __m128d v_m = _mm_or_pd(_mm_and_pd(x,
+                    _mm_castsi128_pd(_mm_set1_epi64x(0x000FFFFFFFFFFFFFLL))),
+                          v_one);
+  __m128d v_big = _mm_cmpgt_pd(v_m, _mm_set1_pd(1.41421356237309504880));
+  v_m = _mm_or_pd(_mm_and_pd(v_big, _mm_mul_pd(v_m, v_half)),
+                  _mm_andnot_pd(v_big, v_m));
+  v_e = _mm_add_pd(v_e, _mm_and_pd(v_big, v_one));
+
+  /* log(m) = 2s + s*R(s^2), with s = f / (2+f) */
+  __m128d v_f = _mm_sub_pd(v_m, v_one);
+  __m128d v_s = _mm_div_pd(v_f, _mm_add_pd(_mm_set1_pd(2.0), v_f));
+  __m128d v_z = _mm_mul_pd(v_s, v_s);
+  __m128d v_w = _mm_mul_pd(v_z, v_z);
+
+  __m128d v_t1 = _mm_mul_pd(v_w, _mm_set1_pd(PLL_LOG_LG7));
+  v_t1 = _mm_mul_pd(v_w, _mm_add_pd(_mm_set1_pd(PLL_LOG_LG5), v_t1));
+  v_t1 = _mm_mul_pd(v_w, _mm_add_pd(_mm_set1_pd(PLL_LOG_LG3), v_t1));
+  v_t1 = _mm_mul_pd(v_z, _mm_add_pd(_mm_set1_pd(PLL_LOG_LG1), v_t1));
+  __m128d v_t2 = _mm_mul_pd(v_w, _mm_set1_pd(PLL_LOG_LG6));
+  v_t2 = _mm_mul_pd(v_w, _mm_add_pd(_mm_set1_pd(PLL_LOG_LG4), v_t2));
+  v_t2 = _mm_mul_pd(v_w, _mm_add_pd(_mm_set1_pd(PLL_LOG_LG2), v_t2));
+  __m128d v_r = _mm_add_pd(v_t1, v_t2);
+  __m128d v_hfsq = _mm_mul_pd(_mm_mul_pd(v_half, v_f), v_f);
+
+  __m128d v_lo = _mm_add_pd(_mm_mul_pd(v_s, _mm_add_pd(v_hfsq, v_r)),
+                            _mm_mul_pd(v_e, _mm_set1_pd(PLL_LOG_LN2_LO)));
+  return _mm_sub_pd(_mm_mul_pd(v_e, _mm_set1_pd(PLL_LOG_LN2_HI)),
+                    _mm_sub_pd(_mm_sub_pd(v_hfsq, v_lo), v_f));
+}
+
+double pll_core_logl_flush_sse(pll_logl_block_t * block)
+{
+  unsigned int k, j;
+  unsigned int count = block->count;
+  double x[2] __attribute__ ((aligned (PLL_ALIGNMENT_SSE)));
+
+  for (k = 0; k < count; k += 2)
+  {
+    __m128d v_x;
+
+    /* the last site is padded with a one */
+    if (k+2 <= count)
+      v_x = _mm_loadu_pd(block->lk + k);
+    else
+      v_x = _mm_set_pd(1.0, block->lk[k]);
+
+    __m128d v_valid = _mm_and_pd(_mm_cmpge_pd(v_x, _mm_set1_pd(DBL_MIN)),
+                                 _mm_cmple_pd(v_x, _mm_set1_pd(DBL_MAX)));
+    int valid = _mm_movemask_pd(v_valid);
+
+    if (valid == 3 && k+2 <= count)
+    {
+      _mm_storeu_pd(block->lk + k, log_sse(v_x));
+      continue;
+    }
+
+    /* zero, subnormal and non-finite values are left to the C library */
+    v_x = _mm_or_pd(_mm_and_pd(v_valid, v_x),
+                    _mm_andnot_pd(v_valid, _mm_set1_pd(1.0)));
+    _mm_store_pd(x, log_sse(v_x));
+
+    for (j = 0; j < 2 && k+j < count; ++j)
+      block->lk[k+j] = (valid & (1 << j)) ? x[j] : log(block->lk[k+j]);
+  }
+
+  return pll_core_logl_accumulate(block);
 }
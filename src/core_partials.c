@@ -178,6 +178,33 @@ PLL_EXPORT void pll_core_update_partial_tt(unsigned int states,
     return;
   }
   #endif
+  #ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    if (states == 4)
+      pll_core_update_partial_tt_4x4_avx(sites,
+                                         rate_cats,
+                                         parent_clv,
+                                         parent_scaler,
+                                         left_tipchars,
+                                         right_tipchars,
+                                         lookup,
+                                         attrib);
+    else
+      pll_core_update_partial_tt_avx(states,
+                                     sites,
+                                     rate_cats,
+                                     parent_clv,
+                                     parent_scaler,
+                                     left_tipchars,
+                                     right_tipchars,
+                                     lookup,
+                                     tipmap_size,
+                                     attrib);
+
+    return;
+  }
+  #endif
 
   unsigned int span = states * rate_cats;
   unsigned int log2_maxstates = (unsigned int) ceil(log2(tipmap_size));
@@ -274,6 +301,22 @@ PLL_EXPORT void pll_core_update_partial_ti_4x4(unsigned int sites,
     return;
   }
   #endif
+  #ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    pll_core_update_partial_ti_4x4_avx512(sites,
+                                          rate_cats,
+                                          parent_clv,
+                                          parent_scaler,
+                                          left_tipchars,
+                                          right_clv,
+                                          left_matrix,
+                                          right_matrix,
+                                          right_scaler,
+                                          attrib);
+    return;
+  }
+  #endif
 
   /* init scaling-related stuff */
   if (parent_scaler)
@@ -377,10 +420,10 @@ PLL_EXPORT void pll_core_update_partial_ti(unsigned int states,
                                            unsigned int tipmap_size,
                                            unsigned int attrib)
 {
-  int scaling;
+  unsigned int scale_mode;  /* 0 = none, 1 = per-site, 2 = per-rate */
+  unsigned int site_scale;
+  unsigned int init_mask;
   unsigned int span = states * rate_cats;
-  unsigned int scaler_size = (attrib & PLL_ATTRIB_RATE_SCALERS) ?
-                                                        sites*rate_cats : sites;
 
   const double * lmat;
   const double * rmat;
@@ -454,6 +497,25 @@ PLL_EXPORT void pll_core_update_partial_ti(unsigned int states,
     return;
   }
 #endif
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    pll_core_update_partial_ti_avx512(states,
+                                      sites,
+                                      rate_cats,
+                                      parent_clv,
+                                      parent_scaler,
+                                      left_tipchars,
+                                      right_clv,
+                                      left_matrix,
+                                      right_matrix,
+                                      right_scaler,
+                                      tipmap,
+                                      tipmap_size,
+                                      attrib);
+    return;
+  }
+#endif
 
   if (states == 4)
   {
@@ -470,24 +532,39 @@ PLL_EXPORT void pll_core_update_partial_ti(unsigned int states,
     return;
   }
 
+  /* init scaling-related stuff */
+  if (parent_scaler)
+  {
+    /* determine the scaling mode and init the vars accordingly */
+    scale_mode = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1;
+    init_mask = (scale_mode == 1) ? 1 : 0;
+    const unsigned int scaler_size = (scale_mode == 2) ? sites * rate_cats : sites;
+
+    /* add up the scale vectors of the two children if available */
+    fill_parent_scaler(scaler_size, parent_scaler, NULL, right_scaler);
+  }
+  else
+  {
+    /* scaling disabled / not required */
+    scale_mode = init_mask = 0;
+  }
+
   double* orig_parent_clv = parent_clv;
   double* orig_right_clv = right_clv;
 
-  if (parent_scaler)
-    fill_parent_scaler(scaler_size, parent_scaler, NULL, right_scaler);
-#pragma omp parallel for private(lmat, rmat, parent_clv, right_clv, scaling)
+#pragma omp parallel for private(lmat, rmat, site_scale, parent_clv, right_clv)
   for (unsigned int n = 0; n < sites; ++n)
   {
     lmat = left_matrix;
     rmat = right_matrix;
-
-    scaling = (parent_scaler) ? 1 : 0;
+    site_scale = init_mask;
 
     for (unsigned int k = 0; k < rate_cats; ++k)
     {
       parent_clv = orig_parent_clv + (n * rate_cats * states ) + (k * states);
       right_clv = orig_right_clv + (n * rate_cats * states ) + (k * states);
 
+      unsigned int rate_scale = 1;
       for (unsigned int i = 0; i < states; ++i)
       {
         double terma = 0;
@@ -506,14 +583,27 @@ PLL_EXPORT void pll_core_update_partial_ti(unsigned int states,
         lmat += states;
         rmat += states;
 
-        scaling = scaling && (parent_clv[i] < PLL_SCALE_THRESHOLD);
+        rate_scale &= (parent_clv[i] < PLL_SCALE_THRESHOLD);
       }
-      // parent_clv += states;
-      // right_clv  += states;
+
+      /* check if scaling is needed for the current rate category */
+      if (scale_mode == 2)
+      {
+        /* PER-RATE SCALING: if *all* entries of the *rate* CLV were below
+         * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+        if (rate_scale)
+        {
+          for (unsigned int i = 0; i < states; ++i)
+            parent_clv[i] *= PLL_SCALE_FACTOR;
+          parent_scaler[n*rate_cats + k] += 1;
+        }
+      }
+      else
+        site_scale = site_scale && rate_scale;
     }
-    /* if *all* entries of the site CLV were below the threshold then scale
-       (all) entries by PLL_SCALE_FACTOR */
-    if (scaling)
+    /* PER-SITE SCALING: if *all* entries of the *site* CLV were below
+     * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+    if (site_scale)
     {
       parent_clv -= span - states;
       for (unsigned int i = 0; i < span; ++i)
@@ -596,13 +686,25 @@ PLL_EXPORT void pll_core_update_partial_repeats(unsigned int states,
   if (attrib & PLL_ATTRIB_ARCH_AVX2 &&  PLL_STAT(avx2_present))
   { 
     core_update_partials = pll_core_update_partial_repeats_generic_avx2;
-    if (states == 4) 
+    if (states == 4)
     {
-      // for DNA, avx is faster than avx2
       if (use_bclv)
-        core_update_partials = pll_core_update_partial_repeatsbclv_4x4_avx;
-      else  
-        core_update_partials = pll_core_update_partial_repeats_4x4_avx;
+        core_update_partials = pll_core_update_partial_repeatsbclv_4x4_avx2;
+      else
+        core_update_partials = pll_core_update_partial_repeats_4x4_avx2;
+    }
+  }
+#endif
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 &&  PLL_STAT(avx512f_present))
+  {
+    core_update_partials = pll_core_update_partial_repeats_generic_avx2;
+    if (states == 4)
+    {
+      if (use_bclv)
+        core_update_partials = pll_core_update_partial_repeatsbclv_4x4_avx2;
+      else
+        core_update_partials = pll_core_update_partial_repeats_4x4_avx2;
     }
   }
 #endif
@@ -703,6 +805,24 @@ PLL_EXPORT void pll_core_update_partial_ii(unsigned int states,
     return;
   }
 #endif
+#ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    pll_core_update_partial_ii_avx512(states,
+                                      sites,
+                                      rate_cats,
+                                      parent_clv,
+                                      parent_scaler,
+                                      left_clv,
+                                      right_clv,
+                                      left_matrix,
+                                      right_matrix,
+                                      left_scaler,
+                                      right_scaler,
+                                      attrib);
+    return;
+  }
+#endif
 
   /* init scaling-related stuff */
   if (parent_scaler)
@@ -1161,6 +1281,25 @@ PLL_EXPORT void pll_core_create_lookup(unsigned int states,
     return;
   }
   #endif
+  #ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    if (states == 4)
+      pll_core_create_lookup_4x4_avx(rate_cats,
+                                     lookup,
+                                     left_matrix,
+                                     right_matrix);
+    else
+      pll_core_create_lookup_avx(states,
+                                 rate_cats,
+                                 lookup,
+                                 left_matrix,
+                                 right_matrix,
+                                 tipmap,
+                                 tipmap_size);
+    return;
+  }
+  #endif
   if (states == 4)
   {
     pll_core_create_lookup_4x4(rate_cats,
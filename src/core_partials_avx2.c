@@ -20,6 +20,7 @@
 */
 
 #include "pll.h"
+#include "pll_private.h"
 
 static void fill_parent_scaler(unsigned int scaler_size,
                                unsigned int * parent_scaler,
@@ -98,6 +99,24 @@ PLL_EXPORT void pll_core_update_partial_ti_avx2(unsigned int states,
     return;
   }
 
+  /* dedicated functions for 61x61 matrices (codons) */
+  if (states == 61)
+  {
+    pll_core_update_partial_ti_61x61_avx2(sites,
+                                          rate_cats,
+                                          parent_clv,
+                                          parent_scaler,
+                                          left_tipchars,
+                                          right_clv,
+                                          left_matrix,
+                                          right_matrix,
+                                          right_scaler,
+                                          tipmap,
+                                          tipmap_size,
+                                          attrib);
+    return;
+  }
+
   /* scaling-related stuff */
   unsigned int scale_mode;  /* 0 = none, 1 = per-site, 2 = per-rate */
   unsigned int init_mask;
@@ -820,6 +839,320 @@ PLL_EXPORT void pll_core_update_partial_ii_20x20_avx2(unsigned int sites,
   }
 }
 
+/* Blocked kernel for state spaces without a dedicated kernel. Instead of
+   one matrix-vector product per site and rate category, a block of sites is
+   treated as a matrix-matrix product of the transposed p-matrix with the
+   block of child CLVs. The product is computed in strips of eight states,
+   such that the strip of the p-matrix stays in L1 cache while it is applied
+   to all sites of the block. Each step of the inner loop updates a register
+   tile of eight states times four sites, i.e. every p-matrix load is reused
+   for four sites and every CLV broadcast for eight states */
+
+/* p[s][i..i+7] = (or *=) sum_j mt[j][i..i+7] * c[s][j] for four sites s */
+static void ii_tile8_avx2(unsigned int states,
+                          unsigned int states_padded,
+                          const double * mt,
+                          const double * const * c,
+                          double * const * p,
+                          unsigned int i,
+                          int multiply)
+{
+  unsigned int j;
+
+  __m256d a00 = _mm256_setzero_pd(), a01 = _mm256_setzero_pd();
+  __m256d a10 = _mm256_setzero_pd(), a11 = _mm256_setzero_pd();
+  __m256d a20 = _mm256_setzero_pd(), a21 = _mm256_setzero_pd();
+  __m256d a30 = _mm256_setzero_pd(), a31 = _mm256_setzero_pd();
+
+  const double * m = mt + i;
+  for (j = 0; j < states; ++j)
+  {
+    __m256d v_m0 = _mm256_load_pd(m);
+    __m256d v_m1 = _mm256_load_pd(m+4);
+    __m256d v_c;
+
+    v_c = _mm256_broadcast_sd(c[0]+j);
+    a00 = _mm256_fmadd_pd(v_m0, v_c, a00);
+    a01 = _mm256_fmadd_pd(v_m1, v_c, a01);
+
+    v_c = _mm256_broadcast_sd(c[1]+j);
+    a10 = _mm256_fmadd_pd(v_m0, v_c, a10);
+    a11 = _mm256_fmadd_pd(v_m1, v_c, a11);
+
+    v_c = _mm256_broadcast_sd(c[2]+j);
+    a20 = _mm256_fmadd_pd(v_m0, v_c, a20);
+    a21 = _mm256_fmadd_pd(v_m1, v_c, a21);
+
+    v_c = _mm256_broadcast_sd(c[3]+j);
+    a30 = _mm256_fmadd_pd(v_m0, v_c, a30);
+    a31 = _mm256_fmadd_pd(v_m1, v_c, a31);
+
+    m += states_padded;
+  }
+
+  if (multiply)
+  {
+    a00 = _mm256_mul_pd(a00, _mm256_load_pd(p[0]+i));
+    a01 = _mm256_mul_pd(a01, _mm256_load_pd(p[0]+i+4));
+    a10 = _mm256_mul_pd(a10, _mm256_load_pd(p[1]+i));
+    a11 = _mm256_mul_pd(a11, _mm256_load_pd(p[1]+i+4));
+    a20 = _mm256_mul_pd(a20, _mm256_load_pd(p[2]+i));
+    a21 = _mm256_mul_pd(a21, _mm256_load_pd(p[2]+i+4));
+    a30 = _mm256_mul_pd(a30, _mm256_load_pd(p[3]+i));
+    a31 = _mm256_mul_pd(a31, _mm256_load_pd(p[3]+i+4));
+  }
+
+  _mm256_store_pd(p[0]+i, a00);
+  _mm256_store_pd(p[0]+i+4, a01);
+  _mm256_store_pd(p[1]+i, a10);
+  _mm256_store_pd(p[1]+i+4, a11);
+  _mm256_store_pd(p[2]+i, a20);
+  _mm256_store_pd(p[2]+i+4, a21);
+  _mm256_store_pd(p[3]+i, a30);
+  _mm256_store_pd(p[3]+i+4, a31);
+}
+
+/* same as above for the last four states if states_padded is not a multiple
+   of eight */
+static void ii_tile4_avx2(unsigned int states,
+                          unsigned int states_padded,
+                          const double * mt,
+                          const double * const * c,
+                          double * const * p,
+                          unsigned int i,
+                          int multiply)
+{
+  unsigned int j;
+
+  __m256d a0 = _mm256_setzero_pd();
+  __m256d a1 = _mm256_setzero_pd();
+  __m256d a2 = _mm256_setzero_pd();
+  __m256d a3 = _mm256_setzero_pd();
+
+  const double * m = mt + i;
+  for (j = 0; j < states; ++j)
+  {
+    __m256d v_m = _mm256_load_pd(m);
+
+    a0 = _mm256_fmadd_pd(v_m, _mm256_broadcast_sd(c[0]+j), a0);
+    a1 = _mm256_fmadd_pd(v_m, _mm256_broadcast_sd(c[1]+j), a1);
+    a2 = _mm256_fmadd_pd(v_m, _mm256_broadcast_sd(c[2]+j), a2);
+    a3 = _mm256_fmadd_pd(v_m, _mm256_broadcast_sd(c[3]+j), a3);
+
+    m += states_padded;
+  }
+
+  if (multiply)
+  {
+    a0 = _mm256_mul_pd(a0, _mm256_load_pd(p[0]+i));
+    a1 = _mm256_mul_pd(a1, _mm256_load_pd(p[1]+i));
+    a2 = _mm256_mul_pd(a2, _mm256_load_pd(p[2]+i));
+    a3 = _mm256_mul_pd(a3, _mm256_load_pd(p[3]+i));
+  }
+
+  _mm256_store_pd(p[0]+i, a0);
+  _mm256_store_pd(p[1]+i, a1);
+  _mm256_store_pd(p[2]+i, a2);
+  _mm256_store_pd(p[3]+i, a3);
+}
+
+/* apply the transposed matrix mt to the CLVs c of the sites in a block and
+   store (or multiply) the result into p. The number of sites must be a
+   multiple of PLL_II_TILE_SITES */
+void pll_core_block_product_avx2(unsigned int states,
+                                 unsigned int states_padded,
+                                 unsigned int block_sites,
+                                 const double * mt,
+                                 const double * const * c,
+                                 double * const * p,
+                                 int multiply)
+{
+  unsigned int i,s;
+
+  for (i = 0; i + 8 <= states_padded; i += 8)
+    for (s = 0; s < block_sites; s += PLL_II_TILE_SITES)
+      ii_tile8_avx2(states, states_padded, mt, c+s, p+s, i, multiply);
+
+  if (i < states_padded)
+    for (s = 0; s < block_sites; s += PLL_II_TILE_SITES)
+      ii_tile4_avx2(states, states_padded, mt, c+s, p+s, i, multiply);
+}
+
+/* mt[j][i] = mat[i][j] for each rate category, zero-padded to
+   states_padded x states_padded */
+void pll_core_transpose_matrices_avx2(double * mt,
+                                      const double * mat,
+                                      unsigned int states,
+                                      unsigned int states_padded,
+                                      unsigned int rate_cats)
+{
+  unsigned int i,j,k;
+  size_t const matrix_size = (size_t)states_padded * states_padded;
+
+  memset(mt, 0, rate_cats * matrix_size * sizeof(double));
+  for (k = 0; k < rate_cats; ++k)
+  {
+    for (i = 0; i < states; ++i)
+      for (j = 0; j < states; ++j)
+        mt[j*states_padded + i] = mat[i*states_padded + j];
+
+    mt += matrix_size;
+    mat += states * states_padded;
+  }
+}
+
+/* returns 0xF if all entries of the (padded) CLV block are below the
+   scaling threshold */
+static unsigned int below_threshold_avx2(const double * clv,
+                                         unsigned int size)
+{
+  unsigned int i;
+  unsigned int mask = 0xF;
+  __m256d v_scale_threshold = _mm256_set1_pd(PLL_SCALE_THRESHOLD);
+
+  for (i = 0; i < size && mask == 0xF; i += 4)
+  {
+    __m256d v_cmp = _mm256_cmp_pd(_mm256_load_pd(clv+i),
+                                  v_scale_threshold,
+                                  _CMP_LT_OS);
+    mask &= _mm256_movemask_pd(v_cmp);
+  }
+
+  return mask;
+}
+
+void pll_core_scale_clv_avx2(double * clv, unsigned int size, double factor)
+{
+  unsigned int i;
+  __m256d v_factor = _mm256_set1_pd(factor);
+
+  for (i = 0; i < size; i += 4)
+    _mm256_store_pd(clv+i, _mm256_mul_pd(_mm256_load_pd(clv+i), v_factor));
+}
+
+/* scale the CLV of site n if all its entries (per-site scaling) or all
+   entries of a rate category (per-rate scaling) are below the threshold */
+void pll_core_scale_site_avx2(double * site_clv,
+                              unsigned int n,
+                              unsigned int states_padded,
+                              unsigned int rate_cats,
+                              unsigned int * parent_scaler,
+                              unsigned int attrib)
+{
+  unsigned int k;
+  unsigned int const span_padded = states_padded * rate_cats;
+
+  if (attrib & PLL_ATTRIB_RATE_SCALERS)
+  {
+    /* PER-RATE SCALING: if *all* entries of the *rate* CLV were below
+     * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+    for (k = 0; k < rate_cats; ++k)
+    {
+      double * rate_clv = site_clv + k*states_padded;
+      if (below_threshold_avx2(rate_clv, states_padded) == 0xF)
+      {
+        pll_core_scale_clv_avx2(rate_clv, states_padded, PLL_SCALE_FACTOR);
+        parent_scaler[n*rate_cats + k] += 1;
+      }
+    }
+  }
+  else if (below_threshold_avx2(site_clv, span_padded) == 0xF)
+  {
+    /* PER-SITE SCALING: if *all* entries of the *site* CLV were below
+     * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+    pll_core_scale_clv_avx2(site_clv, span_padded, PLL_SCALE_FACTOR);
+    parent_scaler[n] += 1;
+  }
+}
+
+PLL_EXPORT void pll_core_update_partial_ii_blocked_avx2(unsigned int states,
+                                                        unsigned int sites,
+                                                        unsigned int rate_cats,
+                                                        double * parent_clv,
+                                                        unsigned int * parent_scaler,
+                                                        const double * left_clv,
+                                                        const double * right_clv,
+                                                        const double * left_matrix,
+                                                        const double * right_matrix,
+                                                        const unsigned int * left_scaler,
+                                                        const unsigned int * right_scaler,
+                                                        unsigned int attrib)
+{
+  unsigned int k,n,s;
+  unsigned int const states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int const span_padded = states_padded * rate_cats;
+  size_t const matrix_size = (size_t)states_padded * states_padded;
+  size_t const alloc_size = 2*rate_cats*matrix_size + states_padded;
+
+  /* transposed matrices of both children, followed by a dummy CLV for the
+     sites past the end of the last block */
+  double * lt = (double *)pll_aligned_alloc(alloc_size * sizeof(double),
+                                            PLL_ALIGNMENT_AVX);
+  if (!lt)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return;
+  }
+  double * rt = lt + rate_cats*matrix_size;
+  double * dummy = rt + rate_cats*matrix_size;
+
+  pll_core_transpose_matrices_avx2(lt, left_matrix, states, states_padded,
+                                   rate_cats);
+  pll_core_transpose_matrices_avx2(rt, right_matrix, states, states_padded,
+                                   rate_cats);
+  memset(dummy, 0, states_padded * sizeof(double));
+
+  if (parent_scaler)
+  {
+    const size_t scaler_size = (attrib & PLL_ATTRIB_RATE_SCALERS) ?
+                               sites * rate_cats : sites;
+    /* add up the scale vector of the two children if available */
+    fill_parent_scaler(scaler_size, parent_scaler, left_scaler, right_scaler);
+  }
+
+  for (n = 0; n < sites; n += PLL_II_BLOCK_SITES)
+  {
+    unsigned int block = PLL_MIN(PLL_II_BLOCK_SITES, sites - n);
+    unsigned int block_tiles = (block + PLL_II_TILE_SITES - 1) &
+                               ~(PLL_II_TILE_SITES - 1);
+
+    for (k = 0; k < rate_cats; ++k)
+    {
+      const double * lc[PLL_II_BLOCK_SITES];
+      const double * rc[PLL_II_BLOCK_SITES];
+      double * pc[PLL_II_BLOCK_SITES];
+
+      /* sites past the end of the CLV in the last tile are read from and
+         written to the dummy buffer */
+      for (s = 0; s < block_tiles; ++s)
+      {
+        size_t offset = (size_t)(n+s)*span_padded + k*states_padded;
+        lc[s] = (s < block) ? left_clv + offset : dummy;
+        rc[s] = (s < block) ? right_clv + offset : dummy;
+        pc[s] = (s < block) ? parent_clv + offset : dummy;
+      }
+
+      pll_core_block_product_avx2(states, states_padded, block_tiles,
+                                  lt + k*matrix_size, lc, pc, 0);
+      pll_core_block_product_avx2(states, states_padded, block_tiles,
+                                  rt + k*matrix_size, rc, pc, 1);
+    }
+
+    if (!parent_scaler) continue;
+
+    for (s = 0; s < block; ++s)
+      pll_core_scale_site_avx2(parent_clv + (size_t)(n+s)*span_padded,
+                               n+s,
+                               states_padded,
+                               rate_cats,
+                               parent_scaler,
+                               attrib);
+  }
+
+  pll_aligned_free(lt);
+}
+
 PLL_EXPORT void pll_core_update_partial_ii_avx2(unsigned int states,
                                                 unsigned int sites,
                                                 unsigned int rate_cats,
@@ -833,9 +1166,6 @@ PLL_EXPORT void pll_core_update_partial_ii_avx2(unsigned int states,
                                                 const unsigned int * right_scaler,
                                                 unsigned int attrib)
 {
-  unsigned int const states_padded = (states+3) & 0xFFFFFFFC;
-  unsigned int const span_padded = states_padded * rate_cats;
-
   /* dedicated functions for 4x4 and 20x20 matrices */
   if (states == 4)
   {
@@ -869,12 +1199,103 @@ PLL_EXPORT void pll_core_update_partial_ii_avx2(unsigned int states,
     return;
   }
 
+  pll_core_update_partial_ii_blocked_avx2(states,
+                                          sites,
+                                          rate_cats,
+                                          parent_clv,
+                                          parent_scaler,
+                                          left_clv,
+                                          right_clv,
+                                          left_matrix,
+                                          right_matrix,
+                                          left_scaler,
+                                          right_scaler,
+                                          attrib);
+}
+
+/* The 4x4 site-repeats kernels transpose the p-matrices once per call, such
+   that the product of a matrix with a CLV becomes the sum of its columns
+   scaled by the CLV entries, i.e. fused multiply-adds with broadcasts and no
+   horizontal additions */
+
+static double * transpose_matrices_4x4_avx2(const double * matrix,
+                                            unsigned int rate_cats)
+{
+  unsigned int i,j,k;
+  double * tmatrix = (double *)pll_aligned_alloc(rate_cats * 16 *
+                                                 sizeof(double),
+                                                 PLL_ALIGNMENT_AVX);
+  if (!tmatrix)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return NULL;
+  }
+
+  for (k = 0; k < rate_cats; ++k)
+    for (i = 0; i < 4; ++i)
+      for (j = 0; j < 4; ++j)
+        tmatrix[k*16 + j*4 + i] = matrix[k*16 + i*4 + j];
+
+  return tmatrix;
+}
+
+/* P_k * clv for the transposed matrix tmat of rate category k */
+static inline __m256d matvec_4x4_avx2(const double * tmat, const double * clv)
+{
+  __m256d v_terma = _mm256_mul_pd(_mm256_load_pd(tmat),
+                                  _mm256_broadcast_sd(clv));
+  __m256d v_termb = _mm256_mul_pd(_mm256_load_pd(tmat+4),
+                                  _mm256_broadcast_sd(clv+1));
+  v_terma = _mm256_fmadd_pd(_mm256_load_pd(tmat+8),
+                            _mm256_broadcast_sd(clv+2),
+                            v_terma);
+  v_termb = _mm256_fmadd_pd(_mm256_load_pd(tmat+12),
+                            _mm256_broadcast_sd(clv+3),
+                            v_termb);
+
+  return _mm256_add_pd(v_terma, v_termb);
+}
+
+PLL_EXPORT void pll_core_update_partial_repeats_4x4_avx2(unsigned int states,
+                                                         unsigned int parent_sites,
+                                                         unsigned int left_sites,
+                                                         unsigned int right_sites,
+                                                         unsigned int rate_cats,
+                                                         double * parent_clv,
+                                                         unsigned int * parent_scaler,
+                                                         const double * left_clv,
+                                                         const double * right_clv,
+                                                         const double * left_matrix,
+                                                         const double * right_matrix,
+                                                         const unsigned int * left_scaler,
+                                                         const unsigned int * right_scaler,
+                                                         const unsigned int * parent_id_site,
+                                                         const unsigned int * left_site_id,
+                                                         const unsigned int * right_site_id,
+                                                         double * bclv_buffer,
+                                                         unsigned int attrib)
+{
+  unsigned int n,k,i;
+
+  unsigned int span = 4 * rate_cats;
+
   /* scaling-related stuff */
   unsigned int scale_mode;  /* 0 = none, 1 = per-site, 2 = per-rate */
+  unsigned int scale_mask;
   unsigned int init_mask;
   __m256d v_scale_threshold = _mm256_set1_pd(PLL_SCALE_THRESHOLD);
   __m256d v_scale_factor = _mm256_set1_pd(PLL_SCALE_FACTOR);
 
+  double * lt = transpose_matrices_4x4_avx2(left_matrix, rate_cats);
+  double * rt = transpose_matrices_4x4_avx2(right_matrix, rate_cats);
+  if (!lt || !rt)
+  {
+    pll_aligned_free(lt);
+    pll_aligned_free(rt);
+    return;
+  }
+
   if (!parent_scaler)
   {
     /* scaling disabled / not required */
@@ -885,149 +1306,168 @@ PLL_EXPORT void pll_core_update_partial_ii_avx2(unsigned int states,
     /* determine the scaling mode and init the vars accordingly */
     scale_mode = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1;
     init_mask = (scale_mode == 1) ? 0xF : 0;
-    const size_t scaler_size = (scale_mode == 2) ? sites * rate_cats : sites;
     /* add up the scale vector of the two children if available */
-    fill_parent_scaler(scaler_size, parent_scaler, left_scaler, right_scaler);
+    if (scale_mode == 2)
+      pll_fill_parent_scaler_repeats_per_rate(parent_sites, rate_cats, parent_scaler, parent_id_site,
+        left_scaler, left_site_id, right_scaler, right_site_id);
+    else
+      pll_fill_parent_scaler_repeats(parent_sites, parent_scaler, parent_id_site,
+        left_scaler, left_site_id, right_scaler, right_site_id);
   }
 
-  size_t const displacement = (states_padded - states) * (states_padded);
-
-  double* orig_parent_clv = parent_clv;
-  double* orig_right_clv = right_clv;
-  double* orig_left_clv = left_clv;
-
-  /* compute CLV */
-  #pragma omp parallel for private(parent_clv, left_clv, right_clv)
-  for (unsigned int n = 0; n < sites; ++n)
+  for (n = 0; n < parent_sites; ++n)
   {
-    const double * lmat = left_matrix;
-    const double * rmat = right_matrix;
-    unsigned int scale_mask = init_mask;
+    unsigned int site = PLL_GET_SITE(parent_id_site, n);
+    unsigned int lid = PLL_GET_ID(left_site_id, site);
+    unsigned int rid = PLL_GET_ID(right_site_id, site);
+    const double * lclv = &left_clv[lid * span];
+    const double * rclv = &right_clv[rid * span];
+    const double * lmat = lt;
+    const double * rmat = rt;
+    scale_mask = init_mask;
 
-    for (unsigned int k = 0; k < rate_cats; ++k)
+    for (k = 0; k < rate_cats; ++k)
     {
-      parent_clv = orig_parent_clv + (n * rate_cats * states_padded ) + (k * states_padded);
-      left_clv = orig_left_clv + (n * rate_cats * states_padded ) + (k * states_padded);
-      right_clv = orig_right_clv + (n * rate_cats * states_padded ) + (k * states_padded);
+      __m256d v_prod = _mm256_mul_pd(matvec_4x4_avx2(lmat, lclv),
+                                     matvec_4x4_avx2(rmat, rclv));
 
-      unsigned int rate_mask = 0xF;
+      /* check if scaling is needed for the current rate category */
+      __m256d v_cmp = _mm256_cmp_pd(v_prod, v_scale_threshold, _CMP_LT_OS);
+      const unsigned int rate_mask = _mm256_movemask_pd(v_cmp);
 
-      /* iterate over quadruples of rows */
-      for (unsigned int i = 0; i < states_padded; i += 4)
+      if (scale_mode == 2)
       {
-        __m256d v_terma0 = _mm256_setzero_pd();
-        __m256d v_termb0 = _mm256_setzero_pd();
-        __m256d v_terma1 = _mm256_setzero_pd();
-        __m256d v_termb1 = _mm256_setzero_pd();
-        __m256d v_terma2 = _mm256_setzero_pd();
-        __m256d v_termb2 = _mm256_setzero_pd();
-        __m256d v_terma3 = _mm256_setzero_pd();
-        __m256d v_termb3 = _mm256_setzero_pd();
-
-        __m256d v_mat;
-        __m256d v_lclv;
-        __m256d v_rclv;
-
-        /* point to the four rows of the left matrix */
-        const double * lm0 = lmat;
-        const double * lm1 = lm0 + states_padded;
-        const double * lm2 = lm1 + states_padded;
-        const double * lm3 = lm2 + states_padded;
-
-        /* point to the four rows of the right matrix */
-        const double * rm0 = rmat;
-        const double * rm1 = rm0 + states_padded;
-        const double * rm2 = rm1 + states_padded;
-        const double * rm3 = rm2 + states_padded;
-
-        /* iterate over quadruples of columns */
-        for (unsigned int j = 0; j < states_padded; j += 4)
+        /* PER-RATE SCALING: if *all* entries of the *rate* CLV were below
+         * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+        if (rate_mask == 0xF)
         {
-          v_lclv    = _mm256_load_pd(left_clv+j);
-          v_rclv    = _mm256_load_pd(right_clv+j);
-
-          /* row 0 */
-          v_mat    = _mm256_load_pd(lm0);
-          v_terma0 = _mm256_fmadd_pd(v_mat, v_lclv, v_terma0);
-
-          v_mat    = _mm256_load_pd(rm0);
-          v_termb0 = _mm256_fmadd_pd(v_mat, v_rclv, v_termb0);
-          lm0 += 4;
-          rm0 += 4;
-
-          /* row 1 */
-          v_mat    = _mm256_load_pd(lm1);
-          v_terma1 = _mm256_fmadd_pd(v_mat, v_lclv, v_terma1);
-
-          v_mat    = _mm256_load_pd(rm1);
-          v_termb1 = _mm256_fmadd_pd(v_mat, v_rclv, v_termb1);
-          lm1 += 4;
-          rm1 += 4;
-
-          /* row 2 */
-          v_mat    = _mm256_load_pd(lm2);
-          v_terma2 = _mm256_fmadd_pd(v_mat, v_lclv, v_terma2);
-
-          v_mat    = _mm256_load_pd(rm2);
-          v_termb2 = _mm256_fmadd_pd(v_mat, v_rclv, v_termb2);
-          lm2 += 4;
-          rm2 += 4;
-
-          /* row 3 */
-          v_mat    = _mm256_load_pd(lm3);
-          v_terma3 = _mm256_fmadd_pd(v_mat, v_lclv, v_terma3);
-
-          v_mat    = _mm256_load_pd(rm3);
-          v_termb3 = _mm256_fmadd_pd(v_mat, v_rclv, v_termb3);
-
-          lm3 += 4;
-          rm3 += 4;
+          v_prod = _mm256_mul_pd(v_prod,v_scale_factor);
+          parent_scaler[n*rate_cats + k] += 1;
         }
+      }
+      else
+        scale_mask = scale_mask & rate_mask;
 
-        /* point pmatrix to the next four rows */ 
-        lmat = lm3;
-        rmat = rm3;
-
-        __m256d xmm0 = _mm256_unpackhi_pd(v_terma0,v_terma1);
-        __m256d xmm1 = _mm256_unpacklo_pd(v_terma0,v_terma1);
-
-        __m256d xmm2 = _mm256_unpackhi_pd(v_terma2,v_terma3);
-        __m256d xmm3 = _mm256_unpacklo_pd(v_terma2,v_terma3);
-
-        xmm0 = _mm256_add_pd(xmm0,xmm1);
-        xmm1 = _mm256_add_pd(xmm2,xmm3);
+      _mm256_store_pd(parent_clv, v_prod);
 
-        xmm2 = _mm256_permute2f128_pd(xmm0,xmm1, _MM_SHUFFLE(0,2,0,1));
+      parent_clv += 4;
+      lclv += 4;
+      rclv += 4;
+      lmat += 16;
+      rmat += 16;
+    }
 
-        xmm3 = _mm256_blend_pd(xmm0,xmm1,12);
+    /* PER-SITE SCALING: if *all* entries of the *site* CLV were below
+     * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+    if (scale_mask == 0xF)
+    {
+      parent_clv -= span;
+      for (i = 0; i < span; i += 4)
+      {
+        __m256d v_prod = _mm256_load_pd(parent_clv + i);
+        v_prod = _mm256_mul_pd(v_prod,v_scale_factor);
+        _mm256_store_pd(parent_clv + i, v_prod);
+      }
+      parent_clv += span;
+      parent_scaler[n] += 1;
+    }
+  }
 
-        __m256d v_terma_sum = _mm256_add_pd(xmm2,xmm3);
+  pll_aligned_free(lt);
+  pll_aligned_free(rt);
+}
 
-        /* compute termb */
+/* the products of the left matrix with the (fewer) left repeat classes are
+   precomputed in bclv_buffer */
+PLL_EXPORT void pll_core_update_partial_repeatsbclv_4x4_avx2(unsigned int states,
+                                                             unsigned int parent_sites,
+                                                             unsigned int left_sites,
+                                                             unsigned int right_sites,
+                                                             unsigned int rate_cats,
+                                                             double * parent_clv,
+                                                             unsigned int * parent_scaler,
+                                                             const double * left_clv,
+                                                             const double * right_clv,
+                                                             const double * left_matrix,
+                                                             const double * right_matrix,
+                                                             const unsigned int * left_scaler,
+                                                             const unsigned int * right_scaler,
+                                                             const unsigned int * parent_id_site,
+                                                             const unsigned int * left_site_id,
+                                                             const unsigned int * right_site_id,
+                                                             double * bclv_buffer,
+                                                             unsigned int attrib)
+{
+  unsigned int n,k,i;
 
-        xmm0 = _mm256_unpackhi_pd(v_termb0,v_termb1);
-        xmm1 = _mm256_unpacklo_pd(v_termb0,v_termb1);
+  unsigned int span = 4 * rate_cats;
 
-        xmm2 = _mm256_unpackhi_pd(v_termb2,v_termb3);
-        xmm3 = _mm256_unpacklo_pd(v_termb2,v_termb3);
+  /* scaling-related stuff */
+  unsigned int scale_mode;  /* 0 = none, 1 = per-site, 2 = per-rate */
+  unsigned int scale_mask;
+  unsigned int init_mask;
+  __m256d v_scale_threshold = _mm256_set1_pd(PLL_SCALE_THRESHOLD);
+  __m256d v_scale_factor = _mm256_set1_pd(PLL_SCALE_FACTOR);
 
-        xmm0 = _mm256_add_pd(xmm0,xmm1);
-        xmm1 = _mm256_add_pd(xmm2,xmm3);
+  double * lt = transpose_matrices_4x4_avx2(left_matrix, rate_cats);
+  double * rt = transpose_matrices_4x4_avx2(right_matrix, rate_cats);
+  if (!lt || !rt)
+  {
+    pll_aligned_free(lt);
+    pll_aligned_free(rt);
+    return;
+  }
 
-        xmm2 = _mm256_permute2f128_pd(xmm0,xmm1, _MM_SHUFFLE(0,2,0,1));
+  if (!parent_scaler)
+  {
+    /* scaling disabled / not required */
+    scale_mode = init_mask = 0;
+  }
+  else
+  {
+    /* determine the scaling mode and init the vars accordingly */
+    scale_mode = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1;
+    init_mask = (scale_mode == 1) ? 0xF : 0;
+    /* add up the scale vector of the two children if available */
+    if (scale_mode == 2)
+      pll_fill_parent_scaler_repeats_per_rate(parent_sites, rate_cats, parent_scaler, parent_id_site,
+        left_scaler, left_site_id, right_scaler, right_site_id);
+    else
+      pll_fill_parent_scaler_repeats(parent_sites, parent_scaler, parent_id_site,
+        left_scaler, left_site_id, right_scaler, right_site_id);
+  }
 
-        xmm3 = _mm256_blend_pd(xmm0,xmm1,12);
+  double * left_res = bclv_buffer;
+  const double * lclv = left_clv;
 
-        __m256d v_termb_sum = _mm256_add_pd(xmm2,xmm3);
+  for (n = 0; n < left_sites; ++n)
+  {
+    const double * lmat = lt;
+    for (k = 0; k < rate_cats; ++k)
+    {
+      _mm256_store_pd(left_res, matvec_4x4_avx2(lmat, lclv));
+      lmat += 16;
+      lclv += 4;
+      left_res += 4;
+    }
+  }
 
-        __m256d v_prod = _mm256_mul_pd(v_terma_sum,v_termb_sum);
+  for (n = 0; n < parent_sites; ++n)
+  {
+    unsigned int site = PLL_GET_SITE(parent_id_site, n);
+    const double * lres = &bclv_buffer[left_site_id[site] * span];
+    const double * rclv = &right_clv[PLL_GET_ID(right_site_id, site) * span];
+    const double * rmat = rt;
+    scale_mask = init_mask;
 
-        /* check if scaling is needed for the current rate category */
-        __m256d v_cmp = _mm256_cmp_pd(v_prod, v_scale_threshold, _CMP_LT_OS);
-        rate_mask = rate_mask & _mm256_movemask_pd(v_cmp);
+    for (k = 0; k < rate_cats; ++k)
+    {
+      __m256d v_prod = _mm256_mul_pd(_mm256_load_pd(lres),
+                                     matvec_4x4_avx2(rmat, rclv));
 
-        _mm256_store_pd(parent_clv+i, v_prod);
-      }
+      /* check if scaling is needed for the current rate category */
+      __m256d v_cmp = _mm256_cmp_pd(v_prod, v_scale_threshold, _CMP_LT_OS);
+      const unsigned int rate_mask = _mm256_movemask_pd(v_cmp);
 
       if (scale_mode == 2)
       {
@@ -1035,44 +1475,39 @@ PLL_EXPORT void pll_core_update_partial_ii_avx2(unsigned int states,
          * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
         if (rate_mask == 0xF)
         {
-          for (unsigned int i = 0; i < states_padded; i += 4)
-          {
-            __m256d v_prod = _mm256_load_pd(parent_clv + i);
-            v_prod = _mm256_mul_pd(v_prod, v_scale_factor);
-            _mm256_store_pd(parent_clv + i, v_prod);
-          }
+          v_prod = _mm256_mul_pd(v_prod,v_scale_factor);
           parent_scaler[n*rate_cats + k] += 1;
         }
       }
       else
         scale_mask = scale_mask & rate_mask;
 
-      /* reset pointers to point to the start of the next p-matrix, as the
-         vectorization assumes a square states_padded * states_padded matrix,
-         even though the real matrix is states * states_padded */
-      lmat -= displacement;
-      rmat -= displacement;
+      _mm256_store_pd(parent_clv, v_prod);
 
-      // parent_clv += states_padded;
-      // left_clv   += states_padded;
-      // right_clv  += states_padded;
+      parent_clv += 4;
+      lres += 4;
+      rclv += 4;
+      rmat += 16;
     }
 
-    /* if *all* entries of the site CLV were below the threshold then scale
-       (all) entries by PLL_SCALE_FACTOR */
+    /* PER-SITE SCALING: if *all* entries of the *site* CLV were below
+     * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
     if (scale_mask == 0xF)
     {
-      parent_clv -= span_padded - states_padded;
-      for (unsigned int i = 0; i < span_padded; i += 4)
+      parent_clv -= span;
+      for (i = 0; i < span; i += 4)
       {
         __m256d v_prod = _mm256_load_pd(parent_clv + i);
         v_prod = _mm256_mul_pd(v_prod,v_scale_factor);
         _mm256_store_pd(parent_clv + i, v_prod);
       }
-      parent_clv += span_padded - states_padded;
+      parent_clv += span;
       parent_scaler[n] += 1;
     }
   }
+
+  pll_aligned_free(lt);
+  pll_aligned_free(rt);
 }
 
 PLL_EXPORT void pll_core_update_partial_repeats_20x20_avx2(unsigned int parent_sites,
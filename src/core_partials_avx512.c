@@ -0,0 +1,1022 @@
+/*
+    Copyright (C) 2015-2020 Tomas Flouri, Diego Darriba, Alexey Kozlov
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "pll.h"
+
+/* AVX-512 kernels keep the CLV layout of the AVX/AVX2 kernels, i.e. each
+   rate category occupies states_padded = (states+3) & ~3 doubles. Rows of
+   eight doubles are therefore processed with full vectors, and the last
+   block of a rate category is masked whenever states_padded is not a
+   multiple of eight.
+
+   Instead of computing one dot product per row of the p-matrix (which would
+   require a horizontal reduction for each parent state), the p-matrices are
+   transposed once per call and the CLV entries are broadcast, so that a
+   vector of eight parent states is accumulated with one FMA per child
+   state. */
+
+static inline __mmask8 block_mask(unsigned int remaining)
+{
+  return (remaining >= 8) ? 0xFF : (__mmask8)((1u << remaining) - 1);
+}
+
+/* transpose the states x states_padded p-matrices of all rate categories
+   into states x block_padded matrices, where row j holds column j of the
+   original matrix and is zero-padded up to a multiple of eight doubles */
+static void transpose_pmatrix(double * dst,
+                              const double * src,
+                              unsigned int states,
+                              unsigned int states_padded,
+                              unsigned int block_padded,
+                              unsigned int rate_cats)
+{
+  unsigned int i,j,k;
+
+  memset(dst, 0, rate_cats * states * block_padded * sizeof(double));
+
+  for (k = 0; k < rate_cats; ++k)
+  {
+    for (i = 0; i < states; ++i)
+      for (j = 0; j < states; ++j)
+        dst[j*block_padded + i] = src[i*states_padded + j];
+
+    src += states * states_padded;
+    dst += states * block_padded;
+  }
+}
+
+/* interleave the 4x4 p-matrices of two consecutive rate categories, such that
+   entry [p][j][i] is the j-th column of the p-matrix of rate 2p (i < 4) and
+   2p+1 (i >= 4). If the number of rate categories is odd, the upper half of
+   the last pair is zero */
+static void transpose_pmatrix_4x4(double * dst,
+                                  const double * src,
+                                  unsigned int rate_cats)
+{
+  unsigned int i,j,k;
+
+  memset(dst, 0, ((rate_cats+1)/2) * 32 * sizeof(double));
+
+  for (k = 0; k < rate_cats; ++k)
+  {
+    double * pair = dst + (k/2)*32 + (k & 1)*4;
+
+    for (i = 0; i < 4; ++i)
+      for (j = 0; j < 4; ++j)
+        pair[j*8 + i] = src[i*4 + j];
+
+    src += 16;
+  }
+}
+
+static void scale_clv_avx512(double * clv, unsigned int len)
+{
+  unsigned int i;
+  __m512d v_scale_factor = _mm512_set1_pd(PLL_SCALE_FACTOR);
+
+  for (i = 0; i < len; i += 8)
+  {
+    __mmask8 m = block_mask(len - i);
+    __m512d v_clv = _mm512_maskz_loadu_pd(m, clv + i);
+    v_clv = _mm512_mul_pd(v_clv, v_scale_factor);
+    _mm512_mask_storeu_pd(clv + i, m, v_clv);
+  }
+}
+
+PLL_EXPORT void pll_core_update_partial_ii_4x4_avx512(unsigned int sites,
+                                                      unsigned int rate_cats,
+                                                      double * parent_clv,
+                                                      unsigned int * parent_scaler,
+                                                      const double * left_clv,
+                                                      const double * right_clv,
+                                                      const double * left_matrix,
+                                                      const double * right_matrix,
+                                                      const unsigned int * left_scaler,
+                                                      const unsigned int * right_scaler,
+                                                      unsigned int attrib)
+{
+  unsigned int const states = 4;
+  unsigned int const span = states * rate_cats;
+  unsigned int const pairs = (rate_cats+1) / 2;
+
+  /* scaling-related stuff */
+  unsigned int scale_mode;  /* 0 = none, 1 = per-site, 2 = per-rate */
+  unsigned int init_mask;
+
+  double * lmat = pll_aligned_alloc(2 * pairs * 32 * sizeof(double),
+                                    PLL_ALIGNMENT_AVX512);
+  if (!lmat)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate space for precomputation.");
+    return;
+  }
+  double * rmat = lmat + pairs * 32;
+
+  transpose_pmatrix_4x4(lmat, left_matrix, rate_cats);
+  transpose_pmatrix_4x4(rmat, right_matrix, rate_cats);
+
+  if (!parent_scaler)
+  {
+    /* scaling disabled / not required */
+    scale_mode = init_mask = 0;
+  }
+  else
+  {
+    /* determine the scaling mode and init the vars accordingly */
+    scale_mode = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1;
+    init_mask = (scale_mode == 1) ? 1 : 0;
+    const size_t scaler_size = (scale_mode == 2) ? sites * rate_cats : sites;
+    /* add up the scale vector of the two children if available */
+    pll_fill_parent_scaler(scaler_size, parent_scaler, left_scaler, right_scaler);
+  }
+
+  __m512d v_scale_threshold = _mm512_set1_pd(PLL_SCALE_THRESHOLD);
+  __m512d v_scale_factor = _mm512_set1_pd(PLL_SCALE_FACTOR);
+
+  /* permutation indices broadcasting state j of both rate categories */
+  __m512i v_perm0 = _mm512_set_epi64(4,4,4,4,0,0,0,0);
+  __m512i v_perm1 = _mm512_set_epi64(5,5,5,5,1,1,1,1);
+  __m512i v_perm2 = _mm512_set_epi64(6,6,6,6,2,2,2,2);
+  __m512i v_perm3 = _mm512_set_epi64(7,7,7,7,3,3,3,3);
+
+  /* compute CLV */
+  for (unsigned int n = 0; n < sites; ++n)
+  {
+    double * pclv = parent_clv + n*span;
+    const double * lclv = left_clv + n*span;
+    const double * rclv = right_clv + n*span;
+
+    unsigned int scale_mask = init_mask;
+
+    for (unsigned int p = 0; p < pairs; ++p)
+    {
+      __mmask8 m = (2*p+1 < rate_cats) ? 0xFF : 0x0F;
+      const double * lm = lmat + p*32;
+      const double * rm = rmat + p*32;
+
+      __m512d v_lclv = _mm512_maskz_loadu_pd(m, lclv + p*8);
+      __m512d v_rclv = _mm512_maskz_loadu_pd(m, rclv + p*8);
+
+      __m512d v_lterm = _mm512_mul_pd(_mm512_load_pd(lm),
+                                      _mm512_permutexvar_pd(v_perm0, v_lclv));
+      __m512d v_rterm = _mm512_mul_pd(_mm512_load_pd(rm),
+                                      _mm512_permutexvar_pd(v_perm0, v_rclv));
+
+      v_lterm = _mm512_fmadd_pd(_mm512_load_pd(lm+8),
+                                _mm512_permutexvar_pd(v_perm1, v_lclv),
+                                v_lterm);
+      v_rterm = _mm512_fmadd_pd(_mm512_load_pd(rm+8),
+                                _mm512_permutexvar_pd(v_perm1, v_rclv),
+                                v_rterm);
+
+      v_lterm = _mm512_fmadd_pd(_mm512_load_pd(lm+16),
+                                _mm512_permutexvar_pd(v_perm2, v_lclv),
+                                v_lterm);
+      v_rterm = _mm512_fmadd_pd(_mm512_load_pd(rm+16),
+                                _mm512_permutexvar_pd(v_perm2, v_rclv),
+                                v_rterm);
+
+      v_lterm = _mm512_fmadd_pd(_mm512_load_pd(lm+24),
+                                _mm512_permutexvar_pd(v_perm3, v_lclv),
+                                v_lterm);
+      v_rterm = _mm512_fmadd_pd(_mm512_load_pd(rm+24),
+                                _mm512_permutexvar_pd(v_perm3, v_rclv),
+                                v_rterm);
+
+      __m512d v_prod = _mm512_mul_pd(v_lterm, v_rterm);
+
+      /* check which entries are below the scaling threshold */
+      __mmask8 cmp = _mm512_mask_cmp_pd_mask(m, v_prod, v_scale_threshold,
+                                             _CMP_LT_OS);
+
+      if (scale_mode == 2)
+      {
+        /* PER-RATE SCALING: if *all* entries of the *rate* CLV were below
+         * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+        __mmask8 smask = 0;
+        if ((cmp & 0x0F) == 0x0F)
+        {
+          smask |= 0x0F;
+          parent_scaler[n*rate_cats + 2*p] += 1;
+        }
+        if ((m & 0xF0) && (cmp & 0xF0) == 0xF0)
+        {
+          smask |= 0xF0;
+          parent_scaler[n*rate_cats + 2*p + 1] += 1;
+        }
+        v_prod = _mm512_mask_mul_pd(v_prod, smask, v_prod, v_scale_factor);
+      }
+      else
+        scale_mask = scale_mask && (cmp == m);
+
+      _mm512_mask_storeu_pd(pclv + p*8, m, v_prod);
+    }
+
+    /* if *all* entries of the site CLV were below the threshold then scale
+       (all) entries by PLL_SCALE_FACTOR */
+    if (scale_mask)
+    {
+      scale_clv_avx512(pclv, span);
+      parent_scaler[n] += 1;
+    }
+  }
+
+  pll_aligned_free(lmat);
+}
+
+PLL_EXPORT void pll_core_update_partial_ti_4x4_avx512(unsigned int sites,
+                                                      unsigned int rate_cats,
+                                                      double * parent_clv,
+                                                      unsigned int * parent_scaler,
+                                                      const unsigned char * left_tipchar,
+                                                      const double * right_clv,
+                                                      const double * left_matrix,
+                                                      const double * right_matrix,
+                                                      const unsigned int * right_scaler,
+                                                      unsigned int attrib)
+{
+  unsigned int const states = 4;
+  unsigned int const span = states * rate_cats;
+  unsigned int const pairs = (rate_cats+1) / 2;
+  unsigned int i,j,p;
+
+  /* scaling-related stuff */
+  unsigned int scale_mode;  /* 0 = none, 1 = per-site, 2 = per-rate */
+  unsigned int init_mask;
+
+  /* transposed left and right matrices, followed by a lookup table of eight
+     values per entry (four states for two rate categories), for all 16
+     states (including ambiguities) */
+  double * lmat = pll_aligned_alloc((2*pairs*32 + 16*pairs*8) * sizeof(double),
+                                    PLL_ALIGNMENT_AVX512);
+  if (!lmat)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate space for precomputation.");
+    return;
+  }
+  double * rmat = lmat + pairs*32;
+  double * lookup = rmat + pairs*32;
+
+  transpose_pmatrix_4x4(lmat, left_matrix, rate_cats);
+  transpose_pmatrix_4x4(rmat, right_matrix, rate_cats);
+
+  /* precompute left-side values: for each state, sum up the columns of the
+     left matrix that correspond to the (possibly ambiguous) tip state */
+  for (i = 0; i < 16; ++i)
+  {
+    for (p = 0; p < pairs; ++p)
+    {
+      __m512d v_term = _mm512_setzero_pd();
+      for (j = 0; j < 4; ++j)
+        if ((i >> j) & 1)
+          v_term = _mm512_add_pd(v_term, _mm512_load_pd(lmat + p*32 + j*8));
+      _mm512_store_pd(lookup + (i*pairs + p)*8, v_term);
+    }
+  }
+
+  if (!parent_scaler)
+  {
+    /* scaling disabled / not required */
+    scale_mode = init_mask = 0;
+  }
+  else
+  {
+    /* determine the scaling mode and init the vars accordingly */
+    scale_mode = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1;
+    init_mask = (scale_mode == 1) ? 1 : 0;
+    const size_t scaler_size = (scale_mode == 2) ? sites * rate_cats : sites;
+    /* update the parent scaler with the scaler of the right child */
+    pll_fill_parent_scaler(scaler_size, parent_scaler, NULL, right_scaler);
+  }
+
+  __m512d v_scale_threshold = _mm512_set1_pd(PLL_SCALE_THRESHOLD);
+  __m512d v_scale_factor = _mm512_set1_pd(PLL_SCALE_FACTOR);
+
+  __m512i v_perm0 = _mm512_set_epi64(4,4,4,4,0,0,0,0);
+  __m512i v_perm1 = _mm512_set_epi64(5,5,5,5,1,1,1,1);
+  __m512i v_perm2 = _mm512_set_epi64(6,6,6,6,2,2,2,2);
+  __m512i v_perm3 = _mm512_set_epi64(7,7,7,7,3,3,3,3);
+
+  /* iterate over sites and compute CLV entries */
+  for (unsigned int n = 0; n < sites; ++n)
+  {
+    double * pclv = parent_clv + n*span;
+    const double * rclv = right_clv + n*span;
+    const double * lterm = lookup + left_tipchar[n]*pairs*8;
+
+    unsigned int scale_mask = init_mask;
+
+    for (unsigned int q = 0; q < pairs; ++q)
+    {
+      __mmask8 m = (2*q+1 < rate_cats) ? 0xFF : 0x0F;
+      const double * rm = rmat + q*32;
+
+      __m512d v_rclv = _mm512_maskz_loadu_pd(m, rclv + q*8);
+
+      __m512d v_rterm = _mm512_mul_pd(_mm512_load_pd(rm),
+                                      _mm512_permutexvar_pd(v_perm0, v_rclv));
+      v_rterm = _mm512_fmadd_pd(_mm512_load_pd(rm+8),
+                                _mm512_permutexvar_pd(v_perm1, v_rclv),
+                                v_rterm);
+      v_rterm = _mm512_fmadd_pd(_mm512_load_pd(rm+16),
+                                _mm512_permutexvar_pd(v_perm2, v_rclv),
+                                v_rterm);
+      v_rterm = _mm512_fmadd_pd(_mm512_load_pd(rm+24),
+                                _mm512_permutexvar_pd(v_perm3, v_rclv),
+                                v_rterm);
+
+      __m512d v_prod = _mm512_mul_pd(_mm512_load_pd(lterm + q*8), v_rterm);
+
+      /* check which entries are below the scaling threshold */
+      __mmask8 cmp = _mm512_mask_cmp_pd_mask(m, v_prod, v_scale_threshold,
+                                             _CMP_LT_OS);
+
+      if (scale_mode == 2)
+      {
+        /* PER-RATE SCALING: if *all* entries of the *rate* CLV were below
+         * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+        __mmask8 smask = 0;
+        if ((cmp & 0x0F) == 0x0F)
+        {
+          smask |= 0x0F;
+          parent_scaler[n*rate_cats + 2*q] += 1;
+        }
+        if ((m & 0xF0) && (cmp & 0xF0) == 0xF0)
+        {
+          smask |= 0xF0;
+          parent_scaler[n*rate_cats + 2*q + 1] += 1;
+        }
+        v_prod = _mm512_mask_mul_pd(v_prod, smask, v_prod, v_scale_factor);
+      }
+      else
+        scale_mask = scale_mask && (cmp == m);
+
+      _mm512_mask_storeu_pd(pclv + q*8, m, v_prod);
+    }
+
+    /* if *all* entries of the site CLV were below the threshold then scale
+       (all) entries by PLL_SCALE_FACTOR */
+    if (scale_mask)
+    {
+      scale_clv_avx512(pclv, span);
+      parent_scaler[n] += 1;
+    }
+  }
+
+  pll_aligned_free(lmat);
+}
+
+PLL_EXPORT void pll_core_update_partial_ii_20x20_avx512(unsigned int sites,
+                                                        unsigned int rate_cats,
+                                                        double * parent_clv,
+                                                        unsigned int * parent_scaler,
+                                                        const double * left_clv,
+                                                        const double * right_clv,
+                                                        const double * left_matrix,
+                                                        const double * right_matrix,
+                                                        const unsigned int * left_scaler,
+                                                        const unsigned int * right_scaler,
+                                                        unsigned int attrib)
+{
+  unsigned int const states = 20;
+  unsigned int const states_padded = 20;
+  unsigned int const block_padded = 24;
+  unsigned int const span_padded = states_padded * rate_cats;
+  unsigned int const matrix_size = states * block_padded;
+
+  /* scaling-related stuff */
+  unsigned int scale_mode;  /* 0 = none, 1 = per-site, 2 = per-rate */
+  unsigned int init_mask;
+
+  double * lmat = pll_aligned_alloc(2 * rate_cats * matrix_size *
+                                    sizeof(double),
+                                    PLL_ALIGNMENT_AVX512);
+  if (!lmat)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate space for precomputation.");
+    return;
+  }
+  double * rmat = lmat + rate_cats * matrix_size;
+
+  transpose_pmatrix(lmat, left_matrix, states, states_padded, block_padded,
+                    rate_cats);
+  transpose_pmatrix(rmat, right_matrix, states, states_padded, block_padded,
+                    rate_cats);
+
+  if (!parent_scaler)
+  {
+    /* scaling disabled / not required */
+    scale_mode = init_mask = 0;
+  }
+  else
+  {
+    /* determine the scaling mode and init the vars accordingly */
+    scale_mode = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1;
+    init_mask = (scale_mode == 1) ? 1 : 0;
+    const size_t scaler_size = (scale_mode == 2) ? sites * rate_cats : sites;
+    /* add up the scale vector of the two children if available */
+    pll_fill_parent_scaler(scaler_size, parent_scaler, left_scaler, right_scaler);
+  }
+
+  __m512d v_scale_threshold = _mm512_set1_pd(PLL_SCALE_THRESHOLD);
+
+  /* compute CLV */
+  for (unsigned int n = 0; n < sites; ++n)
+  {
+    double * pclv = parent_clv + n*span_padded;
+    const double * lclv = left_clv + n*span_padded;
+    const double * rclv = right_clv + n*span_padded;
+
+    unsigned int scale_mask = init_mask;
+
+    for (unsigned int k = 0; k < rate_cats; ++k)
+    {
+      const double * lm = lmat + k*matrix_size;
+      const double * rm = rmat + k*matrix_size;
+
+      __m512d v_lterm0 = _mm512_setzero_pd();
+      __m512d v_lterm1 = _mm512_setzero_pd();
+      __m512d v_lterm2 = _mm512_setzero_pd();
+      __m512d v_rterm0 = _mm512_setzero_pd();
+      __m512d v_rterm1 = _mm512_setzero_pd();
+      __m512d v_rterm2 = _mm512_setzero_pd();
+
+      /* the third block holds states 16-19 and four zero entries */
+      for (unsigned int j = 0; j < states; ++j)
+      {
+        __m512d v_lclv = _mm512_set1_pd(lclv[j]);
+        __m512d v_rclv = _mm512_set1_pd(rclv[j]);
+
+        v_lterm0 = _mm512_fmadd_pd(_mm512_load_pd(lm),    v_lclv, v_lterm0);
+        v_lterm1 = _mm512_fmadd_pd(_mm512_load_pd(lm+8),  v_lclv, v_lterm1);
+        v_lterm2 = _mm512_fmadd_pd(_mm512_load_pd(lm+16), v_lclv, v_lterm2);
+
+        v_rterm0 = _mm512_fmadd_pd(_mm512_load_pd(rm),    v_rclv, v_rterm0);
+        v_rterm1 = _mm512_fmadd_pd(_mm512_load_pd(rm+8),  v_rclv, v_rterm1);
+        v_rterm2 = _mm512_fmadd_pd(_mm512_load_pd(rm+16), v_rclv, v_rterm2);
+
+        lm += block_padded;
+        rm += block_padded;
+      }
+
+      __m512d v_prod0 = _mm512_mul_pd(v_lterm0, v_rterm0);
+      __m512d v_prod1 = _mm512_mul_pd(v_lterm1, v_rterm1);
+      __m512d v_prod2 = _mm512_mul_pd(v_lterm2, v_rterm2);
+
+      _mm512_storeu_pd(pclv, v_prod0);
+      _mm512_storeu_pd(pclv+8, v_prod1);
+      _mm512_mask_storeu_pd(pclv+16, 0x0F, v_prod2);
+
+      /* check if scaling is needed for the current rate category */
+      unsigned int rate_mask =
+        (_mm512_cmp_pd_mask(v_prod0, v_scale_threshold, _CMP_LT_OS) == 0xFF) &&
+        (_mm512_cmp_pd_mask(v_prod1, v_scale_threshold, _CMP_LT_OS) == 0xFF) &&
+        ((_mm512_cmp_pd_mask(v_prod2, v_scale_threshold, _CMP_LT_OS) & 0x0F)
+                                                                      == 0x0F);
+
+      if (scale_mode == 2)
+      {
+        /* PER-RATE SCALING: if *all* entries of the *rate* CLV were below
+         * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+        if (rate_mask)
+        {
+          scale_clv_avx512(pclv, states_padded);
+          parent_scaler[n*rate_cats + k] += 1;
+        }
+      }
+      else
+        scale_mask = scale_mask && rate_mask;
+
+      pclv += states_padded;
+      lclv += states_padded;
+      rclv += states_padded;
+    }
+
+    /* if *all* entries of the site CLV were below the threshold then scale
+       (all) entries by PLL_SCALE_FACTOR */
+    if (scale_mask)
+    {
+      scale_clv_avx512(pclv - span_padded, span_padded);
+      parent_scaler[n] += 1;
+    }
+  }
+
+  pll_aligned_free(lmat);
+}
+
+PLL_EXPORT
+void pll_core_update_partial_ti_20x20_avx512(unsigned int sites,
+                                             unsigned int rate_cats,
+                                             double * parent_clv,
+                                             unsigned int * parent_scaler,
+                                             const unsigned char * left_tipchar,
+                                             const double * right_clv,
+                                             const double * left_matrix,
+                                             const double * right_matrix,
+                                             const unsigned int * right_scaler,
+                                             const pll_state_t * tipmap,
+                                             unsigned int tipmap_size,
+                                             unsigned int attrib)
+{
+  unsigned int const states = 20;
+  unsigned int const states_padded = 20;
+  unsigned int const block_padded = 24;
+  unsigned int const span_padded = states_padded * rate_cats;
+  unsigned int const matrix_size = states * block_padded;
+  unsigned int const lookup_span = block_padded * rate_cats;
+  unsigned int i,j,k;
+
+  /* scaling-related stuff */
+  unsigned int scale_mode;  /* 0 = none, 1 = per-site, 2 = per-rate */
+  unsigned int init_mask;
+
+  /* transposed right matrices, followed by the left-side values of all tip
+     states (including ambiguities) for each rate category */
+  double * rmat = pll_aligned_alloc((rate_cats*matrix_size +
+                                     tipmap_size*lookup_span) * sizeof(double),
+                                    PLL_ALIGNMENT_AVX512);
+  if (!rmat)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate space for precomputation.");
+    return;
+  }
+  double * lookup = rmat + rate_cats*matrix_size;
+
+  transpose_pmatrix(rmat, right_matrix, states, states_padded, block_padded,
+                    rate_cats);
+
+  /* precompute left-side values and store them in lookup table */
+  memset(lookup, 0, tipmap_size*lookup_span*sizeof(double));
+  for (j = 0; j < tipmap_size; ++j)
+  {
+    const double * lmat = left_matrix;
+    double * ptr = lookup + j*lookup_span;
+
+    // just 20 states -> will fit into 32-bit int
+    unsigned int state = (unsigned int) tipmap[j];
+
+    for (k = 0; k < rate_cats; ++k)
+    {
+      for (i = 0; i < states; ++i)
+      {
+        unsigned int s = state;
+        double terml = 0;
+        while (s)
+        {
+          terml += lmat[PLL_CTZ32(s)];
+          s &= s - 1;
+        }
+        ptr[i] = terml;
+        lmat += states_padded;
+      }
+      ptr += block_padded;
+    }
+  }
+
+  if (!parent_scaler)
+  {
+    /* scaling disabled / not required */
+    scale_mode = init_mask = 0;
+  }
+  else
+  {
+    /* determine the scaling mode and init the vars accordingly */
+    scale_mode = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1;
+    init_mask = (scale_mode == 1) ? 1 : 0;
+    const size_t scaler_size = (scale_mode == 2) ? sites * rate_cats : sites;
+    /* update the parent scaler with the scaler of the right child */
+    pll_fill_parent_scaler(scaler_size, parent_scaler, NULL, right_scaler);
+  }
+
+  __m512d v_scale_threshold = _mm512_set1_pd(PLL_SCALE_THRESHOLD);
+
+  /* compute CLV */
+  for (unsigned int n = 0; n < sites; ++n)
+  {
+    double * pclv = parent_clv + n*span_padded;
+    const double * rclv = right_clv + n*span_padded;
+    const double * lterm = lookup + left_tipchar[n]*lookup_span;
+
+    unsigned int scale_mask = init_mask;
+
+    for (unsigned int q = 0; q < rate_cats; ++q)
+    {
+      const double * rm = rmat + q*matrix_size;
+
+      __m512d v_rterm0 = _mm512_setzero_pd();
+      __m512d v_rterm1 = _mm512_setzero_pd();
+      __m512d v_rterm2 = _mm512_setzero_pd();
+
+      for (unsigned int c = 0; c < states; ++c)
+      {
+        __m512d v_rclv = _mm512_set1_pd(rclv[c]);
+
+        v_rterm0 = _mm512_fmadd_pd(_mm512_load_pd(rm),    v_rclv, v_rterm0);
+        v_rterm1 = _mm512_fmadd_pd(_mm512_load_pd(rm+8),  v_rclv, v_rterm1);
+        v_rterm2 = _mm512_fmadd_pd(_mm512_load_pd(rm+16), v_rclv, v_rterm2);
+
+        rm += block_padded;
+      }
+
+      __m512d v_prod0 = _mm512_mul_pd(_mm512_load_pd(lterm),    v_rterm0);
+      __m512d v_prod1 = _mm512_mul_pd(_mm512_load_pd(lterm+8),  v_rterm1);
+      __m512d v_prod2 = _mm512_mul_pd(_mm512_load_pd(lterm+16), v_rterm2);
+
+      _mm512_storeu_pd(pclv, v_prod0);
+      _mm512_storeu_pd(pclv+8, v_prod1);
+      _mm512_mask_storeu_pd(pclv+16, 0x0F, v_prod2);
+
+      /* check if scaling is needed for the current rate category */
+      unsigned int rate_mask =
+        (_mm512_cmp_pd_mask(v_prod0, v_scale_threshold, _CMP_LT_OS) == 0xFF) &&
+        (_mm512_cmp_pd_mask(v_prod1, v_scale_threshold, _CMP_LT_OS) == 0xFF) &&
+        ((_mm512_cmp_pd_mask(v_prod2, v_scale_threshold, _CMP_LT_OS) & 0x0F)
+                                                                      == 0x0F);
+
+      if (scale_mode == 2)
+      {
+        /* PER-RATE SCALING: if *all* entries of the *rate* CLV were below
+         * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+        if (rate_mask)
+        {
+          scale_clv_avx512(pclv, states_padded);
+          parent_scaler[n*rate_cats + q] += 1;
+        }
+      }
+      else
+        scale_mask = scale_mask && rate_mask;
+
+      pclv  += states_padded;
+      rclv  += states_padded;
+      lterm += block_padded;
+    }
+
+    /* if *all* entries of the site CLV were below the threshold then scale
+       (all) entries by PLL_SCALE_FACTOR */
+    if (scale_mask)
+    {
+      scale_clv_avx512(pclv - span_padded, span_padded);
+      parent_scaler[n] += 1;
+    }
+  }
+
+  pll_aligned_free(rmat);
+}
+
+PLL_EXPORT void pll_core_update_partial_ti_avx512(unsigned int states,
+                                                  unsigned int sites,
+                                                  unsigned int rate_cats,
+                                                  double * parent_clv,
+                                                  unsigned int * parent_scaler,
+                                                  const unsigned char * left_tipchars,
+                                                  const double * right_clv,
+                                                  const double * left_matrix,
+                                                  const double * right_matrix,
+                                                  const unsigned int * right_scaler,
+                                                  const pll_state_t * tipmap,
+                                                  unsigned int tipmap_size,
+                                                  unsigned int attrib)
+{
+  unsigned int const states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int const block_padded = (states+7) & 0xFFFFFFF8;
+  unsigned int const span_padded = states_padded * rate_cats;
+  unsigned int const matrix_size = states * block_padded;
+
+  /* dedicated functions for 4x4 matrices (DNA) */
+  if (states == 4)
+  {
+    pll_core_update_partial_ti_4x4_avx512(sites,
+                                          rate_cats,
+                                          parent_clv,
+                                          parent_scaler,
+                                          left_tipchars,
+                                          right_clv,
+                                          left_matrix,
+                                          right_matrix,
+                                          right_scaler,
+                                          attrib);
+    return;
+  }
+
+  /* dedicated functions for 20x20 matrices (AA) */
+  if (states == 20)
+  {
+    pll_core_update_partial_ti_20x20_avx512(sites,
+                                            rate_cats,
+                                            parent_clv,
+                                            parent_scaler,
+                                            left_tipchars,
+                                            right_clv,
+                                            left_matrix,
+                                            right_matrix,
+                                            right_scaler,
+                                            tipmap,
+                                            tipmap_size,
+                                            attrib);
+    return;
+  }
+
+  /* scaling-related stuff */
+  unsigned int scale_mode;  /* 0 = none, 1 = per-site, 2 = per-rate */
+  unsigned int init_mask;
+
+  double * lmat = pll_aligned_alloc(2 * rate_cats * matrix_size *
+                                    sizeof(double),
+                                    PLL_ALIGNMENT_AVX512);
+  if (!lmat)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate space for precomputation.");
+    return;
+  }
+  double * rmat = lmat + rate_cats * matrix_size;
+
+  transpose_pmatrix(lmat, left_matrix, states, states_padded, block_padded,
+                    rate_cats);
+  transpose_pmatrix(rmat, right_matrix, states, states_padded, block_padded,
+                    rate_cats);
+
+  if (!parent_scaler)
+  {
+    /* scaling disabled / not required */
+    scale_mode = init_mask = 0;
+  }
+  else
+  {
+    /* determine the scaling mode and init the vars accordingly */
+    scale_mode = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1;
+    init_mask = (scale_mode == 1) ? 1 : 0;
+    const size_t scaler_size = (scale_mode == 2) ? sites * rate_cats : sites;
+    /* update the parent scaler with the scaler of the right child */
+    pll_fill_parent_scaler(scaler_size, parent_scaler, NULL, right_scaler);
+  }
+
+  __m512d v_scale_threshold = _mm512_set1_pd(PLL_SCALE_THRESHOLD);
+
+  /* compute CLV */
+  for (unsigned int n = 0; n < sites; ++n)
+  {
+    double * pclv = parent_clv + n*span_padded;
+    const double * rclv = right_clv + n*span_padded;
+
+    unsigned int scale_mask = init_mask;
+
+    pll_state_t lstate = tipmap[left_tipchars[n]];
+
+    for (unsigned int k = 0; k < rate_cats; ++k)
+    {
+      unsigned int rate_mask = 1;
+
+      /* iterate over blocks of eight parent states */
+      for (unsigned int i = 0; i < states_padded; i += 8)
+      {
+        __mmask8 m = block_mask(states_padded - i);
+
+        const double * lm = lmat + k*matrix_size + i;
+        const double * rm = rmat + k*matrix_size + i;
+
+        /* left term: sum the columns of all states present at the tip */
+        __m512d v_lterm = _mm512_setzero_pd();
+        pll_state_t s = lstate;
+        while (s)
+        {
+          unsigned int j = PLL_STATE_CTZ(s);
+          if (j >= states)
+            break;
+          v_lterm = _mm512_add_pd(v_lterm, _mm512_load_pd(lm + j*block_padded));
+          s &= s - 1;
+        }
+
+        /* right term */
+        __m512d v_rterm = _mm512_setzero_pd();
+        for (unsigned int j = 0; j < states; ++j)
+        {
+          v_rterm = _mm512_fmadd_pd(_mm512_load_pd(rm),
+                                    _mm512_set1_pd(rclv[j]),
+                                    v_rterm);
+          rm += block_padded;
+        }
+
+        __m512d v_prod = _mm512_mul_pd(v_lterm, v_rterm);
+
+        /* check if scaling is needed for the current rate category */
+        __mmask8 cmp = _mm512_mask_cmp_pd_mask(m, v_prod, v_scale_threshold,
+                                               _CMP_LT_OS);
+        rate_mask = rate_mask && (cmp == m);
+
+        _mm512_mask_storeu_pd(pclv + i, m, v_prod);
+      }
+
+      if (scale_mode == 2)
+      {
+        /* PER-RATE SCALING: if *all* entries of the *rate* CLV were below
+         * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+        if (rate_mask)
+        {
+          scale_clv_avx512(pclv, states_padded);
+          parent_scaler[n*rate_cats + k] += 1;
+        }
+      }
+      else
+        scale_mask = scale_mask && rate_mask;
+
+      pclv += states_padded;
+      rclv += states_padded;
+    }
+
+    /* if *all* entries of the site CLV were below the threshold then scale
+       (all) entries by PLL_SCALE_FACTOR */
+    if (scale_mask)
+    {
+      scale_clv_avx512(pclv - span_padded, span_padded);
+      parent_scaler[n] += 1;
+    }
+  }
+
+  pll_aligned_free(lmat);
+}
+
+PLL_EXPORT void pll_core_update_partial_ii_avx512(unsigned int states,
+                                                  unsigned int sites,
+                                                  unsigned int rate_cats,
+                                                  double * parent_clv,
+                                                  unsigned int * parent_scaler,
+                                                  const double * left_clv,
+                                                  const double * right_clv,
+                                                  const double * left_matrix,
+                                                  const double * right_matrix,
+                                                  const unsigned int * left_scaler,
+                                                  const unsigned int * right_scaler,
+                                                  unsigned int attrib)
+{
+  unsigned int const states_padded = (states+3) & 0xFFFFFFFC;
+  unsigned int const block_padded = (states+7) & 0xFFFFFFF8;
+  unsigned int const span_padded = states_padded * rate_cats;
+  unsigned int const matrix_size = states * block_padded;
+
+  /* dedicated functions for 4x4 and 20x20 matrices */
+  if (states == 4)
+  {
+    pll_core_update_partial_ii_4x4_avx512(sites,
+                                          rate_cats,
+                                          parent_clv,
+                                          parent_scaler,
+                                          left_clv,
+                                          right_clv,
+                                          left_matrix,
+                                          right_matrix,
+                                          left_scaler,
+                                          right_scaler,
+                                          attrib);
+    return;
+  }
+  else if (states == 20)
+  {
+    pll_core_update_partial_ii_20x20_avx512(sites,
+                                            rate_cats,
+                                            parent_clv,
+                                            parent_scaler,
+                                            left_clv,
+                                            right_clv,
+                                            left_matrix,
+                                            right_matrix,
+                                            left_scaler,
+                                            right_scaler,
+                                            attrib);
+    return;
+  }
+
+  /* scaling-related stuff */
+  unsigned int scale_mode;  /* 0 = none, 1 = per-site, 2 = per-rate */
+  unsigned int init_mask;
+
+  double * lmat = pll_aligned_alloc(2 * rate_cats * matrix_size *
+                                    sizeof(double),
+                                    PLL_ALIGNMENT_AVX512);
+  if (!lmat)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate space for precomputation.");
+    return;
+  }
+  double * rmat = lmat + rate_cats * matrix_size;
+
+  transpose_pmatrix(lmat, left_matrix, states, states_padded, block_padded,
+                    rate_cats);
+  transpose_pmatrix(rmat, right_matrix, states, states_padded, block_padded,
+                    rate_cats);
+
+  if (!parent_scaler)
+  {
+    /* scaling disabled / not required */
+    scale_mode = init_mask = 0;
+  }
+  else
+  {
+    /* determine the scaling mode and init the vars accordingly */
+    scale_mode = (attrib & PLL_ATTRIB_RATE_SCALERS) ? 2 : 1;
+    init_mask = (scale_mode == 1) ? 1 : 0;
+    const size_t scaler_size = (scale_mode == 2) ? sites * rate_cats : sites;
+    /* add up the scale vector of the two children if available */
+    pll_fill_parent_scaler(scaler_size, parent_scaler, left_scaler, right_scaler);
+  }
+
+  __m512d v_scale_threshold = _mm512_set1_pd(PLL_SCALE_THRESHOLD);
+
+  /* compute CLV */
+  for (unsigned int n = 0; n < sites; ++n)
+  {
+    double * pclv = parent_clv + n*span_padded;
+    const double * lclv = left_clv + n*span_padded;
+    const double * rclv = right_clv + n*span_padded;
+
+    unsigned int scale_mask = init_mask;
+
+    for (unsigned int k = 0; k < rate_cats; ++k)
+    {
+      unsigned int rate_mask = 1;
+
+      /* iterate over blocks of eight parent states */
+      for (unsigned int i = 0; i < states_padded; i += 8)
+      {
+        __mmask8 m = block_mask(states_padded - i);
+
+        const double * lm = lmat + k*matrix_size + i;
+        const double * rm = rmat + k*matrix_size + i;
+
+        __m512d v_lterm = _mm512_setzero_pd();
+        __m512d v_rterm = _mm512_setzero_pd();
+
+        for (unsigned int j = 0; j < states; ++j)
+        {
+          v_lterm = _mm512_fmadd_pd(_mm512_load_pd(lm),
+                                    _mm512_set1_pd(lclv[j]),
+                                    v_lterm);
+          v_rterm = _mm512_fmadd_pd(_mm512_load_pd(rm),
+                                    _mm512_set1_pd(rclv[j]),
+                                    v_rterm);
+          lm += block_padded;
+          rm += block_padded;
+        }
+
+        __m512d v_prod = _mm512_mul_pd(v_lterm, v_rterm);
+
+        /* check if scaling is needed for the current rate category */
+        __mmask8 cmp = _mm512_mask_cmp_pd_mask(m, v_prod, v_scale_threshold,
+                                               _CMP_LT_OS);
+        rate_mask = rate_mask && (cmp == m);
+
+        _mm512_mask_storeu_pd(pclv + i, m, v_prod);
+      }
+
+      if (scale_mode == 2)
+      {
+        /* PER-RATE SCALING: if *all* entries of the *rate* CLV were below
+         * the threshold then scale (all) entries by PLL_SCALE_FACTOR */
+        if (rate_mask)
+        {
+          scale_clv_avx512(pclv, states_padded);
+          parent_scaler[n*rate_cats + k] += 1;
+        }
+      }
+      else
+        scale_mask = scale_mask && rate_mask;
+
+      pclv += states_padded;
+      lclv += states_padded;
+      rclv += states_padded;
+    }
+
+    /* if *all* entries of the site CLV were below the threshold then scale
+       (all) entries by PLL_SCALE_FACTOR */
+    if (scale_mask)
+    {
+      scale_clv_avx512(pclv - span_padded, span_padded);
+      parent_scaler[n] += 1;
+    }
+  }
+
+  pll_aligned_free(lmat);
+}
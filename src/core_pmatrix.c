@@ -151,11 +151,75 @@ PLL_EXPORT int pll_core_update_pmatrix(double ** pmatrix,
                                              inv_eigenvecs,
                                              count);
     }
+    if (states == 61)
+    {
+      return pll_core_update_pmatrix_61x61_avx2(pmatrix,
+                                                rate_cats,
+                                                rates,
+                                                branch_lengths,
+                                                matrix_indices,
+                                                params_indices,
+                                                prop_invar,
+                                                eigenvals,
+                                                eigenvecs,
+                                                inv_eigenvecs,
+                                                count);
+    }
     /* this line is never called, but should we disable the else case above,
        then states_padded must be set to this value */
     states_padded = (states+3) & 0xFFFFFFFC;
   }
   #endif
+  #ifdef HAVE_AVX512
+  if (attrib & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    if (states == 4)
+    {
+      /* use AVX version here since FMA doesn't make much sense */
+      return pll_core_update_pmatrix_4x4_avx(pmatrix,
+                                             rate_cats,
+                                             rates,
+                                             branch_lengths,
+                                             matrix_indices,
+                                             params_indices,
+                                             prop_invar,
+                                             eigenvals,
+                                             eigenvecs,
+                                             inv_eigenvecs,
+                                             count);
+    }
+    if (states == 20)
+    {
+      return pll_core_update_pmatrix_20x20_avx2(pmatrix,
+                                             rate_cats,
+                                             rates,
+                                             branch_lengths,
+                                             matrix_indices,
+                                             params_indices,
+                                             prop_invar,
+                                             eigenvals,
+                                             eigenvecs,
+                                             inv_eigenvecs,
+                                             count);
+    }
+    if (states == 61)
+    {
+      return pll_core_update_pmatrix_61x61_avx2(pmatrix,
+                                                rate_cats,
+                                                rates,
+                                                branch_lengths,
+                                                matrix_indices,
+                                                params_indices,
+                                                prop_invar,
+                                                eigenvals,
+                                                eigenvecs,
+                                                inv_eigenvecs,
+                                                count);
+    }
+    /* other state counts use the generic code; CLVs keep the AVX padding */
+    states_padded = (states+3) & 0xFFFFFFFC;
+  }
+  #endif
 
   expd = (double *)malloc(states * sizeof(double));
   temp = (double *)malloc(states*states*sizeof(double));
@@ -20,6 +20,7 @@
 */
 
 #include "pll.h"
+#include "pll_private.h"
 
 static int sumtable_tipinner(pll_partition_t * partition,
                              unsigned int parent_clv_index,
@@ -249,16 +250,31 @@ PLL_EXPORT int pll_update_sumtable(pll_partition_t * partition,
   unsigned int * parent_scaler;
   unsigned int * child_scaler;
 
-  /* get parent scaler */
-  if (parent_scaler_index == PLL_SCALE_BUFFER_NONE)
-    parent_scaler = NULL;
-  else
-    parent_scaler = partition->scale_buffer[parent_scaler_index];
+  if (partition->attributes & PLL_ATTRIB_FLOAT)
+  {
+    pll_errno = PLL_ERROR_FLOAT_NOSUPPORT;
+    snprintf(pll_errmsg, 200,
+             "Derivatives are not available for single-precision CLVs.");
+    return PLL_FAILURE;
+  }
 
-  if (child_scaler_index == PLL_SCALE_BUFFER_NONE)
-    child_scaler = NULL;
-  else
-    child_scaler = partition->scale_buffer[child_scaler_index];
+  /* with limited memory the CLVs may have to be recomputed first */
+  if (!pll_clv_require(partition, parent_clv_index))
+    return PLL_FAILURE;
+
+  if (!pll_clv_require(partition, child_clv_index))
+  {
+    pll_clv_unpin(partition, parent_clv_index);
+    return PLL_FAILURE;
+  }
+
+  /* get parent scaler */
+  parent_scaler = pll_scaler_load(partition,
+                                  parent_scaler_index,
+                                  PLL_SCALER_PARENT);
+  child_scaler = pll_scaler_load(partition,
+                                 child_scaler_index,
+                                 PLL_SCALER_LEFT);
 
 
   if (pll_repeats_enabled(partition) && 
@@ -320,6 +336,9 @@ PLL_EXPORT int pll_update_sumtable(pll_partition_t * partition,
                                  sumtable);
   }
 
+  pll_clv_unpin(partition, parent_clv_index);
+  pll_clv_unpin(partition, child_clv_index);
+
   return retval;
 }
 
@@ -330,28 +349,32 @@ PLL_EXPORT int pll_update_sumtable(pll_partition_t * partition,
  * d_f:  [output] first derivative
  * dd_f: [output] second derivative
  */
-PLL_EXPORT int pll_compute_likelihood_derivatives(pll_partition_t * partition,
-                                                  int parent_scaler_index,
-                                                  int child_scaler_index,
-                                                  double branch_length,
-                                                  const unsigned int * params_indices,
-                                                  const double * sumtable,
-                                                  double * d_f,
-                                                  double * dd_f)
+/* gather the model parameters of each rate category for the derivatives */
+static int derivative_params(const pll_partition_t * partition,
+                             const unsigned int * params_indices,
+                             double *** eigenvals,
+                             double *** freqs,
+                             double ** prop_invar)
 {
-  unsigned int * parent_scaler;
-  unsigned int * child_scaler;
   unsigned int i;
   unsigned int rate_cats = partition->rate_cats;
 
-  double ** eigenvals = (double **) malloc(rate_cats * sizeof(double *));
-  double ** freqs     = (double **) malloc(rate_cats * sizeof(double *));
-  double * prop_invar = (double *)  malloc(rate_cats * sizeof(double));
-  if (!eigenvals || !prop_invar || !freqs)
+  if (partition->attributes & PLL_ATTRIB_FLOAT)
   {
-    if (eigenvals) free(eigenvals);
-    if (prop_invar) free(prop_invar);
-    if (freqs) free(freqs);
+    pll_errno = PLL_ERROR_FLOAT_NOSUPPORT;
+    snprintf(pll_errmsg, 200,
+             "Derivatives are not available for single-precision CLVs.");
+    return PLL_FAILURE;
+  }
+
+  *eigenvals  = (double **) malloc(rate_cats * sizeof(double *));
+  *freqs      = (double **) malloc(rate_cats * sizeof(double *));
+  *prop_invar = (double *)  malloc(rate_cats * sizeof(double));
+  if (!*eigenvals || !*prop_invar || !*freqs)
+  {
+    if (*eigenvals) free(*eigenvals);
+    if (*prop_invar) free(*prop_invar);
+    if (*freqs) free(*freqs);
 
     pll_errno = PLL_ERROR_MEM_ALLOC;
     snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
@@ -360,21 +383,43 @@ PLL_EXPORT int pll_compute_likelihood_derivatives(pll_partition_t * partition,
 
   for (i=0; i<rate_cats; ++i)
   {
-    eigenvals[i]  = partition->eigenvals[params_indices[i]];
-    freqs[i]      = partition->frequencies[params_indices[i]];
-    prop_invar[i] = partition->prop_invar[params_indices[i]];
+    (*eigenvals)[i]  = partition->eigenvals[params_indices[i]];
+    (*freqs)[i]      = partition->frequencies[params_indices[i]];
+    (*prop_invar)[i] = partition->prop_invar[params_indices[i]];
   }
 
-  /* get parent scaler */
-  if (parent_scaler_index == PLL_SCALE_BUFFER_NONE)
-    parent_scaler = NULL;
-  else
-    parent_scaler = partition->scale_buffer[parent_scaler_index];
+  return PLL_SUCCESS;
+}
 
-  if (child_scaler_index == PLL_SCALE_BUFFER_NONE)
-    child_scaler = NULL;
-  else
-    child_scaler = partition->scale_buffer[child_scaler_index];
+PLL_EXPORT int pll_compute_likelihood_derivatives(pll_partition_t * partition,
+                                                  int parent_scaler_index,
+                                                  int child_scaler_index,
+                                                  double branch_length,
+                                                  const unsigned int * params_indices,
+                                                  const double * sumtable,
+                                                  double * d_f,
+                                                  double * dd_f)
+{
+  unsigned int * parent_scaler;
+  unsigned int * child_scaler;
+  double ** eigenvals;
+  double ** freqs;
+  double * prop_invar;
+
+  if (!derivative_params(partition,
+                         params_indices,
+                         &eigenvals,
+                         &freqs,
+                         &prop_invar))
+    return PLL_FAILURE;
+
+  /* get parent scaler */
+  parent_scaler = pll_scaler_load(partition,
+                                  parent_scaler_index,
+                                  PLL_SCALER_PARENT);
+  child_scaler = pll_scaler_load(partition,
+                                 child_scaler_index,
+                                 PLL_SCALER_LEFT);
 
 
   unsigned int parent_ids = partition->sites;
@@ -416,3 +461,355 @@ PLL_EXPORT int pll_compute_likelihood_derivatives(pll_partition_t * partition,
 
   return retval;
 }
+
+/* Derivatives for each row of a replicates x sites matrix of site weights
+   (in the original site order), from a single pass over the sumtable. As for
+   the log-likelihood replicates, the ascertainment bias correction is taken
+   from the derivatives under the partition weights and only the Lewis
+   correction is rescaled with the sum of the replicate weights */
+PLL_EXPORT int pll_compute_likelihood_derivatives_replicates(pll_partition_t * partition,
+                                                             int parent_scaler_index,
+                                                             int child_scaler_index,
+                                                             double branch_length,
+                                                             const unsigned int * params_indices,
+                                                             const double * sumtable,
+                                                             const unsigned int * weights,
+                                                             unsigned int replicates,
+                                                             double * d_f,
+                                                             double * dd_f)
+{
+  unsigned int n, r;
+  unsigned int sites = partition->sites;
+  double ** eigenvals;
+  double ** freqs;
+  double * prop_invar;
+  double correction_d_f = 0;
+  double correction_dd_f = 0;
+  int retval;
+
+  if (!derivative_params(partition,
+                         params_indices,
+                         &eigenvals,
+                         &freqs,
+                         &prop_invar))
+    return PLL_FAILURE;
+
+  double * persite_d_f = (double *) malloc(sites * sizeof(double));
+  double * persite_dd_f = (double *) malloc(sites * sizeof(double));
+  if (!persite_d_f || !persite_dd_f)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    retval = PLL_FAILURE;
+    goto cleanup;
+  }
+
+  retval = pll_core_likelihood_derivatives_persite(partition->states,
+                                                   sites,
+                                                   partition->rate_cats,
+                                                   partition->rate_weights,
+                                                   partition->invariant,
+                                                   branch_length,
+                                                   prop_invar,
+                                                   freqs,
+                                                   partition->rates,
+                                                   eigenvals,
+                                                   sumtable,
+                                                   persite_d_f,
+                                                   persite_dd_f,
+                                                   partition->attributes);
+  if (!retval)
+    goto cleanup;
+
+  if (partition->attributes & PLL_ATTRIB_AB_MASK)
+  {
+    retval = pll_compute_likelihood_derivatives(partition,
+                                                parent_scaler_index,
+                                                child_scaler_index,
+                                                branch_length,
+                                                params_indices,
+                                                sumtable,
+                                                &correction_d_f,
+                                                &correction_dd_f);
+    if (!retval)
+      goto cleanup;
+
+    for (n = 0; n < sites; ++n)
+    {
+      correction_d_f -= partition->pattern_weights[n] * persite_d_f[n];
+      correction_dd_f -= partition->pattern_weights[n] * persite_dd_f[n];
+    }
+  }
+
+  if (!pll_repeats_restore_site_order(partition, persite_d_f, 1) ||
+      !pll_repeats_restore_site_order(partition, persite_dd_f, 1))
+  {
+    retval = PLL_FAILURE;
+    goto cleanup;
+  }
+
+  pll_core_weighted_sums(sites,
+                         replicates,
+                         weights,
+                         persite_d_f,
+                         d_f,
+                         partition->attributes);
+  pll_core_weighted_sums(sites,
+                         replicates,
+                         weights,
+                         persite_dd_f,
+                         dd_f,
+                         partition->attributes);
+
+  for (r = 0; r < replicates; ++r)
+  {
+    double scale = 1;
+    if ((partition->attributes & PLL_ATTRIB_AB_MASK) == PLL_ATTRIB_AB_LEWIS)
+    {
+      const unsigned int * w = weights + (size_t)r * sites;
+      unsigned int weight_sum = 0;
+      for (n = 0; n < sites; ++n)
+        weight_sum += w[n];
+      scale = (double) weight_sum / partition->pattern_weight_sum;
+    }
+    d_f[r] += correction_d_f * scale;
+    dd_f[r] += correction_dd_f * scale;
+  }
+
+cleanup:
+  free(persite_d_f);
+  free(persite_dd_f);
+  free(freqs);
+  free(prop_invar);
+  free(eigenvals);
+
+  return retval;
+}
+
+/* Derivatives of all branch lengths from one pre-order traversal. Every edge
+   is visited with the message of the rest of the tree and the subtree CLV at
+   its lower end, from which the sumtable of the edge follows as in
+   pll_update_sumtable(). Each thread computes the sumtables and derivatives
+   of its own block of sites; the per-thread sums are added in thread order,
+   hence the results do not depend on the scheduling */
+
+typedef struct tree_derivatives_job_s
+{
+  double ** eigenvecs;
+  double ** inv_eigenvecs;
+  double ** eigenvals;
+  double ** freqs;
+  double * prop_invar;
+  double * sumtable;
+  unsigned int matrices;
+  double * thread_d_f;          /* threads x matrices */
+  double * thread_dd_f;
+  int * thread_failed;
+} tree_derivatives_job_t;
+
+static void tree_derivatives_visit(const pll_preorder_t * preorder,
+                                   const pll_preorder_step_t * step,
+                                   unsigned int begin,
+                                   unsigned int end,
+                                   unsigned int thread_id,
+                                   void * data)
+{
+  tree_derivatives_job_t * job = (tree_derivatives_job_t *)data;
+  const pll_partition_t * partition = preorder->partition;
+  const pll_unode_t * node = step->node;
+  unsigned int sites = end - begin;
+  double * sumtable = job->sumtable + (size_t)begin * partition->rate_cats *
+                                      partition->states_padded;
+  const double * out_clv, * in_clv;
+  const unsigned int * out_scaler, * in_scaler;
+  const unsigned char * out_tipchars, * in_tipchars;
+  double d_f, dd_f;
+  int retval;
+
+  if (job->thread_failed[thread_id])
+    return;
+
+  /* the message is never a tip */
+  pll_preorder_src_buffers(preorder, &step->left, begin,
+                           &out_clv, &out_scaler, &out_tipchars);
+  pll_preorder_src_buffers(preorder, &step->right, begin,
+                           &in_clv, &in_scaler, &in_tipchars);
+
+  if (in_tipchars)
+    retval = pll_core_update_sumtable_ti(partition->states,
+                                         sites,
+                                         partition->rate_cats,
+                                         out_clv,
+                                         in_tipchars,
+                                         out_scaler,
+                                         job->eigenvecs,
+                                         job->inv_eigenvecs,
+                                         job->freqs,
+                                         partition->tipmap,
+                                         partition->maxstates,
+                                         sumtable,
+                                         partition->attributes);
+  else
+    retval = pll_core_update_sumtable_ii(partition->states,
+                                         sites,
+                                         partition->rate_cats,
+                                         out_clv,
+                                         in_clv,
+                                         out_scaler,
+                                         in_scaler,
+                                         job->eigenvecs,
+                                         job->inv_eigenvecs,
+                                         job->freqs,
+                                         sumtable,
+                                         partition->attributes);
+
+  /* the scalers are only needed for the ascertainment bias correction */
+  if (retval)
+    retval = pll_core_likelihood_derivatives(partition->states,
+                                             sites,
+                                             partition->rate_cats,
+                                             partition->rate_weights,
+                                             NULL,
+                                             NULL,
+                                             sites,
+                                             sites,
+                                             partition->invariant ?
+                                               partition->invariant + begin :
+                                               NULL,
+                                             partition->pattern_weights + begin,
+                                             node->length,
+                                             job->prop_invar,
+                                             job->freqs,
+                                             partition->rates,
+                                             job->eigenvals,
+                                             sumtable,
+                                             &d_f,
+                                             &dd_f,
+                                             partition->attributes);
+
+  if (!retval)
+  {
+    job->thread_failed[thread_id] = 1;
+    return;
+  }
+
+  job->thread_d_f[thread_id * job->matrices + node->pmatrix_index] += d_f;
+  job->thread_dd_f[thread_id * job->matrices + node->pmatrix_index] += dd_f;
+}
+
+/* computes the first and second derivatives of the negative log-likelihood
+   with respect to the lengths of all branches of the tree with the inner node
+   root, as pll_compute_likelihood_derivatives() does for a single branch. The
+   derivatives of the branch with p-matrix index i are stored in d_f[i] and
+   dd_f[i], which must hold prob_matrices values; the branch lengths are taken
+   from the length fields of the nodes. The p-matrices and the eigen
+   decompositions must be up to date; the CLVs of the tree are recomputed
+   towards root. Not supported for single-precision CLVs, ascertainment bias
+   correction, site repeats and limited memory */
+PLL_EXPORT int pll_compute_tree_derivatives(pll_partition_t * partition,
+                                            pll_unode_t * root,
+                                            const unsigned int * params_indices,
+                                            double * d_f,
+                                            double * dd_f)
+{
+  unsigned int i, t;
+  unsigned int threads;
+  unsigned int rate_cats;
+  int retval = PLL_FAILURE;
+  pll_preorder_t * preorder = NULL;
+  tree_derivatives_job_t job;
+
+  if (!partition || !d_f || !dd_f)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200, "Invalid partition or output buffers.");
+    return PLL_FAILURE;
+  }
+
+  if (partition->attributes & PLL_ATTRIB_AB_MASK)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "Whole-tree derivatives are not supported with ascertainment "
+             "bias correction.");
+    return PLL_FAILURE;
+  }
+
+  memset(&job, 0, sizeof(tree_derivatives_job_t));
+
+  if (!derivative_params(partition,
+                         params_indices,
+                         &job.eigenvals,
+                         &job.freqs,
+                         &job.prop_invar))
+    return PLL_FAILURE;
+
+  preorder = pll_preorder_create(partition, root, PLL_PREORDER_EDGES);
+  if (!preorder)
+    goto cleanup;
+
+  rate_cats = partition->rate_cats;
+  threads = pll_thread_pool_size(partition->thread_pool);
+
+  job.matrices = partition->prob_matrices;
+  job.eigenvecs = (double **)malloc(rate_cats * sizeof(double *));
+  job.inv_eigenvecs = (double **)malloc(rate_cats * sizeof(double *));
+  job.sumtable = pll_aligned_alloc((size_t)partition->sites * rate_cats *
+                                   partition->states_padded * sizeof(double),
+                                   partition->alignment);
+  job.thread_d_f = (double *)calloc((size_t)threads * job.matrices,
+                                    sizeof(double));
+  job.thread_dd_f = (double *)calloc((size_t)threads * job.matrices,
+                                     sizeof(double));
+  job.thread_failed = (int *)calloc(threads, sizeof(int));
+  if (!job.eigenvecs || !job.inv_eigenvecs || !job.sumtable ||
+      !job.thread_d_f || !job.thread_dd_f || !job.thread_failed)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    goto cleanup;
+  }
+
+  for (i = 0; i < rate_cats; ++i)
+  {
+    job.eigenvecs[i] = partition->eigenvecs[params_indices[i]];
+    job.inv_eigenvecs[i] = partition->inv_eigenvecs[params_indices[i]];
+  }
+
+  pll_preorder_run(preorder, tree_derivatives_visit, &job);
+
+  for (t = 0; t < threads; ++t)
+    if (job.thread_failed[t])
+    {
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+      goto cleanup;
+    }
+
+  for (i = 0; i < job.matrices; ++i)
+  {
+    d_f[i] = 0;
+    dd_f[i] = 0;
+    for (t = 0; t < threads; ++t)
+    {
+      d_f[i] += job.thread_d_f[t * job.matrices + i];
+      dd_f[i] += job.thread_dd_f[t * job.matrices + i];
+    }
+  }
+
+  retval = PLL_SUCCESS;
+
+cleanup:
+  pll_preorder_destroy(preorder);
+  pll_aligned_free(job.sumtable);
+  free(job.eigenvecs);
+  free(job.inv_eigenvecs);
+  free(job.thread_d_f);
+  free(job.thread_dd_f);
+  free(job.thread_failed);
+  free(job.eigenvals);
+  free(job.freqs);
+  free(job.prop_invar);
+
+  return retval;
+}
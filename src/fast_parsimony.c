@@ -79,6 +79,21 @@ static int alloc_pars_structs(pll_parsimony_t * parsimony,
   return PLL_SUCCESS;
 }
 
+/* entry of the tip CLV at the given site (pattern) and state */
+static unsigned int tip_clv_entry(const pll_partition_t * partition,
+                                  unsigned int tip_index,
+                                  unsigned int site,
+                                  unsigned int state)
+{
+  size_t offset = (size_t)site * partition->states_padded *
+                  partition->rate_cats + state;
+
+  if (partition->attributes & PLL_ATTRIB_FLOAT)
+    return (unsigned int)(partition->clv_float[tip_index][offset]);
+
+  return (unsigned int)(partition->clv[tip_index][offset]);
+}
+
 static int check_informative_extended(const pll_partition_t * partition,
                                       unsigned int index,
                                       unsigned int * singleton)
@@ -101,11 +116,9 @@ static int check_informative_extended(const pll_partition_t * partition,
     c = 0;
 
     unsigned int *site_id = pll_get_site_id(partition, i);
-    double * clv = partition->clv[i] +
-                   PLL_GET_ID(site_id, index)*partition->states_padded*partition->rate_cats;
 
     for (j = 0; j < partition->states; ++j)
-       c = (c << 1) | (unsigned int)(clv[j]);
+       c = (c << 1) | tip_clv_entry(partition, i, PLL_GET_ID(site_id, index), j);
 
     map[c]++;
   }
@@ -169,11 +182,9 @@ static int check_informative(const pll_partition_t * partition,
       c = 0;
 
       unsigned int *site_id = pll_get_site_id(partition, i);
-      double * clv = partition->clv[i] +
-                     PLL_GET_ID(site_id, index)*partition->states_padded*partition->rate_cats;
 
       for (j = 0; j < partition->states; ++j)
-         c = (c << 1) | (unsigned int)(clv[j]);
+         c = (c << 1) | tip_clv_entry(partition, i, PLL_GET_ID(site_id, index), j);
 
       map[c]++;
     }
@@ -259,7 +270,8 @@ static int fill_parsimony_vectors(const pll_partition_t * partition,
 #endif
 
 #ifdef HAVE_AVX2
-  if (parsimony->attributes & PLL_ATTRIB_ARCH_AVX2 && PLL_STAT(avx2_present))
+  if (parsimony->attributes & (PLL_ATTRIB_ARCH_AVX2 | PLL_ATTRIB_ARCH_AVX512) &&
+      PLL_STAT(avx2_present))
     bitvectors = (bitvectors+7) & 0xFFFFFFF8;
 #endif
   
@@ -312,11 +324,8 @@ static int fill_parsimony_vectors(const pll_partition_t * partition,
           }
           else
           {
-            double * clv = partition->clv[i] + 
-                           PLL_GET_ID(site_id, j)*partition->states_padded * partition->rate_cats;
-
             for (k = 0; k < states; ++k)
-              if ((int)(clv[k]))
+              if (tip_clv_entry(partition, i, PLL_GET_ID(site_id, j), k))
               {
                 val[k] |= (1 << bitcount);
               }
@@ -668,7 +677,8 @@ static void fastparsimony_update_vectors_4x4(pll_parsimony_t * parsimony,
     else
 #endif
 #ifdef HAVE_AVX2
-    if (parsimony->attributes & PLL_ATTRIB_ARCH_AVX2 && PLL_STAT(avx2_present))
+    if (parsimony->attributes & (PLL_ATTRIB_ARCH_AVX2 | PLL_ATTRIB_ARCH_AVX512) &&
+        PLL_STAT(avx2_present))
       pll_fastparsimony_update_vector_4x4_avx2(parsimony,op);
     else
 #endif
@@ -697,7 +707,8 @@ static int fastparsimony_update_vectors(pll_parsimony_t * parsimony,
     else
 #endif
 #ifdef HAVE_AVX2
-    if (parsimony->attributes & PLL_ATTRIB_ARCH_AVX2 && PLL_STAT(avx2_present))
+    if (parsimony->attributes & (PLL_ATTRIB_ARCH_AVX2 | PLL_ATTRIB_ARCH_AVX512) &&
+        PLL_STAT(avx2_present))
       pll_fastparsimony_update_vector_avx2(parsimony,op);
     else
 #endif
@@ -735,7 +746,8 @@ PLL_EXPORT unsigned int pll_fastparsimony_edge_score(const pll_parsimony_t * par
                                                   node2_score_index);
 #endif
 #ifdef HAVE_AVX2
-    if (parsimony->attributes & PLL_ATTRIB_ARCH_AVX2 && PLL_STAT(avx2_present))
+    if (parsimony->attributes & (PLL_ATTRIB_ARCH_AVX2 | PLL_ATTRIB_ARCH_AVX512) &&
+        PLL_STAT(avx2_present))
       return pll_fastparsimony_edge_score_4x4_avx2(parsimony,
                                                    node1_score_index,
                                                    node2_score_index);
@@ -760,7 +772,8 @@ PLL_EXPORT unsigned int pll_fastparsimony_edge_score(const pll_parsimony_t * par
   else
 #endif
 #ifdef HAVE_AVX2
-  if (parsimony->attributes & PLL_ATTRIB_ARCH_AVX2 && PLL_STAT(avx2_present))
+  if (parsimony->attributes & (PLL_ATTRIB_ARCH_AVX2 | PLL_ATTRIB_ARCH_AVX512) &&
+      PLL_STAT(avx2_present))
     return pll_fastparsimony_edge_score_avx2(parsimony,
                                              node1_score_index,
                                              node2_score_index);
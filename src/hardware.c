@@ -97,6 +97,7 @@ static void cpu_features_detect()
     {
       cpuid(7,0,a,b,c,d);
       pll_hardware.avx2_present = (b >> 5) & 1;
+      pll_hardware.avx512f_present = (b >> 16) & 1;
     }
   }
 #endif
@@ -123,6 +124,7 @@ static void cpu_features_detect()
   pll_hardware.popcnt_present  = __builtin_cpu_supports("popcnt");
   pll_hardware.avx_present     = __builtin_cpu_supports("avx");
   pll_hardware.avx2_present    = __builtin_cpu_supports("avx2");
+  pll_hardware.avx512f_present = __builtin_cpu_supports("avx512f");
 #endif
 }
 
@@ -153,6 +155,8 @@ static void cpu_features_show()
     fprintf(stderr, " avx");
   if (pll_hardware.avx2_present)
     fprintf(stderr, " avx2");
+  if (pll_hardware.avx512f_present)
+    fprintf(stderr, " avx512f");
   fprintf(stderr, "\n");
 }
 
@@ -186,4 +190,5 @@ PLL_EXPORT void pll_hardware_ignore()
   pll_hardware.popcnt_present  = 1;
   pll_hardware.avx_present     = 1;
   pll_hardware.avx2_present    = 1;
+  pll_hardware.avx512f_present = 1;
 }
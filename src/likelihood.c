@@ -19,7 +19,9 @@
     Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
 */
 
+#include <limits.h>
 #include "pll.h"
+#include "pll_private.h"
 
 static double compute_asc_bias_correction(double logl_base,
                                           unsigned int sum_w,
@@ -47,6 +49,56 @@ static double compute_asc_bias_correction(double logl_base,
   return logl_correction;
 }
 
+/* scaling factors of an additional per-state site, given by its index in the
+   parent (and child) CLV. With per-rate scalers the minimum over the rate
+   categories is returned and the remaining, capped, factors of each category
+   are stored in rate_scalings, as in the core likelihood functions */
+static unsigned int asc_bias_scalings(const pll_partition_t * partition,
+                                      const unsigned int * parent_scaler,
+                                      unsigned int parent_site,
+                                      const unsigned int * child_scaler,
+                                      unsigned int child_site,
+                                      unsigned int * rate_scalings)
+{
+  unsigned int i;
+  unsigned int rate_cats = partition->rate_cats;
+  unsigned int site_scalings = UINT_MAX;
+
+  if (!(partition->attributes & PLL_ATTRIB_RATE_SCALERS))
+  {
+    site_scalings = parent_scaler ? parent_scaler[parent_site] : 0;
+    site_scalings += child_scaler ? child_scaler[child_site] : 0;
+    return site_scalings;
+  }
+
+  for (i = 0; i < rate_cats; ++i)
+  {
+    rate_scalings[i] = parent_scaler ?
+                       parent_scaler[parent_site*rate_cats + i] : 0;
+    rate_scalings[i] += child_scaler ?
+                        child_scaler[child_site*rate_cats + i] : 0;
+    site_scalings = PLL_MIN(site_scalings, rate_scalings[i]);
+  }
+
+  for (i = 0; i < rate_cats; ++i)
+    rate_scalings[i] = PLL_MIN(rate_scalings[i] - site_scalings,
+                               PLL_SCALE_RATE_MAXDIFF);
+
+  return site_scalings;
+}
+
+static unsigned int * alloc_rate_scalings(const pll_partition_t * partition)
+{
+  unsigned int * rate_scalings = (unsigned int *)calloc(partition->rate_cats,
+                                                        sizeof(unsigned int));
+  if (!rate_scalings)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate space for rate scalers.");
+  }
+  return rate_scalings;
+}
+
 static double root_loglikelihood_asc_bias(pll_partition_t * partition,
                                           unsigned int sites,
                                           const double * clv,
@@ -68,13 +120,27 @@ static double root_loglikelihood_asc_bias(pll_partition_t * partition,
    double logl_correction = 0;
    unsigned int sum_w_inv = 0;
    int asc_bias_type = partition->attributes & PLL_ATTRIB_AB_MASK;
+   unsigned int * rate_scalings = alloc_rate_scalings(partition);
+
+   if (!rate_scalings)
+     return -INFINITY;
 
-   /* point clvp to state sites */
+   /* point clvp to state sites; with site repeats the CLV holds one entry per
+      class, but the weights of the state sites follow the original sites */
    clv += sites * partition->rate_cats * partition->states_padded;
+   pattern_weights += partition->sites;
 
    /* 1. compute per-site logl for each state */
    for (i = 0; i < states; ++i)
    {
+     /* count number of scaling factors to acount for */
+     scale_factors = asc_bias_scalings(partition,
+                                       scaler,
+                                       sites + i,
+                                       NULL,
+                                       0,
+                                       rate_scalings);
+
      term = 0;
      for (j = 0; j < partition->rate_cats; ++j)
      {
@@ -84,18 +150,17 @@ static double root_loglikelihood_asc_bias(pll_partition_t * partition,
        {
          term_r += clv[k] * freqs[k];
        }
+       if (rate_scalings[j])
+         term_r *= pow(PLL_SCALE_THRESHOLD, rate_scalings[j]);
        term += term_r * rate_weights[j];
        clv += states_padded;
      }
 
-     /* count number of scaling factors to acount for */
-     scale_factors = scaler ? scaler[sites + i] : 0;
-
-     sum_w_inv += pattern_weights[sites + i];
+     sum_w_inv += pattern_weights[i];
      if (asc_bias_type == PLL_ATTRIB_AB_STAMATAKIS)
      {
        /* 2a. site_lk is the lnl weighted by the number of occurences */
-       site_lk = log(term) * partition->pattern_weights[sites + i];
+       site_lk = log(term) * pattern_weights[i];
        if (scale_factors)
          site_lk += scale_factors * log(PLL_SCALE_THRESHOLD);
      }
@@ -116,23 +181,39 @@ static double root_loglikelihood_asc_bias(pll_partition_t * partition,
                                        sum_w_inv,
                                        asc_bias_type);
 
+   free(rate_scalings);
+
    return logl;
 }
 
-PLL_EXPORT double pll_compute_root_loglikelihood(pll_partition_t * partition,
-                                                 unsigned int clv_index,
-                                                 int scaler_index,
-                                                 const unsigned int * freqs_indices,
-                                                 double * persite_lnl)
+static double root_loglikelihood(pll_partition_t * partition,
+                                 unsigned int clv_index,
+                                 int scaler_index,
+                                 const unsigned int * freqs_indices,
+                                 double * persite_lnl)
 {
   double logl = 0;
   unsigned int * scaler;
   unsigned int identifiers;
   /* get scaler array if specified */
-  if (scaler_index == PLL_SCALE_BUFFER_NONE)
-    scaler = NULL;
-  else
-    scaler = partition->scale_buffer[scaler_index];
+  scaler = pll_scaler_load(partition, scaler_index, PLL_SCALER_PARENT);
+
+  if (partition->attributes & PLL_ATTRIB_FLOAT)
+  {
+    return pll_core_root_loglikelihood_float(partition->states,
+                                             partition->sites,
+                                             partition->rate_cats,
+                                             partition->clv_float[clv_index],
+                                             scaler,
+                                             partition->frequencies,
+                                             partition->rate_weights,
+                                             partition->pattern_weights,
+                                             partition->prop_invar,
+                                             partition->invariant,
+                                             freqs_indices,
+                                             persite_lnl,
+                                             partition->attributes);
+  }
 
   /* compute log-likelihood via the core function */
   if (pll_repeats_enabled(partition) &&
@@ -177,7 +258,7 @@ PLL_EXPORT double pll_compute_root_loglikelihood(pll_partition_t * partition,
     /* Note the assertion must be done for all rate matrices
     assert(prop_invar == 0);
     */
-    identifiers = pll_get_sites_number(partition, clv_index) - partition->rate_cats;
+    identifiers = pll_get_sites_number(partition, clv_index) - partition->states;
     logl += root_loglikelihood_asc_bias(partition,
                                         identifiers,
                                         partition->clv[clv_index],
@@ -188,6 +269,32 @@ PLL_EXPORT double pll_compute_root_loglikelihood(pll_partition_t * partition,
   return logl;
 }
 
+PLL_EXPORT double pll_compute_root_loglikelihood(pll_partition_t * partition,
+                                                 unsigned int clv_index,
+                                                 int scaler_index,
+                                                 const unsigned int * freqs_indices,
+                                                 double * persite_lnl)
+{
+  double logl;
+
+  /* with limited memory the CLV may have to be recomputed first */
+  if (!pll_clv_require(partition, clv_index))
+    return -INFINITY;
+
+  logl = root_loglikelihood(partition,
+                            clv_index,
+                            scaler_index,
+                            freqs_indices,
+                            persite_lnl);
+
+  pll_clv_unpin(partition, clv_index);
+
+  if (persite_lnl && !pll_repeats_restore_site_order(partition, persite_lnl, 1))
+    return -INFINITY;
+
+  return logl;
+}
+
 static double edge_loglikelihood_asc_bias_ti(pll_partition_t * partition,
                                              unsigned int parent_clv_index,
                                              unsigned int * parent_scaler,
@@ -211,16 +318,26 @@ static double edge_loglikelihood_asc_bias_ti(pll_partition_t * partition,
   double logl_correction = 0;
   unsigned int sum_w_inv = 0;
   int asc_bias_type = partition->attributes & PLL_ATTRIB_AB_MASK;
+  unsigned int * rate_scalings = alloc_rate_scalings(partition);
+
+  if (!rate_scalings)
+    return -INFINITY;
 
   /* point clvp to state sites */
   clvp += partition->sites * partition->rate_cats * partition->states_padded;
   pattern_weights += partition->sites;
-  if (parent_scaler)
-    parent_scaler += partition->sites;
 
   /* 1. compute per-site logl for each state */
   for (n = 0; n < partition->states; ++n)
   {
+    /* count number of scaling factors to acount for */
+    scale_factors = asc_bias_scalings(partition,
+                                      parent_scaler,
+                                      partition->sites + n,
+                                      NULL,
+                                      0,
+                                      rate_scalings);
+
     pmatrix = partition->pmatrix[matrix_index];
     terma = 0;
     for (i = 0; i < partition->rate_cats; ++i)
@@ -233,13 +350,12 @@ static double edge_loglikelihood_asc_bias_ti(pll_partition_t * partition,
         pmatrix += states_padded;
       }
 
+      if (rate_scalings[i])
+        terma_r *= pow(PLL_SCALE_THRESHOLD, rate_scalings[i]);
       terma += terma_r * rate_weights[i];
       clvp += states_padded;
     }
 
-    /* count number of scaling factors to acount for */
-    scale_factors = (parent_scaler) ? parent_scaler[n] : 0;
-
     sum_w_inv += pattern_weights[n];
     if (asc_bias_type == PLL_ATTRIB_AB_STAMATAKIS)
     {
@@ -264,6 +380,9 @@ static double edge_loglikelihood_asc_bias_ti(pll_partition_t * partition,
                                       partition->pattern_weight_sum,
                                       sum_w_inv,
                                       asc_bias_type);
+
+  free(rate_scalings);
+
   return logl;
 }
 
@@ -280,10 +399,9 @@ static double edge_loglikelihood_tipinner(pll_partition_t * partition,
 
   unsigned int * parent_scaler;
 
-  if (parent_scaler_index == PLL_SCALE_BUFFER_NONE)
-    parent_scaler = NULL;
-  else
-    parent_scaler = partition->scale_buffer[parent_scaler_index];
+  parent_scaler = pll_scaler_load(partition,
+                                  parent_scaler_index,
+                                  PLL_SCALER_PARENT);
 
   if (states == 4)
   {
@@ -373,18 +491,26 @@ static double edge_loglikelihood_asc_bias_ii(pll_partition_t * partition,
   pattern_weights += partition->sites;
   clvp += parent_offset;
   clvc += child_offset;
-  if (parent_scaler)
-    parent_scaler += parent_sites;
-  if (child_scaler)
-    child_scaler += child_sites;
 
   double logl_correction = 0;
   unsigned int sum_w_inv = 0;
   int asc_bias_type = partition->attributes & PLL_ATTRIB_AB_MASK;
+  unsigned int * rate_scalings = alloc_rate_scalings(partition);
+
+  if (!rate_scalings)
+    return -INFINITY;
 
   /* 1. compute per-site logl for each state */
   for (n = 0; n < partition->states; ++n)
   {
+    /* count number of scaling factors to acount for */
+    scale_factors = asc_bias_scalings(partition,
+                                      parent_scaler,
+                                      parent_sites + n,
+                                      child_scaler,
+                                      child_sites + n,
+                                      rate_scalings);
+
     pmatrix = partition->pmatrix[matrix_index];
     terma = 0;
     for (i = 0; i < partition->rate_cats; ++i)
@@ -402,15 +528,13 @@ static double edge_loglikelihood_asc_bias_ii(pll_partition_t * partition,
         pmatrix += states_padded;
       }
 
+      if (rate_scalings[i])
+        terma_r *= pow(PLL_SCALE_THRESHOLD, rate_scalings[i]);
       terma += terma_r * rate_weights[i];
       clvp += states_padded;
       clvc += states_padded;
     }
 
-    /* count number of scaling factors to acount for */
-    scale_factors = (parent_scaler) ? parent_scaler[n] : 0;
-    scale_factors += (child_scaler) ? child_scaler[n] : 0;
-
     sum_w_inv += pattern_weights[n];
     if (asc_bias_type == PLL_ATTRIB_AB_STAMATAKIS)
     {
@@ -436,6 +560,8 @@ static double edge_loglikelihood_asc_bias_ii(pll_partition_t * partition,
                                       sum_w_inv,
                                       asc_bias_type);
 
+  free(rate_scalings);
+
   return logl;
 }
 
@@ -456,15 +582,12 @@ static double edge_loglikelihood(pll_partition_t * partition,
   unsigned int * parent_scaler;
   unsigned int * child_scaler;
 
-  if (child_scaler_index == PLL_SCALE_BUFFER_NONE)
-    child_scaler = NULL;
-  else
-    child_scaler = partition->scale_buffer[child_scaler_index];
-
-  if (parent_scaler_index == PLL_SCALE_BUFFER_NONE)
-    parent_scaler = NULL;
-  else
-    parent_scaler = partition->scale_buffer[parent_scaler_index];
+  child_scaler = pll_scaler_load(partition,
+                                 child_scaler_index,
+                                 PLL_SCALER_LEFT);
+  parent_scaler = pll_scaler_load(partition,
+                                  parent_scaler_index,
+                                  PLL_SCALER_PARENT);
 
   /* compute log-likelihood via the core function */
   logl = pll_core_edge_loglikelihood_ii(partition->states,
@@ -583,16 +706,93 @@ static double edge_loglikelihood_repeats(pll_partition_t * partition,
 
 
 
-PLL_EXPORT double pll_compute_edge_loglikelihood(pll_partition_t * partition,
-                                                 unsigned int parent_clv_index,
-                                                 int parent_scaler_index,
-                                                 unsigned int child_clv_index,
-                                                 int child_scaler_index,
-                                                 unsigned int matrix_index,
-                                                 const unsigned int * freqs_indices,
-                                                 double * persite_lnl)
+static double edge_loglikelihood_float(pll_partition_t * partition,
+                                       unsigned int parent_clv_index,
+                                       int parent_scaler_index,
+                                       unsigned int child_clv_index,
+                                       int child_scaler_index,
+                                       unsigned int matrix_index,
+                                       const unsigned int * freqs_indices,
+                                       double * persite_lnl)
+{
+  unsigned int * parent_scaler;
+  unsigned int * child_scaler;
+
+  /* the tip is always passed as the child */
+  if ((partition->attributes & PLL_ATTRIB_PATTERN_TIP) &&
+      parent_clv_index < partition->tips)
+  {
+    PLL_SWAP(parent_clv_index, child_clv_index);
+    PLL_SWAP(parent_scaler_index, child_scaler_index);
+  }
+
+  parent_scaler = pll_scaler_load(partition,
+                                  parent_scaler_index,
+                                  PLL_SCALER_PARENT);
+  child_scaler = pll_scaler_load(partition,
+                                 child_scaler_index,
+                                 PLL_SCALER_LEFT);
+
+  if ((partition->attributes & PLL_ATTRIB_PATTERN_TIP) &&
+      child_clv_index < partition->tips)
+  {
+    return pll_core_edge_loglikelihood_ti_float(partition->states,
+                                                partition->sites,
+                                                partition->rate_cats,
+                                                partition->clv_float[parent_clv_index],
+                                                parent_scaler,
+                                                partition->tipchars[child_clv_index],
+                                                partition->tipmap,
+                                                partition->maxstates,
+                                                partition->pmatrix[matrix_index],
+                                                partition->frequencies,
+                                                partition->rate_weights,
+                                                partition->pattern_weights,
+                                                partition->prop_invar,
+                                                partition->invariant,
+                                                freqs_indices,
+                                                persite_lnl,
+                                                partition->attributes);
+  }
+
+  return pll_core_edge_loglikelihood_ii_float(partition->states,
+                                              partition->sites,
+                                              partition->rate_cats,
+                                              partition->clv_float[parent_clv_index],
+                                              parent_scaler,
+                                              partition->clv_float[child_clv_index],
+                                              child_scaler,
+                                              partition->pmatrix[matrix_index],
+                                              partition->frequencies,
+                                              partition->rate_weights,
+                                              partition->pattern_weights,
+                                              partition->prop_invar,
+                                              partition->invariant,
+                                              freqs_indices,
+                                              persite_lnl,
+                                              partition->attributes);
+}
+
+static double compute_edge_loglikelihood(pll_partition_t * partition,
+                                         unsigned int parent_clv_index,
+                                         int parent_scaler_index,
+                                         unsigned int child_clv_index,
+                                         int child_scaler_index,
+                                         unsigned int matrix_index,
+                                         const unsigned int * freqs_indices,
+                                         double * persite_lnl)
 {
   double logl;
+
+  if (partition->attributes & PLL_ATTRIB_FLOAT)
+    return edge_loglikelihood_float(partition,
+                                    parent_clv_index,
+                                    parent_scaler_index,
+                                    child_clv_index,
+                                    child_scaler_index,
+                                    matrix_index,
+                                    freqs_indices,
+                                    persite_lnl);
   
   if (pll_repeats_enabled(partition) 
       && (partition->repeats->pernode_ids[parent_clv_index] 
@@ -635,7 +835,475 @@ PLL_EXPORT double pll_compute_edge_loglikelihood(pll_partition_t * partition,
   return logl;
 }
 
+PLL_EXPORT double pll_compute_edge_loglikelihood(pll_partition_t * partition,
+                                                 unsigned int parent_clv_index,
+                                                 int parent_scaler_index,
+                                                 unsigned int child_clv_index,
+                                                 int child_scaler_index,
+                                                 unsigned int matrix_index,
+                                                 const unsigned int * freqs_indices,
+                                                 double * persite_lnl)
+{
+  double logl;
+
+  /* with limited memory the CLVs may have to be recomputed first */
+  if (!pll_clv_require(partition, parent_clv_index))
+    return -INFINITY;
+
+  if (!pll_clv_require(partition, child_clv_index))
+  {
+    pll_clv_unpin(partition, parent_clv_index);
+    return -INFINITY;
+  }
+
+  logl = compute_edge_loglikelihood(partition,
+                                    parent_clv_index,
+                                    parent_scaler_index,
+                                    child_clv_index,
+                                    child_scaler_index,
+                                    matrix_index,
+                                    freqs_indices,
+                                    persite_lnl);
+
+  pll_clv_unpin(partition, parent_clv_index);
+  pll_clv_unpin(partition, child_clv_index);
+
+  if (persite_lnl && !pll_repeats_restore_site_order(partition, persite_lnl, 1))
+    return -INFINITY;
+
+  return logl;
+}
+
+
+/* Fused update of the last operation and evaluation of the edge between its
+   parent and another node. The parent CLV is computed for one block of sites
+   at a time into a small buffer that stays in cache, and is consumed by the
+   edge kernel right away instead of being written to the partition */
+
+#define FUSED_BLOCK_BYTES 262144
+
+static void fused_partial_block(pll_partition_t * partition,
+                                const pll_operation_t * op,
+                                unsigned int begin,
+                                unsigned int sites,
+                                double * parent_clv,
+                                unsigned int * parent_scaler)
+{
+  size_t clv_offset = (size_t)begin * partition->rate_cats *
+                      partition->states_padded;
+  unsigned int tip1 = (partition->attributes & PLL_ATTRIB_PATTERN_TIP) &&
+                      op->child1_clv_index < partition->tips;
+  unsigned int tip2 = (partition->attributes & PLL_ATTRIB_PATTERN_TIP) &&
+                      op->child2_clv_index < partition->tips;
+  unsigned int * left_scaler = pll_scaler_load_range(partition,
+                                                     op->child1_scaler_index,
+                                                     PLL_SCALER_LEFT,
+                                                     begin,
+                                                     begin + sites);
+  unsigned int * right_scaler = pll_scaler_load_range(partition,
+                                                      op->child2_scaler_index,
+                                                      PLL_SCALER_RIGHT,
+                                                      begin,
+                                                      begin + sites);
+
+  if (tip1 && tip2)
+  {
+    /* the lookup table was created by the caller */
+    pll_core_update_partial_tt(partition->states,
+                               sites,
+                               partition->rate_cats,
+                               parent_clv,
+                               parent_scaler,
+                               partition->tipchars[op->child1_clv_index] + begin,
+                               partition->tipchars[op->child2_clv_index] + begin,
+                               partition->tipmap,
+                               partition->maxstates,
+                               partition->ttlookup,
+                               partition->attributes);
+  }
+  else if (tip1 || tip2)
+  {
+    pll_core_update_partial_ti(partition->states,
+                               sites,
+                               partition->rate_cats,
+                               parent_clv,
+                               parent_scaler,
+                               partition->tipchars[tip1 ? op->child1_clv_index :
+                                                          op->child2_clv_index] +
+                                 begin,
+                               partition->clv[tip1 ? op->child2_clv_index :
+                                                     op->child1_clv_index] +
+                                 clv_offset,
+                               partition->pmatrix[tip1 ? op->child1_matrix_index :
+                                                         op->child2_matrix_index],
+                               partition->pmatrix[tip1 ? op->child2_matrix_index :
+                                                         op->child1_matrix_index],
+                               tip1 ? right_scaler : left_scaler,
+                               partition->tipmap,
+                               partition->maxstates,
+                               partition->attributes);
+  }
+  else
+  {
+    pll_core_update_partial_ii(partition->states,
+                               sites,
+                               partition->rate_cats,
+                               parent_clv,
+                               parent_scaler,
+                               partition->clv[op->child1_clv_index] + clv_offset,
+                               partition->clv[op->child2_clv_index] + clv_offset,
+                               partition->pmatrix[op->child1_matrix_index],
+                               partition->pmatrix[op->child2_matrix_index],
+                               left_scaler,
+                               right_scaler,
+                               partition->attributes);
+  }
+}
+
+static double fused_edge_block(pll_partition_t * partition,
+                               unsigned int begin,
+                               unsigned int sites,
+                               const double * parent_clv,
+                               const unsigned int * parent_scaler,
+                               unsigned int other_clv_index,
+                               int other_scaler_index,
+                               unsigned int matrix_index,
+                               const unsigned int * freqs_indices,
+                               double * persite_lnl)
+{
+  size_t clv_offset = (size_t)begin * partition->rate_cats *
+                      partition->states_padded;
+  const int * invariant = partition->invariant ?
+                          partition->invariant + begin : NULL;
+  unsigned int * other_scaler;
+
+  if (persite_lnl)
+    persite_lnl += begin;
+
+  if ((partition->attributes & PLL_ATTRIB_PATTERN_TIP) &&
+      other_clv_index < partition->tips)
+  {
+    if (partition->states == 4)
+      return pll_core_edge_loglikelihood_ti_4x4(sites,
+                                                partition->rate_cats,
+                                                parent_clv,
+                                                parent_scaler,
+                                                partition->tipchars[other_clv_index] +
+                                                  begin,
+                                                partition->pmatrix[matrix_index],
+                                                partition->frequencies,
+                                                partition->rate_weights,
+                                                partition->pattern_weights + begin,
+                                                partition->prop_invar,
+                                                invariant,
+                                                freqs_indices,
+                                                persite_lnl,
+                                                partition->attributes);
+
+    return pll_core_edge_loglikelihood_ti(partition->states,
+                                          sites,
+                                          partition->rate_cats,
+                                          parent_clv,
+                                          parent_scaler,
+                                          partition->tipchars[other_clv_index] +
+                                            begin,
+                                          partition->tipmap,
+                                          partition->maxstates,
+                                          partition->pmatrix[matrix_index],
+                                          partition->frequencies,
+                                          partition->rate_weights,
+                                          partition->pattern_weights + begin,
+                                          partition->prop_invar,
+                                          invariant,
+                                          freqs_indices,
+                                          persite_lnl,
+                                          partition->attributes);
+  }
+
+  /* the scratch buffer of the right child is free once the parent block is
+     computed */
+  other_scaler = pll_scaler_load_range(partition,
+                                       other_scaler_index,
+                                       PLL_SCALER_RIGHT,
+                                       begin,
+                                       begin + sites);
+
+  return pll_core_edge_loglikelihood_ii(partition->states,
+                                        sites,
+                                        partition->rate_cats,
+                                        parent_clv,
+                                        parent_scaler,
+                                        partition->clv[other_clv_index] +
+                                          clv_offset,
+                                        other_scaler,
+                                        partition->pmatrix[matrix_index],
+                                        partition->frequencies,
+                                        partition->rate_weights,
+                                        partition->pattern_weights + begin,
+                                        partition->prop_invar,
+                                        invariant,
+                                        freqs_indices,
+                                        persite_lnl,
+                                        partition->attributes);
+}
+
+static double fused_loglikelihood(pll_partition_t * partition,
+                                  const pll_operation_t * op,
+                                  unsigned int other_clv_index,
+                                  int other_scaler_index,
+                                  unsigned int matrix_index,
+                                  const unsigned int * freqs_indices,
+                                  double * persite_lnl)
+{
+  unsigned int n;
+  unsigned int sites = partition->sites;
+  unsigned int rate_cats = partition->rate_cats;
+  size_t span = (size_t)partition->states_padded * rate_cats;
+  double logl = 0;
+
+  /* block of sites that fits into the L2 cache, a multiple of eight sites
+     such that the block offsets keep the alignment of the CLVs */
+  unsigned int block = (unsigned int)(FUSED_BLOCK_BYTES /
+                                      (span * sizeof(double))) & ~7u;
+  block = PLL_MIN(PLL_MAX(block, 8), sites);
+
+  double * clv = pll_aligned_alloc(block * span * sizeof(double),
+                                   partition->alignment);
+  unsigned int * scaler = NULL;
+
+  if (op->parent_scaler_index != PLL_SCALE_BUFFER_NONE)
+    scaler = (unsigned int *)malloc(block * rate_cats * sizeof(unsigned int));
+
+  if (!clv || (op->parent_scaler_index != PLL_SCALE_BUFFER_NONE && !scaler))
+  {
+    pll_aligned_free(clv);
+    free(scaler);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return -INFINITY;
+  }
+
+  /* zero-out the padding, see pll_partition_create() */
+  memset(clv, 0, block * span * sizeof(double));
+
+  if ((partition->attributes & PLL_ATTRIB_PATTERN_TIP) &&
+      op->child1_clv_index < partition->tips &&
+      op->child2_clv_index < partition->tips)
+  {
+    pll_core_create_lookup(partition->states,
+                           rate_cats,
+                           partition->ttlookup,
+                           partition->pmatrix[op->child1_matrix_index],
+                           partition->pmatrix[op->child2_matrix_index],
+                           partition->tipmap,
+                           partition->maxstates,
+                           partition->attributes);
+  }
+
+  for (n = 0; n < sites; n += block)
+  {
+    unsigned int count = PLL_MIN(block, sites - n);
+
+    fused_partial_block(partition, op, n, count, clv, scaler);
+
+    logl += fused_edge_block(partition,
+                             n,
+                             count,
+                             clv,
+                             scaler,
+                             other_clv_index,
+                             other_scaler_index,
+                             matrix_index,
+                             freqs_indices,
+                             persite_lnl);
+  }
+
+  pll_aligned_free(clv);
+  free(scaler);
+
+  return logl;
+}
+
+/* computes the log-likelihood at the edge between the parent of op and the
+   node other_clv_index, as pll_update_partials() on op followed by
+   pll_compute_edge_loglikelihood() would, but without writing the parent CLV
+   and scale buffer, whose contents are left unchanged. Single-precision CLVs,
+   site repeats and ascertainment bias correction use the unfused path */
+PLL_EXPORT double pll_compute_edge_loglikelihood_fused(pll_partition_t * partition,
+                                                       const pll_operation_t * op,
+                                                       unsigned int other_clv_index,
+                                                       int other_scaler_index,
+                                                       unsigned int matrix_index,
+                                                       const unsigned int * freqs_indices,
+                                                       double * persite_lnl)
+{
+  double logl;
+
+  if ((partition->attributes & (PLL_ATTRIB_FLOAT | PLL_ATTRIB_AB_MASK)) ||
+      pll_repeats_enabled(partition))
+  {
+    if (!pll_update_partials(partition, op, 1))
+      return -INFINITY;
+    return pll_compute_edge_loglikelihood(partition,
+                                          op->parent_clv_index,
+                                          op->parent_scaler_index,
+                                          other_clv_index,
+                                          other_scaler_index,
+                                          matrix_index,
+                                          freqs_indices,
+                                          persite_lnl);
+  }
+
+  /* with limited memory the CLVs may have to be recomputed first */
+  if (!pll_clv_require(partition, op->child1_clv_index))
+    return -INFINITY;
+
+  if (!pll_clv_require(partition, op->child2_clv_index))
+  {
+    pll_clv_unpin(partition, op->child1_clv_index);
+    return -INFINITY;
+  }
+
+  if (!pll_clv_require(partition, other_clv_index))
+  {
+    pll_clv_unpin(partition, op->child1_clv_index);
+    pll_clv_unpin(partition, op->child2_clv_index);
+    return -INFINITY;
+  }
+
+  logl = fused_loglikelihood(partition,
+                             op,
+                             other_clv_index,
+                             other_scaler_index,
+                             matrix_index,
+                             freqs_indices,
+                             persite_lnl);
+
+  pll_clv_unpin(partition, op->child1_clv_index);
+  pll_clv_unpin(partition, op->child2_clv_index);
+  pll_clv_unpin(partition, other_clv_index);
+
+  /* a resident copy of the parent CLV is outdated; drop it such that it is
+     recomputed from op when it is required */
+  pll_clv_release(partition, op->parent_clv_index);
+  pll_clv_set_operation(partition, op);
+
+  return logl;
+}
+
+/* log-likelihood of the sites [begin,end) at the edge between parent and
+   child. The per-site log-likelihoods are stored at persite_lnl[begin..end-1].
+   Ranges are independent of each other and can be evaluated concurrently;
+   the log-likelihood of the partition is the sum over the ranges. Not
+   supported for single-precision CLVs, site repeats, ascertainment bias
+   correction and limited memory */
+PLL_EXPORT double pll_compute_edge_loglikelihood_range(pll_partition_t * partition,
+                                                       unsigned int begin,
+                                                       unsigned int end,
+                                                       unsigned int parent_clv_index,
+                                                       int parent_scaler_index,
+                                                       unsigned int child_clv_index,
+                                                       int child_scaler_index,
+                                                       unsigned int matrix_index,
+                                                       const unsigned int * freqs_indices,
+                                                       double * persite_lnl)
+{
+  size_t clv_offset = (size_t)begin * partition->rate_cats *
+                      partition->states_padded;
+  unsigned int * parent_scaler;
+
+  if ((partition->attributes & (PLL_ATTRIB_FLOAT | PLL_ATTRIB_AB_MASK)) ||
+      pll_repeats_enabled(partition) || partition->clv_manager)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "Site ranges are not supported with single precision, site "
+             "repeats, ascertainment bias correction or limited memory.");
+    return -INFINITY;
+  }
+
+  if (begin > end || end > partition->sites)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200, "Invalid site range [%u,%u).", begin, end);
+    return -INFINITY;
+  }
+
+  if (begin == end)
+    return 0;
 
+  /* the tip (if any) is evaluated as the other node of the edge */
+  if ((partition->attributes & PLL_ATTRIB_PATTERN_TIP) &&
+      parent_clv_index < partition->tips)
+  {
+    PLL_SWAP(parent_clv_index, child_clv_index);
+    PLL_SWAP(parent_scaler_index, child_scaler_index);
+  }
+
+  parent_scaler = pll_scaler_load_range(partition,
+                                        parent_scaler_index,
+                                        PLL_SCALER_PARENT,
+                                        begin,
+                                        end);
+
+  return fused_edge_block(partition,
+                          begin,
+                          end - begin,
+                          partition->clv[parent_clv_index] + clv_offset,
+                          parent_scaler,
+                          child_clv_index,
+                          child_scaler_index,
+                          matrix_index,
+                          freqs_indices,
+                          persite_lnl);
+}
+
+/* normalized marginal probabilities of a site, given the CLV of the site
+   combined from both directions. With per-rate scalers (rate_scaler is not
+   NULL) the rate categories are brought to a common scale first */
+static void site_ancestral_probs(const pll_partition_t * partition,
+                                 const double * clvp,
+                                 const unsigned int * rate_scaler,
+                                 const unsigned int * freqs_indices,
+                                 double * ancp)
+{
+  unsigned int i, j;
+  unsigned int states = partition->states;
+  unsigned int rate_cats = partition->rate_cats;
+  unsigned int min_scaler = UINT_MAX;
+  double sum = 0;
+
+  if (rate_scaler)
+    for (i = 0; i < rate_cats; ++i)
+      min_scaler = PLL_MIN(min_scaler, rate_scaler[i]);
+
+  memset(ancp, 0, states * sizeof(double));
+
+  for (i = 0; i < rate_cats; ++i)
+  {
+    const double * freqs = partition->frequencies[freqs_indices[i]];
+    double rate_weight = partition->rate_weights[i];
+
+    if (rate_scaler && rate_scaler[i] > min_scaler)
+      rate_weight *= pow(PLL_SCALE_THRESHOLD,
+                         PLL_MIN(rate_scaler[i] - min_scaler,
+                                 PLL_SCALE_RATE_MAXDIFF));
+
+    for (j = 0; j < states; ++j)
+      ancp[j] += clvp[j] * freqs[j] * rate_weight;
+
+    clvp += partition->states_padded;
+  }
+
+  // normalize probs
+  for (j = 0; j < states; ++j)
+    sum += ancp[j];
+  for (j = 0; j < states; ++j)
+    ancp[j] /= sum;
+}
+
+/* with site repeats, temp_clv and temp_scaler must be large enough for an
+   uncompressed CLV and scale buffer */
 PLL_EXPORT int pll_compute_node_ancestral_extbuf(pll_partition_t * partition,
                                                  unsigned int node_clv_index,
                                                  int node_scaler_index,
@@ -664,29 +1332,97 @@ PLL_EXPORT int pll_compute_node_ancestral_extbuf(pll_partition_t * partition,
     return PLL_FAILURE;
   }
 
-  if (pll_repeats_enabled(partition))
+  if (partition->attributes & PLL_ATTRIB_FLOAT)
   {
-    pll_errno = PLL_ERROR_EINVAL;
+    pll_errno = PLL_ERROR_FLOAT_NOSUPPORT;
     snprintf(pll_errmsg, 200,
-             "Site repeats are not compatible with ancestral state reconstruction!");
+             "Single-precision CLVs are not compatible with ancestral state "
+             "reconstruction!");
     return PLL_FAILURE;
   }
 
-  unsigned int n, i, j;
+  unsigned int n;
   unsigned int states = partition->states;
   unsigned int states_padded = partition->states_padded;
   unsigned int sites = partition->sites;
   unsigned int rate_cats = partition->rate_cats;
 
+  /* with site repeats, the probabilities are computed once per class of the
+     pair of nodes and copied to the other sites of the class */
+  unsigned int classes = sites;
+  unsigned int * site_id = NULL;
+  unsigned int * id_site = NULL;
+
   const double * pmat = partition->pmatrix[pmatrix_index];
 
+  /* with limited memory the CLVs may have to be recomputed first */
+  if (!pll_clv_require(partition, node_clv_index))
+    return PLL_FAILURE;
+
+  if (!pll_clv_require(partition, other_clv_index))
+  {
+    pll_clv_unpin(partition, node_clv_index);
+    return PLL_FAILURE;
+  }
+
   const double * node_clv = partition->clv[node_clv_index];
 
-  unsigned int * node_scaler = (node_scaler_index == PLL_SCALE_BUFFER_NONE) ?
-                            NULL : partition->scale_buffer[node_scaler_index];
+  unsigned int * node_scaler = pll_scaler_load(partition,
+                                               node_scaler_index,
+                                               PLL_SCALER_PARENT);
 
-  if (other_clv_index < partition->tips &&
-      (partition->attributes & PLL_ATTRIB_PATTERN_TIP))
+  if (pll_repeats_enabled(partition))
+  {
+    const double * other_clv = partition->clv[other_clv_index];
+    unsigned int * other_scaler = (other_scaler_index == PLL_SCALE_BUFFER_NONE) ?
+                              NULL : partition->scale_buffer[other_scaler_index];
+    const unsigned int * node_site_id = pll_get_site_id(partition,
+                                                        node_clv_index);
+    const unsigned int * other_site_id = pll_get_site_id(partition,
+                                                         other_clv_index);
+
+    if (node_site_id && other_site_id)
+    {
+      site_id = (unsigned int *)malloc(2 * sites * sizeof(unsigned int));
+      if (!site_id)
+      {
+        pll_clv_unpin(partition, node_clv_index);
+        pll_clv_unpin(partition, other_clv_index);
+        pll_errno = PLL_ERROR_MEM_ALLOC;
+        snprintf(pll_errmsg, 200, "Cannot allocate memory");
+        return PLL_FAILURE;
+      }
+      id_site = site_id + sites;
+      classes = pll_repeats_pair_classes(partition,
+                                         node_clv_index,
+                                         other_clv_index,
+                                         site_id,
+                                         id_site);
+    }
+
+    pll_core_update_partial_repeats(states,
+                                    classes,
+                                    pll_get_sites_number(partition,
+                                                         node_clv_index),
+                                    pll_get_sites_number(partition,
+                                                         other_clv_index),
+                                    rate_cats,
+                                    temp_clv,
+                                    temp_scaler,
+                                    node_clv,
+                                    other_clv,
+                                    ident_pmat,
+                                    pmat,
+                                    node_scaler,
+                                    other_scaler,
+                                    id_site,
+                                    node_site_id,
+                                    other_site_id,
+                                    NULL,
+                                    partition->attributes);
+  }
+  else if (other_clv_index < partition->tips &&
+           (partition->attributes & PLL_ATTRIB_PATTERN_TIP))
   {
     pll_core_update_partial_ti(states,
                                sites,
@@ -705,8 +1441,9 @@ PLL_EXPORT int pll_compute_node_ancestral_extbuf(pll_partition_t * partition,
   else
   {
     const double * other_clv = partition->clv[other_clv_index];
-    unsigned int * other_scaler = (other_scaler_index == PLL_SCALE_BUFFER_NONE) ?
-                              NULL : partition->scale_buffer[other_scaler_index];
+    unsigned int * other_scaler = pll_scaler_load(partition,
+                                                  other_scaler_index,
+                                                  PLL_SCALER_LEFT);
 
     pll_core_update_partial_ii(states,
                                sites,
@@ -722,37 +1459,72 @@ PLL_EXPORT int pll_compute_node_ancestral_extbuf(pll_partition_t * partition,
                                partition->attributes);
   }
 
+  pll_clv_unpin(partition, node_clv_index);
+  pll_clv_unpin(partition, other_clv_index);
+
   double * clvp = temp_clv;
-  double * ancp = ancestral;
+  double * ancp;
 
   memset(ancestral, 0, sites * states * sizeof(double));
 
-  for (n = 0; n < sites; ++n)
+  for (n = 0; n < classes; ++n)
   {
-    for (i = 0; i < rate_cats; ++i)
-    {
-      double * freqs = partition->frequencies[freqs_indices[i]];
-      double rate_weight = partition->rate_weights[i];
+    ancp = ancestral + PLL_GET_SITE(id_site, n) * states;
 
-      for (j = 0; j < states; ++j)
-      {
-        ancp[j] += clvp[j] * freqs[j] * rate_weight;
-      }
+    site_ancestral_probs(partition,
+                         clvp,
+                         (partition->attributes & PLL_ATTRIB_RATE_SCALERS) ?
+                           temp_scaler + n * rate_cats : NULL,
+                         freqs_indices,
+                         ancp);
 
-      clvp += states_padded;
+    clvp += states_padded * rate_cats;
+  }
+
+  if (site_id)
+  {
+    for (n = 0; n < sites; ++n)
+    {
+      unsigned int first = id_site[site_id[n]];
+      if (first != n)
+        memcpy(ancestral + n * states,
+               ancestral + first * states,
+               states * sizeof(double));
     }
+    free(site_id);
+  }
 
-    // normalize probs
-    double sum = 0;
-    for (j = 0; j < states; ++j)
-      sum += ancp[j];
+  return pll_repeats_restore_site_order(partition, ancestral, states);
+}
+
+/* identity p-matrices of all rate categories, laid out as the p-matrices of
+   the partition */
+static double * create_identity_pmatrix(const pll_partition_t * partition)
+{
+  unsigned int i, j, k;
+  unsigned int states = partition->states;
+  unsigned int states_padded = partition->states_padded;
+  unsigned int displacement = (states_padded - states) * (states_padded) * sizeof(double);
+  unsigned int pmat_size = states_padded * states * partition->rate_cats * sizeof(double) + displacement;
+  double * ident_pmat = (double *) pll_aligned_alloc(pmat_size, partition->alignment);
+
+  if (!ident_pmat)
+    return NULL;
+
+  memset(ident_pmat, 0, pmat_size);
+  double * pmat = ident_pmat;
+  for (i = 0; i < partition->rate_cats; ++i)
+  {
     for (j = 0; j < states; ++j)
-      ancp[j] /= sum;
+    {
+      for (k = 0; k < states_padded; ++k)
+        pmat[j*states_padded + k] = (j == k) ? 1 : 0;
+    }
 
-    ancp += states;
+    pmat +=  states*states_padded;
   }
 
-  return PLL_SUCCESS;
+  return ident_pmat;
 }
 
 PLL_EXPORT int pll_compute_node_ancestral(pll_partition_t * partition,
@@ -765,21 +1537,22 @@ PLL_EXPORT int pll_compute_node_ancestral(pll_partition_t * partition,
                                           double * ancestral)
 {
   int retval = PLL_FAILURE;
-  unsigned int i, j, k;
 
-  unsigned int states = partition->states;
   unsigned int states_padded = partition->states_padded;
   unsigned int sites = partition->sites;
   unsigned int rate_cats = partition->rate_cats;
 
-  unsigned int clv_size = pll_get_clv_size(partition, node_clv_index) * sizeof(double);
+  /* with site repeats, the pair of nodes may have more classes than either
+     node, hence the buffer has the size of an uncompressed CLV */
+  unsigned int clv_size = (pll_repeats_enabled(partition) ?
+                           sites * states_padded * rate_cats :
+                           pll_get_clv_size(partition, node_clv_index)) *
+                          sizeof(double);
   double * temp_clv = (double *) pll_aligned_alloc(clv_size, partition->alignment);
   unsigned int scaler_size = ((partition->attributes & PLL_ATTRIB_RATE_SCALERS) ?
                              sites*rate_cats : sites) * sizeof(unsigned int);
   unsigned int * temp_scaler = (unsigned int *) pll_aligned_alloc(scaler_size, partition->alignment);
-  unsigned int displacement = (states_padded - states) * (states_padded) * sizeof(double);
-  unsigned int pmat_size = states_padded * states * rate_cats * sizeof(double) + displacement;
-  double * ident_pmat = (double *) pll_aligned_alloc(pmat_size, partition->alignment);
+  double * ident_pmat = create_identity_pmatrix(partition);
 
   if (!temp_clv || !temp_scaler || !ident_pmat)
   {
@@ -788,20 +1561,6 @@ PLL_EXPORT int pll_compute_node_ancestral(pll_partition_t * partition,
     goto cleanup;
   }
 
-  // init identity matrix
-  memset(ident_pmat, 0, pmat_size);
-  double * pmat = ident_pmat;
-  for (i = 0; i < rate_cats; ++i)
-  {
-    for (j = 0; j < states; ++j)
-    {
-      for (k = 0; k < states_padded; ++k)
-        pmat[j*states_padded + k] = (j == k) ? 1 : 0;
-    }
-
-    pmat +=  states*states_padded;
-  }
-
   retval = pll_compute_node_ancestral_extbuf(partition,
                                            node_clv_index,
                                            node_scaler_index,
@@ -821,3 +1580,287 @@ cleanup:
 
   return retval;
 }
+
+/* Marginal ancestral states of all inner nodes. The pre-order traversal
+   visits every inner node v with the message of the rest of the tree out_v
+   and its subtree CLV in_v; the marginal probabilities of v are given by
+   (P_v * out_v) x in_v times the frequencies */
+
+typedef struct ancestral_job_s
+{
+  const unsigned int * freqs_indices;
+  double * temp_clv;
+  unsigned int * temp_scaler;
+  double * ancestral;
+} ancestral_job_t;
+
+static void ancestral_visit(const pll_preorder_t * preorder,
+                            const pll_preorder_step_t * step,
+                            unsigned int begin,
+                            unsigned int end,
+                            unsigned int thread_id,
+                            void * data)
+{
+  const ancestral_job_t * job = (const ancestral_job_t *)data;
+  const pll_partition_t * partition = preorder->partition;
+  unsigned int n;
+  unsigned int states = partition->states;
+  unsigned int rate_cats = partition->rate_cats;
+  size_t span = (size_t)partition->states_padded * rate_cats;
+  double * ancp = job->ancestral +
+                  ((size_t)(step->node->clv_index - partition->tips) *
+                   partition->sites + begin) * states;
+
+  pll_preorder_combine(preorder,
+                       step,
+                       begin,
+                       end,
+                       job->temp_clv + begin * span,
+                       (partition->attributes & PLL_ATTRIB_RATE_SCALERS) ?
+                         job->temp_scaler + begin * rate_cats :
+                         job->temp_scaler + begin);
+
+  for (n = begin; n < end; ++n)
+  {
+    site_ancestral_probs(partition,
+                         job->temp_clv + n * span,
+                         (partition->attributes & PLL_ATTRIB_RATE_SCALERS) ?
+                           job->temp_scaler + n * rate_cats : NULL,
+                         job->freqs_indices,
+                         ancp);
+    ancp += states;
+  }
+}
+
+/* computes the marginal ancestral probabilities of all inner nodes of the
+   tree with the inner node root, with one post-order and one pre-order
+   traversal. The probabilities of the inner node with CLV index c are stored
+   at ancestral[(c - tips) * sites * states], hence ancestral must hold
+   clv_buffers * sites * states values. The p-matrices must be up to date; the
+   CLVs of the tree are recomputed towards root. The pre-order traversal is
+   processed by the threads of the partition. Not supported for
+   single-precision CLVs, site repeats and limited memory */
+PLL_EXPORT int pll_compute_tree_ancestral(pll_partition_t * partition,
+                                          pll_unode_t * root,
+                                          const unsigned int * freqs_indices,
+                                          double * ancestral)
+{
+  unsigned int sites;
+  size_t clv_size, scaler_size;
+  pll_preorder_t * preorder;
+  ancestral_job_t job;
+
+  if (!partition || !ancestral)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200, "Invalid partition or output buffer.");
+    return PLL_FAILURE;
+  }
+
+  preorder = pll_preorder_create(partition, root, PLL_PREORDER_MARGINALS);
+  if (!preorder)
+    return PLL_FAILURE;
+
+  sites = partition->sites;
+  clv_size = (size_t)sites * partition->states_padded * partition->rate_cats;
+  scaler_size = (partition->attributes & PLL_ATTRIB_RATE_SCALERS) ?
+                (size_t)sites * partition->rate_cats : sites;
+
+  job.freqs_indices = freqs_indices;
+  job.ancestral = ancestral;
+  job.temp_clv = pll_aligned_alloc(clv_size * sizeof(double),
+                                   partition->alignment);
+  job.temp_scaler = (unsigned int *)malloc(scaler_size *
+                                           sizeof(unsigned int));
+  if (!job.temp_clv || !job.temp_scaler)
+  {
+    pll_aligned_free(job.temp_clv);
+    free(job.temp_scaler);
+    pll_preorder_destroy(preorder);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory");
+    return PLL_FAILURE;
+  }
+
+  /* zero-out the padding, see pll_partition_create() */
+  memset(job.temp_clv, 0, clv_size * sizeof(double));
+
+  pll_preorder_run(preorder, ancestral_visit, &job);
+
+  pll_aligned_free(job.temp_clv);
+  free(job.temp_scaler);
+  pll_preorder_destroy(preorder);
+
+  return PLL_SUCCESS;
+}
+
+/* RELL-style scoring of replicate site weightings. The per-site
+   log-likelihoods are computed once with unit weights and each replicate is
+   a weighted sum of them. The ascertainment bias correction does not depend
+   on the site weights, except for the Lewis correction that is proportional
+   to their sum. weights is a replicates x sites matrix in the original order
+   of the sites */
+
+static unsigned int * unit_pattern_weights(const pll_partition_t * partition)
+{
+  unsigned int i;
+  unsigned int sites_alloc = partition->sites +
+                             (unsigned int) partition->asc_additional_sites;
+  unsigned int * weights;
+
+  weights = (unsigned int *) malloc(sites_alloc * sizeof(unsigned int));
+  if (!weights)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return NULL;
+  }
+
+  for (i = 0; i < partition->sites; ++i)
+    weights[i] = 1;
+
+  /* keep the weights of the ascertainment bias correction states */
+  for (; i < sites_alloc; ++i)
+    weights[i] = partition->pattern_weights[i];
+
+  return weights;
+}
+
+static int replicate_loglikelihoods(const pll_partition_t * partition,
+                                    double logl,
+                                    const double * persite_lnl,
+                                    const unsigned int * weights,
+                                    unsigned int replicates,
+                                    double * replicate_lnl)
+{
+  unsigned int n, r;
+  unsigned int sites = partition->sites;
+  double correction = 0;
+
+  if (logl == -INFINITY)
+    return PLL_FAILURE;
+
+  if (partition->attributes & PLL_ATTRIB_AB_MASK)
+  {
+    correction = logl;
+    for (n = 0; n < sites; ++n)
+      correction -= persite_lnl[n];
+  }
+
+  pll_core_weighted_sums(sites,
+                         replicates,
+                         weights,
+                         persite_lnl,
+                         replicate_lnl,
+                         partition->attributes);
+
+  for (r = 0; r < replicates; ++r)
+  {
+    if ((partition->attributes & PLL_ATTRIB_AB_MASK) == PLL_ATTRIB_AB_LEWIS)
+    {
+      const unsigned int * w = weights + (size_t)r * sites;
+      unsigned int weight_sum = 0;
+      for (n = 0; n < sites; ++n)
+        weight_sum += w[n];
+      replicate_lnl[r] += correction * weight_sum / partition->pattern_weight_sum;
+    }
+    else
+      replicate_lnl[r] += correction;
+  }
+
+  return PLL_SUCCESS;
+}
+
+PLL_EXPORT int pll_compute_root_loglikelihood_replicates(pll_partition_t * partition,
+                                                         unsigned int clv_index,
+                                                         int scaler_index,
+                                                         const unsigned int * freqs_indices,
+                                                         const unsigned int * weights,
+                                                         unsigned int replicates,
+                                                         double * replicate_lnl)
+{
+  int retval;
+  double logl;
+  unsigned int * pattern_weights = partition->pattern_weights;
+  unsigned int * unit_weights = unit_pattern_weights(partition);
+  double * persite_lnl = (double *) malloc(partition->sites * sizeof(double));
+
+  if (!unit_weights || !persite_lnl)
+  {
+    free(unit_weights);
+    free(persite_lnl);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return PLL_FAILURE;
+  }
+
+  partition->pattern_weights = unit_weights;
+  logl = pll_compute_root_loglikelihood(partition,
+                                        clv_index,
+                                        scaler_index,
+                                        freqs_indices,
+                                        persite_lnl);
+  partition->pattern_weights = pattern_weights;
+
+  retval = replicate_loglikelihoods(partition,
+                                    logl,
+                                    persite_lnl,
+                                    weights,
+                                    replicates,
+                                    replicate_lnl);
+
+  free(unit_weights);
+  free(persite_lnl);
+
+  return retval;
+}
+
+PLL_EXPORT int pll_compute_edge_loglikelihood_replicates(pll_partition_t * partition,
+                                                         unsigned int parent_clv_index,
+                                                         int parent_scaler_index,
+                                                         unsigned int child_clv_index,
+                                                         int child_scaler_index,
+                                                         unsigned int matrix_index,
+                                                         const unsigned int * freqs_indices,
+                                                         const unsigned int * weights,
+                                                         unsigned int replicates,
+                                                         double * replicate_lnl)
+{
+  int retval;
+  double logl;
+  unsigned int * pattern_weights = partition->pattern_weights;
+  unsigned int * unit_weights = unit_pattern_weights(partition);
+  double * persite_lnl = (double *) malloc(partition->sites * sizeof(double));
+
+  if (!unit_weights || !persite_lnl)
+  {
+    free(unit_weights);
+    free(persite_lnl);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return PLL_FAILURE;
+  }
+
+  partition->pattern_weights = unit_weights;
+  logl = pll_compute_edge_loglikelihood(partition,
+                                        parent_clv_index,
+                                        parent_scaler_index,
+                                        child_clv_index,
+                                        child_scaler_index,
+                                        matrix_index,
+                                        freqs_indices,
+                                        persite_lnl);
+  partition->pattern_weights = pattern_weights;
+
+  retval = replicate_loglikelihoods(partition,
+                                    logl,
+                                    persite_lnl,
+                                    weights,
+                                    replicates,
+                                    replicate_lnl);
+
+  free(unit_weights);
+  free(persite_lnl);
+
+  return retval;
+}
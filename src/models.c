@@ -427,19 +427,25 @@ PLL_EXPORT int pll_update_prob_matrices(pll_partition_t * partition,
     }
   }
 
-  return pll_core_update_pmatrix(partition->pmatrix,
-                                 partition->states,
-                                 partition->rate_cats,
-                                 partition->rates,
-                                 branch_lengths,
-                                 matrix_indices,
-                                 params_indices,
-                                 partition->prop_invar,
-                                 partition->eigenvals,
-                                 partition->eigenvecs,
-                                 partition->inv_eigenvecs,
-                                 count,
-                                 partition->attributes);
+  if (!pll_core_update_pmatrix(partition->pmatrix,
+                               partition->states,
+                               partition->rate_cats,
+                               partition->rates,
+                               branch_lengths,
+                               matrix_indices,
+                               params_indices,
+                               partition->prop_invar,
+                               partition->eigenvals,
+                               partition->eigenvecs,
+                               partition->inv_eigenvecs,
+                               count,
+                               partition->attributes))
+    return PLL_FAILURE;
+
+  for (n = 0; n < count; ++n)
+    pll_invalidate_pmatrix(partition, matrix_indices[n]);
+
+  return PLL_SUCCESS;
 }
 
 PLL_EXPORT void pll_set_frequencies(pll_partition_t * partition,
@@ -543,10 +549,34 @@ PLL_EXPORT int pll_update_invariant_sites_proportion(pll_partition_t * partition
   return PLL_SUCCESS;
 }
 
+/* state set encoded in the tip CLV entries starting at offset */
+static pll_state_t tip_clv_state(const pll_partition_t * partition,
+                                 unsigned int tip_index,
+                                 size_t offset)
+{
+  unsigned int k;
+  pll_state_t state = 0;
+
+  if (partition->attributes & PLL_ATTRIB_FLOAT)
+  {
+    const float * tipclv = partition->clv_float[tip_index] + offset;
+    for (k = 0; k < partition->states; ++k)
+      state |= ((pll_state_t)tipclv[k] << k);
+  }
+  else
+  {
+    const double * tipclv = partition->clv[tip_index] + offset;
+    for (k = 0; k < partition->states; ++k)
+      state |= ((pll_state_t)tipclv[k] << k);
+  }
+
+  return state;
+}
+
 PLL_EXPORT unsigned int pll_count_invariant_sites(pll_partition_t * partition,
                                                   unsigned int * state_inv_count)
 {
-  unsigned int i,j,k;
+  unsigned int i,j;
   unsigned int invariant_count = 0;
   unsigned int tips = partition->tips;
   unsigned int sites = partition->sites;
@@ -554,7 +584,6 @@ PLL_EXPORT unsigned int pll_count_invariant_sites(pll_partition_t * partition,
   pll_state_t gap_state = 0;
   pll_state_t cur_state;
   int * invariant = partition->invariant;
-  double * tipclv;
 
   /* gap state has always all bits set to one */
   for (i = 0; i < states; ++i)
@@ -620,16 +649,10 @@ PLL_EXPORT unsigned int pll_count_invariant_sites(pll_partition_t * partition,
       for (j = 0; j < sites; ++j)
       {
         unsigned int clv_shift = j*span_padded;
-        tipclv = partition->clv[0] + clv_shift;
         pll_state_t state = gap_state;
         for (i = 0; i < tips; ++i)
         {
-          tipclv = partition->clv[i] + clv_shift;
-          cur_state = 0;
-          for (k = 0; k < states; ++k)
-          {
-            cur_state |= ((pll_state_t)tipclv[k] << k);
-          }
+          cur_state = tip_clv_state(partition, i, clv_shift);
           state &= cur_state;
           if (!state)
           {
@@ -650,7 +673,7 @@ PLL_EXPORT unsigned int pll_count_invariant_sites(pll_partition_t * partition,
 
 PLL_EXPORT int pll_update_invariant_sites(pll_partition_t * partition)
 {
-  unsigned int i,j,k;
+  unsigned int i,j;
   pll_state_t state;
   unsigned int states = partition->states;
   unsigned int states_padded = partition->states_padded;
@@ -659,7 +682,6 @@ PLL_EXPORT int pll_update_invariant_sites(pll_partition_t * partition)
   unsigned int rate_cats = partition->rate_cats;
   pll_state_t gap_state = 0;
   pll_state_t * invariant;
-  double * tipclv;
 
   /* gap state has always all bits set to one */
   for (i = 0; i < states; ++i)
@@ -725,12 +747,7 @@ PLL_EXPORT int pll_update_invariant_sites(pll_partition_t * partition)
       for (j = 0; j < sites; ++j)
       {
         unsigned int site = site_id ? site_id[j] : j;
-        tipclv = partition->clv[i] + span_padded * site;
-        state = 0;
-        for (k = 0; k < states; ++k)
-        {
-          state |= ((pll_state_t)tipclv[k] << k);
-        }
+        state = tip_clv_state(partition, i, (size_t)span_padded * site);
         invariant[j] &= state;
       }
     }
@@ -0,0 +1,338 @@
+/*
+    Copyright (C) 2015-2020 Tomas Flouri, Diego Darriba, Alexey Kozlov
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "pll.h"
+
+/* Multi-partition evaluation. The work of every partition (its operations
+   followed by the evaluation of an edge) is estimated from the number of
+   sites times states_padded times rate_cats, where the sites of compressed
+   nodes are replaced by their number of repeat classes. Partitions that are
+   more expensive than the share of a thread are split into site ranges,
+   then the resulting work units are assigned to threads by decreasing cost,
+   each to the thread with the least work so far (longest processing time
+   first). Small partitions are thereby packed together, and every thread
+   synchronizes only once */
+
+typedef struct work_unit_s
+{
+  unsigned int task;
+  unsigned int begin;
+  unsigned int end;
+  int split;                    /* site range of a split partition */
+  double cost;
+  unsigned int thread_id;
+
+  /* results, written by the thread that processed the unit */
+  double logl;
+  int errno_value;
+  char errmsg[200];
+} work_unit_t;
+
+typedef struct multipart_job_s
+{
+  const pll_partition_task_t * tasks;
+  work_unit_t * units;
+  unsigned int units_count;
+} multipart_job_t;
+
+/* sites of a node the operations on it are executed for */
+static double node_sites(const pll_partition_t * partition,
+                         unsigned int clv_index)
+{
+  if (pll_repeats_enabled(partition) &&
+      partition->repeats->pernode_ids[clv_index])
+    return partition->repeats->pernode_ids[clv_index];
+
+  return partition->sites;
+}
+
+static double task_cost(const pll_partition_task_t * task)
+{
+  const pll_partition_t * partition = task->partition;
+  double span = (double)partition->states_padded * partition->rate_cats;
+  double sites;
+  unsigned int i;
+
+  sites = PLL_MAX(node_sites(partition, task->parent_clv_index),
+                  node_sites(partition, task->child_clv_index));
+
+  for (i = 0; i < task->operations_count; ++i)
+    sites += node_sites(partition, task->operations[i].parent_clv_index);
+
+  return sites * span;
+}
+
+/* a partition can be split by sites unless its sites are coupled, or its
+   CLVs are managed by the library */
+static int task_splittable(const pll_partition_task_t * task)
+{
+  const pll_partition_t * partition = task->partition;
+
+  return !(partition->attributes & (PLL_ATTRIB_FLOAT |
+                                    PLL_ATTRIB_AB_MASK |
+                                    PLL_ATTRIB_CLV_VERSIONS)) &&
+         !pll_repeats_enabled(partition) &&
+         !partition->clv_manager &&
+         !partition->asc_bias_alloc;
+}
+
+static int cb_cost_cmp(const void * a, const void * b)
+{
+  const work_unit_t * x = *(work_unit_t * const *)a;
+  const work_unit_t * y = *(work_unit_t * const *)b;
+
+  if (x->cost > y->cost) return -1;
+  if (x->cost < y->cost) return 1;
+
+  /* keep the order deterministic */
+  return (x < y) ? -1 : (x > y);
+}
+
+static work_unit_t * create_units(const pll_partition_task_t * tasks,
+                                  unsigned int count,
+                                  unsigned int threads,
+                                  unsigned int * units_count)
+{
+  unsigned int i, j, n;
+  unsigned int chunks;
+  unsigned int units = 0;
+  double total = 0;
+  double share;
+  double * cost;
+  work_unit_t * unit;
+  work_unit_t ** order;
+  double * load;
+
+  cost = (double *)malloc(count * sizeof(double));
+  load = (double *)calloc(threads, sizeof(double));
+  if (!cost || !load)
+  {
+    free(cost);
+    free(load);
+    return NULL;
+  }
+
+  for (i = 0; i < count; ++i)
+  {
+    cost[i] = task_cost(tasks + i);
+    total += cost[i];
+  }
+  share = total / threads;
+
+  /* number of site ranges each partition is split into */
+  for (i = 0; i < count; ++i)
+    units += (task_splittable(tasks + i) && cost[i] > share) ?
+               PLL_MIN((unsigned int)ceil(cost[i] / share), threads) : 1;
+
+  unit = (work_unit_t *)calloc(units, sizeof(work_unit_t));
+  order = (work_unit_t **)malloc(units * sizeof(work_unit_t *));
+  if (!unit || !order)
+  {
+    free(cost);
+    free(load);
+    free(unit);
+    free(order);
+    return NULL;
+  }
+
+  for (i = 0, n = 0; i < count; ++i)
+  {
+    const pll_partition_t * partition = tasks[i].partition;
+
+    chunks = (task_splittable(tasks + i) && cost[i] > share) ?
+               PLL_MIN((unsigned int)ceil(cost[i] / share), threads) : 1;
+
+    for (j = 0; j < chunks; ++j, ++n)
+    {
+      unit[n].task = i;
+      unit[n].split = chunks > 1;
+      if (chunks > 1)
+        pll_thread_site_range(partition->sites,
+                              j,
+                              chunks,
+                              &unit[n].begin,
+                              &unit[n].end);
+      else
+      {
+        unit[n].begin = 0;
+        unit[n].end = partition->sites;
+      }
+      unit[n].cost = partition->sites ?
+                     cost[i] * (unit[n].end - unit[n].begin) /
+                       partition->sites : 0;
+      order[n] = unit + n;
+    }
+  }
+
+  /* longest processing time first */
+  qsort(order, units, sizeof(work_unit_t *), cb_cost_cmp);
+  for (n = 0; n < units; ++n)
+  {
+    unsigned int lightest = 0;
+    for (j = 1; j < threads; ++j)
+      if (load[j] < load[lightest])
+        lightest = j;
+
+    order[n]->thread_id = lightest;
+    load[lightest] += order[n]->cost;
+  }
+
+  free(cost);
+  free(load);
+  free(order);
+
+  *units_count = units;
+  return unit;
+}
+
+static double unit_loglikelihood(const pll_partition_task_t * task,
+                                 const work_unit_t * unit)
+{
+  pll_partition_t * partition = task->partition;
+
+  if (!unit->split)
+  {
+    if (!pll_update_partials(partition,
+                             task->operations,
+                             task->operations_count))
+      return -INFINITY;
+
+    return pll_compute_edge_loglikelihood(partition,
+                                          task->parent_clv_index,
+                                          task->parent_scaler_index,
+                                          task->child_clv_index,
+                                          task->child_scaler_index,
+                                          task->matrix_index,
+                                          task->freqs_indices,
+                                          task->persite_lnl);
+  }
+
+  if (!pll_update_partials_range(partition,
+                                 task->operations,
+                                 task->operations_count,
+                                 unit->begin,
+                                 unit->end))
+    return -INFINITY;
+
+  return pll_compute_edge_loglikelihood_range(partition,
+                                              unit->begin,
+                                              unit->end,
+                                              task->parent_clv_index,
+                                              task->parent_scaler_index,
+                                              task->child_clv_index,
+                                              task->child_scaler_index,
+                                              task->matrix_index,
+                                              task->freqs_indices,
+                                              task->persite_lnl);
+}
+
+static void multipart_job(void * data,
+                          unsigned int thread_id,
+                          unsigned int thread_count)
+{
+  multipart_job_t * job = (multipart_job_t *)data;
+  unsigned int n;
+
+  for (n = 0; n < job->units_count; ++n)
+  {
+    work_unit_t * unit = job->units + n;
+
+    if (unit->thread_id != thread_id)
+      continue;
+
+    pll_errno = 0;
+    unit->logl = unit_loglikelihood(job->tasks + unit->task, unit);
+
+    /* pll_errno is thread-local; hand errors over to the calling thread */
+    unit->errno_value = pll_errno;
+    if (pll_errno)
+      memcpy(unit->errmsg, pll_errmsg, 200);
+  }
+}
+
+/* computes the log-likelihoods of several partitions on a thread pool (which
+   may be NULL) and returns their sum. The log-likelihood of every partition
+   is stored in partition_lnl (if not NULL). The p-matrices must be up to
+   date, and every partition may occur in at most one task */
+PLL_EXPORT double pll_compute_partitions_loglikelihood(pll_thread_pool_t * pool,
+                                                       const pll_partition_task_t * tasks,
+                                                       unsigned int count,
+                                                       double * partition_lnl)
+{
+  unsigned int i, j, n;
+  unsigned int units_count;
+  unsigned int threads = pll_thread_pool_size(pool);
+  double logl = 0;
+  multipart_job_t job;
+  work_unit_t * units;
+
+  for (i = 0; i < count; ++i)
+    for (j = 0; j < i; ++j)
+      if (tasks[i].partition == tasks[j].partition)
+      {
+        pll_errno = PLL_ERROR_PARAM_INVALID;
+        snprintf(pll_errmsg, 200,
+                 "Partition of task %u also occurs in task %u.", i, j);
+        return -INFINITY;
+      }
+
+  units = create_units(tasks, count, threads, &units_count);
+  if (!units && count)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return -INFINITY;
+  }
+
+  job.tasks = tasks;
+  job.units = units;
+  job.units_count = units_count;
+
+  if (count)
+    pll_thread_pool_run(pool, multipart_job, &job);
+
+  /* units of a partition are in site order, hence the sums do not depend on
+     the assignment of units to threads */
+  for (n = 0, i = 0; i < count; ++i)
+  {
+    double task_logl = 0;
+
+    for (; n < units_count && units[n].task == i; ++n)
+    {
+      if (units[n].errno_value)
+      {
+        pll_errno = units[n].errno_value;
+        memcpy(pll_errmsg, units[n].errmsg, 200);
+        free(units);
+        return -INFINITY;
+      }
+      task_logl += units[n].logl;
+    }
+
+    if (partition_lnl)
+      partition_lnl[i] = task_logl;
+    logl += task_logl;
+  }
+
+  free(units);
+
+  return logl;
+}
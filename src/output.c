@@ -20,8 +20,9 @@
 */
 
 #include "pll.h"
+#include "pll_private.h"
 
-static void unscale(double * prob, unsigned int times);
+static void unscale(double * prob, unsigned int times, double threshold);
 
 PLL_EXPORT void pll_show_pmatrix(const pll_partition_t * partition,
                                  unsigned int index,
@@ -45,12 +46,12 @@ PLL_EXPORT void pll_show_pmatrix(const pll_partition_t * partition,
   }
 }
 
-static void unscale(double * prob, unsigned int times)
+static void unscale(double * prob, unsigned int times, double threshold)
 {
   unsigned int i;
 
   for (i = 0; i < times; ++i)
-    *prob *= PLL_SCALE_THRESHOLD;
+    *prob *= threshold;
 }
 
 PLL_EXPORT void pll_show_clv(const pll_partition_t * partition,
@@ -60,9 +61,13 @@ PLL_EXPORT void pll_show_clv(const pll_partition_t * partition,
 {
   unsigned int s,i,j,k;
 
-  double * clv = partition->clv[clv_index];
-  unsigned int * scaler = (scaler_index == PLL_SCALE_BUFFER_NONE) ?
-                          NULL : partition->scale_buffer[scaler_index];
+  const double * clv = NULL;
+  const float * clv_float = NULL;
+  double threshold = (partition->attributes & PLL_ATTRIB_FLOAT) ?
+                          PLL_SCALE_THRESHOLD_FLOAT : PLL_SCALE_THRESHOLD;
+  unsigned int * scaler = pll_scaler_load(partition,
+                                          scaler_index,
+                                          PLL_SCALER_PARENT);
   unsigned int states = partition->states;
   unsigned int states_padded = partition->states_padded;
   unsigned int rates = partition->rate_cats;
@@ -76,6 +81,15 @@ PLL_EXPORT void pll_show_clv(const pll_partition_t * partition,
       (partition->attributes & PLL_ATTRIB_PATTERN_TIP))
     return;
 
+  /* evicted CLVs (PLL_ATTRIB_LIMIT_MEMORY) */
+  if (!pll_clv_resident(partition, clv_index))
+    return;
+
+  if (partition->attributes & PLL_ATTRIB_FLOAT)
+    clv_float = partition->clv_float[clv_index];
+  else
+    clv = partition->clv[clv_index];
+
   printf ("[ ");
   for (s = 0; s < partition->sites; ++s)
   {
@@ -86,12 +100,14 @@ PLL_EXPORT void pll_show_clv(const pll_partition_t * partition,
       printf("(");
       for (k = 0; k < states-1; ++k)
       {
-        prob = clv[i*rates*states_padded + j*states_padded + k];
-        if (scaler) unscale(&prob, scaler[i]);
+        prob = clv ? clv[i*rates*states_padded + j*states_padded + k] :
+                     clv_float[i*rates*states_padded + j*states_padded + k];
+        if (scaler) unscale(&prob, scaler[i], threshold);
         printf("%.*f,", float_precision, prob);
       }
-      prob = clv[i*rates*states_padded + j*states_padded + k];
-      if (scaler) unscale(&prob, scaler[i]);
+      prob = clv ? clv[i*rates*states_padded + j*states_padded + k] :
+                     clv_float[i*rates*states_padded + j*states_padded + k];
+      if (scaler) unscale(&prob, scaler[i], threshold);
       printf("%.*f)", float_precision, prob);
       if (j < rates - 1) printf(",");
     }
@@ -99,3 +115,29 @@ PLL_EXPORT void pll_show_clv(const pll_partition_t * partition,
   }
   printf ("]\n");
 }
+
+PLL_EXPORT void pll_show_repeats_stats(const pll_partition_t * partition)
+{
+  pll_repeats_stats_t stats;
+
+  if (!pll_repeats_stats(partition, &stats))
+    return;
+
+  printf("Site repeats: %u of %u inner CLVs compressed\n",
+         stats.compressed, stats.nodes);
+  printf("  classes/sites: %.4f (inner), %.4f (tips), max %u classes of %u "
+         "sites\n",
+         stats.mean_ratio, stats.tip_ratio, stats.max_classes,
+         partition->sites);
+  printf("  bytes: %zu (CLVs), %zu (scalers), %zu (pooled), %zu (without "
+         "repeats)\n",
+         stats.clv_bytes, stats.scaler_bytes, stats.pooled_bytes,
+         stats.plain_bytes);
+  printf("  class updates: %lu, %lu disabled, %lu without gain, %lu kept\n",
+         stats.updates, stats.declined, stats.no_gain, stats.kept);
+  printf("  reallocations: %lu CLVs (%lu new), %lu scalers (%lu new), "
+         "%lu freed\n",
+         stats.clv_reallocs, stats.clv_allocs, stats.scaler_reallocs,
+         stats.scaler_allocs, stats.releases);
+  printf("  lookup table: %u entries\n", stats.lookup_size);
+}
@@ -19,31 +19,70 @@
     Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
 */
 
+#include <pthread.h>
+#include <limits.h>
 #include "pll.h"
+#include "pll_private.h"
+
+/* offset of site begin within CLVs */
+static size_t clv_offset(const pll_partition_t * partition, unsigned int begin)
+{
+  return (size_t)begin * partition->rate_cats * partition->states_padded;
+}
+
+/* the case_* functions update the parent CLV for sites [begin,end) */
 
 static void case_tiptip(pll_partition_t * partition,
-                        const pll_operation_t * op)
+                        const pll_operation_t * op,
+                        unsigned int begin,
+                        unsigned int end,
+                        double * lookup)
 {
   const double * left_matrix = partition->pmatrix[op->child1_matrix_index];
   const double * right_matrix = partition->pmatrix[op->child2_matrix_index];
-  double * parent_clv = partition->clv[op->parent_clv_index];
+  double * parent_clv;
   unsigned int * parent_scaler;
-  unsigned int sites = partition->sites;
-
-  /* ascertaiment bias correction */
-  if (partition->asc_bias_alloc)
-    sites += partition->states;
+  unsigned int sites = end - begin;
 
   /* get parent scaler */
-  if (op->parent_scaler_index == PLL_SCALE_BUFFER_NONE)
-    parent_scaler = NULL;
-  else
-    parent_scaler = partition->scale_buffer[op->parent_scaler_index];
+  parent_scaler = pll_scaler_load_range(partition,
+                                        op->parent_scaler_index,
+                                        PLL_SCALER_PARENT,
+                                        begin,
+                                        end);
+
+  if (partition->attributes & PLL_ATTRIB_FLOAT)
+  {
+    pll_core_update_partial_tt_float(partition->states,
+                                     sites,
+                                     partition->rate_cats,
+                                     partition->clv_float[op->parent_clv_index] +
+                                       clv_offset(partition, begin),
+                                     parent_scaler,
+                                     partition->tipchars[op->child1_clv_index] +
+                                       begin,
+                                     partition->tipchars[op->child2_clv_index] +
+                                       begin,
+                                     left_matrix,
+                                     right_matrix,
+                                     partition->tipmap,
+                                     partition->maxstates,
+                                     partition->attributes);
+    pll_scaler_store_range(partition,
+                           op->parent_scaler_index,
+                           PLL_SCALER_PARENT,
+                           begin,
+                           end);
+    return;
+  }
+
+  parent_clv = partition->clv[op->parent_clv_index] +
+               clv_offset(partition, begin);
 
   /* precompute lookup table */
   pll_core_create_lookup(partition->states,
                          partition->rate_cats,
-                         partition->ttlookup,
+                         lookup,
                          left_matrix,
                          right_matrix,
                          partition->tipmap,
@@ -57,35 +96,39 @@ static void case_tiptip(pll_partition_t * partition,
                              partition->rate_cats,
                              parent_clv,
                              parent_scaler,
-                             partition->tipchars[op->child1_clv_index],
-                             partition->tipchars[op->child2_clv_index],
+                             partition->tipchars[op->child1_clv_index] + begin,
+                             partition->tipchars[op->child2_clv_index] + begin,
                              partition->tipmap,
                              partition->maxstates,
-                             partition->ttlookup,
+                             lookup,
                              partition->attributes);
+
+  pll_scaler_store_range(partition,
+                         op->parent_scaler_index,
+                         PLL_SCALER_PARENT,
+                         begin,
+                         end);
 }
 
 static void case_tipinner(pll_partition_t * partition,
-                          const pll_operation_t * op)
+                          const pll_operation_t * op,
+                          unsigned int begin,
+                          unsigned int end)
 {
-  double * parent_clv = partition->clv[op->parent_clv_index];
   unsigned int tip_clv_index;
   unsigned int inner_clv_index;
   unsigned int tip_matrix_index;
   unsigned int inner_matrix_index;
   unsigned int * right_scaler;
   unsigned int * parent_scaler;
-  unsigned int sites = partition->sites;
-
-  /* ascertaiment bias correction */
-  if (partition->asc_bias_alloc)
-    sites += partition->states;
+  unsigned int sites = end - begin;
 
   /* get parent scaler */
-  if (op->parent_scaler_index == PLL_SCALE_BUFFER_NONE)
-    parent_scaler = NULL;
-  else
-    parent_scaler = partition->scale_buffer[op->parent_scaler_index];
+  parent_scaler = pll_scaler_load_range(partition,
+                                        op->parent_scaler_index,
+                                        PLL_SCALER_PARENT,
+                                        begin,
+                                        end);
 
   /* find which of the two child nodes is the tip */
   if (op->child1_clv_index < partition->tips)
@@ -94,10 +137,11 @@ static void case_tipinner(pll_partition_t * partition,
     tip_matrix_index = op->child1_matrix_index;
     inner_clv_index = op->child2_clv_index;
     inner_matrix_index = op->child2_matrix_index;
-    if (op->child2_scaler_index == PLL_SCALE_BUFFER_NONE)
-      right_scaler = NULL;
-    else
-      right_scaler = partition->scale_buffer[op->child2_scaler_index];
+    right_scaler = pll_scaler_load_range(partition,
+                                         op->child2_scaler_index,
+                                         PLL_SCALER_RIGHT,
+                                         begin,
+                                         end);
   }
   else
   {
@@ -105,78 +149,142 @@ static void case_tipinner(pll_partition_t * partition,
     tip_matrix_index = op->child2_matrix_index;
     inner_clv_index = op->child1_clv_index;
     inner_matrix_index = op->child1_matrix_index;
-    if (op->child1_scaler_index == PLL_SCALE_BUFFER_NONE)
-      right_scaler = NULL;
-    else
-      right_scaler = partition->scale_buffer[op->child1_scaler_index];
+    right_scaler = pll_scaler_load_range(partition,
+                                         op->child1_scaler_index,
+                                         PLL_SCALER_RIGHT,
+                                         begin,
+                                         end);
+  }
+
+  if (partition->attributes & PLL_ATTRIB_FLOAT)
+  {
+    pll_core_update_partial_ti_float(partition->states,
+                                     sites,
+                                     partition->rate_cats,
+                                     partition->clv_float[op->parent_clv_index] +
+                                       clv_offset(partition, begin),
+                                     parent_scaler,
+                                     partition->tipchars[tip_clv_index] + begin,
+                                     partition->clv_float[inner_clv_index] +
+                                       clv_offset(partition, begin),
+                                     partition->pmatrix[tip_matrix_index],
+                                     partition->pmatrix[inner_matrix_index],
+                                     right_scaler,
+                                     partition->tipmap,
+                                     partition->maxstates,
+                                     partition->attributes);
+    pll_scaler_store_range(partition,
+                           op->parent_scaler_index,
+                           PLL_SCALER_PARENT,
+                           begin,
+                           end);
+    return;
   }
-  
 
   pll_core_update_partial_ti(partition->states,
                              sites,
                              partition->rate_cats,
-                             parent_clv,
+                             partition->clv[op->parent_clv_index] +
+                               clv_offset(partition, begin),
                              parent_scaler,
-                             partition->tipchars[tip_clv_index],
-                             partition->clv[inner_clv_index],
+                             partition->tipchars[tip_clv_index] + begin,
+                             partition->clv[inner_clv_index] +
+                               clv_offset(partition, begin),
                              partition->pmatrix[tip_matrix_index],
                              partition->pmatrix[inner_matrix_index],
                              right_scaler,
                              partition->tipmap,
                              partition->maxstates,
                              partition->attributes);
+
+  pll_scaler_store_range(partition,
+                         op->parent_scaler_index,
+                         PLL_SCALER_PARENT,
+                         begin,
+                         end);
 }
 
 static void case_innerinner(pll_partition_t * partition,
-                            const pll_operation_t * op)
+                            const pll_operation_t * op,
+                            unsigned int begin,
+                            unsigned int end)
 {
   const double * left_matrix = partition->pmatrix[op->child1_matrix_index];
   const double * right_matrix = partition->pmatrix[op->child2_matrix_index];
-  double * parent_clv = partition->clv[op->parent_clv_index];
-  double * left_clv = partition->clv[op->child1_clv_index];
-  double * right_clv = partition->clv[op->child2_clv_index];
+  size_t clvoff = clv_offset(partition, begin);
   unsigned int * parent_scaler;
   unsigned int * left_scaler;
   unsigned int * right_scaler;
-  unsigned int sites = partition->sites;
-
-  /* ascertaiment bias correction */
-  if (partition->asc_bias_alloc)
-    sites += partition->states;
+  unsigned int sites = end - begin;
 
   /* get parent scaler */
-  if (op->parent_scaler_index == PLL_SCALE_BUFFER_NONE)
-    parent_scaler = NULL;
-  else
-    parent_scaler = partition->scale_buffer[op->parent_scaler_index];
+  parent_scaler = pll_scaler_load_range(partition,
+                                        op->parent_scaler_index,
+                                        PLL_SCALER_PARENT,
+                                        begin,
+                                        end);
 
-  if (op->child1_scaler_index != PLL_SCALE_BUFFER_NONE)
-    left_scaler = partition->scale_buffer[op->child1_scaler_index];
-  else
-    left_scaler = NULL;
+  left_scaler = pll_scaler_load_range(partition,
+                                      op->child1_scaler_index,
+                                      PLL_SCALER_LEFT,
+                                      begin,
+                                      end);
 
   /* if child2 has a scaler add its values to the parent scaler */
-  if (op->child2_scaler_index != PLL_SCALE_BUFFER_NONE)
-    right_scaler = partition->scale_buffer[op->child2_scaler_index];
-  else
-    right_scaler = NULL;
+  right_scaler = pll_scaler_load_range(partition,
+                                       op->child2_scaler_index,
+                                       PLL_SCALER_RIGHT,
+                                       begin,
+                                       end);
+
+  if (partition->attributes & PLL_ATTRIB_FLOAT)
+  {
+    pll_core_update_partial_ii_float(partition->states,
+                                     sites,
+                                     partition->rate_cats,
+                                     partition->clv_float[op->parent_clv_index] +
+                                       clvoff,
+                                     parent_scaler,
+                                     partition->clv_float[op->child1_clv_index] +
+                                       clvoff,
+                                     partition->clv_float[op->child2_clv_index] +
+                                       clvoff,
+                                     left_matrix,
+                                     right_matrix,
+                                     left_scaler,
+                                     right_scaler,
+                                     partition->attributes);
+    pll_scaler_store_range(partition,
+                           op->parent_scaler_index,
+                           PLL_SCALER_PARENT,
+                           begin,
+                           end);
+    return;
+  }
 
   pll_core_update_partial_ii(partition->states,
                              sites,
                              partition->rate_cats,
-                             parent_clv,
+                             partition->clv[op->parent_clv_index] + clvoff,
                              parent_scaler,
-                             left_clv,
-                             right_clv,
+                             partition->clv[op->child1_clv_index] + clvoff,
+                             partition->clv[op->child2_clv_index] + clvoff,
                              left_matrix,
                              right_matrix,
                              left_scaler,
                              right_scaler,
                              partition->attributes);
+
+  pll_scaler_store_range(partition,
+                         op->parent_scaler_index,
+                         PLL_SCALER_PARENT,
+                         begin,
+                         end);
 }
 
 static void case_repeats(pll_partition_t * partition,
-                            const pll_operation_t * op)
+                            const pll_operation_t * op,
+                            double * bclv_buffer)
 {
   const double * left_matrix = partition->pmatrix[op->child1_matrix_index];
   const double * right_matrix = partition->pmatrix[op->child2_matrix_index];
@@ -192,7 +300,6 @@ static void case_repeats(pll_partition_t * partition,
   const unsigned int * right_site_id = pll_get_site_id(partition, op->child2_clv_index);
   unsigned int left_sites = pll_get_sites_number(partition, op->child1_clv_index);
   unsigned int right_sites = pll_get_sites_number(partition, op->child2_clv_index);
-  double * bclv_buffer = partition->repeats ? partition->repeats->bclv_buffer : 0;;
   unsigned int inv = left_sites < right_sites;
 
 
@@ -234,25 +341,536 @@ static void case_repeats(pll_partition_t * partition,
                                 partition->attributes);
 }
 
-PLL_EXPORT void pll_update_partials(pll_partition_t * partition,
+PLL_EXPORT int pll_update_partials(pll_partition_t * partition,
+                                   const pll_operation_t * operations,
+                                   unsigned int count)
+{
+  return pll_update_partials_rep(partition, operations, count, 1);
+}
+
+
+static unsigned int total_sites(const pll_partition_t * partition)
+{
+  unsigned int sites = partition->sites;
+
+  /* ascertaiment bias correction */
+  if (partition->asc_bias_alloc)
+    sites += partition->states;
+
+  return sites;
+}
+
+static void update_partial(pll_partition_t * partition,
+                           const pll_operation_t * op,
+                           unsigned int begin,
+                           unsigned int end,
+                           double * lookup)
+{
+  if (partition->attributes & PLL_ATTRIB_PATTERN_TIP)
+  {
+    if ((op->child1_clv_index < partition->tips) &&
+        (op->child2_clv_index < partition->tips))
+    {
+      /* tip-tip case */
+      case_tiptip(partition, op, begin, end, lookup);
+    }
+    else if ((op->child1_clv_index < partition->tips) ||
+             (op->child2_clv_index < partition->tips))
+    {
+      /* tip-inner */
+      case_tipinner(partition, op, begin, end);
+    }
+    else
+    {
+      /* inner-inner */
+      case_innerinner(partition, op, begin, end);
+    }
+  }
+  else
+  {
+    /* inner-inner */
+    case_innerinner(partition, op, begin, end);
+  }
+}
+
+/* site-parallel update of a batch of operations. Each thread processes all
+   operations on its own block of sites, hence the threads need to
+   synchronize only once per batch. Large blocks are processed in chunks of
+   sites whose CLVs fit into the L2 cache, such that the CLVs computed by one
+   operation are still cached when the next operation reads them. Tip-tip
+   operations read no CLVs and are executed on the whole block first, since
+   their lookup tables would otherwise be recreated for every chunk */
+
+#define PARTIALS_BLOCK_BYTES 262144
+
+typedef struct partials_job_s
+{
+  pll_partition_t * partition;
+  const pll_operation_t * operations;
+  unsigned int count;
+  unsigned int chunk;
+  double ** ttlookup;
+} partials_job_t;
+
+static int is_tiptip(const pll_partition_t * partition,
+                     const pll_operation_t * op)
+{
+  return (partition->attributes & PLL_ATTRIB_PATTERN_TIP) &&
+         (op->child1_clv_index < partition->tips) &&
+         (op->child2_clv_index < partition->tips);
+}
+
+static void partials_job(void * data,
+                         unsigned int thread_id,
+                         unsigned int thread_count)
+{
+  partials_job_t * job = (partials_job_t *)data;
+  unsigned int i;
+  unsigned int begin, end, c;
+
+  pll_thread_site_range(total_sites(job->partition),
+                        thread_id,
+                        thread_count,
+                        &begin,
+                        &end);
+
+  if (begin == end) return;
+
+  if (end - begin <= job->chunk)
+  {
+    for (i = 0; i < job->count; ++i)
+      update_partial(job->partition,
+                     job->operations + i,
+                     begin,
+                     end,
+                     job->ttlookup[thread_id]);
+    return;
+  }
+
+  for (i = 0; i < job->count; ++i)
+    if (is_tiptip(job->partition, job->operations + i))
+      update_partial(job->partition,
+                     job->operations + i,
+                     begin,
+                     end,
+                     job->ttlookup[thread_id]);
+
+  for (c = begin; c < end; c += job->chunk)
+    for (i = 0; i < job->count; ++i)
+      if (!is_tiptip(job->partition, job->operations + i))
+        update_partial(job->partition,
+                       job->operations + i,
+                       c,
+                       PLL_MIN(c + job->chunk, end),
+                       NULL);
+}
+
+/* number of sites processed at once by a thread: three CLVs (the parent and
+   two children) of the chunk should fit into the L2 cache. Chunks start at
+   multiples of PLL_THREAD_SITE_ALIGN to keep the alignment of the CLVs. If a
+   tip-tip operation writes to a CLV that an earlier operation of the batch
+   reads or writes, the operations cannot be reordered and the batch is not
+   chunked */
+static unsigned int partials_chunk(const pll_partition_t * partition,
+                                   const pll_operation_t * operations,
+                                   unsigned int count)
+{
+  unsigned int i, j;
+  size_t site_bytes = (size_t)partition->states_padded * partition->rate_cats *
+                      ((partition->attributes & PLL_ATTRIB_FLOAT) ?
+                         sizeof(float) : sizeof(double));
+  unsigned int chunk = (unsigned int)(PARTIALS_BLOCK_BYTES / (3 * site_bytes));
+
+  for (i = 0; i < count; ++i)
+  {
+    const pll_operation_t * op = operations + i;
+
+    if (!is_tiptip(partition, op))
+      continue;
+
+    for (j = 0; j < i; ++j)
+      if (operations[j].parent_clv_index == op->parent_clv_index ||
+          operations[j].child1_clv_index == op->parent_clv_index ||
+          operations[j].child2_clv_index == op->parent_clv_index ||
+          (op->parent_scaler_index != PLL_SCALE_BUFFER_NONE &&
+           (operations[j].parent_scaler_index == op->parent_scaler_index ||
+            operations[j].child1_scaler_index == op->parent_scaler_index ||
+            operations[j].child2_scaler_index == op->parent_scaler_index)))
+        return UINT_MAX;
+  }
+
+  chunk -= chunk % PLL_THREAD_SITE_ALIGN;
+
+  return PLL_MAX(chunk, PLL_THREAD_SITE_ALIGN);
+}
+
+static int has_tiptip(const pll_partition_t * partition,
+                      const pll_operation_t * operations,
+                      unsigned int count)
+{
+  unsigned int i;
+
+  for (i = 0; i < count; ++i)
+    if (is_tiptip(partition, operations + i))
+      return 1;
+
+  return 0;
+}
+
+/* tip-tip lookup tables depend on the operation and must not be shared
+   between threads; thread 0 uses the partition table */
+static double ** alloc_thread_lookups(const pll_partition_t * partition,
+                                      const pll_operation_t * operations,
+                                      unsigned int count,
+                                      unsigned int threads)
+{
+  unsigned int i;
+  double ** lookups = (double **)calloc(threads, sizeof(double *));
+
+  if (!lookups)
+    return NULL;
+
+  lookups[0] = partition->ttlookup;
+  if (has_tiptip(partition, operations, count))
+  {
+    size_t size = pll_ttlookup_size(partition);
+    for (i = 1; i < threads; ++i)
+    {
+      lookups[i] = pll_aligned_alloc(size * sizeof(double),
+                                     partition->alignment);
+      if (!lookups[i])
+      {
+        while (--i)
+          pll_aligned_free(lookups[i]);
+        free(lookups);
+        return NULL;
+      }
+    }
+  }
+
+  return lookups;
+}
+
+static void free_thread_lookups(double ** lookups, unsigned int threads)
+{
+  unsigned int i;
+
+  for (i = 1; i < threads; ++i)
+    if (lookups[i])
+      pll_aligned_free(lookups[i]);
+  free(lookups);
+}
+
+static int update_partials_parallel(pll_partition_t * partition,
                                     const pll_operation_t * operations,
                                     unsigned int count)
 {
-  pll_update_partials_rep(partition, operations, count, 1);
+  unsigned int threads = pll_thread_pool_size(partition->thread_pool);
+  partials_job_t job;
+
+  job.partition = partition;
+  job.operations = operations;
+  job.count = count;
+  job.chunk = partials_chunk(partition, operations, count);
+  job.ttlookup = alloc_thread_lookups(partition, operations, count, threads);
+  if (!job.ttlookup)
+    return PLL_FAILURE;
+
+  pll_thread_pool_run(partition->thread_pool, partials_job, &job);
+
+  free_thread_lookups(job.ttlookup, threads);
+
+  return PLL_SUCCESS;
 }
 
+/* executes a batch of operations on the sites [begin,end) only. Site ranges
+   of the same partition may be processed concurrently as long as they do not
+   overlap and start at multiples of PLL_THREAD_SITE_ALIGN; the range starting
+   at site 0 uses the tip-tip lookup table of the partition, all other ranges
+   a private one. Operations are neither filtered nor stamped, and site
+   repeats and memory-saving mode are not supported */
+PLL_EXPORT int pll_update_partials_range(pll_partition_t * partition,
+                                         const pll_operation_t * operations,
+                                         unsigned int count,
+                                         unsigned int begin,
+                                         unsigned int end)
+{
+  unsigned int i;
+  double * ttlookup = partition->ttlookup;
 
-PLL_EXPORT void pll_update_partials_rep(pll_partition_t * partition,
-                                    const pll_operation_t * operations,
-                                    unsigned int count,
-                                    unsigned int update_repeats)
+  if (pll_repeats_enabled(partition) || partition->clv_manager)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "Site ranges are not supported with site repeats or limited "
+             "memory.");
+    return PLL_FAILURE;
+  }
+
+  if (begin > end || end > total_sites(partition))
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200, "Invalid site range [%u,%u).", begin, end);
+    return PLL_FAILURE;
+  }
+
+  if (begin && has_tiptip(partition, operations, count))
+  {
+    ttlookup = pll_aligned_alloc(pll_ttlookup_size(partition) * sizeof(double),
+                                 partition->alignment);
+    if (!ttlookup)
+    {
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+      return PLL_FAILURE;
+    }
+  }
+
+  if (begin < end)
+    for (i = 0; i < count; ++i)
+      update_partial(partition, operations + i, begin, end, ttlookup);
+
+  if (ttlookup != partition->ttlookup)
+    pll_aligned_free(ttlookup);
+
+  return PLL_SUCCESS;
+}
+
+/* CLV versioning. Every write to a CLV, p-matrix or scale buffer assigns it
+   a new stamp from a partition-wide counter. An operation can be skipped if
+   its parent CLV was computed by the same operation and is newer than all of
+   its inputs, and the parent scale buffer has not been overwritten since */
+
+static int clv_current(const pll_partition_t * partition,
+                       const pll_operation_t * op)
+{
+  const pll_operation_t * last = partition->clv_operation +
+                                 op->parent_clv_index;
+  unsigned long stamp = partition->clv_version[op->parent_clv_index];
+
+  if (!stamp ||
+      last->parent_clv_index != op->parent_clv_index ||
+      last->parent_scaler_index != op->parent_scaler_index ||
+      last->child1_clv_index != op->child1_clv_index ||
+      last->child1_matrix_index != op->child1_matrix_index ||
+      last->child1_scaler_index != op->child1_scaler_index ||
+      last->child2_clv_index != op->child2_clv_index ||
+      last->child2_matrix_index != op->child2_matrix_index ||
+      last->child2_scaler_index != op->child2_scaler_index)
+    return 0;
+
+  if (partition->clv_version[op->child1_clv_index] >= stamp ||
+      partition->clv_version[op->child2_clv_index] >= stamp ||
+      partition->pmatrix_version[op->child1_matrix_index] >= stamp ||
+      partition->pmatrix_version[op->child2_matrix_index] >= stamp)
+    return 0;
+
+  if (op->child1_scaler_index != PLL_SCALE_BUFFER_NONE &&
+      partition->scaler_version[op->child1_scaler_index] >= stamp)
+    return 0;
+
+  if (op->child2_scaler_index != PLL_SCALE_BUFFER_NONE &&
+      partition->scaler_version[op->child2_scaler_index] >= stamp)
+    return 0;
+
+  if (op->parent_scaler_index != PLL_SCALE_BUFFER_NONE &&
+      partition->scaler_version[op->parent_scaler_index] != stamp)
+    return 0;
+
+  return 1;
+}
+
+static void clv_stamp(pll_partition_t * partition, const pll_operation_t * op)
+{
+  unsigned long stamp = ++partition->version;
+
+  partition->clv_version[op->parent_clv_index] = stamp;
+  if (op->parent_scaler_index != PLL_SCALE_BUFFER_NONE)
+    partition->scaler_version[op->parent_scaler_index] = stamp;
+
+  partition->clv_operation[op->parent_clv_index] = *op;
+}
+
+/* returns the operations that must be executed and stamps their outputs. The
+   decision only depends on the stamps, hence the returned operations can be
+   executed by any of the update paths; stamping ahead lets later operations
+   of the batch see that their inputs change. The stamps of operations that
+   are not executed are withdrawn, see discard_operations(). Returns NULL if
+   no operation is skipped or the copy cannot be allocated */
+static pll_operation_t * versions_filter(pll_partition_t * partition,
+                                               const pll_operation_t * operations,
+                                               unsigned int * count)
+{
+  unsigned int i;
+  unsigned int run = 0;
+  pll_operation_t * filtered;
+
+  filtered = (pll_operation_t *)malloc(*count * sizeof(pll_operation_t));
+
+  for (i = 0; i < *count; ++i)
+  {
+    const pll_operation_t * op = operations + i;
+
+    if (filtered && clv_current(partition, op))
+      continue;
+
+    clv_stamp(partition, op);
+    if (filtered)
+      filtered[run++] = *op;
+  }
+
+  if (!filtered || run == *count)
+  {
+    free(filtered);
+    return NULL;
+  }
+
+  *count = run;
+  return filtered;
+}
+
+/* Memory-saving mode. Before an operation is executed, its children are made
+   resident (recomputing them if they were evicted) and pinned, such that
+   assigning a slot to the parent cannot evict them */
+
+static int clv_require(pll_partition_t * partition,
+                       unsigned int clv_index,
+                       unsigned int depth);
+
+static int update_partial_slots(pll_partition_t * partition,
+                                const pll_operation_t * op,
+                                unsigned int depth)
+{
+  if (!clv_require(partition, op->child1_clv_index, depth))
+    return PLL_FAILURE;
+
+  if (!clv_require(partition, op->child2_clv_index, depth))
+  {
+    pll_clv_unpin(partition, op->child1_clv_index);
+    return PLL_FAILURE;
+  }
+
+  if (!pll_clv_assign_slot(partition, op->parent_clv_index))
+  {
+    pll_clv_unpin(partition, op->child1_clv_index);
+    pll_clv_unpin(partition, op->child2_clv_index);
+    return PLL_FAILURE;
+  }
+
+  if (!partition->thread_pool || !update_partials_parallel(partition, op, 1))
+    update_partial(partition, op, 0, total_sites(partition),
+                   partition->ttlookup);
+
+  pll_clv_set_operation(partition, op);
+
+  pll_clv_unpin(partition, op->child1_clv_index);
+  pll_clv_unpin(partition, op->child2_clv_index);
+
+  return PLL_SUCCESS;
+}
+
+/* a chain of recomputations cannot be longer than the number of inner CLVs,
+   unless the recorded operations form a cycle */
+static int clv_require(pll_partition_t * partition,
+                       unsigned int clv_index,
+                       unsigned int depth)
+{
+  pll_operation_t op;
+
+  if (depth > partition->clv_buffers)
+  {
+    pll_errno = PLL_ERROR_CLV_SLOTS;
+    snprintf(pll_errmsg, 200,
+             "The recorded operations of CLV %u form a cycle.", clv_index);
+    return PLL_FAILURE;
+  }
+
+  if (pll_clv_resident(partition, clv_index))
+  {
+    if (!pll_clv_assign_slot(partition, clv_index))
+      return PLL_FAILURE;
+  }
+  else
+  {
+    if (!pll_clv_get_operation(partition, clv_index, &op))
+      return PLL_FAILURE;
+
+    if (!update_partial_slots(partition, &op, depth + 1))
+      return PLL_FAILURE;
+  }
+
+  pll_clv_pin(partition, clv_index);
+
+  return PLL_SUCCESS;
+}
+
+/* makes the CLV resident and pins it; the caller must unpin it once it is no
+   longer needed. An evicted CLV is recomputed from the operation that last
+   computed it, with the current contents of its children */
+int pll_clv_require(pll_partition_t * partition, unsigned int clv_index)
+{
+  if (!partition->clv_manager)
+    return PLL_SUCCESS;
+
+  return clv_require(partition, clv_index, 0);
+}
+
+/* the parents of operations that were not executed hold outdated contents;
+   they are evicted and can no longer be recomputed, such that reading them
+   fails instead of returning stale values. Their stamps are withdrawn, such
+   that the next update executes the operations */
+static void discard_operations(pll_partition_t * partition,
+                               const pll_operation_t * operations,
+                               unsigned int count)
+{
+  unsigned int i;
+
+  for (i = 0; i < count; ++i)
+  {
+    pll_clv_release(partition, operations[i].parent_clv_index);
+    pll_clv_clear_operation(partition, operations[i].parent_clv_index);
+    pll_invalidate_clv(partition, operations[i].parent_clv_index);
+  }
+}
+
+static int update_partials_rep(pll_partition_t * partition,
+                               const pll_operation_t * operations,
+                               unsigned int count,
+                               unsigned int update_repeats)
 {
   unsigned int i;
   const pll_operation_t * op;
+  double start;
+
+  /* with limited memory, operations are executed one at a time. On failure
+     pll_errno is set and the remaining operations are discarded */
+  if (partition->clv_manager)
+  {
+    for (i = 0; i < count; ++i)
+    {
+      if (!pll_clv_check_slots(partition, operations + i) ||
+          !update_partial_slots(partition, operations + i, 0))
+      {
+        discard_operations(partition, operations + i, count - i);
+        return PLL_FAILURE;
+      }
+    }
+    return PLL_SUCCESS;
+  }
+
+  /* site repeats are processed serially; otherwise fall back to the serial
+     code only if the thread-local buffers cannot be allocated */
+  if (partition->thread_pool && !pll_repeats_enabled(partition))
+  {
+    if (update_partials_parallel(partition, operations, count))
+      return PLL_SUCCESS;
+  }
 
   for (i = 0; i < count; ++i)
   {
     op = &(operations[i]);
+    start = pll_repeats_adaptive_begin(partition);
+
     if (pll_repeats_enabled(partition) && update_repeats) 
       pll_update_repeats(partition, op);
 
@@ -260,33 +878,413 @@ PLL_EXPORT void pll_update_partials_rep(pll_partition_t * partition,
         && (partition->repeats->pernode_ids[op->child1_clv_index]
             ||  partition->repeats->pernode_ids[op->child2_clv_index]))
     {
-      case_repeats(partition, op);
+      case_repeats(partition, op, partition->repeats->bclv_buffer);
     }
-    else if (partition->attributes & PLL_ATTRIB_PATTERN_TIP)
+    else
     {
-      if ((op->child1_clv_index < partition->tips) &&
-          (op->child2_clv_index < partition->tips))
-      {
-        /* tip-tip case */
-        case_tiptip(partition,op);
-      }
-      else if ((operations[i].child1_clv_index < partition->tips) ||
-               (operations[i].child2_clv_index < partition->tips))
-      {
-        /* tip-inner */
-        case_tipinner(partition,op);
-      }
-      else
-      {
-        /* inner-inner */
-        case_innerinner(partition,op);
-      }
+      update_partial(partition, op, 0, total_sites(partition),
+                     partition->ttlookup);
+    }
+
+    if (update_repeats)
+      pll_repeats_adaptive_end(partition, op, start);
+  }
+
+  return PLL_SUCCESS;
+}
+
+PLL_EXPORT int pll_update_partials_rep(pll_partition_t * partition,
+                                       const pll_operation_t * operations,
+                                       unsigned int count,
+                                       unsigned int update_repeats)
+{
+  int retval;
+  pll_operation_t * filtered = NULL;
+
+  if (partition->attributes & PLL_ATTRIB_CLV_VERSIONS)
+    filtered = versions_filter(partition, operations, &count);
+
+  retval = update_partials_rep(partition,
+                               filtered ? filtered : operations,
+                               count,
+                               update_repeats);
+
+  free(filtered);
+
+  return retval;
+}
+
+/* Concurrent execution of a batch of operations. Each operation depends on
+   the earlier operations that write the CLVs/scalers it reads (read after
+   write), that read the CLV/scaler it writes (write after read) or that write
+   the same CLV/scaler (write after write). Operations whose dependencies are
+   resolved are executed on the thread pool; every thread keeps its own deque
+   of ready operations and steals from the other deques when it runs dry.
+   Threads without work sleep until an operation becomes ready */
+
+typedef struct dag_deque_s
+{
+  pthread_mutex_t mutex;
+  unsigned int * items;
+  unsigned int top;
+  unsigned int bottom;
+} dag_deque_t;
+
+typedef struct dag_job_s
+{
+  pll_partition_t * partition;
+  const pll_operation_t * operations;
+  unsigned int count;
+
+  /* successor lists */
+  int * edge_head;
+  int * edge_next;
+  unsigned int * edge_to;
+
+  /* number of unresolved dependencies per operation */
+  unsigned int * pending;
+
+  /* operations not yet completed and operations in the deques that no
+     thread has claimed; idle threads sleep on cond_ready */
+  pthread_mutex_t mutex;
+  pthread_cond_t cond_ready;
+  unsigned int remaining;
+  unsigned int available;
+
+  dag_deque_t * deques;
+  double ** ttlookup;
+
+  /* per-thread scratch buffers for site repeats, or NULL */
+  pll_repeats_workspace_t ** repeats;
+} dag_job_t;
+
+static void deque_push(dag_deque_t * deque, unsigned int item)
+{
+  pthread_mutex_lock(&deque->mutex);
+  deque->items[deque->bottom++] = item;
+  pthread_mutex_unlock(&deque->mutex);
+}
+
+/* the owner takes the most recent operation (its children's results are
+   likely still in cache), thieves take the oldest one */
+static int deque_pop(dag_deque_t * deque, unsigned int * item, int steal)
+{
+  int found = 0;
+
+  pthread_mutex_lock(&deque->mutex);
+  if (deque->top < deque->bottom)
+  {
+    *item = steal ? deque->items[deque->top++] : deque->items[--deque->bottom];
+    found = 1;
+  }
+  pthread_mutex_unlock(&deque->mutex);
+
+  return found;
+}
+
+/* updates the repeats of the parent and its CLV using the scratch buffers of
+   one thread */
+static void update_partial_repeats(pll_partition_t * partition,
+                                   const pll_operation_t * op,
+                                   const pll_repeats_workspace_t * ws,
+                                   double * lookup)
+{
+  double start = pll_repeats_adaptive_begin(partition);
+
+  pll_update_repeats_workspace(partition, op, ws);
+
+  if (partition->repeats->pernode_ids[op->child1_clv_index] ||
+      partition->repeats->pernode_ids[op->child2_clv_index])
+    case_repeats(partition,
+                 op,
+                 partition->repeats->bclv_buffer ? ws->bclv_buffer : NULL);
+  else
+    update_partial(partition, op, 0, total_sites(partition), lookup);
+
+  pll_repeats_adaptive_end(partition, op, start);
+}
+
+/* makes an operation whose dependencies are resolved available to the
+   threads */
+static void dag_release(dag_job_t * job,
+                        unsigned int thread_id,
+                        unsigned int item)
+{
+  deque_push(job->deques + thread_id, item);
+
+  pthread_mutex_lock(&job->mutex);
+  job->available++;
+  pthread_cond_signal(&job->cond_ready);
+  pthread_mutex_unlock(&job->mutex);
+}
+
+static void dag_job(void * data,
+                    unsigned int thread_id,
+                    unsigned int thread_count)
+{
+  dag_job_t * job = (dag_job_t *)data;
+  unsigned int sites = total_sites(job->partition);
+  unsigned int i, op;
+  int e;
+
+  while (1)
+  {
+    int found = 0;
+
+    /* claim one of the available operations, or wait until one becomes
+       available or all are completed */
+    pthread_mutex_lock(&job->mutex);
+    while (!job->available && job->remaining)
+      pthread_cond_wait(&job->cond_ready, &job->mutex);
+    if (!job->available)
+    {
+      pthread_mutex_unlock(&job->mutex);
+      break;
     }
+    job->available--;
+    pthread_mutex_unlock(&job->mutex);
+
+    /* the claimed operation is in one of the deques */
+    while (!found)
+    {
+      found = deque_pop(job->deques + thread_id, &op, 0);
+      for (i = 1; i < thread_count && !found; ++i)
+        found = deque_pop(job->deques + (thread_id + i) % thread_count,
+                          &op,
+                          1);
+    }
+
+    if (job->repeats)
+      update_partial_repeats(job->partition,
+                             job->operations + op,
+                             job->repeats[thread_id],
+                             job->ttlookup[thread_id]);
     else
+      update_partial(job->partition,
+                     job->operations + op,
+                     0,
+                     sites,
+                     job->ttlookup[thread_id]);
+
+    /* release the operations waiting for this one */
+    for (e = job->edge_head[op]; e != -1; e = job->edge_next[e])
+      if (!__atomic_sub_fetch(job->pending + job->edge_to[e], 1,
+                              __ATOMIC_ACQ_REL))
+        dag_release(job, thread_id, job->edge_to[e]);
+
+    pthread_mutex_lock(&job->mutex);
+    if (!--job->remaining)
+      pthread_cond_broadcast(&job->cond_ready);
+    pthread_mutex_unlock(&job->mutex);
+  }
+}
+
+static void dag_add_edge(dag_job_t * job,
+                         unsigned int * edge_count,
+                         unsigned int from,
+                         unsigned int to)
+{
+  unsigned int e = (*edge_count)++;
+
+  job->edge_to[e] = to;
+  job->edge_next[e] = job->edge_head[from];
+  job->edge_head[from] = (int)e;
+  job->pending[to]++;
+}
+
+static int dag_build(dag_job_t * job)
+{
+  const pll_partition_t * partition = job->partition;
+  unsigned int resources = partition->nodes + partition->scale_buffers;
+  unsigned int i, k;
+  unsigned int edge_count = 0;
+  unsigned int reader_count = 0;
+  int r;
+
+  /* each operation reads at most four and writes at most two resources,
+     bounding the number of dependencies by 10 per operation */
+  int * last_writer = (int *)malloc(resources * sizeof(int));
+  int * reader_head = (int *)malloc(resources * sizeof(int));
+  int * reader_next = (int *)malloc(4 * job->count * sizeof(int));
+  unsigned int * reader_op = (unsigned int *)malloc(4 * job->count *
+                                                    sizeof(unsigned int));
+
+  job->edge_head = (int *)malloc(job->count * sizeof(int));
+  job->edge_next = (int *)malloc(10 * job->count * sizeof(int));
+  job->edge_to = (unsigned int *)malloc(10 * job->count * sizeof(unsigned int));
+  job->pending = (unsigned int *)calloc(job->count, sizeof(unsigned int));
+
+  if (!last_writer || !reader_head || !reader_next || !reader_op ||
+      !job->edge_head || !job->edge_next || !job->edge_to || !job->pending)
+  {
+    free(last_writer);
+    free(reader_head);
+    free(reader_next);
+    free(reader_op);
+    return PLL_FAILURE;
+  }
+
+  for (i = 0; i < resources; ++i)
+    last_writer[i] = reader_head[i] = -1;
+
+  for (i = 0; i < job->count; ++i)
+  {
+    const pll_operation_t * op = job->operations + i;
+    int reads[4];
+    int writes[2];
+
+    job->edge_head[i] = -1;
+
+    /* scalers are mapped after the CLVs into a common index space */
+    reads[0] = (int)op->child1_clv_index;
+    reads[1] = (int)op->child2_clv_index;
+    reads[2] = (op->child1_scaler_index == PLL_SCALE_BUFFER_NONE) ? -1 :
+                         (int)(partition->nodes + op->child1_scaler_index);
+    reads[3] = (op->child2_scaler_index == PLL_SCALE_BUFFER_NONE) ? -1 :
+                         (int)(partition->nodes + op->child2_scaler_index);
+    writes[0] = (int)op->parent_clv_index;
+    writes[1] = (op->parent_scaler_index == PLL_SCALE_BUFFER_NONE) ? -1 :
+                         (int)(partition->nodes + op->parent_scaler_index);
+
+    for (k = 0; k < 4; ++k)
     {
-      /* inner-inner */
-      case_innerinner(partition,op);
+      if ((r = reads[k]) == -1) continue;
+
+      if (last_writer[r] != -1)
+        dag_add_edge(job, &edge_count, (unsigned int)last_writer[r], i);
+
+      reader_op[reader_count] = i;
+      reader_next[reader_count] = reader_head[r];
+      reader_head[r] = (int)reader_count++;
+    }
+
+    for (k = 0; k < 2; ++k)
+    {
+      if ((r = writes[k]) == -1) continue;
+
+      if (last_writer[r] != -1)
+        dag_add_edge(job, &edge_count, (unsigned int)last_writer[r], i);
+
+      for (int x = reader_head[r]; x != -1; x = reader_next[x])
+        if (reader_op[x] != i)
+          dag_add_edge(job, &edge_count, reader_op[x], i);
+
+      reader_head[r] = -1;
+      last_writer[r] = (int)i;
     }
   }
+
+  free(last_writer);
+  free(reader_head);
+  free(reader_next);
+  free(reader_op);
+
+  return PLL_SUCCESS;
 }
 
+static int update_partials_dag(pll_partition_t * partition,
+                               const pll_operation_t * operations,
+                               unsigned int count)
+{
+  unsigned int i;
+  unsigned int threads = pll_thread_pool_size(partition->thread_pool);
+  unsigned int ready = 0;
+  int retval = PLL_FAILURE;
+  dag_job_t job;
+
+  memset(&job, 0, sizeof(dag_job_t));
+  job.partition = partition;
+  job.operations = operations;
+  job.count = count;
+  job.remaining = count;
+
+  job.deques = (dag_deque_t *)calloc(threads, sizeof(dag_deque_t));
+  if (!job.deques)
+    return PLL_FAILURE;
+
+  pthread_mutex_init(&job.mutex, NULL);
+  pthread_cond_init(&job.cond_ready, NULL);
+
+  for (i = 0; i < threads; ++i)
+    pthread_mutex_init(&job.deques[i].mutex, NULL);
+
+  for (i = 0; i < threads; ++i)
+  {
+    job.deques[i].items = (unsigned int *)malloc(count * sizeof(unsigned int));
+    if (!job.deques[i].items)
+      goto cleanup;
+  }
+
+  if (!dag_build(&job))
+    goto cleanup;
+
+  if (pll_repeats_enabled(partition))
+  {
+    job.repeats = pll_repeats_thread_workspaces(partition, threads);
+    if (!job.repeats)
+      goto cleanup;
+  }
+
+  job.ttlookup = alloc_thread_lookups(partition, operations, count, threads);
+  if (!job.ttlookup)
+    goto cleanup;
+
+  /* distribute the initially ready operations among the threads */
+  for (i = 0; i < count; ++i)
+    if (!job.pending[i])
+      deque_push(job.deques + (ready++ % threads), i);
+  job.available = ready;
+
+  pll_thread_pool_run(partition->thread_pool, dag_job, &job);
+
+  free_thread_lookups(job.ttlookup, threads);
+  retval = PLL_SUCCESS;
+
+cleanup:
+  for (i = 0; i < threads; ++i)
+  {
+    pthread_mutex_destroy(&job.deques[i].mutex);
+    free(job.deques[i].items);
+  }
+  free(job.deques);
+  pthread_mutex_destroy(&job.mutex);
+  pthread_cond_destroy(&job.cond_ready);
+  free(job.edge_head);
+  free(job.edge_next);
+  free(job.edge_to);
+  free(job.pending);
+
+  return retval;
+}
+
+PLL_EXPORT int pll_update_partials_dag(pll_partition_t * partition,
+                                       const pll_operation_t * operations,
+                                       unsigned int count)
+{
+  int retval;
+  pll_operation_t * filtered = NULL;
+
+  if (partition->attributes & PLL_ATTRIB_CLV_VERSIONS)
+    filtered = versions_filter(partition, operations, &count);
+
+  if (filtered)
+    operations = filtered;
+
+  /* with site repeats, every thread uses its own scratch buffers. Compact
+     scale buffers share their scratch buffers among the operations */
+  if (partition->thread_pool && !partition->clv_manager &&
+      !(partition->attributes & PLL_ATTRIB_COMPACT_SCALERS) && count > 1)
+  {
+    if (update_partials_dag(partition, operations, count))
+    {
+      free(filtered);
+      return PLL_SUCCESS;
+    }
+  }
+
+  retval = update_partials_rep(partition, operations, count, 1);
+
+  free(filtered);
+
+  return retval;
+}
@@ -19,12 +19,14 @@
     Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
 */
 
+#include <limits.h>
 #include "pll.h"
+#include "pll_private.h"
 
 __thread int pll_errno;
 __thread char pll_errmsg[200] = {0};
 
-__thread pll_hardware_t pll_hardware = {0,0,0,0,0,0,0,0,0,0,0,0};
+__thread pll_hardware_t pll_hardware = {0,0,0,0,0,0,0,0,0,0,0,0,0};
 
 static void dealloc_partition_data(pll_partition_t * partition);
 
@@ -49,6 +51,16 @@ static void dealloc_partition_data(pll_partition_t * partition)
       free(partition->scale_buffer[i]);
   free(partition->scale_buffer);
 
+  if (partition->scale_buffer_compact)
+    for (i = 0; i < partition->scale_buffers; ++i)
+      free(partition->scale_buffer_compact[i]);
+  free(partition->scale_buffer_compact);
+
+  if (partition->scale_scratch)
+    for (i = 0; i < PLL_SCALER_SLOTS; ++i)
+      free(partition->scale_scratch[i]);
+  free(partition->scale_scratch);
+
   if (partition->tipchars)
     for (i = 0; i < partition->tips; ++i)
       pll_aligned_free(partition->tipchars[i]);
@@ -63,15 +75,31 @@ static void dealloc_partition_data(pll_partition_t * partition)
   if (partition->tipmap)
     free(partition->tipmap);
 
+  /* with limited memory, inner CLVs point to the slots of the manager */
+  unsigned int clv_end = partition->clv_manager ?
+                         partition->tips :
+                         partition->clv_buffers + partition->tips;
+
   if (partition->clv)
   {
     unsigned int start = (partition->attributes & PLL_ATTRIB_PATTERN_TIP) ?
                           partition->tips : 0;
-    for (i = start; i < partition->clv_buffers + partition->tips; ++i)
+    for (i = start; i < clv_end; ++i)
       pll_aligned_free(partition->clv[i]);
   }
   free(partition->clv);
 
+  if (partition->clv_float)
+  {
+    unsigned int start = (partition->attributes & PLL_ATTRIB_PATTERN_TIP) ?
+                          partition->tips : 0;
+    for (i = start; i < clv_end; ++i)
+      pll_aligned_free(partition->clv_float[i]);
+  }
+  free(partition->clv_float);
+
+  pll_clv_manager_destroy(partition);
+
   if (partition->pmatrix)
   {
     //for (i = 0; i < partition->prob_matrices; ++i)
@@ -120,14 +148,30 @@ static void dealloc_partition_data(pll_partition_t * partition)
     free(repeats->pernode_ids);
     free(repeats->perscale_ids);
     free(repeats->pernode_allocated_clvs);
+    free(repeats->pernode_record);
+    free(repeats->site_order);
     free(repeats->lookup_buffer);
+    free(repeats->lookup_keys);
     free(repeats->toclean_buffer);
     free(repeats->id_site_buffer);
     free(repeats->bclv_buffer);
     free(repeats->charmap);
+    for (i = 0; i < repeats->thread_workspaces_count; ++i)
+      pll_repeats_workspace_destroy(repeats->thread_workspaces[i]);
+    free(repeats->thread_workspaces);
+    pll_repeats_arena_destroy(partition);
+    pll_repeats_adaptive_destroy(partition);
     free(repeats);
   }
 
+  if (partition->thread_pool)
+    pll_thread_pool_destroy(partition->thread_pool);
+
+  free(partition->clv_version);
+  free(partition->pmatrix_version);
+  free(partition->scaler_version);
+  free(partition->clv_operation);
+
   free(partition);
 }
 
@@ -449,6 +493,53 @@ PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
   }
 
 
+  if (attributes & PLL_ATTRIB_FLOAT)
+  {
+    if (attributes & (PLL_ATTRIB_SITE_REPEATS |
+                      PLL_ATTRIB_AB_MASK |
+                      PLL_ATTRIB_AB_FLAG))
+    {
+      pll_errno = PLL_ERROR_FLOAT_NOSUPPORT;
+      snprintf(pll_errmsg, 200, "Single-precision CLVs are not compatible "
+                                "with site repeats and ascertainment bias "
+                                "correction.");
+      return PLL_FAILURE;
+    }
+  }
+
+  /* a scale counter grows by at most one per operation below the node */
+  if ((attributes & PLL_ATTRIB_COMPACT_SCALERS) &&
+      ((attributes & PLL_ATTRIB_SITE_REPEATS) || clv_buffers > USHRT_MAX))
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200, "Compact scale buffers are not compatible with "
+                              "site repeats or more than %u inner CLVs.",
+                              USHRT_MAX);
+    return PLL_FAILURE;
+  }
+
+  if ((attributes & PLL_ATTRIB_LIMIT_MEMORY) &&
+      (attributes & PLL_ATTRIB_SITE_REPEATS))
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200, "Limited CLV memory is not compatible with "
+                              "site repeats.");
+    return PLL_FAILURE;
+  }
+
+  /* fall back to AVX2 kernels if AVX-512 is not supported by the build or
+     by the processor. There are no single-precision AVX-512 kernels */
+  if (attributes & PLL_ATTRIB_ARCH_AVX512)
+  {
+#ifdef HAVE_AVX512
+    if (!PLL_STAT(avx512f_present) || (attributes & PLL_ATTRIB_FLOAT))
+#endif
+    {
+      attributes &= ~PLL_ATTRIB_ARCH_AVX512;
+      attributes |= PLL_ATTRIB_ARCH_AVX2;
+    }
+  }
+
   /* allocate partition */
   pll_partition_t * partition = (pll_partition_t *)malloc(sizeof(pll_partition_t));
   if (!partition)
@@ -483,6 +574,15 @@ PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
     partition->states_padded = (states+3) & 0xFFFFFFFC;
   }
 #endif
+#ifdef HAVE_AVX512
+  if (attributes & PLL_ATTRIB_ARCH_AVX512 && PLL_STAT(avx512f_present))
+  {
+    /* keep the AVX padding, such that AVX/AVX2 kernels can be used for
+       operations without a dedicated AVX-512 implementation */
+    partition->alignment = PLL_ALIGNMENT_AVX512;
+    partition->states_padded = (states+3) & 0xFFFFFFFC;
+  }
+#endif
 
   unsigned int states_padded = partition->states_padded;
 
@@ -512,15 +612,29 @@ PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
   partition->rate_weights = NULL;
   partition->subst_params = NULL;
   partition->scale_buffer = NULL;
+  partition->scale_buffer_compact = NULL;
+  partition->scale_scratch = NULL;
   partition->frequencies = NULL;
   partition->eigen_decomp_valid = 0;
 
+  partition->clv = NULL;
+  partition->clv_float = NULL;
+  partition->pmatrix = NULL;
+
   partition->ttlookup = NULL;
   partition->tipchars = NULL;
   partition->charmap = NULL;
   partition->tipmap = NULL;
   
   partition->repeats = NULL;
+  partition->thread_pool = NULL;
+
+  partition->version = 0;
+  partition->clv_version = NULL;
+  partition->pmatrix_version = NULL;
+  partition->scaler_version = NULL;
+  partition->clv_operation = NULL;
+  partition->clv_manager = NULL;
 
   /* If ascertainment bias correction attribute is set, CLVs will be allocated
      with additional sites for each state */
@@ -542,43 +656,81 @@ PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
     snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
     return PLL_FAILURE;
   }
+  /* with limited memory only the tip CLVs are allocated here, inner CLVs are
+     assigned slots on demand */
+  unsigned int clv_end = (attributes & PLL_ATTRIB_LIMIT_MEMORY) ?
+                         partition->tips : partition->nodes;
+
   /* clv */
-  partition->clv = (double **)calloc(partition->nodes, sizeof(double *));
-  if (!partition->clv)
+  if (partition->attributes & PLL_ATTRIB_FLOAT)
   {
-    dealloc_partition_data(partition);
-    pll_errno = PLL_ERROR_MEM_ALLOC;
-    snprintf(pll_errmsg, 200, "Unable to allocate enough memory for CLVs.");
-    return PLL_FAILURE;
-  }
+    partition->clv_float = (float **)calloc(partition->nodes, sizeof(float *));
+    if (!partition->clv_float)
+    {
+      dealloc_partition_data(partition);
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Unable to allocate enough memory for CLVs.");
+      return PLL_FAILURE;
+    }
 
-  /* if site repeats are enabled, we allocate CLVs dynamically */
-  if (!pll_repeats_enabled(partition)) 
-  {
-    /* if tip pattern precomputation is enabled, then do not allocate CLV space
-       for the tip nodes */
     unsigned int start = (partition->attributes & PLL_ATTRIB_PATTERN_TIP) ?
                           partition->tips : 0;
 
-    for (i = start; i < partition->tips + partition->clv_buffers; ++i)
+    for (i = start; i < clv_end; ++i)
     {
-      partition->clv[i] = pll_aligned_alloc(sites_alloc * states_padded *
-                                            rate_cats * sizeof(double),
-                                            partition->alignment);
-      if (!partition->clv[i])
+      size_t clv_size = (size_t)sites_alloc * states_padded * rate_cats;
+      partition->clv_float[i] = pll_aligned_alloc(clv_size * sizeof(float),
+                                                  partition->alignment);
+      if (!partition->clv_float[i])
       {
         dealloc_partition_data(partition);
         pll_errno = PLL_ERROR_MEM_ALLOC;
         snprintf(pll_errmsg, 200, "Unable to allocate enough memory for CLVs.");
         return PLL_FAILURE;
       }
-      /* zero-out CLV vectors to avoid valgrind warnings when using odd number of
-         states with vectorized code */
-      memset(partition->clv[i],
-             0,
-             (size_t)sites_alloc*states_padded*rate_cats*sizeof(double));
+      memset(partition->clv_float[i], 0, clv_size * sizeof(float));
     }
   }
+  else
+  {
+    partition->clv = (double **)calloc(partition->nodes, sizeof(double *));
+    if (!partition->clv)
+    {
+      dealloc_partition_data(partition);
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Unable to allocate enough memory for CLVs.");
+      return PLL_FAILURE;
+    }
+
+    /* if site repeats are enabled, we allocate CLVs dynamically */
+    if (!pll_repeats_enabled(partition)) 
+    {
+      /* if tip pattern precomputation is enabled, then do not allocate CLV space
+         for the tip nodes */
+      unsigned int start = (partition->attributes & PLL_ATTRIB_PATTERN_TIP) ?
+                            partition->tips : 0;
+
+      for (i = start; i < clv_end; ++i)
+      {
+        partition->clv[i] = pll_aligned_alloc(sites_alloc * states_padded *
+                                              rate_cats * sizeof(double),
+                                              partition->alignment);
+        if (!partition->clv[i])
+        {
+          dealloc_partition_data(partition);
+          pll_errno = PLL_ERROR_MEM_ALLOC;
+          snprintf(pll_errmsg, 200, "Unable to allocate enough memory for CLVs.");
+          return PLL_FAILURE;
+        }
+        /* zero-out CLV vectors to avoid valgrind warnings when using odd number of
+           states with vectorized code */
+        memset(partition->clv[i],
+               0,
+               (size_t)sites_alloc*states_padded*rate_cats*sizeof(double));
+      }
+    }
+  }
+
   /* pmatrix */
   partition->pmatrix = (double **)calloc(partition->prob_matrices,
                                          sizeof(double *));
@@ -835,8 +987,58 @@ PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
              "Unable to allocate enough memory for scale buffers.");
     return PLL_FAILURE;
   }
+  /* compact scale buffers are widened into scratch buffers for the kernels,
+     see pll_scaler_load() */
+  if (attributes & PLL_ATTRIB_COMPACT_SCALERS)
+  {
+    size_t scaler_size = (attributes & PLL_ATTRIB_RATE_SCALERS) ?
+                                            sites_alloc * rate_cats : sites_alloc;
+    partition->scale_buffer_compact = (unsigned short **)calloc(
+                                                  partition->scale_buffers,
+                                                  sizeof(unsigned short *));
+    partition->scale_scratch = (unsigned int **)calloc(PLL_SCALER_SLOTS,
+                                                       sizeof(unsigned int *));
+    if (!partition->scale_buffer_compact || !partition->scale_scratch)
+    {
+      dealloc_partition_data(partition);
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg,
+               200,
+               "Unable to allocate enough memory for scale buffers.");
+      return PLL_FAILURE;
+    }
+    for (i = 0; i < partition->scale_buffers; ++i)
+    {
+      partition->scale_buffer_compact[i] = (unsigned short *)calloc(
+                                                  scaler_size,
+                                                  sizeof(unsigned short));
+      if (!partition->scale_buffer_compact[i])
+      {
+        dealloc_partition_data(partition);
+        pll_errno = PLL_ERROR_MEM_ALLOC;
+        snprintf(pll_errmsg,
+                 200,
+                 "Unable to allocate enough memory for scale buffers.");
+        return PLL_FAILURE;
+      }
+    }
+    for (i = 0; i < PLL_SCALER_SLOTS; ++i)
+    {
+      partition->scale_scratch[i] = (unsigned int *)calloc(scaler_size,
+                                                           sizeof(unsigned int));
+      if (!partition->scale_scratch[i])
+      {
+        dealloc_partition_data(partition);
+        pll_errno = PLL_ERROR_MEM_ALLOC;
+        snprintf(pll_errmsg,
+                 200,
+                 "Unable to allocate enough memory for scale buffers.");
+        return PLL_FAILURE;
+      }
+    }
+  }
   /* if we use site repeats, we allocate scales dynamically (later) */
-  if(!pll_repeats_enabled(partition)) 
+  else if(!pll_repeats_enabled(partition)) 
   {
     for (i = 0; i < partition->scale_buffers; ++i)
     {
@@ -856,6 +1058,39 @@ PLL_EXPORT pll_partition_t * pll_partition_create(unsigned int tips,
     }
   }
 
+  /* version stamps (zero means never computed) */
+  if (attributes & PLL_ATTRIB_CLV_VERSIONS)
+  {
+    partition->clv_version = (unsigned long *)calloc(partition->nodes,
+                                                     sizeof(unsigned long));
+    partition->pmatrix_version = (unsigned long *)calloc(partition->prob_matrices,
+                                                         sizeof(unsigned long));
+    partition->scaler_version = (unsigned long *)calloc(partition->scale_buffers,
+                                                        sizeof(unsigned long));
+    partition->clv_operation = (pll_operation_t *)calloc(partition->nodes,
+                                                         sizeof(pll_operation_t));
+    if (!partition->clv_version || !partition->pmatrix_version ||
+        (partition->scale_buffers && !partition->scaler_version) ||
+        !partition->clv_operation)
+    {
+      dealloc_partition_data(partition);
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg,
+               200,
+               "Unable to allocate enough memory for version stamps.");
+      return PLL_FAILURE;
+    }
+  }
+
+  if (attributes & PLL_ATTRIB_LIMIT_MEMORY)
+  {
+    if (!pll_clv_manager_init(partition))
+    {
+      dealloc_partition_data(partition);
+      return PLL_FAILURE;
+    }
+  }
+
   if (pll_repeats_enabled(partition)) 
   {
     if (PLL_FAILURE == pll_repeats_initialize(partition))
@@ -956,6 +1191,41 @@ static int set_tipchars(pll_partition_t * partition,
   return PLL_SUCCESS;
 }
 
+static int set_tipclv_float(pll_partition_t * partition,
+                            unsigned int tip_index,
+                            const pll_state_t * map,
+                            const char * sequence)
+{
+  pll_state_t c;
+  unsigned int i,j,k;
+  float * tipclv = partition->clv_float[tip_index];
+
+  /* site repeats and ascertainment bias correction are not available in
+     single-precision mode */
+  for (i = 0; i < partition->sites; ++i)
+  {
+    if ((c = map[(int)sequence[i]]) == 0)
+    {
+      pll_errno = PLL_ERROR_TIPDATA_ILLEGALSTATE;
+      snprintf(pll_errmsg, 200, "Illegal state code in tip \"%c\"", sequence[i]);
+      return PLL_FAILURE;
+    }
+
+    for (k = 0; k < partition->rate_cats; ++k)
+    {
+      pll_state_t state = c;
+      for (j = 0; j < partition->states; ++j)
+      {
+        tipclv[j] = (float)(state & 1);
+        state >>= 1;
+      }
+      tipclv += partition->states_padded;
+    }
+  }
+
+  return PLL_SUCCESS;
+}
+
 static int set_tipclv(pll_partition_t * partition,
                      unsigned int tip_index,
                      const pll_state_t * map,
@@ -1029,11 +1299,33 @@ PLL_EXPORT int pll_set_tip_states(pll_partition_t * partition,
                                   const char * sequence)
 {
   int rc;
+  char * reordered = NULL;
 
   if (pll_repeats_enabled(partition))
   {
+    /* the sequence is given in the original order of the sites, see
+       pll_repeats_reorder_sites() */
+    if (partition->repeats->site_order)
+    {
+      unsigned int i;
+      reordered = (char *)malloc(partition->sites + 1);
+      if (!reordered)
+      {
+        pll_errno = PLL_ERROR_MEM_ALLOC;
+        snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+        return PLL_FAILURE;
+      }
+      for (i = 0; i < partition->sites; ++i)
+        reordered[i] = sequence[partition->repeats->site_order[i]];
+      reordered[partition->sites] = 0;
+      sequence = reordered;
+    }
+
     if (PLL_FAILURE == pll_update_repeats_tips(partition, tip_index, map, sequence)) 
+    {
+      free(reordered);
       return PLL_FAILURE;
+    }
   }
   if (partition->attributes & PLL_ATTRIB_PATTERN_TIP)
   {
@@ -1046,6 +1338,7 @@ PLL_EXPORT int pll_set_tip_states(pll_partition_t * partition,
     {
       if (!create_charmap(partition,map))
       {
+        free(reordered);
         dealloc_partition_data(partition);
         return PLL_FAILURE;
       }
@@ -1056,9 +1349,14 @@ PLL_EXPORT int pll_set_tip_states(pll_partition_t * partition,
     else
       rc = set_tipchars(partition, tip_index, map, sequence);
   }
+  else if (partition->attributes & PLL_ATTRIB_FLOAT)
+    rc = set_tipclv_float(partition, tip_index, map, sequence);
   else
     rc = set_tipclv(partition, tip_index, map, sequence);
 
+  pll_invalidate_clv(partition, tip_index);
+  free(reordered);
+
   return rc;
 }
 
@@ -1078,6 +1376,26 @@ PLL_EXPORT int pll_set_tip_clv(pll_partition_t * partition,
     return PLL_FAILURE;
   }
 
+  if (partition->attributes & PLL_ATTRIB_FLOAT)
+  {
+    float * tipclv = partition->clv_float[tip_index];
+
+    for (i = 0; i < partition->sites; ++i)
+    {
+      for (j = 0; j < partition->rate_cats; ++j)
+      {
+        for (k = 0; k < partition->states; ++k)
+          tipclv[k] = (float)clv[k];
+        tipclv += partition->states_padded;
+      }
+      clv += padding ? partition->states_padded : partition->states;
+    }
+
+    pll_invalidate_clv(partition, tip_index);
+
+    return PLL_SUCCESS;
+  }
+
   double * tipclv = partition->clv[tip_index];
 
   for (i = 0; i < partition->sites; ++i)
@@ -1106,6 +1424,8 @@ PLL_EXPORT int pll_set_tip_clv(pll_partition_t * partition,
     }
   }
 
+  pll_invalidate_clv(partition, tip_index);
+
   return PLL_SUCCESS;
 }
 
@@ -1113,9 +1433,19 @@ PLL_EXPORT void pll_set_pattern_weights(pll_partition_t * partition,
                                         const unsigned int * pattern_weights)
 {
   unsigned int i;
-  memcpy(partition->pattern_weights,
-         pattern_weights,
-         sizeof(unsigned int)*partition->sites);
+
+  /* the weights are given in the original order of the sites, see
+     pll_repeats_reorder_sites() */
+  if (pll_repeats_enabled(partition) && partition->repeats->site_order)
+  {
+    for (i = 0; i < partition->sites; ++i)
+      partition->pattern_weights[i] =
+        pattern_weights[partition->repeats->site_order[i]];
+  }
+  else
+    memcpy(partition->pattern_weights,
+           pattern_weights,
+           sizeof(unsigned int)*partition->sites);
 
   /* recompute the sum of weights */
   partition->pattern_weight_sum = 0;
@@ -1180,6 +1510,107 @@ PLL_EXPORT void pll_set_asc_state_weights(pll_partition_t * partition,
          sizeof(unsigned int)*partition->states);
 }
 
+/* mark a CLV or p-matrix that was written outside of the library functions
+   as changed, such that the partials depending on it are recomputed by the
+   next call to pll_update_partials() */
+PLL_EXPORT void pll_invalidate_clv(pll_partition_t * partition,
+                                   unsigned int clv_index)
+{
+  if (!(partition->attributes & PLL_ATTRIB_CLV_VERSIONS))
+    return;
+
+  partition->clv_version[clv_index] = ++partition->version;
+
+  /* the contents no longer correspond to the recorded operation */
+  partition->clv_operation[clv_index].parent_clv_index = ~0u;
+}
+
+PLL_EXPORT void pll_invalidate_pmatrix(pll_partition_t * partition,
+                                       unsigned int matrix_index)
+{
+  if (!(partition->attributes & PLL_ATTRIB_CLV_VERSIONS))
+    return;
+
+  partition->pmatrix_version[matrix_index] = ++partition->version;
+}
+
+static size_t scaler_entries(const pll_partition_t * partition,
+                             unsigned int site)
+{
+  return (partition->attributes & PLL_ATTRIB_RATE_SCALERS) ?
+                    (size_t)site * partition->rate_cats : site;
+}
+
+/* returns the scale buffer as unsigned int counters, starting at site begin.
+   Compact scale buffers are widened into the scratch buffer slot for the
+   sites [begin,end) first; concurrent callers must use different slots or
+   disjoint site ranges */
+unsigned int * pll_scaler_load_range(const pll_partition_t * partition,
+                                     int scaler_index,
+                                     unsigned int slot,
+                                     unsigned int begin,
+                                     unsigned int end)
+{
+  size_t i, n;
+  const unsigned short * src;
+  unsigned int * dst;
+
+  if (scaler_index == PLL_SCALE_BUFFER_NONE)
+    return NULL;
+
+  if (!(partition->attributes & PLL_ATTRIB_COMPACT_SCALERS))
+    return partition->scale_buffer[scaler_index] +
+           scaler_entries(partition, begin);
+
+  src = partition->scale_buffer_compact[scaler_index] +
+        scaler_entries(partition, begin);
+  dst = partition->scale_scratch[slot] + scaler_entries(partition, begin);
+  n = scaler_entries(partition, end - begin);
+
+  for (i = 0; i < n; ++i)
+    dst[i] = src[i];
+
+  return dst;
+}
+
+unsigned int * pll_scaler_load(const pll_partition_t * partition,
+                               int scaler_index,
+                               unsigned int slot)
+{
+  return pll_scaler_load_range(partition,
+                               scaler_index,
+                               slot,
+                               0,
+                               partition->sites +
+                                 (unsigned int)partition->asc_additional_sites);
+}
+
+/* narrows the counters the kernels wrote into the scratch buffer slot back
+   into the compact scale buffer; they cannot overflow, see
+   pll_partition_create() */
+void pll_scaler_store_range(pll_partition_t * partition,
+                            int scaler_index,
+                            unsigned int slot,
+                            unsigned int begin,
+                            unsigned int end)
+{
+  size_t i, n;
+  const unsigned int * src;
+  unsigned short * dst;
+
+  if (scaler_index == PLL_SCALE_BUFFER_NONE ||
+      !(partition->attributes & PLL_ATTRIB_COMPACT_SCALERS))
+    return;
+
+  src = partition->scale_scratch[slot] + scaler_entries(partition, begin);
+  dst = partition->scale_buffer_compact[scaler_index] +
+        scaler_entries(partition, begin);
+  n = scaler_entries(partition, end - begin);
+
+  for (i = 0; i < n; ++i)
+    dst[i] = (unsigned short)src[i];
+}
+
 PLL_EXPORT void pll_fill_parent_scaler(unsigned int scaler_size,
                                unsigned int * parent_scaler,
                                const unsigned int * left_scaler,
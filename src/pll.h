@@ -81,6 +81,7 @@
 #define PLL_ALIGNMENT_CPU   8
 #define PLL_ALIGNMENT_SSE  16
 #define PLL_ALIGNMENT_AVX  32
+#define PLL_ALIGNMENT_AVX512 64
 
 #define PLL_LINEALLOC 2048
 
@@ -90,6 +91,8 @@
 #define PLL_SCALE_THRESHOLD (1.0/PLL_SCALE_FACTOR)
 #define PLL_SCALE_FACTOR_SQRT 340282366920938463463374607431768211456.0 /* 2**128 */
 #define PLL_SCALE_THRESHOLD_SQRT (1.0/PLL_SCALE_FACTOR_SQRT)
+#define PLL_SCALE_FACTOR_FLOAT 4294967296.0 /* 2**32 */
+#define PLL_SCALE_THRESHOLD_FLOAT (1.0/PLL_SCALE_FACTOR_FLOAT)
 #define PLL_SCALE_BUFFER_NONE -1
 
 /* in per-rate scaling mode, maximum difference between scalers
@@ -125,9 +128,26 @@
 /* site repeats */
 
 #define PLL_ATTRIB_SITE_REPEATS    (1 << 10)
+/* size of the former dense repeats lookup table, no longer used */
 #define PLL_REPEATS_LOOKUP_SIZE  2000000 
 
-#define PLL_ATTRIB_MASK ((1 << 11) - 1)
+/* single-precision CLVs */
+
+#define PLL_ATTRIB_FLOAT          (1 << 11)
+
+/* skip partial updates whose inputs have not changed */
+
+#define PLL_ATTRIB_CLV_VERSIONS   (1 << 12)
+
+/* keep only a limited number of inner CLVs in memory */
+
+#define PLL_ATTRIB_LIMIT_MEMORY   (1 << 13)
+
+/* 16-bit scale buffers */
+
+#define PLL_ATTRIB_COMPACT_SCALERS (1 << 14)
+
+#define PLL_ATTRIB_MASK ((1 << 15) - 1)
 
 /* topological rearrangements */
 
@@ -177,6 +197,9 @@
 #define PLL_ERROR_MSA_EMPTY                131
 #define PLL_ERROR_MSA_MAP_INVALID          132
 #define PLL_ERROR_TREE_INVALID             133
+#define PLL_ERROR_THREAD_CREATE            134
+#define PLL_ERROR_FLOAT_NOSUPPORT          135
+#define PLL_ERROR_CLV_SLOTS                136
 
 /* utree specific */
 
@@ -192,6 +215,10 @@
 #define PLL_GAMMA_RATES_MEAN             0
 #define PLL_GAMMA_RATES_MEDIAN           1
 
+/* multithreading: site ranges assigned to threads start at multiples of
+   this value to keep threads from writing to the same cache lines */
+#define PLL_THREAD_SITE_ALIGN            16
+
 // TODO: this must be adapted for MSVC
 #define PLL_POPCNT32 __builtin_popcount
 #define PLL_POPCNT64 __builtin_popcountll
@@ -221,12 +248,23 @@ typedef struct pll_hardware_s
   int popcnt_present;
   int avx_present;
   int avx2_present;
+  int avx512f_present;
 
   /* TODO: add chip,core,mem info */
 } pll_hardware_t;
 
 struct pll_repeats;
 
+typedef struct pll_thread_pool pll_thread_pool_t;
+
+typedef struct pll_clv_manager pll_clv_manager_t;
+typedef struct pll_repeats_arena pll_repeats_arena_t;
+typedef struct pll_repeats_adaptive pll_repeats_adaptive_t;
+
+typedef void (*pll_thread_job_t)(void * data,
+                                 unsigned int thread_id,
+                                 unsigned int thread_count);
+
 typedef struct pll_partition
 {
   unsigned int tips;
@@ -246,11 +284,15 @@ typedef struct pll_partition
   unsigned int states_padded;
 
   double ** clv;
+  float ** clv_float;       /* used instead of clv with PLL_ATTRIB_FLOAT */
   double ** pmatrix;
   double * rates;
   double * rate_weights;
   double ** subst_params;
   unsigned int ** scale_buffer;
+  unsigned short ** scale_buffer_compact; /* used instead of scale_buffer
+                                             with PLL_ATTRIB_COMPACT_SCALERS */
+  unsigned int ** scale_scratch;  /* scale buffers widened for the kernels */
   double ** frequencies;
   double * prop_invar;
   int * invariant;
@@ -274,8 +316,43 @@ typedef struct pll_partition
 
   /* site repeats */
   struct pll_repeats *repeats;
+
+  /* worker threads for site-parallel computation (NULL if single-threaded) */
+  pll_thread_pool_t * thread_pool;
+
+  /* version stamps of CLVs, p-matrices and scale buffers, and the operation
+     that last computed each CLV (only with PLL_ATTRIB_CLV_VERSIONS) */
+  unsigned long version;
+  unsigned long * clv_version;
+  unsigned long * pmatrix_version;
+  unsigned long * scaler_version;
+  struct pll_operation * clv_operation;
+
+  /* CLV slots of the memory-saving mode (NULL unless PLL_ATTRIB_LIMIT_MEMORY) */
+  pll_clv_manager_t * clv_manager;
 } pll_partition_t;
 
+/* scratch buffers for identifying repeats */
+typedef struct pll_repeats_workspace
+{
+  unsigned int * lookup_buffer;
+  unsigned long long * lookup_keys;
+  unsigned int lookup_buffer_size;
+  unsigned int * toclean_buffer;
+  unsigned int * id_site_buffer;
+  double * bclv_buffer;
+} pll_repeats_workspace_t;
+
+/* inputs of the last class update of a node, see
+   pll_update_repeats_incremental() */
+typedef struct pll_repeats_record
+{
+  unsigned long stamp;            /* number of class updates of the node */
+  unsigned int child[2];          /* children, or -1 if never updated */
+  unsigned long child_stamp[2];   /* their stamps at the update */
+  int scaler_index;
+} pll_repeats_record_t;
+
 typedef struct pll_repeats
 {
   /* (node,site) -> class identifier (starts at 1) */
@@ -286,8 +363,16 @@ typedef struct pll_repeats
   unsigned int * pernode_ids;
   // (scale) -> number of class ids
   unsigned int * perscale_ids;
-  // (node) -> number of allocated clvs
+  // (node) -> number of sites the clv and id_site buffers can hold
   unsigned int * pernode_allocated_clvs;
+  /* pool of the buffers of pll_default_reallocate_repeats() */
+  pll_repeats_arena_t * arena;
+  /* state of pll_adaptive_enable_repeats() (NULL unless enabled) */
+  pll_repeats_adaptive_t * adaptive;
+  // (node) -> inputs of the last class update
+  pll_repeats_record_t * pernode_record;
+  // (site) -> site of the original alignment, or NULL if not reordered
+  unsigned int * site_order;
 
   /* return true if we should compute repeats on the current node
    default is pll_default_enable_repeats */
@@ -302,13 +387,77 @@ typedef struct pll_repeats
                               unsigned int sites_to_alloc);
   /* temporary buffers */ 
   unsigned int * lookup_buffer;  
+  unsigned long long * lookup_keys;
   unsigned int * toclean_buffer; 
   unsigned int * id_site_buffer; 
   double * bclv_buffer;
   unsigned int lookup_buffer_size;
   char * charmap;
+
+  /* scratch buffers of the threads of the thread pool */
+  pll_repeats_workspace_t ** thread_workspaces;
+  unsigned int thread_workspaces_count;
 } pll_repeats_t;
 
+/* counters of pll_adaptive_enable_repeats(). Costs are in seconds per
+   site of the partition; a compressed node is predicted to cost
+   cost_site + cost_class * ratio, where ratio is the number of classes over
+   the number of sites */
+typedef struct pll_repeats_adaptive_stats
+{
+  unsigned long decisions_repeats;  /* nodes computed with repeats */
+  unsigned long decisions_plain;    /* nodes computed without */
+  unsigned long samples_repeats;    /* timed updates of compressed nodes */
+  unsigned long samples_plain;      /* timed updates of uncompressed nodes */
+  double seconds_repeats;
+  double seconds_plain;
+  double mean_ratio;                /* mean ratio of the compressed nodes */
+  double cost_plain;
+  double cost_site;
+  double cost_class;
+  double break_even;                /* ratio below which repeats pay off */
+  int calibrated;
+} pll_repeats_adaptive_stats_t;
+
+/* state of the site repeats of one CLV. Sizes are in sites and include the
+   additional sites of the ascertainment bias correction */
+typedef struct pll_repeats_node_stats
+{
+  unsigned int classes;             /* 0 if the CLV is not compressed */
+  unsigned int sites;               /* sites stored in the CLV */
+  unsigned int capacity;            /* sites the CLV buffer can hold */
+  size_t bytes;                     /* CLV and class -> site map */
+  unsigned long updates;            /* class updates of the node */
+} pll_repeats_node_stats_t;
+
+/* summary of the site repeats of a partition. The node figures cover the
+   inner CLVs whose classes were computed at least once; the counters are
+   cumulative since the creation of the partition or the last call of
+   pll_repeats_reset_stats(). Reallocations are only counted by the default
+   reallocate_repeats callback */
+typedef struct pll_repeats_stats
+{
+  unsigned int nodes;               /* inner CLVs with classes */
+  unsigned int compressed;          /* of which currently compressed */
+  unsigned int max_classes;         /* most classes of a compressed CLV */
+  double mean_ratio;                /* mean classes/sites of compressed CLVs */
+  double tip_ratio;                 /* mean classes/sites of the tips */
+  size_t clv_bytes;                 /* inner CLVs and class -> site maps */
+  size_t scaler_bytes;              /* scale buffers */
+  size_t pooled_bytes;              /* released buffers kept for reuse */
+  size_t plain_bytes;               /* inner CLVs and scalers w/o repeats */
+  unsigned int lookup_size;         /* entries of the class lookup table */
+  unsigned long updates;            /* class updates of inner CLVs */
+  unsigned long declined;           /* ... disabled by enable_repeats */
+  unsigned long no_gain;            /* ... with as many classes as sites */
+  unsigned long kept;               /* ... skipped as still current */
+  unsigned long clv_reallocs;       /* CLV buffers exchanged */
+  unsigned long clv_allocs;         /* ... of which newly allocated */
+  unsigned long scaler_reallocs;    /* scale buffers exchanged */
+  unsigned long scaler_allocs;      /* ... of which newly allocated */
+  unsigned long releases;           /* buffers freed instead of pooled */
+} pll_repeats_stats_t;
+
 /* Structure for driving likelihood operations */
 
 typedef struct pll_operation
@@ -323,6 +472,22 @@ typedef struct pll_operation
   int child2_scaler_index;
 } pll_operation_t;
 
+/* the work on one partition for pll_compute_partitions_loglikelihood(): the
+   operations to execute, followed by the evaluation of an edge */
+typedef struct pll_partition_task
+{
+  pll_partition_t * partition;
+  const pll_operation_t * operations;
+  unsigned int operations_count;
+  unsigned int parent_clv_index;
+  int parent_scaler_index;
+  unsigned int child_clv_index;
+  int child_scaler_index;
+  unsigned int matrix_index;
+  const unsigned int * freqs_indices;
+  double * persite_lnl;                 /* per-site log-likelihoods or NULL */
+} pll_partition_task_t;
+
 /* Doubly-linked list */
 
 typedef struct pll_dlist
@@ -399,6 +564,53 @@ typedef struct pll_utree_s
   pll_unode_t * vroot;
 } pll_utree_t;
 
+/* pre-order traversals, see preorder.c */
+
+#define PLL_PREORDER_MARGINALS           0
+#define PLL_PREORDER_EDGES               1
+
+/* a CLV of the partition (slot == -1) or a message buffer */
+typedef struct pll_preorder_src
+{
+  int slot;
+  unsigned int clv_index;
+  int scaler_index;
+} pll_preorder_src_t;
+
+/* combines left and right into the message buffer target_slot, or, if
+   target_slot == -1, visits node with the pair left (the message of the
+   rest of the tree) and right (the subtree CLV of node) */
+typedef struct pll_preorder_step
+{
+  pll_preorder_src_t left;
+  pll_preorder_src_t right;
+  const double * left_matrix;
+  const double * right_matrix;
+  int target_slot;
+  const pll_unode_t * node;
+  double * ttlookup;                    /* tip-tip lookup table or NULL */
+} pll_preorder_step_t;
+
+typedef struct pll_preorder
+{
+  pll_partition_t * partition;
+  int mode;
+  pll_preorder_step_t * steps;
+  unsigned int steps_count;
+  unsigned int slots;
+  double ** slot_clv;
+  unsigned int ** slot_scaler;
+  double * ident_pmat;
+  double * ttlookup;
+} pll_preorder_t;
+
+typedef void (*pll_preorder_visit_t)(const pll_preorder_t * preorder,
+                                     const pll_preorder_step_t * step,
+                                     unsigned int begin,
+                                     unsigned int end,
+                                     unsigned int thread_id,
+                                     void * data);
+
 typedef struct pll_rnode_s
 {
   char * label;
@@ -634,6 +846,12 @@ PLL_EXPORT int pll_set_asc_bias_type(pll_partition_t * partition,
 PLL_EXPORT void pll_set_asc_state_weights(pll_partition_t * partition,
                                           const unsigned int * state_weights);
 
+PLL_EXPORT void pll_invalidate_clv(pll_partition_t * partition,
+                                   unsigned int clv_index);
+
+PLL_EXPORT void pll_invalidate_pmatrix(pll_partition_t * partition,
+                                       unsigned int matrix_index);
+
 /* functions in list.c */
 
 PLL_EXPORT int pll_dlist_append(pll_dlist_t ** dlist, void * data);
@@ -675,6 +893,33 @@ PLL_EXPORT unsigned int pll_no_enable_repeats(pll_partition_t *partition,
     unsigned int left_clv,
     unsigned int right_clv);
 
+PLL_EXPORT unsigned int pll_adaptive_enable_repeats(pll_partition_t *partition,
+    unsigned int left_clv,
+    unsigned int right_clv);
+
+PLL_EXPORT int pll_repeats_set_adaptive(pll_partition_t * partition,
+                                        unsigned int sample_updates);
+
+PLL_EXPORT void pll_repeats_adaptive_destroy(pll_partition_t * partition);
+
+PLL_EXPORT double pll_repeats_adaptive_begin(const pll_partition_t * partition);
+
+PLL_EXPORT void pll_repeats_adaptive_end(pll_partition_t * partition,
+                                         const pll_operation_t * op,
+                                         double start);
+
+PLL_EXPORT int pll_repeats_adaptive_stats(const pll_partition_t * partition,
+                                      pll_repeats_adaptive_stats_t * stats);
+
+PLL_EXPORT int pll_repeats_node_stats(const pll_partition_t * partition,
+                                      unsigned int clv_index,
+                                      pll_repeats_node_stats_t * stats);
+
+PLL_EXPORT int pll_repeats_stats(const pll_partition_t * partition,
+                                 pll_repeats_stats_t * stats);
+
+PLL_EXPORT void pll_repeats_reset_stats(pll_partition_t * partition);
+
 PLL_EXPORT void pll_default_reallocate_repeats(pll_partition_t * partition,
                               unsigned int parent,
                               int scaler_index,
@@ -682,6 +927,8 @@ PLL_EXPORT void pll_default_reallocate_repeats(pll_partition_t * partition,
 
 PLL_EXPORT int pll_repeats_initialize(pll_partition_t *partition);
 
+PLL_EXPORT void pll_repeats_arena_destroy(pll_partition_t * partition);
+
 PLL_EXPORT int pll_update_repeats_tips(pll_partition_t * partition,
                                   unsigned int tip_index,
                                   const pll_state_t * map,
@@ -690,6 +937,39 @@ PLL_EXPORT int pll_update_repeats_tips(pll_partition_t * partition,
 PLL_EXPORT void pll_update_repeats(pll_partition_t * partition,
                     const pll_operation_t * op) ;
 
+PLL_EXPORT unsigned int pll_update_repeats_incremental(pll_partition_t * partition,
+                                          const pll_operation_t * operations,
+                                          unsigned int count,
+                                          const unsigned int * dirty_clvs,
+                                          unsigned int dirty_count);
+
+PLL_EXPORT unsigned int pll_repeats_pair_classes(pll_partition_t * partition,
+                                                 unsigned int clv1,
+                                                 unsigned int clv2,
+                                                 unsigned int * site_id,
+                                                 unsigned int * id_site);
+
+PLL_EXPORT int pll_repeats_reorder_sites(pll_partition_t * partition,
+                                         const unsigned int * tip_order,
+                                         unsigned int count);
+
+PLL_EXPORT int pll_repeats_restore_site_order(const pll_partition_t * partition,
+                                              double * values,
+                                              unsigned int width);
+
+PLL_EXPORT void pll_update_repeats_workspace(pll_partition_t * partition,
+                                             const pll_operation_t * op,
+                                             const pll_repeats_workspace_t * ws);
+
+PLL_EXPORT pll_repeats_workspace_t * pll_repeats_workspace_create(
+                                          const pll_partition_t * partition);
+
+PLL_EXPORT void pll_repeats_workspace_destroy(pll_repeats_workspace_t * ws);
+
+PLL_EXPORT pll_repeats_workspace_t ** pll_repeats_thread_workspaces(
+                                          pll_partition_t * partition,
+                                          unsigned int threads);
+
 PLL_EXPORT void pll_disable_bclv(pll_partition_t *partition);
 
 PLL_EXPORT void pll_fill_parent_scaler_repeats(unsigned int sites,
@@ -764,6 +1044,25 @@ PLL_EXPORT double pll_compute_edge_loglikelihood(pll_partition_t * partition,
                                                  const unsigned int * freqs_indices,
                                                  double * persite_lnl);
 
+PLL_EXPORT double pll_compute_edge_loglikelihood_fused(pll_partition_t * partition,
+                                                       const pll_operation_t * op,
+                                                       unsigned int other_clv_index,
+                                                       int other_scaler_index,
+                                                       unsigned int matrix_index,
+                                                       const unsigned int * freqs_indices,
+                                                       double * persite_lnl);
+
+PLL_EXPORT double pll_compute_edge_loglikelihood_range(pll_partition_t * partition,
+                                                       unsigned int begin,
+                                                       unsigned int end,
+                                                       unsigned int parent_clv_index,
+                                                       int parent_scaler_index,
+                                                       unsigned int child_clv_index,
+                                                       int child_scaler_index,
+                                                       unsigned int matrix_index,
+                                                       const unsigned int * freqs_indices,
+                                                       double * persite_lnl);
+
 PLL_EXPORT int pll_compute_node_ancestral(pll_partition_t * partition,
                                           unsigned int node_clv_index,
                                           int node_scaler_index,
@@ -785,17 +1084,113 @@ PLL_EXPORT int pll_compute_node_ancestral_extbuf(pll_partition_t * partition,
                                                  unsigned int * temp_scaler,
                                                  double * ident_pmat);
 
+PLL_EXPORT int pll_compute_tree_ancestral(pll_partition_t * partition,
+                                          pll_unode_t * root,
+                                          const unsigned int * freqs_indices,
+                                          double * ancestral);
+
+PLL_EXPORT int pll_compute_root_loglikelihood_replicates(pll_partition_t * partition,
+                                                         unsigned int clv_index,
+                                                         int scaler_index,
+                                                         const unsigned int * freqs_indices,
+                                                         const unsigned int * weights,
+                                                         unsigned int replicates,
+                                                         double * replicate_lnl);
+
+PLL_EXPORT int pll_compute_edge_loglikelihood_replicates(pll_partition_t * partition,
+                                                         unsigned int parent_clv_index,
+                                                         int parent_scaler_index,
+                                                         unsigned int child_clv_index,
+                                                         int child_scaler_index,
+                                                         unsigned int matrix_index,
+                                                         const unsigned int * freqs_indices,
+                                                         const unsigned int * weights,
+                                                         unsigned int replicates,
+                                                         double * replicate_lnl);
+
 
 /* functions in partials.c */
 
-PLL_EXPORT void pll_update_partials(pll_partition_t * partition,
-                                    const pll_operation_t * operations,
-                                    unsigned int count);
+PLL_EXPORT int pll_update_partials(pll_partition_t * partition,
+                                   const pll_operation_t * operations,
+                                   unsigned int count);
+
+PLL_EXPORT int pll_update_partials_rep(pll_partition_t * partition,
+                                       const pll_operation_t * operations,
+                                       unsigned int count,
+                                       unsigned int update_repeats);
+
+PLL_EXPORT int pll_update_partials_dag(pll_partition_t * partition,
+                                       const pll_operation_t * operations,
+                                       unsigned int count);
+
+PLL_EXPORT int pll_update_partials_range(pll_partition_t * partition,
+                                         const pll_operation_t * operations,
+                                         unsigned int count,
+                                         unsigned int begin,
+                                         unsigned int end);
+
+/* functions in clv_manager.c */
+
+PLL_EXPORT int pll_set_clv_slots(pll_partition_t * partition,
+                                 unsigned int slots);
+
+PLL_EXPORT int pll_clv_resident(const pll_partition_t * partition,
+                                unsigned int clv_index);
+
+/* functions in threads.c */
+
+PLL_EXPORT int pll_set_thread_count(pll_partition_t * partition,
+                                    unsigned int threads);
 
-PLL_EXPORT void pll_update_partials_rep(pll_partition_t * partition,
-                                        const pll_operation_t * operations,
-                                        unsigned int count,
-                                        unsigned int update_repeats);
+PLL_EXPORT pll_thread_pool_t * pll_thread_pool_create(unsigned int threads);
+
+PLL_EXPORT void pll_thread_pool_destroy(pll_thread_pool_t * pool);
+
+PLL_EXPORT unsigned int pll_thread_pool_size(const pll_thread_pool_t * pool);
+
+PLL_EXPORT void pll_thread_pool_run(pll_thread_pool_t * pool,
+                                    pll_thread_job_t job,
+                                    void * data);
+
+PLL_EXPORT void pll_thread_site_range(unsigned int sites,
+                                      unsigned int thread_id,
+                                      unsigned int thread_count,
+                                      unsigned int * begin,
+                                      unsigned int * end);
+
+/* functions in multipart.c */
+
+PLL_EXPORT double pll_compute_partitions_loglikelihood(pll_thread_pool_t * pool,
+                                                       const pll_partition_task_t * tasks,
+                                                       unsigned int count,
+                                                       double * partition_lnl);
+
+/* functions in preorder.c */
+
+PLL_EXPORT pll_preorder_t * pll_preorder_create(pll_partition_t * partition,
+                                                pll_unode_t * root,
+                                                int mode);
+
+PLL_EXPORT void pll_preorder_destroy(pll_preorder_t * preorder);
+
+PLL_EXPORT void pll_preorder_src_buffers(const pll_preorder_t * preorder,
+                                         const pll_preorder_src_t * src,
+                                         unsigned int begin,
+                                         const double ** clv,
+                                         const unsigned int ** scaler,
+                                         const unsigned char ** tipchars);
+
+PLL_EXPORT void pll_preorder_combine(const pll_preorder_t * preorder,
+                                     const pll_preorder_step_t * step,
+                                     unsigned int begin,
+                                     unsigned int end,
+                                     double * clv,
+                                     unsigned int * scaler);
+
+PLL_EXPORT void pll_preorder_run(pll_preorder_t * preorder,
+                                 pll_preorder_visit_t visit,
+                                 void * data);
 
 /* functions in derivatives.c */
 
@@ -816,6 +1211,23 @@ PLL_EXPORT int pll_compute_likelihood_derivatives(pll_partition_t * partition,
                                                   double * d_f,
                                                   double * dd_f);
 
+PLL_EXPORT int pll_compute_likelihood_derivatives_replicates(pll_partition_t * partition,
+                                                             int parent_scaler_index,
+                                                             int child_scaler_index,
+                                                             double branch_length,
+                                                             const unsigned int * params_indices,
+                                                             const double * sumtable,
+                                                             const unsigned int * weights,
+                                                             unsigned int replicates,
+                                                             double * d_f,
+                                                             double * dd_f);
+
+PLL_EXPORT int pll_compute_tree_derivatives(pll_partition_t * partition,
+                                            pll_unode_t * root,
+                                            const unsigned int * params_indices,
+                                            double * d_f,
+                                            double * dd_f);
+
 /* functions in gamma.c */
 
 PLL_EXPORT int pll_compute_gamma_cats(double alpha,
@@ -834,6 +1246,8 @@ PLL_EXPORT void pll_show_clv(const pll_partition_t * partition,
                              int scaler_index,
                              unsigned int float_precision);
 
+PLL_EXPORT void pll_show_repeats_stats(const pll_partition_t * partition);
+
 /* functions in fasta.c */
 
 PLL_EXPORT pll_fasta_t * pll_fasta_open(const char * filename,
@@ -1240,6 +1654,21 @@ PLL_EXPORT int pll_core_likelihood_derivatives(unsigned int states,
                                                double * dd_f,
                                                unsigned int attrib);
 
+PLL_EXPORT int pll_core_likelihood_derivatives_persite(unsigned int states,
+                                                       unsigned int sites,
+                                                       unsigned int rate_cats,
+                                                       const double * rate_weights,
+                                                       const int * invariant,
+                                                       double branch_length,
+                                                       const double * prop_invar,
+                                                       double * const * freqs,
+                                                       const double * rates,
+                                                       double * const * eigenvals,
+                                                       const double * sumtable,
+                                                       double * persite_d_f,
+                                                       double * persite_dd_f,
+                                                       unsigned int attrib);
+
 PLL_EXPORT int pll_core_update_sumtable_repeats_avx(unsigned int states,
                                                     unsigned int sites,
                                                     unsigned int parent_sites,
@@ -1381,6 +1810,13 @@ PLL_EXPORT double pll_core_root_loglikelihood(unsigned int states,
                                               double * persite_lnl,
                                               unsigned int attrib);
 
+PLL_EXPORT void pll_core_weighted_sums(unsigned int sites,
+                                       unsigned int count,
+                                       const unsigned int * weights,
+                                       const double * values,
+                                       double * sums,
+                                       unsigned int attrib);
+
 /* functions in core_partials_sse.c */
 
 #ifdef HAVE_SSE3
@@ -1716,6 +2152,19 @@ PLL_EXPORT void pll_core_update_partial_ii_avx2(unsigned int states,
                                                 const unsigned int * right_scaler,
                                                 unsigned int attrib);
 
+PLL_EXPORT void pll_core_update_partial_ii_blocked_avx2(unsigned int states,
+                                                        unsigned int sites,
+                                                        unsigned int rate_cats,
+                                                        double * parent_clv,
+                                                        unsigned int * parent_scaler,
+                                                        const double * left_clv,
+                                                        const double * right_clv,
+                                                        const double * left_matrix,
+                                                        const double * right_matrix,
+                                                        const unsigned int * left_scaler,
+                                                        const unsigned int * right_scaler,
+                                                        unsigned int attrib);
+
 PLL_EXPORT void pll_core_update_partial_repeats_generic_avx2(unsigned int states,
                                                              unsigned int parent_sites,
                                                              unsigned int left_sites,
@@ -1734,6 +2183,125 @@ PLL_EXPORT void pll_core_update_partial_repeats_generic_avx2(unsigned int states
                                                              const unsigned int * right_site_id,
                                                              double * bclv_buffer,
                                                              unsigned int attrib);
+
+PLL_EXPORT void pll_core_update_partial_repeats_4x4_avx2(unsigned int states,
+                                                         unsigned int parent_sites,
+                                                         unsigned int left_sites,
+                                                         unsigned int right_sites,
+                                                         unsigned int rate_cats,
+                                                         double * parent_clv,
+                                                         unsigned int * parent_scaler,
+                                                         const double * left_clv,
+                                                         const double * right_clv,
+                                                         const double * left_matrix,
+                                                         const double * right_matrix,
+                                                         const unsigned int * left_scaler,
+                                                         const unsigned int * right_scaler,
+                                                         const unsigned int * parent_id_site,
+                                                         const unsigned int * left_site_id,
+                                                         const unsigned int * right_site_id,
+                                                         double * bclv_buffer,
+                                                         unsigned int attrib);
+
+PLL_EXPORT void pll_core_update_partial_repeatsbclv_4x4_avx2(unsigned int states,
+                                                             unsigned int parent_sites,
+                                                             unsigned int left_sites,
+                                                             unsigned int right_sites,
+                                                             unsigned int rate_cats,
+                                                             double * parent_clv,
+                                                             unsigned int * parent_scaler,
+                                                             const double * left_clv,
+                                                             const double * right_clv,
+                                                             const double * left_matrix,
+                                                             const double * right_matrix,
+                                                             const unsigned int * left_scaler,
+                                                             const unsigned int * right_scaler,
+                                                             const unsigned int * parent_id_site,
+                                                             const unsigned int * left_site_id,
+                                                             const unsigned int * right_site_id,
+                                                             double * bclv_buffer,
+                                                             unsigned int attrib);
+#endif
+
+
+/* functions in core_partials_avx512.c */
+
+#ifdef HAVE_AVX512
+PLL_EXPORT void pll_core_update_partial_ti_avx512(unsigned int states,
+                                                  unsigned int sites,
+                                                  unsigned int rate_cats,
+                                                  double * parent_clv,
+                                                  unsigned int * parent_scaler,
+                                                  const unsigned char * left_tipchars,
+                                                  const double * right_clv,
+                                                  const double * left_matrix,
+                                                  const double * right_matrix,
+                                                  const unsigned int * right_scaler,
+                                                  const pll_state_t * tipmap,
+                                                  unsigned int tipmap_size,
+                                                  unsigned int attrib);
+
+PLL_EXPORT void pll_core_update_partial_ti_4x4_avx512(unsigned int sites,
+                                                      unsigned int rate_cats,
+                                                      double * parent_clv,
+                                                      unsigned int * parent_scaler,
+                                                      const unsigned char * left_tipchar,
+                                                      const double * right_clv,
+                                                      const double * left_matrix,
+                                                      const double * right_matrix,
+                                                      const unsigned int * right_scaler,
+                                                      unsigned int attrib);
+
+PLL_EXPORT
+void pll_core_update_partial_ti_20x20_avx512(unsigned int sites,
+                                             unsigned int rate_cats,
+                                             double * parent_clv,
+                                             unsigned int * parent_scaler,
+                                             const unsigned char * left_tipchar,
+                                             const double * right_clv,
+                                             const double * left_matrix,
+                                             const double * right_matrix,
+                                             const unsigned int * right_scaler,
+                                             const pll_state_t * tipmap,
+                                             unsigned int tipmap_size,
+                                             unsigned int attrib);
+
+PLL_EXPORT void pll_core_update_partial_ii_avx512(unsigned int states,
+                                                  unsigned int sites,
+                                                  unsigned int rate_cats,
+                                                  double * parent_clv,
+                                                  unsigned int * parent_scaler,
+                                                  const double * left_clv,
+                                                  const double * right_clv,
+                                                  const double * left_matrix,
+                                                  const double * right_matrix,
+                                                  const unsigned int * left_scaler,
+                                                  const unsigned int * right_scaler,
+                                                  unsigned int attrib);
+
+PLL_EXPORT void pll_core_update_partial_ii_4x4_avx512(unsigned int sites,
+                                                      unsigned int rate_cats,
+                                                      double * parent_clv,
+                                                      unsigned int * parent_scaler,
+                                                      const double * left_clv,
+                                                      const double * right_clv,
+                                                      const double * left_matrix,
+                                                      const double * right_matrix,
+                                                      const unsigned int * left_scaler,
+                                                      const unsigned int * right_scaler,
+                                                      unsigned int attrib);
+
+PLL_EXPORT void pll_core_update_partial_ii_20x20_avx512(unsigned int sites,
+                                                        unsigned int rate_cats,
+                                                        double * parent_clv,
+                                                        unsigned int * parent_scaler,
+                                                        const double * left_clv,
+                                                        const double * right_clv,
+                                                        const double * left_matrix,
+                                                        const double * right_matrix,
+                                                        const unsigned int * left_scaler,
+                                                        const unsigned int * right_scaler,
+                                                        unsigned int attrib);
 #endif
 
 
@@ -1946,6 +2514,88 @@ PLL_EXPORT int pll_core_update_sumtable_repeats_generic_avx2(unsigned int states
                                                              double * bclv_buffer,
                                                              unsigned int inv,
                                                              unsigned int attrib);
+
+PLL_EXPORT int pll_core_update_sumtable_repeats_4x4_avx2(unsigned int states,
+                                                         unsigned int sites,
+                                                         unsigned int parent_sites,
+                                                         unsigned int rate_cats,
+                                                         const double * clvp,
+                                                         const double * clvc,
+                                                         const unsigned int * parent_scaler,
+                                                         const unsigned int * child_scaler,
+                                                         double * const * eigenvecs,
+                                                         double * const * inv_eigenvecs,
+                                                         double * const * freqs,
+                                                         double *sumtable,
+                                                         const unsigned int * parent_site_id,
+                                                         const unsigned int * child_site_id,
+                                                         double * bclv_buffer,
+                                                         unsigned int inv,
+                                                         unsigned int attrib);
+
+PLL_EXPORT int pll_core_update_sumtable_repeatsbclv_4x4_avx2(unsigned int states,
+                                                             unsigned int sites,
+                                                             unsigned int parent_sites,
+                                                             unsigned int rate_cats,
+                                                             const double * clvp,
+                                                             const double * clvc,
+                                                             const unsigned int * parent_scaler,
+                                                             const unsigned int * child_scaler,
+                                                             double * const * eigenvecs,
+                                                             double * const * inv_eigenvecs,
+                                                             double * const * freqs,
+                                                             double *sumtable,
+                                                             const unsigned int * parent_site_id,
+                                                             const unsigned int * child_site_id,
+                                                             double * bclv_buffer,
+                                                             unsigned int inv,
+                                                             unsigned int attrib);
+#endif
+
+/* functions in core_derivatives_avx512.c */
+
+#ifdef HAVE_AVX512
+PLL_EXPORT int pll_core_update_sumtable_ii_avx512(unsigned int states,
+                                                  unsigned int sites,
+                                                  unsigned int rate_cats,
+                                                  const double * clvp,
+                                                  const double * clvc,
+                                                  const unsigned int * parent_scaler,
+                                                  const unsigned int * child_scaler,
+                                                  double * const * eigenvecs,
+                                                  double * const * inv_eigenvecs,
+                                                  double * const * freqs,
+                                                  double * sumtable,
+                                                  unsigned int attrib);
+
+PLL_EXPORT int pll_core_update_sumtable_ti_avx512(unsigned int states,
+                                                  unsigned int sites,
+                                                  unsigned int rate_cats,
+                                                  const double * parent_clv,
+                                                  const unsigned char * left_tipchars,
+                                                  const unsigned int * parent_scaler,
+                                                  double * const * eigenvecs,
+                                                  double * const * inv_eigenvecs,
+                                                  double * const * freqs,
+                                                  const pll_state_t * tipmap,
+                                                  unsigned int tipmap_size,
+                                                  double *sumtable,
+                                                  unsigned int attrib);
+
+PLL_EXPORT
+int pll_core_likelihood_derivatives_avx512(unsigned int states,
+                                           unsigned int states_padded,
+                                           unsigned int rate_cats,
+                                           unsigned int ef_sites,
+                                           const unsigned int * pattern_weights,
+                                           const double * rate_weights,
+                                           const int * invariant,
+                                           const double * prop_invar,
+                                           double * const * freqs,
+                                           const double * sumtable,
+                                           const double * diagptable,
+                                           double * d_f,
+                                           double * dd_f);
 #endif
 
 /* functions in core_likelihood_sse.c */
@@ -2267,6 +2917,12 @@ PLL_EXPORT double pll_core_edge_loglikelihood_repeatsbclv_4x4_avx(unsigned int s
                                                                   const unsigned int * child_site_id,
                                                                   double * bclv,
                                                                   unsigned int attrib);
+
+PLL_EXPORT void pll_core_weighted_sums_avx(unsigned int sites,
+                                           unsigned int count,
+                                           const unsigned int * weights,
+                                           const double * values,
+                                           double * sums);
 #endif
 
 
@@ -2361,6 +3017,446 @@ double pll_core_edge_loglikelihood_repeats_generic_avx2(unsigned int states,
                                                         double * bclv,
                                                         unsigned int attrib);
 
+PLL_EXPORT
+double pll_core_edge_loglikelihood_repeats_4x4_avx2(unsigned int states,
+                                                    unsigned int sites,
+                                                    const unsigned int child_sites,
+                                                    unsigned int rate_cats,
+                                                    const double * parent_clv,
+                                                    const unsigned int * parent_scaler,
+                                                    const double * child_clv,
+                                                    const unsigned int * child_scaler,
+                                                    const double * pmatrix,
+                                                    double ** frequencies,
+                                                    const double * rate_weights,
+                                                    const unsigned int * pattern_weights,
+                                                    const double * invar_proportion,
+                                                    const int * invar_indices,
+                                                    const unsigned int * freqs_indices,
+                                                    double * persite_lnl,
+                                                    const unsigned int * parent_site_id,
+                                                    const unsigned int * child_site_id,
+                                                    double * bclv,
+                                                    unsigned int attrib);
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_repeatsbclv_4x4_avx2(unsigned int states,
+                                                        unsigned int sites,
+                                                        const unsigned int child_sites,
+                                                        unsigned int rate_cats,
+                                                        const double * parent_clv,
+                                                        const unsigned int * parent_scaler,
+                                                        const double * child_clv,
+                                                        const unsigned int * child_scaler,
+                                                        const double * pmatrix,
+                                                        double ** frequencies,
+                                                        const double * rate_weights,
+                                                        const unsigned int * pattern_weights,
+                                                        const double * invar_proportion,
+                                                        const int * invar_indices,
+                                                        const unsigned int * freqs_indices,
+                                                        double * persite_lnl,
+                                                        const unsigned int * parent_site_id,
+                                                        const unsigned int * child_site_id,
+                                                        double * bclv,
+                                                        unsigned int attrib);
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_repeats_20x20_avx2(unsigned int sites,
+                                                      const unsigned int child_sites,
+                                                      unsigned int rate_cats,
+                                                      const double * parent_clv,
+                                                      const unsigned int * parent_scaler,
+                                                      const double * child_clv,
+                                                      const unsigned int * child_scaler,
+                                                      const double * pmatrix,
+                                                      double ** frequencies,
+                                                      const double * rate_weights,
+                                                      const unsigned int * pattern_weights,
+                                                      const double * invar_proportion,
+                                                      const int * invar_indices,
+                                                      const unsigned int * freqs_indices,
+                                                      double * persite_lnl,
+                                                      const unsigned int * parent_site_id,
+                                                      const unsigned int * child_site_id,
+                                                      unsigned int attrib);
+
+#endif
+
+/* functions in core_likelihood_avx512.c */
+
+#ifdef HAVE_AVX512
+PLL_EXPORT
+double pll_core_root_loglikelihood_avx512(unsigned int states,
+                                          unsigned int sites,
+                                          unsigned int rate_cats,
+                                          const double * clv,
+                                          const unsigned int * scaler,
+                                          double * const * frequencies,
+                                          const double * rate_weights,
+                                          const unsigned int * pattern_weights,
+                                          const double * invar_proportion,
+                                          const int * invar_indices,
+                                          const unsigned int * freqs_indices,
+                                          double * persite_lnl);
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_ti_avx512(unsigned int states,
+                                             unsigned int sites,
+                                             unsigned int rate_cats,
+                                             const double * parent_clv,
+                                             const unsigned int * parent_scaler,
+                                             const unsigned char * tipchars,
+                                             const pll_state_t * tipmap,
+                                             unsigned int tipmap_size,
+                                             const double * pmatrix,
+                                             double * const * frequencies,
+                                             const double * rate_weights,
+                                             const unsigned int * pattern_weights,
+                                             const double * invar_proportion,
+                                             const int * invar_indices,
+                                             const unsigned int * freqs_indices,
+                                             double * persite_lnl,
+                                             unsigned int attrib);
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_ti_4x4_avx512(unsigned int sites,
+                                                 unsigned int rate_cats,
+                                                 const double * parent_clv,
+                                                 const unsigned int * parent_scaler,
+                                                 const unsigned char * tipchars,
+                                                 const double * pmatrix,
+                                                 double * const * frequencies,
+                                                 const double * rate_weights,
+                                                 const unsigned int * pattern_weights,
+                                                 const double * invar_proportion,
+                                                 const int * invar_indices,
+                                                 const unsigned int * freqs_indices,
+                                                 double * persite_lnl,
+                                                 unsigned int attrib);
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_ii_avx512(unsigned int states,
+                                             unsigned int sites,
+                                             unsigned int rate_cats,
+                                             const double * parent_clv,
+                                             const unsigned int * parent_scaler,
+                                             const double * child_clv,
+                                             const unsigned int * child_scaler,
+                                             const double * pmatrix,
+                                             double * const * frequencies,
+                                             const double * rate_weights,
+                                             const unsigned int * pattern_weights,
+                                             const double * invar_proportion,
+                                             const int * invar_indices,
+                                             const unsigned int * freqs_indices,
+                                             double * persite_lnl,
+                                             unsigned int attrib);
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_ii_4x4_avx512(unsigned int sites,
+                                                 unsigned int rate_cats,
+                                                 const double * parent_clv,
+                                                 const unsigned int * parent_scaler,
+                                                 const double * child_clv,
+                                                 const unsigned int * child_scaler,
+                                                 const double * pmatrix,
+                                                 double * const * frequencies,
+                                                 const double * rate_weights,
+                                                 const unsigned int * pattern_weights,
+                                                 const double * invar_proportion,
+                                                 const int * invar_indices,
+                                                 const unsigned int * freqs_indices,
+                                                 double * persite_lnl,
+                                                 unsigned int attrib);
+#endif
+
+/* functions in core_float.c */
+
+PLL_EXPORT void pll_core_update_partial_tt_float(unsigned int states,
+                                                 unsigned int sites,
+                                                 unsigned int rate_cats,
+                                                 float * parent_clv,
+                                                 unsigned int * parent_scaler,
+                                                 const unsigned char * left_tipchars,
+                                                 const unsigned char * right_tipchars,
+                                                 const double * left_matrix,
+                                                 const double * right_matrix,
+                                                 const pll_state_t * tipmap,
+                                                 unsigned int tipmap_size,
+                                                 unsigned int attrib);
+
+PLL_EXPORT void pll_core_update_partial_ti_float(unsigned int states,
+                                                 unsigned int sites,
+                                                 unsigned int rate_cats,
+                                                 float * parent_clv,
+                                                 unsigned int * parent_scaler,
+                                                 const unsigned char * left_tipchars,
+                                                 const float * right_clv,
+                                                 const double * left_matrix,
+                                                 const double * right_matrix,
+                                                 const unsigned int * right_scaler,
+                                                 const pll_state_t * tipmap,
+                                                 unsigned int tipmap_size,
+                                                 unsigned int attrib);
+
+PLL_EXPORT void pll_core_update_partial_ii_float(unsigned int states,
+                                                 unsigned int sites,
+                                                 unsigned int rate_cats,
+                                                 float * parent_clv,
+                                                 unsigned int * parent_scaler,
+                                                 const float * left_clv,
+                                                 const float * right_clv,
+                                                 const double * left_matrix,
+                                                 const double * right_matrix,
+                                                 const unsigned int * left_scaler,
+                                                 const unsigned int * right_scaler,
+                                                 unsigned int attrib);
+
+PLL_EXPORT double pll_core_root_loglikelihood_float(unsigned int states,
+                                                    unsigned int sites,
+                                                    unsigned int rate_cats,
+                                                    const float * clv,
+                                                    const unsigned int * scaler,
+                                                    double * const * frequencies,
+                                                    const double * rate_weights,
+                                                    const unsigned int * pattern_weights,
+                                                    const double * invar_proportion,
+                                                    const int * invar_indices,
+                                                    const unsigned int * freqs_indices,
+                                                    double * persite_lnl,
+                                                    unsigned int attrib);
+
+PLL_EXPORT double pll_core_edge_loglikelihood_ti_float(unsigned int states,
+                                                       unsigned int sites,
+                                                       unsigned int rate_cats,
+                                                       const float * parent_clv,
+                                                       const unsigned int * parent_scaler,
+                                                       const unsigned char * tipchars,
+                                                       const pll_state_t * tipmap,
+                                                       unsigned int tipmap_size,
+                                                       const double * pmatrix,
+                                                       double * const * frequencies,
+                                                       const double * rate_weights,
+                                                       const unsigned int * pattern_weights,
+                                                       const double * invar_proportion,
+                                                       const int * invar_indices,
+                                                       const unsigned int * freqs_indices,
+                                                       double * persite_lnl,
+                                                       unsigned int attrib);
+
+PLL_EXPORT double pll_core_edge_loglikelihood_ii_float(unsigned int states,
+                                                       unsigned int sites,
+                                                       unsigned int rate_cats,
+                                                       const float * parent_clv,
+                                                       const unsigned int * parent_scaler,
+                                                       const float * child_clv,
+                                                       const unsigned int * child_scaler,
+                                                       const double * pmatrix,
+                                                       double * const * frequencies,
+                                                       const double * rate_weights,
+                                                       const unsigned int * pattern_weights,
+                                                       const double * invar_proportion,
+                                                       const int * invar_indices,
+                                                       const unsigned int * freqs_indices,
+                                                       double * persite_lnl,
+                                                       unsigned int attrib);
+
+/* functions in core_float_sse.c */
+
+#ifdef HAVE_SSE3
+PLL_EXPORT void pll_core_update_partial_ii_float_sse(unsigned int states,
+                                                     unsigned int sites,
+                                                     unsigned int rate_cats,
+                                                     float * parent_clv,
+                                                     unsigned int * parent_scaler,
+                                                     const float * left_clv,
+                                                     const float * right_clv,
+                                                     const float * left_matrix,
+                                                     const float * right_matrix,
+                                                     unsigned int attrib);
+
+PLL_EXPORT void pll_core_update_partial_ti_float_sse(unsigned int states,
+                                                     unsigned int sites,
+                                                     unsigned int rate_cats,
+                                                     float * parent_clv,
+                                                     unsigned int * parent_scaler,
+                                                     const unsigned char * left_tipchars,
+                                                     const float * right_clv,
+                                                     const float * left_lookup,
+                                                     const float * right_matrix,
+                                                     unsigned int attrib);
+
+PLL_EXPORT void pll_core_site_terms_float_sse(unsigned int states,
+                                              unsigned int sites,
+                                              unsigned int rate_cats,
+                                              const float * parent_clv,
+                                              const float * child_clv,
+                                              const unsigned char * child_tipchars,
+                                              const float * child_matrix,
+                                              const float * frequencies,
+                                              double * terms);
+#endif
+
+/* functions in core_float_avx.c */
+
+#ifdef HAVE_AVX
+PLL_EXPORT void pll_core_update_partial_ii_float_avx(unsigned int states,
+                                                     unsigned int sites,
+                                                     unsigned int rate_cats,
+                                                     float * parent_clv,
+                                                     unsigned int * parent_scaler,
+                                                     const float * left_clv,
+                                                     const float * right_clv,
+                                                     const float * left_matrix,
+                                                     const float * right_matrix,
+                                                     unsigned int attrib);
+
+PLL_EXPORT void pll_core_update_partial_ti_float_avx(unsigned int states,
+                                                     unsigned int sites,
+                                                     unsigned int rate_cats,
+                                                     float * parent_clv,
+                                                     unsigned int * parent_scaler,
+                                                     const unsigned char * left_tipchars,
+                                                     const float * right_clv,
+                                                     const float * left_lookup,
+                                                     const float * right_matrix,
+                                                     unsigned int attrib);
+
+PLL_EXPORT void pll_core_site_terms_float_avx(unsigned int states,
+                                              unsigned int sites,
+                                              unsigned int rate_cats,
+                                              const float * parent_clv,
+                                              const float * child_clv,
+                                              const unsigned char * child_tipchars,
+                                              const float * child_matrix,
+                                              const float * frequencies,
+                                              double * terms);
+#endif
+
+/* functions in core_float_avx2.c */
+
+#ifdef HAVE_AVX2
+PLL_EXPORT void pll_core_update_partial_ii_float_avx2(unsigned int states,
+                                                      unsigned int sites,
+                                                      unsigned int rate_cats,
+                                                      float * parent_clv,
+                                                      unsigned int * parent_scaler,
+                                                      const float * left_clv,
+                                                      const float * right_clv,
+                                                      const float * left_matrix,
+                                                      const float * right_matrix,
+                                                      unsigned int attrib);
+
+PLL_EXPORT void pll_core_update_partial_ti_float_avx2(unsigned int states,
+                                                      unsigned int sites,
+                                                      unsigned int rate_cats,
+                                                      float * parent_clv,
+                                                      unsigned int * parent_scaler,
+                                                      const unsigned char * left_tipchars,
+                                                      const float * right_clv,
+                                                      const float * left_lookup,
+                                                      const float * right_matrix,
+                                                      unsigned int attrib);
+
+PLL_EXPORT void pll_core_site_terms_float_avx2(unsigned int states,
+                                               unsigned int sites,
+                                               unsigned int rate_cats,
+                                               const float * parent_clv,
+                                               const float * child_clv,
+                                               const unsigned char * child_tipchars,
+                                               const float * child_matrix,
+                                               const float * frequencies,
+                                               double * terms);
+#endif
+
+/* functions in core_codon_avx2.c */
+
+#ifdef HAVE_AVX2
+PLL_EXPORT void pll_core_update_partial_ti_61x61_avx2(unsigned int sites,
+                                                      unsigned int rate_cats,
+                                                      double * parent_clv,
+                                                      unsigned int * parent_scaler,
+                                                      const unsigned char * left_tipchars,
+                                                      const double * right_clv,
+                                                      const double * left_matrix,
+                                                      const double * right_matrix,
+                                                      const unsigned int * right_scaler,
+                                                      const pll_state_t * tipmap,
+                                                      unsigned int tipmap_size,
+                                                      unsigned int attrib);
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_ii_61x61_avx2(unsigned int sites,
+                                                 unsigned int rate_cats,
+                                                 const double * parent_clv,
+                                                 const unsigned int * parent_scaler,
+                                                 const double * child_clv,
+                                                 const unsigned int * child_scaler,
+                                                 const double * pmatrix,
+                                                 double * const * frequencies,
+                                                 const double * rate_weights,
+                                                 const unsigned int * pattern_weights,
+                                                 const double * invar_proportion,
+                                                 const int * invar_indices,
+                                                 const unsigned int * freqs_indices,
+                                                 double * persite_lnl,
+                                                 unsigned int attrib);
+
+PLL_EXPORT
+double pll_core_edge_loglikelihood_ti_61x61_avx2(unsigned int sites,
+                                                 unsigned int rate_cats,
+                                                 const double * parent_clv,
+                                                 const unsigned int * parent_scaler,
+                                                 const unsigned char * tipchars,
+                                                 const pll_state_t * tipmap,
+                                                 unsigned int tipmap_size,
+                                                 const double * pmatrix,
+                                                 double * const * frequencies,
+                                                 const double * rate_weights,
+                                                 const unsigned int * pattern_weights,
+                                                 const double * invar_proportion,
+                                                 const int * invar_indices,
+                                                 const unsigned int * freqs_indices,
+                                                 double * persite_lnl,
+                                                 unsigned int attrib);
+
+PLL_EXPORT int pll_core_update_sumtable_ii_61x61_avx2(unsigned int sites,
+                                                      unsigned int rate_cats,
+                                                      const double * clvp,
+                                                      const double * clvc,
+                                                      const unsigned int * parent_scaler,
+                                                      const unsigned int * child_scaler,
+                                                      double * const * eigenvecs,
+                                                      double * const * inv_eigenvecs,
+                                                      double * const * freqs,
+                                                      double * sumtable,
+                                                      unsigned int attrib);
+
+PLL_EXPORT int pll_core_update_sumtable_ti_61x61_avx2(unsigned int sites,
+                                                      unsigned int rate_cats,
+                                                      const double * parent_clv,
+                                                      const unsigned char * left_tipchars,
+                                                      const unsigned int * parent_scaler,
+                                                      double * const * eigenvecs,
+                                                      double * const * inv_eigenvecs,
+                                                      double * const * freqs,
+                                                      const pll_state_t * tipmap,
+                                                      unsigned int tipmap_size,
+                                                      double * sumtable,
+                                                      unsigned int attrib);
+
+PLL_EXPORT int pll_core_update_pmatrix_61x61_avx2(double ** pmatrix,
+                                                  unsigned int rate_cats,
+                                                  const double * rates,
+                                                  const double * branch_lengths,
+                                                  const unsigned int * matrix_indices,
+                                                  const unsigned int * params_indices,
+                                                  const double * prop_invar,
+                                                  double * const * eigenvals,
+                                                  double * const * eigenvecs,
+                                                  double * const * inv_eigenvecs,
+                                                  unsigned int count);
 #endif
 
 /* functions in core_pmatrix.c */
@@ -2485,6 +3581,9 @@ PLL_EXPORT int pll_utree_rollback(pll_utree_rb_t * rollback,
                                   double * branch_lengths,
                                   unsigned int * matrix_indices);
 
+PLL_EXPORT unsigned int pll_utree_rb_clv_indices(const pll_utree_rb_t * rb,
+                                                 unsigned int * clv_indices);
+
 /* functions in parsimony.c */
 
 PLL_EXPORT int pll_set_parsimony_sequence(pll_parsimony_t * pars,
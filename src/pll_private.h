@@ -0,0 +1,196 @@
+/*
+    Copyright (C) 2015-2020 Tomas Flouri, Diego Darriba, Alexey Kozlov
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#ifndef PLL_PRIVATE_H
+#define PLL_PRIVATE_H
+
+#include "pll.h"
+
+/* declarations shared by the library sources; not installed */
+
+/* number of site likelihoods buffered by the likelihood kernels before their
+   logarithms are computed and summed up */
+#define PLL_LOGL_BLOCK 64
+
+/* coefficients of the logarithm of the likelihood kernels (from fdlibm) */
+#define PLL_LOG_LN2_HI 6.93147180369123816490e-01
+#define PLL_LOG_LN2_LO 1.90821492927058770002e-10
+#define PLL_LOG_LG1 6.666666666666735130e-01
+#define PLL_LOG_LG2 3.999999999940941908e-01
+#define PLL_LOG_LG3 2.857142874366239149e-01
+#define PLL_LOG_LG4 2.222219843214978396e-01
+#define PLL_LOG_LG5 1.818357216161805012e-01
+#define PLL_LOG_LG6 1.531383769920937332e-01
+#define PLL_LOG_LG7 1.479819860511658591e-01
+
+/* site likelihoods buffered by the likelihood kernels, see
+   pll_core_logl_flush() */
+
+typedef struct pll_logl_block
+{
+  double lk[PLL_LOGL_BLOCK];            /* site likelihoods */
+  unsigned int scalings[PLL_LOGL_BLOCK];/* scaling factors to undo */
+  unsigned int count;                   /* buffered sites */
+  unsigned int site;                    /* index of the first buffered site */
+  const unsigned int * pattern_weights;
+  double * persite_lnl;
+  double sum;                           /* log-likelihood of flushed sites */
+  double comp;                          /* rounding error compensation */
+} pll_logl_block_t;
+
+/* buffer the likelihood of the next site; the logarithms are taken by
+   flush, one of the pll_core_logl_flush*() functions, once the block is full */
+static inline void pll_core_logl_push(pll_logl_block_t * block,
+                                      double site_lk,
+                                      unsigned int scalings,
+                                      double (*flush)(pll_logl_block_t *))
+{
+  block->lk[block->count] = site_lk;
+  block->scalings[block->count] = scalings;
+  if (++block->count == PLL_LOGL_BLOCK)
+    flush(block);
+}
+
+/* scratch buffers of compact scale buffers, see pll_scaler_load_range() */
+#define PLL_SCALER_SLOTS  3
+#define PLL_SCALER_PARENT 0
+#define PLL_SCALER_LEFT   1
+#define PLL_SCALER_RIGHT  2
+
+/* number of entries of a tip-tip lookup table of the partition. Only
+   meaningful with PLL_ATTRIB_PATTERN_TIP, which sets maxstates */
+static inline size_t pll_ttlookup_size(const pll_partition_t * partition)
+{
+  unsigned int l2_maxstates = (unsigned int)ceil(log2(partition->maxstates));
+
+  size_t size = ((size_t)1 << (2 * l2_maxstates)) *
+                (partition->states_padded * partition->rate_cats);
+
+  /* the 4x4 vectorized kernels index a fixed-size table */
+  if (partition->states == 4)
+    size = PLL_MAX(size, 1024 * partition->rate_cats);
+
+  return size;
+}
+
+/* functions in core_likelihood.c */
+
+void pll_core_logl_init(pll_logl_block_t * block,
+                        const unsigned int * pattern_weights,
+                        double * persite_lnl);
+
+double pll_core_logl_accumulate(pll_logl_block_t * block);
+
+double pll_core_logl_flush(pll_logl_block_t * block);
+
+/* functions in core_likelihood_sse.c */
+
+#ifdef HAVE_SSE3
+double pll_core_logl_flush_sse(pll_logl_block_t * block);
+#endif
+
+/* functions in core_likelihood_avx.c */
+
+#ifdef HAVE_AVX
+double pll_core_logl_flush_avx(pll_logl_block_t * block);
+#endif
+
+/* functions in core_partials_avx2.c */
+
+#ifdef HAVE_AVX2
+/* sites per block and per register tile of the blocked matrix products */
+#define PLL_II_BLOCK_SITES 32
+#define PLL_II_TILE_SITES 4
+
+void pll_core_block_product_avx2(unsigned int states,
+                                 unsigned int states_padded,
+                                 unsigned int block_sites,
+                                 const double * mt,
+                                 const double * const * c,
+                                 double * const * p,
+                                 int multiply);
+
+void pll_core_transpose_matrices_avx2(double * mt,
+                                      const double * mat,
+                                      unsigned int states,
+                                      unsigned int states_padded,
+                                      unsigned int rate_cats);
+
+void pll_core_scale_clv_avx2(double * clv, unsigned int size, double factor);
+
+void pll_core_scale_site_avx2(double * site_clv,
+                              unsigned int n,
+                              unsigned int states_padded,
+                              unsigned int rate_cats,
+                              unsigned int * parent_scaler,
+                              unsigned int attrib);
+#endif
+
+/* functions in pll.c */
+
+unsigned int * pll_scaler_load_range(const pll_partition_t * partition,
+                                     int scaler_index,
+                                     unsigned int slot,
+                                     unsigned int begin,
+                                     unsigned int end);
+
+unsigned int * pll_scaler_load(const pll_partition_t * partition,
+                               int scaler_index,
+                               unsigned int slot);
+
+void pll_scaler_store_range(pll_partition_t * partition,
+                            int scaler_index,
+                            unsigned int slot,
+                            unsigned int begin,
+                            unsigned int end);
+
+/* functions in partials.c */
+
+int pll_clv_require(pll_partition_t * partition, unsigned int clv_index);
+
+/* functions in clv_manager.c */
+
+int pll_clv_manager_init(pll_partition_t * partition);
+
+void pll_clv_manager_destroy(pll_partition_t * partition);
+
+int pll_clv_check_slots(const pll_partition_t * partition,
+                        const pll_operation_t * op);
+
+int pll_clv_assign_slot(pll_partition_t * partition, unsigned int clv_index);
+
+void pll_clv_pin(pll_partition_t * partition, unsigned int clv_index);
+
+void pll_clv_unpin(pll_partition_t * partition, unsigned int clv_index);
+
+void pll_clv_release(pll_partition_t * partition, unsigned int clv_index);
+
+void pll_clv_set_operation(pll_partition_t * partition,
+                           const pll_operation_t * op);
+
+void pll_clv_clear_operation(pll_partition_t * partition,
+                             unsigned int clv_index);
+
+int pll_clv_get_operation(const pll_partition_t * partition,
+                          unsigned int clv_index,
+                          pll_operation_t * op);
+
+#endif
@@ -0,0 +1,622 @@
+/*
+    Copyright (C) 2015-2020 Tomas Flouri, Diego Darriba, Alexey Kozlov
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include "pll.h"
+#include "pll_private.h"
+
+/* Pre-order (outside) messages. After a post-order traversal towards the
+   inner node root, every node v holds the CLV of its subtree (in_v). The
+   message of the rest of the tree at the other end of the edge of v is
+
+     out_v = (P_p * out_p) x (P_s * in_s)
+
+   for the parent p and the sibling s of v. For the neighbors a, b, c of the
+   root, out_a = in_r and out_b = (P_a * in_a) x (P_c * in_c). Every edge of
+   the tree (or every inner node) is visited with the pair out_v, in_v, from
+   which marginal probabilities or branch-length derivatives follow.
+
+   Messages are kept in buffers that are recycled once the messages of both
+   children have been computed, hence only a few buffers are allocated. The
+   schedule of kernel calls is built once and then executed by every thread
+   of the partition on its own block of sites */
+
+typedef struct preorder_stack_s
+{
+  const pll_unode_t * node;
+  pll_preorder_src_t out;
+} preorder_stack_t;
+
+typedef struct preorder_run_s
+{
+  pll_preorder_t * preorder;
+  pll_preorder_visit_t visit;
+  void * data;
+} preorder_run_t;
+
+static pll_preorder_src_t node_src(const pll_unode_t * node)
+{
+  pll_preorder_src_t src;
+
+  src.slot = -1;
+  src.clv_index = node->clv_index;
+  src.scaler_index = node->scaler_index;
+
+  return src;
+}
+
+static pll_preorder_src_t slot_src(int slot)
+{
+  pll_preorder_src_t src;
+
+  src.slot = slot;
+  src.clv_index = 0;
+  src.scaler_index = PLL_SCALE_BUFFER_NONE;
+
+  return src;
+}
+
+static int src_is_tip(const pll_partition_t * partition,
+                      const pll_preorder_src_t * src)
+{
+  return src->slot == -1 &&
+         (partition->attributes & PLL_ATTRIB_PATTERN_TIP) &&
+         src->clv_index < partition->tips;
+}
+
+static void add_step(pll_preorder_t * preorder,
+                     pll_preorder_src_t left,
+                     const pll_unode_t * left_edge,
+                     pll_preorder_src_t right,
+                     const pll_unode_t * right_edge,
+                     int target_slot,
+                     const pll_unode_t * node)
+{
+  pll_preorder_step_t * step = preorder->steps + preorder->steps_count++;
+  const pll_partition_t * partition = preorder->partition;
+
+  step->left = left;
+  step->right = right;
+  step->left_matrix = partition->pmatrix[left_edge->pmatrix_index];
+  step->right_matrix = right_edge ?
+                       partition->pmatrix[right_edge->pmatrix_index] :
+                       preorder->ident_pmat;
+  step->target_slot = target_slot;
+  step->node = node;
+  step->ttlookup = NULL;
+}
+
+static int alloc_slot(pll_preorder_t * preorder, int * free_slots,
+                      unsigned int * free_count)
+{
+  if (*free_count)
+    return free_slots[--*free_count];
+
+  return (int)preorder->slots++;
+}
+
+/* message of the child c of a node whose own message is out, where s is the
+   sibling of c and v the node */
+static void add_message(pll_preorder_t * preorder,
+                        preorder_stack_t * stack,
+                        unsigned int * stack_top,
+                        int * free_slots,
+                        unsigned int * free_count,
+                        pll_preorder_src_t left,
+                        const pll_unode_t * left_edge,
+                        const pll_unode_t * sibling,
+                        const pll_unode_t * child)
+{
+  int slot = alloc_slot(preorder, free_slots, free_count);
+
+  add_step(preorder, left, left_edge, node_src(sibling), sibling, slot, NULL);
+  stack[*stack_top].node = child;
+  stack[(*stack_top)++].out = slot_src(slot);
+}
+
+/* builds the kernel calls of the pre-order traversal. Every node is pushed
+   once, hence the stack holds at most nodes entries */
+static int build_schedule(pll_preorder_t * preorder, const pll_unode_t * root)
+{
+  const pll_partition_t * partition = preorder->partition;
+  unsigned int nodes = partition->tips + partition->clv_buffers;
+  unsigned int stack_top = 0;
+  unsigned int free_count = 0;
+  int edges = preorder->mode == PLL_PREORDER_EDGES;
+  const pll_unode_t * a = root->back;
+  const pll_unode_t * b = root->next->back;
+  const pll_unode_t * c = root->next->next->back;
+  preorder_stack_t * stack;
+  int * free_slots;
+
+  preorder->steps = (pll_preorder_step_t *)malloc(3 * nodes *
+                                                  sizeof(pll_preorder_step_t));
+  stack = (preorder_stack_t *)malloc(nodes * sizeof(preorder_stack_t));
+  free_slots = (int *)malloc(nodes * sizeof(int));
+  if (!preorder->steps || !stack || !free_slots)
+  {
+    free(stack);
+    free(free_slots);
+    return PLL_FAILURE;
+  }
+
+  /* the marginals of the root combine its three subtrees */
+  if (!edges)
+    add_step(preorder, node_src(a), a, node_src(root), NULL, -1, root);
+
+  if (edges || c->next)
+    add_message(preorder, stack, &stack_top, free_slots, &free_count,
+                node_src(a), a, b, c);
+  if (edges || b->next)
+    add_message(preorder, stack, &stack_top, free_slots, &free_count,
+                node_src(a), a, c, b);
+  if (edges || a->next)
+  {
+    stack[stack_top].node = a;
+    stack[stack_top++].out = node_src(root);
+  }
+
+  while (stack_top)
+  {
+    const pll_unode_t * v = stack[--stack_top].node;
+    pll_preorder_src_t out = stack[stack_top].out;
+
+    add_step(preorder, out, v, node_src(v), NULL, -1, v);
+
+    if (v->next)
+    {
+      const pll_unode_t * c1 = v->next->back;
+      const pll_unode_t * c2 = v->next->next->back;
+
+      if (edges || c1->next)
+        add_message(preorder, stack, &stack_top, free_slots, &free_count,
+                    out, v, c2, c1);
+      if (edges || c2->next)
+        add_message(preorder, stack, &stack_top, free_slots, &free_count,
+                    out, v, c1, c2);
+    }
+
+    /* the message of v is no longer needed */
+    if (out.slot != -1)
+      free_slots[free_count++] = out.slot;
+  }
+
+  free(stack);
+  free(free_slots);
+
+  return PLL_SUCCESS;
+}
+
+/* only messages at the root may combine two tips, and only in a tree of
+   three tips more than one does. The first uses the lookup table of the
+   partition, the others private tables */
+static int assign_lookups(pll_preorder_t * preorder)
+{
+  const pll_partition_t * partition = preorder->partition;
+  size_t size = 0;
+  unsigned int i;
+  unsigned int count = 0;
+
+  for (i = 0; i < preorder->steps_count; ++i)
+  {
+    pll_preorder_step_t * step = preorder->steps + i;
+
+    if (src_is_tip(partition, &step->left) &&
+        src_is_tip(partition, &step->right))
+      ++count;
+  }
+
+  /* tip-tip steps only exist with pattern tips */
+  if (count > 1)
+  {
+    size = pll_ttlookup_size(partition);
+    preorder->ttlookup = pll_aligned_alloc((count-1) * size * sizeof(double),
+                                           partition->alignment);
+    if (!preorder->ttlookup)
+      return PLL_FAILURE;
+  }
+
+  for (i = 0, count = 0; i < preorder->steps_count; ++i)
+  {
+    pll_preorder_step_t * step = preorder->steps + i;
+
+    if (src_is_tip(partition, &step->left) &&
+        src_is_tip(partition, &step->right))
+    {
+      step->ttlookup = count ? preorder->ttlookup + (count-1) * size :
+                               partition->ttlookup;
+      ++count;
+    }
+  }
+
+  return PLL_SUCCESS;
+}
+
+/* identity p-matrices of all rate categories, laid out as the p-matrices of
+   the partition */
+static double * create_identity_pmatrix(const pll_partition_t * partition)
+{
+  unsigned int i, j;
+  unsigned int states = partition->states;
+  unsigned int states_padded = partition->states_padded;
+  size_t displacement = (states_padded - states) * states_padded;
+  size_t size = states_padded * states * partition->rate_cats + displacement;
+  double * ident_pmat = (double *)pll_aligned_alloc(size * sizeof(double),
+                                                    partition->alignment);
+
+  if (!ident_pmat)
+    return NULL;
+
+  memset(ident_pmat, 0, size * sizeof(double));
+  for (i = 0; i < partition->rate_cats; ++i)
+    for (j = 0; j < states; ++j)
+      ident_pmat[(i*states + j)*states_padded + j] = 1;
+
+  return ident_pmat;
+}
+
+static int cb_traverse_full(pll_unode_t * node)
+{
+  return 1;
+}
+
+/* recomputes the CLVs of the tree towards root */
+static int update_postorder(pll_partition_t * partition, pll_unode_t * root)
+{
+  unsigned int nodes = partition->tips + partition->clv_buffers;
+  unsigned int trav_size, ops_count;
+  int retval;
+  pll_unode_t ** travbuffer;
+  pll_operation_t * operations;
+
+  travbuffer = (pll_unode_t **)malloc(nodes * sizeof(pll_unode_t *));
+  operations = (pll_operation_t *)malloc(nodes * sizeof(pll_operation_t));
+  if (!travbuffer || !operations)
+  {
+    free(travbuffer);
+    free(operations);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return PLL_FAILURE;
+  }
+
+  if (!pll_utree_traverse(root,
+                          PLL_TREE_TRAVERSE_POSTORDER,
+                          cb_traverse_full,
+                          travbuffer,
+                          &trav_size))
+  {
+    free(travbuffer);
+    free(operations);
+    return PLL_FAILURE;
+  }
+
+  pll_utree_create_operations(travbuffer,
+                              trav_size,
+                              NULL,
+                              NULL,
+                              operations,
+                              NULL,
+                              &ops_count);
+
+  retval = pll_update_partials(partition, operations, ops_count);
+
+  free(travbuffer);
+  free(operations);
+
+  return retval;
+}
+
+/* runs the post-order traversal towards the inner node root and prepares
+   the pre-order traversal. In mode PLL_PREORDER_EDGES every edge is visited
+   once, with the node v at the end that points away from root; in mode
+   PLL_PREORDER_MARGINALS the inner nodes are visited, and the root with its
+   neighbor root->back. The p-matrices must be up to date. Not supported for
+   single-precision CLVs, site repeats and limited memory */
+PLL_EXPORT pll_preorder_t * pll_preorder_create(pll_partition_t * partition,
+                                                pll_unode_t * root,
+                                                int mode)
+{
+  unsigned int i;
+  size_t clv_size, scaler_size;
+  pll_preorder_t * preorder;
+
+  if (!partition || !root || !root->next)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200, "Root must be an inner node.");
+    return NULL;
+  }
+
+  if (partition->attributes & PLL_ATTRIB_FLOAT)
+  {
+    pll_errno = PLL_ERROR_FLOAT_NOSUPPORT;
+    snprintf(pll_errmsg, 200,
+             "Pre-order traversals are not available for single-precision "
+             "CLVs.");
+    return NULL;
+  }
+
+  if (pll_repeats_enabled(partition) || partition->clv_manager ||
+      (partition->attributes & PLL_ATTRIB_COMPACT_SCALERS))
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "Pre-order traversals are not supported with site repeats, "
+             "limited memory or compact scale buffers.");
+    return NULL;
+  }
+
+  if (!update_postorder(partition, root))
+    return NULL;
+
+  preorder = (pll_preorder_t *)calloc(1, sizeof(pll_preorder_t));
+  if (!preorder)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return NULL;
+  }
+
+  preorder->partition = partition;
+  preorder->mode = mode;
+  preorder->ident_pmat = create_identity_pmatrix(partition);
+  if (!preorder->ident_pmat || !build_schedule(preorder, root) ||
+      !assign_lookups(preorder))
+    goto cleanup;
+
+  clv_size = (size_t)partition->sites * partition->states_padded *
+             partition->rate_cats;
+  scaler_size = (partition->attributes & PLL_ATTRIB_RATE_SCALERS) ?
+                (size_t)partition->sites * partition->rate_cats :
+                partition->sites;
+
+  preorder->slot_clv = (double **)calloc(preorder->slots, sizeof(double *));
+  preorder->slot_scaler = (unsigned int **)calloc(preorder->slots,
+                                                  sizeof(unsigned int *));
+  if (preorder->slots && (!preorder->slot_clv || !preorder->slot_scaler))
+    goto cleanup;
+
+  /* zero-out the padding, see pll_partition_create() */
+  for (i = 0; i < preorder->slots; ++i)
+  {
+    preorder->slot_clv[i] = pll_aligned_alloc(clv_size * sizeof(double),
+                                              partition->alignment);
+    preorder->slot_scaler[i] = (unsigned int *)malloc(scaler_size *
+                                                      sizeof(unsigned int));
+    if (!preorder->slot_clv[i] || !preorder->slot_scaler[i])
+      goto cleanup;
+    memset(preorder->slot_clv[i], 0, clv_size * sizeof(double));
+  }
+
+  return preorder;
+
+cleanup:
+  pll_preorder_destroy(preorder);
+  pll_errno = PLL_ERROR_MEM_ALLOC;
+  snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+  return NULL;
+}
+
+PLL_EXPORT void pll_preorder_destroy(pll_preorder_t * preorder)
+{
+  unsigned int i;
+
+  if (!preorder) return;
+
+  for (i = 0; i < preorder->slots; ++i)
+  {
+    if (preorder->slot_clv)
+      pll_aligned_free(preorder->slot_clv[i]);
+    if (preorder->slot_scaler)
+      free(preorder->slot_scaler[i]);
+  }
+
+  free(preorder->slot_clv);
+  free(preorder->slot_scaler);
+  free(preorder->steps);
+  pll_aligned_free(preorder->ttlookup);
+  pll_aligned_free(preorder->ident_pmat);
+  free(preorder);
+}
+
+/* buffers of a message or partition CLV, starting at site begin. Exactly one
+   of clv and tipchars is set */
+PLL_EXPORT void pll_preorder_src_buffers(const pll_preorder_t * preorder,
+                                         const pll_preorder_src_t * src,
+                                         unsigned int begin,
+                                         const double ** clv,
+                                         const unsigned int ** scaler,
+                                         const unsigned char ** tipchars)
+{
+  const pll_partition_t * partition = preorder->partition;
+  size_t clv_offset = (size_t)begin * partition->rate_cats *
+                      partition->states_padded;
+  size_t scaler_offset = (partition->attributes & PLL_ATTRIB_RATE_SCALERS) ?
+                         (size_t)begin * partition->rate_cats : begin;
+
+  *clv = NULL;
+  *scaler = NULL;
+  *tipchars = NULL;
+
+  if (src->slot != -1)
+  {
+    *clv = preorder->slot_clv[src->slot] + clv_offset;
+    *scaler = preorder->slot_scaler[src->slot] + scaler_offset;
+  }
+  else if (src_is_tip(partition, src))
+    *tipchars = partition->tipchars[src->clv_index] + begin;
+  else
+  {
+    *clv = partition->clv[src->clv_index] + clv_offset;
+    if (src->scaler_index != PLL_SCALE_BUFFER_NONE)
+      *scaler = partition->scale_buffer[src->scaler_index] + scaler_offset;
+  }
+}
+
+/* combines the two sources of a step for the sites [begin,end) into clv and
+   scaler, which point to the entries of site begin */
+PLL_EXPORT void pll_preorder_combine(const pll_preorder_t * preorder,
+                                     const pll_preorder_step_t * step,
+                                     unsigned int begin,
+                                     unsigned int end,
+                                     double * clv,
+                                     unsigned int * scaler)
+{
+  const pll_partition_t * partition = preorder->partition;
+  const pll_preorder_src_t * left = &step->left;
+  const pll_preorder_src_t * right = &step->right;
+  const double * left_matrix = step->left_matrix;
+  const double * right_matrix = step->right_matrix;
+  const double * left_clv, * right_clv;
+  const unsigned int * left_scaler, * right_scaler;
+  const unsigned char * left_tipchars, * right_tipchars;
+
+  /* the tip kernels expect the tip on the left */
+  if (src_is_tip(partition, right) && !src_is_tip(partition, left))
+  {
+    PLL_SWAP(left, right);
+    PLL_SWAP(left_matrix, right_matrix);
+  }
+
+  pll_preorder_src_buffers(preorder, left, begin,
+                           &left_clv, &left_scaler, &left_tipchars);
+  pll_preorder_src_buffers(preorder, right, begin,
+                           &right_clv, &right_scaler, &right_tipchars);
+
+  if (left_tipchars && right_tipchars)
+  {
+    pll_core_update_partial_tt(partition->states,
+                               end - begin,
+                               partition->rate_cats,
+                               clv,
+                               scaler,
+                               left_tipchars,
+                               right_tipchars,
+                               partition->tipmap,
+                               partition->maxstates,
+                               step->ttlookup,
+                               partition->attributes);
+  }
+  else if (left_tipchars)
+  {
+    pll_core_update_partial_ti(partition->states,
+                               end - begin,
+                               partition->rate_cats,
+                               clv,
+                               scaler,
+                               left_tipchars,
+                               right_clv,
+                               left_matrix,
+                               right_matrix,
+                               right_scaler,
+                               partition->tipmap,
+                               partition->maxstates,
+                               partition->attributes);
+  }
+  else
+  {
+    pll_core_update_partial_ii(partition->states,
+                               end - begin,
+                               partition->rate_cats,
+                               clv,
+                               scaler,
+                               left_clv,
+                               right_clv,
+                               left_matrix,
+                               right_matrix,
+                               left_scaler,
+                               right_scaler,
+                               partition->attributes);
+  }
+}
+
+static void preorder_job(void * data,
+                         unsigned int thread_id,
+                         unsigned int thread_count)
+{
+  preorder_run_t * run = (preorder_run_t *)data;
+  pll_preorder_t * preorder = run->preorder;
+  const pll_partition_t * partition = preorder->partition;
+  unsigned int i;
+  unsigned int begin, end;
+  size_t clv_offset, scaler_offset;
+
+  pll_thread_site_range(partition->sites,
+                        thread_id,
+                        thread_count,
+                        &begin,
+                        &end);
+
+  if (begin == end) return;
+
+  clv_offset = (size_t)begin * partition->rate_cats * partition->states_padded;
+  scaler_offset = (partition->attributes & PLL_ATTRIB_RATE_SCALERS) ?
+                  (size_t)begin * partition->rate_cats : begin;
+
+  for (i = 0; i < preorder->steps_count; ++i)
+  {
+    const pll_preorder_step_t * step = preorder->steps + i;
+
+    if (step->target_slot == -1)
+      run->visit(preorder, step, begin, end, thread_id, run->data);
+    else
+      pll_preorder_combine(preorder,
+                           step,
+                           begin,
+                           end,
+                           preorder->slot_clv[step->target_slot] + clv_offset,
+                           preorder->slot_scaler[step->target_slot] +
+                             scaler_offset);
+  }
+}
+
+/* executes the pre-order traversal on the threads of the partition. visit is
+   called for every visited node, by every thread for its own block of sites
+   [begin,end), in pre-order */
+PLL_EXPORT void pll_preorder_run(pll_preorder_t * preorder,
+                                 pll_preorder_visit_t visit,
+                                 void * data)
+{
+  pll_partition_t * partition = preorder->partition;
+  preorder_run_t run;
+  unsigned int i;
+
+  for (i = 0; i < preorder->steps_count; ++i)
+  {
+    const pll_preorder_step_t * step = preorder->steps + i;
+
+    if (step->ttlookup)
+      pll_core_create_lookup(partition->states,
+                             partition->rate_cats,
+                             step->ttlookup,
+                             step->left_matrix,
+                             step->right_matrix,
+                             partition->tipmap,
+                             partition->maxstates,
+                             partition->attributes);
+  }
+
+  run.preorder = preorder;
+  run.visit = visit;
+  run.data = data;
+
+  pll_thread_pool_run(partition->thread_pool, preorder_job, &run);
+}
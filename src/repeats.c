@@ -19,6 +19,8 @@
     Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
 */
 
+#include <pthread.h>
+#include <time.h>
 #include "pll.h"
 
 const unsigned int EMPTY_ELEMENT = (unsigned int) -1;
@@ -49,15 +51,222 @@ PLL_EXPORT int pll_repeats_enabled(const pll_partition_t *partition)
   return PLL_ATTRIB_SITE_REPEATS & partition->attributes;
 }
 
+/* Repeat classes of a parent are identified by the pair of class identifiers
+   of its children. The pairs are mapped to the parent identifiers with an
+   open-addressing hash table (linear probing). A parent has at most one class
+   per site, hence a table with twice as many slots as sites never fills up,
+   and its size only depends on the number of sites. If the number of possible
+   pairs does not exceed the number of slots, the table is indexed directly by
+   the pair instead. Either way, the slots that were used are reset
+   afterwards */
+
+#define EMPTY_KEY ((unsigned long long) -1)
+
+/* minimum number of sites for assigning the classes in parallel */
+#define REPEATS_PARALLEL_SITES 65536
+
+static int alloc_lookup(unsigned int sites,
+                        unsigned int ** lookup_buffer,
+                        unsigned long long ** lookup_keys,
+                        unsigned int * lookup_buffer_size)
+{
+  unsigned int i;
+  unsigned int slots = 16;
+
+  while (slots < 2 * sites)
+    slots <<= 1;
+
+  if (*lookup_buffer && slots == *lookup_buffer_size)
+    return PLL_SUCCESS;
+
+  free(*lookup_buffer);
+  free(*lookup_keys);
+  *lookup_buffer = malloc(slots * sizeof(unsigned int));
+  *lookup_keys = malloc(slots * sizeof(unsigned long long));
+  if (!*lookup_buffer || !*lookup_keys)
+  {
+    free(*lookup_buffer);
+    free(*lookup_keys);
+    *lookup_buffer = NULL;
+    *lookup_keys = NULL;
+    *lookup_buffer_size = 0;
+    return PLL_FAILURE;
+  }
+
+  *lookup_buffer_size = slots;
+  for (i = 0; i < slots; ++i)
+  {
+    (*lookup_buffer)[i] = EMPTY_ELEMENT;
+    (*lookup_keys)[i] = EMPTY_KEY;
+  }
+
+  return PLL_SUCCESS;
+}
+
+/* (re)allocates the lookup table for the number of sites of the partition. The
+   size argument is kept for compatibility with the former dense table, which
+   had to hold the product of the number of classes of both children; the hash
+   table never needs more than twice the number of sites, hence it is
+   ignored */
 PLL_EXPORT void pll_resize_repeats_lookup(pll_partition_t *partition, unsigned int size)
 {
-  if (!size)
+  pll_repeats_t * repeats = partition->repeats;
+
+  if (!alloc_lookup(partition->sites,
+                    &repeats->lookup_buffer,
+                    &repeats->lookup_keys,
+                    &repeats->lookup_buffer_size))
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg,
+             200,
+             "Unable to allocate enough memory for repeats lookup.");
+  }
+}
+
+/* Scratch workspaces. The buffers of pll_repeats_t form the workspace used
+   by the serial code. Concurrent updates of the repeats of different nodes
+   must use distinct workspaces, either created with
+   pll_repeats_workspace_create() or the per-thread workspaces of the
+   partition, see pll_repeats_thread_workspaces() */
+
+static void default_workspace(const pll_repeats_t * repeats,
+                              pll_repeats_workspace_t * ws)
+{
+  ws->lookup_buffer = repeats->lookup_buffer;
+  ws->lookup_keys = repeats->lookup_keys;
+  ws->lookup_buffer_size = repeats->lookup_buffer_size;
+  ws->toclean_buffer = repeats->toclean_buffer;
+  ws->id_site_buffer = repeats->id_site_buffer;
+  ws->bclv_buffer = repeats->bclv_buffer;
+}
+
+PLL_EXPORT pll_repeats_workspace_t * pll_repeats_workspace_create(
+                                          const pll_partition_t * partition)
+{
+  unsigned int sites_alloc = (unsigned int) partition->asc_additional_sites +
+                                            partition->sites;
+  pll_repeats_workspace_t * ws = calloc(1, sizeof(pll_repeats_workspace_t));
+
+  if (ws)
+  {
+    ws->toclean_buffer = malloc(sites_alloc * sizeof(unsigned int));
+    ws->id_site_buffer = malloc(sites_alloc * sizeof(unsigned int));
+    ws->bclv_buffer = pll_aligned_alloc(sites_alloc
+        * partition->rate_cats * partition->states_padded
+        * sizeof(double), partition->alignment);
+  }
+
+  if (!ws || !ws->toclean_buffer || !ws->id_site_buffer || !ws->bclv_buffer
+      || !alloc_lookup(partition->sites,
+                       &ws->lookup_buffer,
+                       &ws->lookup_keys,
+                       &ws->lookup_buffer_size))
+  {
+    pll_repeats_workspace_destroy(ws);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg,
+             200,
+             "Unable to allocate enough memory for repeats workspace.");
+    return NULL;
+  }
+
+  return ws;
+}
+
+PLL_EXPORT void pll_repeats_workspace_destroy(pll_repeats_workspace_t * ws)
+{
+  if (!ws)
     return;
-  partition->repeats->lookup_buffer_size = size;
-  free(partition->repeats->lookup_buffer);
-  partition->repeats->lookup_buffer = 
-    malloc(size * sizeof(unsigned int));
-  memset(partition->repeats->lookup_buffer, EMPTY_ELEMENT, partition->repeats->lookup_buffer_size * sizeof(unsigned int));
+
+  free(ws->lookup_buffer);
+  free(ws->lookup_keys);
+  free(ws->toclean_buffer);
+  free(ws->id_site_buffer);
+  pll_aligned_free(ws->bclv_buffer);
+  free(ws);
+}
+
+/* returns one workspace for each of the first threads, creating them if
+   necessary, or NULL if they cannot be allocated */
+PLL_EXPORT pll_repeats_workspace_t ** pll_repeats_thread_workspaces(
+                                          pll_partition_t * partition,
+                                          unsigned int threads)
+{
+  pll_repeats_t * repeats = partition->repeats;
+  pll_repeats_workspace_t ** workspaces;
+  unsigned int i;
+
+  if (threads <= repeats->thread_workspaces_count)
+    return repeats->thread_workspaces;
+
+  workspaces = realloc(repeats->thread_workspaces,
+                       threads * sizeof(pll_repeats_workspace_t *));
+  if (!workspaces)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg,
+             200,
+             "Unable to allocate enough memory for repeats workspace.");
+    return NULL;
+  }
+  repeats->thread_workspaces = workspaces;
+
+  for (i = repeats->thread_workspaces_count; i < threads; ++i)
+  {
+    workspaces[i] = pll_repeats_workspace_create(partition);
+    if (!workspaces[i])
+      return NULL;
+    repeats->thread_workspaces_count = i + 1;
+  }
+
+  return workspaces;
+}
+
+/* returns the slot holding key, or the empty slot where it must be inserted */
+static unsigned int lookup_slot(const pll_repeats_workspace_t * ws,
+                                unsigned long long key)
+{
+  unsigned int mask = ws->lookup_buffer_size - 1;
+  unsigned int slot = (unsigned int)((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+
+  while (ws->lookup_keys[slot] != key && ws->lookup_keys[slot] != EMPTY_KEY)
+    slot = (slot + 1) & mask;
+
+  return slot;
+}
+
+/* returns the class of key. If key is new, it is assigned the next class
+   identifier *count, with site as the representative site of the class */
+static inline unsigned int lookup_class(const pll_repeats_workspace_t * ws,
+                                        unsigned long long key,
+                                        int dense,
+                                        unsigned int site,
+                                        unsigned int * count)
+{
+  unsigned int slot = dense ? (unsigned int) key : lookup_slot(ws, key);
+
+  if (EMPTY_ELEMENT == ws->lookup_buffer[slot])
+  {
+    ws->toclean_buffer[*count] = slot;
+    ws->id_site_buffer[*count] = site;
+    ws->lookup_keys[slot] = key;
+    ws->lookup_buffer[slot] = (*count)++;
+  }
+
+  return ws->lookup_buffer[slot];
+}
+
+static void reset_lookup(const pll_repeats_workspace_t * ws,
+                         unsigned int count)
+{
+  unsigned int i;
+
+  for (i = 0; i < count; ++i)
+  {
+    ws->lookup_buffer[ws->toclean_buffer[i]] = EMPTY_ELEMENT;
+    ws->lookup_keys[ws->toclean_buffer[i]] = EMPTY_KEY;
+  }
 }
 
 PLL_EXPORT unsigned int pll_get_sites_number(const pll_partition_t * partition,
@@ -102,9 +311,7 @@ PLL_EXPORT unsigned int pll_default_enable_repeats(pll_partition_t *partition,
     unsigned int right_clv)
 {
   pll_repeats_t * repeats = partition->repeats;
-  unsigned long long min_size = (unsigned long long)repeats->pernode_ids[left_clv] 
-                          * (unsigned long long)repeats->pernode_ids[right_clv];
-  return !(!min_size || ((unsigned long long)repeats->lookup_buffer_size <= min_size)
+  return !(!repeats->pernode_ids[left_clv] || !repeats->pernode_ids[right_clv]
       || (repeats->pernode_ids[left_clv] > (partition->sites / 2))
       || (repeats->pernode_ids[right_clv] > (partition->sites / 2)));
 }
@@ -116,6 +323,486 @@ PLL_EXPORT unsigned int pll_no_enable_repeats(pll_partition_t *partition,
   return 0;
 }
 
+/* Adaptive policy. The updates of the nodes are timed (see
+   pll_repeats_adaptive_begin/end) and a cost model is fitted: an
+   uncompressed node costs cost_plain per site, a compressed node costs
+   cost_site per site (class assignment) plus cost_class per class. During
+   the first sample_updates decisions, nodes alternate between both modes;
+   afterwards, a node is compressed if its predicted cost is lower. The
+   number of classes of a node is predicted from its last compression with
+   the same children; nodes without such a record are compressed to measure
+   it. All times are accumulated, such that the model keeps following the
+   measurements */
+
+#define ADAPTIVE_NONE ((unsigned int)-1)
+
+struct pll_repeats_adaptive
+{
+  pthread_mutex_t mutex;
+  unsigned int sample_updates;
+  unsigned int sites;
+
+  unsigned int * last_sibling;  /* (left child) -> right child, or NONE */
+  double * last_ratio;          /* (left child) -> classes/sites of parent */
+
+  unsigned long decisions[2];   /* plain, repeats */
+  unsigned long samples[2];
+  double seconds[2];
+
+  /* sums of the linear fit of the per-site cost of compressed nodes over
+     their ratio */
+  double sum_r;
+  double sum_rr;
+  double sum_y;
+  double sum_ry;
+};
+
+static double adaptive_clock(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/* fits the cost model; returns 0 unless both modes have been timed */
+static int adaptive_model(const pll_repeats_adaptive_t * ad,
+                          double * cost_plain,
+                          double * cost_site,
+                          double * cost_class)
+{
+  double n = (double)ad->samples[1];
+  double det;
+
+  if (!ad->samples[0] || !ad->samples[1] || ad->sum_r <= 0)
+    return 0;
+
+  *cost_plain = ad->seconds[0] / ((double)ad->samples[0] * ad->sites);
+
+  /* least squares if the ratios are spread enough. Otherwise a class is
+     taken to cost as much as a site of an uncompressed node, and the
+     remainder is attributed to the class assignment */
+  det = n * ad->sum_rr - ad->sum_r * ad->sum_r;
+  *cost_class = *cost_plain;
+  *cost_site = PLL_MAX(0, (ad->sum_y - *cost_class * ad->sum_r) / n);
+  if (det > 1e-4 * n * n)
+  {
+    double b = (n * ad->sum_ry - ad->sum_r * ad->sum_y) / det;
+    double a = (ad->sum_y - b * ad->sum_r) / n;
+    if (a >= 0 && b >= 0)
+    {
+      *cost_site = a;
+      *cost_class = b;
+    }
+  }
+
+  return 1;
+}
+
+PLL_EXPORT int pll_repeats_set_adaptive(pll_partition_t * partition,
+                                        unsigned int sample_updates)
+{
+  unsigned int i;
+  pll_repeats_adaptive_t * ad;
+
+  if (!pll_repeats_enabled(partition))
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "Adaptive repeats require a partition created with "
+             "PLL_ATTRIB_SITE_REPEATS.");
+    return PLL_FAILURE;
+  }
+
+  pll_repeats_adaptive_destroy(partition);
+
+  ad = (pll_repeats_adaptive_t *)calloc(1, sizeof(pll_repeats_adaptive_t));
+  if (ad)
+  {
+    ad->last_sibling = (unsigned int *)malloc(partition->nodes *
+                                              sizeof(unsigned int));
+    ad->last_ratio = (double *)calloc(partition->nodes, sizeof(double));
+  }
+  if (!ad || !ad->last_sibling || !ad->last_ratio)
+  {
+    if (ad)
+    {
+      free(ad->last_sibling);
+      free(ad->last_ratio);
+      free(ad);
+    }
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return PLL_FAILURE;
+  }
+
+  for (i = 0; i < partition->nodes; ++i)
+    ad->last_sibling[i] = ADAPTIVE_NONE;
+
+  ad->sites = partition->sites;
+
+  /* by default, sample two full traversals */
+  ad->sample_updates = sample_updates ? sample_updates :
+                                        2 * partition->clv_buffers;
+
+  pthread_mutex_init(&ad->mutex, NULL);
+  partition->repeats->adaptive = ad;
+  partition->repeats->enable_repeats = pll_adaptive_enable_repeats;
+
+  return PLL_SUCCESS;
+}
+
+PLL_EXPORT void pll_repeats_adaptive_destroy(pll_partition_t * partition)
+{
+  pll_repeats_adaptive_t * ad;
+
+  if (!pll_repeats_enabled(partition) || !partition->repeats->adaptive)
+    return;
+
+  ad = partition->repeats->adaptive;
+  pthread_mutex_destroy(&ad->mutex);
+  free(ad->last_sibling);
+  free(ad->last_ratio);
+  free(ad);
+
+  partition->repeats->adaptive = NULL;
+  if (partition->repeats->enable_repeats == pll_adaptive_enable_repeats)
+    partition->repeats->enable_repeats = pll_default_enable_repeats;
+}
+
+/* enable_repeats callback of the adaptive policy, see
+   pll_repeats_set_adaptive(). Without its state, it behaves like
+   pll_default_enable_repeats() */
+PLL_EXPORT unsigned int pll_adaptive_enable_repeats(pll_partition_t *partition,
+    unsigned int left_clv,
+    unsigned int right_clv)
+{
+  pll_repeats_t * repeats = partition->repeats;
+  pll_repeats_adaptive_t * ad = repeats->adaptive;
+  unsigned int ids_left = repeats->pernode_ids[left_clv];
+  unsigned int ids_right = repeats->pernode_ids[right_clv];
+  unsigned long made;
+  unsigned int enable;
+  double cost_plain, cost_site, cost_class;
+
+  if (!ad)
+    return pll_default_enable_repeats(partition, left_clv, right_clv);
+
+  if (!ids_left || !ids_right)
+    return 0;
+
+  pthread_mutex_lock(&ad->mutex);
+
+  made = ad->decisions[0] + ad->decisions[1];
+  if (made < ad->sample_updates)
+  {
+    enable = (made % 2 == 0);
+  }
+  else if (!adaptive_model(ad, &cost_plain, &cost_site, &cost_class))
+  {
+    enable = pll_default_enable_repeats(partition, left_clv, right_clv);
+  }
+  else if (ad->last_sibling[left_clv] != right_clv)
+  {
+    enable = 1;
+  }
+  else
+  {
+    enable = cost_site + cost_class * ad->last_ratio[left_clv] < cost_plain;
+  }
+
+  ad->decisions[enable]++;
+
+  pthread_mutex_unlock(&ad->mutex);
+
+  return enable;
+}
+
+/* returns the start time of a node update, or 0 without the adaptive
+   policy */
+PLL_EXPORT double pll_repeats_adaptive_begin(const pll_partition_t * partition)
+{
+  if (!pll_repeats_enabled(partition) || !partition->repeats->adaptive)
+    return 0;
+
+  return adaptive_clock();
+}
+
+/* records the time of the update of op (class assignment and CLV) that
+   started at start */
+PLL_EXPORT void pll_repeats_adaptive_end(pll_partition_t * partition,
+                                         const pll_operation_t * op,
+                                         double start)
+{
+  pll_repeats_t * repeats;
+  pll_repeats_adaptive_t * ad;
+  unsigned int ids;
+  double seconds;
+
+  if (!pll_repeats_enabled(partition) || !partition->repeats->adaptive)
+    return;
+
+  seconds = adaptive_clock() - start;
+  repeats = partition->repeats;
+  ad = repeats->adaptive;
+  ids = repeats->pernode_ids[op->parent_clv_index];
+
+  pthread_mutex_lock(&ad->mutex);
+
+  if (ids)
+  {
+    double r = (double)ids / partition->sites;
+    double y = seconds / partition->sites;
+
+    ad->sum_r += r;
+    ad->sum_rr += r * r;
+    ad->sum_y += y;
+    ad->sum_ry += r * y;
+
+    ad->last_sibling[op->child1_clv_index] = op->child2_clv_index;
+    ad->last_ratio[op->child1_clv_index] = r;
+  }
+
+  ad->samples[ids ? 1 : 0]++;
+  ad->seconds[ids ? 1 : 0] += seconds;
+
+  pthread_mutex_unlock(&ad->mutex);
+}
+
+PLL_EXPORT int pll_repeats_adaptive_stats(const pll_partition_t * partition,
+                                      pll_repeats_adaptive_stats_t * stats)
+{
+  pll_repeats_adaptive_t * ad;
+
+  if (!pll_repeats_enabled(partition) || !partition->repeats->adaptive)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200, "Adaptive repeats are not enabled.");
+    return PLL_FAILURE;
+  }
+
+  ad = partition->repeats->adaptive;
+  memset(stats, 0, sizeof(pll_repeats_adaptive_stats_t));
+
+  pthread_mutex_lock(&ad->mutex);
+
+  stats->decisions_plain = ad->decisions[0];
+  stats->decisions_repeats = ad->decisions[1];
+  stats->samples_plain = ad->samples[0];
+  stats->samples_repeats = ad->samples[1];
+  stats->seconds_plain = ad->seconds[0];
+  stats->seconds_repeats = ad->seconds[1];
+  if (ad->samples[1])
+    stats->mean_ratio = ad->sum_r / ad->samples[1];
+  stats->calibrated = adaptive_model(ad,
+                                     &stats->cost_plain,
+                                     &stats->cost_site,
+                                     &stats->cost_class);
+  if (stats->calibrated && stats->cost_class > 0)
+    stats->break_even = PLL_MIN(1, PLL_MAX(0, (stats->cost_plain -
+                                               stats->cost_site) /
+                                              stats->cost_class));
+
+  pthread_mutex_unlock(&ad->mutex);
+
+  return PLL_SUCCESS;
+}
+
+/* Buffers of the repeat-compressed nodes. The capacity of a node (in sites)
+   grows with some headroom and only shrinks once less than a quarter of it
+   is used, such that the small changes of the number of classes during a
+   tree search do not reallocate. Buffers that are given up are kept in a
+   per-partition arena and handed out again to other nodes. The arena holds
+   at most a few blocks, and no more sites than two full CLVs, per kind */
+
+#define REPEATS_ARENA_BLOCKS 16
+
+enum { ARENA_NODE, ARENA_SCALER, ARENA_KINDS };
+
+typedef struct repeats_block
+{
+  void * buffer;          /* CLV or scaler */
+  unsigned int * id_site; /* class -> site map of a CLV */
+  unsigned int capacity;
+} repeats_block_t;
+
+struct pll_repeats_arena
+{
+  pthread_mutex_t mutex;
+  repeats_block_t blocks[ARENA_KINDS][REPEATS_ARENA_BLOCKS];
+  unsigned int count[ARENA_KINDS];
+  unsigned long pooled_sites[ARENA_KINDS];
+  unsigned int * perscale_allocated;  /* (scale) -> capacity */
+
+  /* counters, see pll_repeats_stats() */
+  unsigned long updates;
+  unsigned long declined;
+  unsigned long no_gain;
+  unsigned long kept;
+  unsigned long takes[ARENA_KINDS];
+  unsigned long allocs[ARENA_KINDS];
+  unsigned long releases;
+};
+
+static int arena_init(pll_partition_t * partition)
+{
+  pll_repeats_arena_t * arena = (pll_repeats_arena_t *)
+                                calloc(1, sizeof(pll_repeats_arena_t));
+  if (!arena)
+    return PLL_FAILURE;
+
+  arena->perscale_allocated = (unsigned int *)
+                              calloc(partition->scale_buffers,
+                                     sizeof(unsigned int));
+  if (!arena->perscale_allocated && partition->scale_buffers)
+  {
+    free(arena);
+    return PLL_FAILURE;
+  }
+
+  pthread_mutex_init(&arena->mutex, NULL);
+  partition->repeats->arena = arena;
+
+  return PLL_SUCCESS;
+}
+
+static void free_block(int kind, repeats_block_t * block)
+{
+  if (kind == ARENA_NODE)
+  {
+    pll_aligned_free(block->buffer);
+    free(block->id_site);
+  }
+  else
+    free(block->buffer);
+}
+
+PLL_EXPORT void pll_repeats_arena_destroy(pll_partition_t * partition)
+{
+  unsigned int i;
+  int kind;
+  pll_repeats_arena_t * arena = partition->repeats->arena;
+
+  if (!arena) return;
+
+  for (kind = 0; kind < ARENA_KINDS; ++kind)
+    for (i = 0; i < arena->count[kind]; ++i)
+      free_block(kind, &arena->blocks[kind][i]);
+
+  pthread_mutex_destroy(&arena->mutex);
+  free(arena->perscale_allocated);
+  free(arena);
+
+  partition->repeats->arena = NULL;
+}
+
+static int must_resize(unsigned int sites, unsigned int capacity)
+{
+  return sites > capacity || sites < capacity / 4;
+}
+
+static int alloc_block(const pll_partition_t * partition,
+                       int kind,
+                       unsigned int sites,
+                       repeats_block_t * block)
+{
+  unsigned int max_sites = partition->sites +
+                           (unsigned int) partition->asc_additional_sites;
+  unsigned int capacity = PLL_MIN(sites + sites / 4, max_sites);
+  size_t span = (kind == ARENA_NODE) ?
+                (size_t)partition->states_padded * partition->rate_cats :
+                ((partition->attributes & PLL_ATTRIB_RATE_SCALERS) ?
+                 partition->rate_cats : 1);
+
+  capacity = PLL_MAX(capacity, sites);
+  block->id_site = NULL;
+
+  if (kind == ARENA_NODE)
+  {
+    block->buffer = pll_aligned_alloc(capacity * span * sizeof(double),
+                                      partition->alignment);
+    block->id_site = (unsigned int *)malloc(capacity * sizeof(unsigned int));
+    if (!block->buffer || !block->id_site)
+    {
+      free_block(kind, block);
+      return PLL_FAILURE;
+    }
+  }
+  else
+  {
+    block->buffer = calloc(capacity * span, sizeof(unsigned int));
+    if (!block->buffer)
+      return PLL_FAILURE;
+  }
+
+  block->capacity = capacity;
+
+  return PLL_SUCCESS;
+}
+
+/* hands out the smallest pooled block that is large enough and would not
+   have to shrink right away, or allocates a new one */
+static int arena_take(pll_partition_t * partition,
+                      int kind,
+                      unsigned int sites,
+                      repeats_block_t * block)
+{
+  unsigned int i;
+  unsigned int best = EMPTY_ELEMENT;
+  pll_repeats_arena_t * arena = partition->repeats->arena;
+  repeats_block_t * blocks = arena->blocks[kind];
+
+  pthread_mutex_lock(&arena->mutex);
+  for (i = 0; i < arena->count[kind]; ++i)
+  {
+    if (must_resize(sites, blocks[i].capacity))
+      continue;
+    if (best == EMPTY_ELEMENT || blocks[i].capacity < blocks[best].capacity)
+      best = i;
+  }
+  if (best != EMPTY_ELEMENT)
+  {
+    *block = blocks[best];
+    arena->pooled_sites[kind] -= block->capacity;
+    blocks[best] = blocks[--arena->count[kind]];
+  }
+  else
+    arena->allocs[kind]++;
+  arena->takes[kind]++;
+  pthread_mutex_unlock(&arena->mutex);
+
+  if (best != EMPTY_ELEMENT)
+    return PLL_SUCCESS;
+
+  return alloc_block(partition, kind, sites, block);
+}
+
+static void arena_give(pll_partition_t * partition,
+                       int kind,
+                       repeats_block_t * block)
+{
+  int pooled = 0;
+  pll_repeats_arena_t * arena = partition->repeats->arena;
+
+  if (!block->buffer && !block->id_site)
+    return;
+
+  pthread_mutex_lock(&arena->mutex);
+  if (block->capacity && block->buffer &&
+      (kind != ARENA_NODE || block->id_site) &&
+      arena->count[kind] < REPEATS_ARENA_BLOCKS &&
+      arena->pooled_sites[kind] + block->capacity <= 2ul * partition->sites)
+  {
+    arena->blocks[kind][arena->count[kind]++] = *block;
+    arena->pooled_sites[kind] += block->capacity;
+    pooled = 1;
+  }
+  else if (block->capacity)
+    arena->releases++;
+  pthread_mutex_unlock(&arena->mutex);
+
+  if (!pooled)
+    free_block(kind, block);
+}
 
 PLL_EXPORT int pll_repeats_initialize(pll_partition_t *partition)
 {
@@ -164,8 +851,30 @@ PLL_EXPORT int pll_repeats_initialize(pll_partition_t *partition)
   repeats->perscale_ids = calloc(partition->scale_buffers, sizeof(unsigned int));
   repeats->pernode_allocated_clvs = 
     calloc(partition->nodes, sizeof(unsigned int));
+  repeats->pernode_record = calloc(partition->nodes,
+                                   sizeof(pll_repeats_record_t));
+  if (!repeats->pernode_record)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg,
+             200,
+             "Unable to allocate enough memory for repeats records.");
+    return PLL_FAILURE;
+  }
+  for (i = 0; i < partition->nodes; ++i)
+    repeats->pernode_record[i].child[0] = EMPTY_ELEMENT;
+  if (!arena_init(partition))
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg,
+             200,
+             "Unable to allocate enough memory for repeats buffers.");
+    return PLL_FAILURE;
+  }
   repeats->lookup_buffer = 0;
+  repeats->lookup_keys = 0;
   repeats->lookup_buffer_size = 0;
+  pll_resize_repeats_lookup(partition, 0);
   repeats->toclean_buffer = malloc(sites_alloc * sizeof(unsigned int));
   repeats->id_site_buffer = malloc(sites_alloc * sizeof(unsigned int));
   repeats->bclv_buffer = pll_aligned_alloc(sites_alloc 
@@ -175,7 +884,7 @@ PLL_EXPORT int pll_repeats_initialize(pll_partition_t *partition)
   if (!(repeats->pernode_ids
        && repeats->pernode_allocated_clvs && repeats->bclv_buffer
        && repeats->toclean_buffer && repeats->id_site_buffer 
-       && repeats->charmap))
+       && repeats->charmap && repeats->lookup_buffer))
   {
     pll_errno = PLL_ERROR_MEM_ALLOC;
     snprintf(pll_errmsg,
@@ -186,122 +895,448 @@ PLL_EXPORT int pll_repeats_initialize(pll_partition_t *partition)
   return PLL_SUCCESS;
 }
 
-PLL_EXPORT int pll_update_repeats_tips(pll_partition_t * partition,
-                                  unsigned int tip_index,
-                                  const pll_state_t * map,
-                                  const char * sequence)
+PLL_EXPORT int pll_update_repeats_tips(pll_partition_t * partition,
+                                  unsigned int tip_index,
+                                  const pll_state_t * map,
+                                  const char * sequence)
+{
+  unsigned int s;
+  pll_repeats_t * repeats = partition->repeats;
+  unsigned int ** id_site = repeats->pernode_id_site;
+  unsigned int additional_sites = 
+    partition->asc_bias_alloc ? partition->states : 0;
+  pll_repeats_workspace_t ws;
+
+  default_workspace(repeats, &ws);
+  repeats_fill_charmap(map, repeats->charmap);
+  repeats->pernode_ids[tip_index] = 0;
+  unsigned int curr_id = 0;
+  /* fill pernode_site_id */
+  for (s = 0; s < partition->sites; ++s) 
+  {
+    unsigned long long key = (unsigned char) repeats->charmap[(int)sequence[s]];
+    repeats->pernode_site_id[tip_index][s] = lookup_class(&ws, key, 0, s,
+                                                          &curr_id);
+  }
+  unsigned int ids = curr_id;
+  repeats->pernode_ids[tip_index] = ids;
+  repeats->pernode_record[tip_index].stamp++;
+  free(id_site[tip_index]);
+  id_site[tip_index] = malloc(sizeof(unsigned int) 
+      * (ids + additional_sites));
+  for (s = 0; s < ids; ++s) 
+    id_site[tip_index][s] = repeats->id_site_buffer[s];
+  reset_lookup(&ws, ids);
+  for (s = 0; s < additional_sites; ++s) 
+  {
+    id_site[tip_index][ids + s] = partition->sites + s;
+    repeats->pernode_site_id[tip_index][partition->sites + s] = ids + s;
+  }
+  unsigned int sizealloc = (ids + additional_sites) * partition->states_padded * 
+                          partition->rate_cats * sizeof(double);
+  free(partition->clv[tip_index]); 
+  
+  partition->clv[tip_index] = pll_aligned_alloc(sizealloc,
+                                        partition->alignment);
+  if (!partition->clv[tip_index]) 
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg,
+             200,
+             "Unable to allocate enough memory for repeats structure.");
+    return PLL_FAILURE;
+  }
+  /* zero-out CLV vectors to avoid valgrind warnings when using odd number of
+       states with vectorized code */
+   repeats->pernode_allocated_clvs[tip_index] = ids;
+  memset(partition->clv[tip_index],
+          0,
+          sizealloc);
+  return PLL_SUCCESS;
+}
+
+/* Default reallocate_repeats callback. The buffers of the parent are only
+   exchanged if the classes do not fit or use less than a quarter of them, see
+   above. May be called concurrently for different parents */
+PLL_EXPORT void pll_default_reallocate_repeats(pll_partition_t * partition,
+                              unsigned int parent,
+                              int scaler_index,
+                              unsigned int sites_to_alloc)
+{
+  pll_repeats_t * repeats = partition->repeats;
+  repeats_block_t block;
+
+  if (must_resize(sites_to_alloc, repeats->pernode_allocated_clvs[parent]))
+  {
+    block.buffer = partition->clv[parent];
+    block.id_site = repeats->pernode_id_site[parent];
+    block.capacity = repeats->pernode_allocated_clvs[parent];
+    arena_give(partition, ARENA_NODE, &block);
+
+    if (!arena_take(partition, ARENA_NODE, sites_to_alloc, &block))
+    {
+      partition->clv[parent] = NULL;
+      repeats->pernode_id_site[parent] = NULL;
+      repeats->pernode_allocated_clvs[parent] = 0;
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg,
+               200,
+               "Unable to allocate enough memory for repeats structure.");
+      return;
+    }
+    partition->clv[parent] = (double *)block.buffer;
+    repeats->pernode_id_site[parent] = block.id_site;
+    repeats->pernode_allocated_clvs[parent] = block.capacity;
+  }
+
+  if (PLL_SCALE_BUFFER_NONE != scaler_index)
+  {
+    unsigned int * capacity = repeats->arena->perscale_allocated + scaler_index;
+    if (must_resize(sites_to_alloc, *capacity))
+    {
+      block.buffer = partition->scale_buffer[scaler_index];
+      block.id_site = NULL;
+      block.capacity = *capacity;
+      arena_give(partition, ARENA_SCALER, &block);
+
+      if (!arena_take(partition, ARENA_SCALER, sites_to_alloc, &block))
+      {
+        partition->scale_buffer[scaler_index] = NULL;
+        *capacity = 0;
+        pll_errno = PLL_ERROR_MEM_ALLOC;
+        snprintf(pll_errmsg,
+                 200,
+                 "Unable to allocate enough memory for repeats structure.");
+        return;
+      }
+      partition->scale_buffer[scaler_index] = (unsigned int *)block.buffer;
+      *capacity = block.capacity;
+    }
+  }
+}
+
+static size_t clv_bytes(const pll_partition_t * partition, size_t sites)
+{
+  return sites * (partition->states_padded * partition->rate_cats *
+                  sizeof(double) + sizeof(unsigned int));
+}
+
+static size_t scaler_bytes(const pll_partition_t * partition, size_t sites)
+{
+  size_t span = (partition->attributes & PLL_ATTRIB_RATE_SCALERS) ?
+                partition->rate_cats : 1;
+
+  return sites * span * sizeof(unsigned int);
+}
+
+PLL_EXPORT int pll_repeats_node_stats(const pll_partition_t * partition,
+                                      unsigned int clv_index,
+                                      pll_repeats_node_stats_t * stats)
+{
+  const pll_repeats_t * repeats = partition->repeats;
+
+  if (!pll_repeats_enabled(partition))
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200, "Site repeats are not enabled.");
+    return PLL_FAILURE;
+  }
+
+  if (clv_index >= partition->nodes)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200, "Invalid CLV index %u.", clv_index);
+    return PLL_FAILURE;
+  }
+
+  memset(stats, 0, sizeof(pll_repeats_node_stats_t));
+  stats->classes = repeats->pernode_ids[clv_index];
+  stats->sites = pll_get_sites_number(partition, clv_index);
+  stats->updates = repeats->pernode_record[clv_index].stamp;
+
+  /* the buffers of the tips are allocated to fit their classes, see
+     pll_update_repeats_tips() */
+  if (clv_index < partition->tips)
+    stats->capacity = stats->sites;
+  else
+    stats->capacity = repeats->pernode_allocated_clvs[clv_index];
+  stats->bytes = clv_bytes(partition, stats->capacity);
+
+  return PLL_SUCCESS;
+}
+
+PLL_EXPORT int pll_repeats_stats(const pll_partition_t * partition,
+                                 pll_repeats_stats_t * stats)
 {
-  if (!partition->repeats->lookup_buffer)
-    pll_resize_repeats_lookup(partition, PLL_REPEATS_LOOKUP_SIZE);
-   
-  unsigned int s;
-  pll_repeats_t * repeats = partition->repeats;
-  unsigned int ** id_site = repeats->pernode_id_site;
-  unsigned int additional_sites = 
-    partition->asc_bias_alloc ? partition->states : 0;
+  unsigned int i;
+  unsigned int full_sites;
+  double sum_ratio = 0;
+  double sum_tip_ratio = 0;
+  pll_repeats_node_stats_t node;
+  pll_repeats_arena_t * arena;
 
-  repeats_fill_charmap(map, repeats->charmap);
-  repeats->pernode_ids[tip_index] = 0;
-  unsigned int curr_id = 0;
-  /* fill pernode_site_id */
-  for (s = 0; s < partition->sites; ++s) 
+  if (!pll_repeats_enabled(partition))
   {
-    unsigned int index_lookup = (unsigned int) repeats->charmap[(int)sequence[s]];
-    if (EMPTY_ELEMENT == repeats->lookup_buffer[index_lookup]) 
-    {
-      repeats->toclean_buffer[curr_id] = index_lookup;
-      repeats->id_site_buffer[curr_id] = s;
-      repeats->lookup_buffer[index_lookup] = curr_id++;
-    }
-    repeats->pernode_site_id[tip_index][s] = repeats->lookup_buffer[index_lookup];
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200, "Site repeats are not enabled.");
+    return PLL_FAILURE;
   }
-  unsigned int ids = curr_id;
-  repeats->pernode_ids[tip_index] = ids;
-  free(id_site[tip_index]);
-  id_site[tip_index] = malloc(sizeof(unsigned int) 
-      * (ids + additional_sites));
-  for (s = 0; s < ids; ++s) 
+
+  arena = partition->repeats->arena;
+  full_sites = partition->sites + (partition->asc_bias_alloc ?
+                                   partition->states : 0);
+  memset(stats, 0, sizeof(pll_repeats_stats_t));
+
+  for (i = 0; i < partition->nodes; ++i)
   {
-    id_site[tip_index][s] = repeats->id_site_buffer[s];
-    repeats->lookup_buffer[repeats->toclean_buffer[s]] = EMPTY_ELEMENT;
+    pll_repeats_node_stats(partition, i, &node);
+
+    if (i < partition->tips)
+    {
+      sum_tip_ratio += (node.classes ? node.classes : partition->sites) /
+                       (double)partition->sites;
+      continue;
+    }
+
+    stats->clv_bytes += node.bytes;
+    if (!node.updates)
+      continue;
+
+    stats->nodes++;
+    if (node.classes)
+    {
+      stats->compressed++;
+      stats->max_classes = PLL_MAX(stats->max_classes, node.classes);
+      sum_ratio += node.classes / (double)partition->sites;
+    }
   }
-  for (s = 0; s < additional_sites; ++s) 
+
+  if (stats->compressed)
+    stats->mean_ratio = sum_ratio / stats->compressed;
+  stats->tip_ratio = sum_tip_ratio / partition->tips;
+
+  for (i = 0; i < partition->scale_buffers; ++i)
+    stats->scaler_bytes += scaler_bytes(partition,
+                                        arena->perscale_allocated[i]);
+
+  /* inner CLVs (without class -> site maps) and scalers of a partition
+     created without site repeats */
+  stats->plain_bytes = partition->clv_buffers *
+                       (clv_bytes(partition, full_sites) -
+                        full_sites * sizeof(unsigned int)) +
+                       partition->scale_buffers *
+                       scaler_bytes(partition, full_sites);
+
+  stats->lookup_size = partition->repeats->lookup_buffer_size;
+
+  pthread_mutex_lock(&arena->mutex);
+  stats->pooled_bytes = clv_bytes(partition, arena->pooled_sites[ARENA_NODE]) +
+                        scaler_bytes(partition,
+                                     arena->pooled_sites[ARENA_SCALER]);
+  stats->updates = arena->updates;
+  stats->declined = arena->declined;
+  stats->no_gain = arena->no_gain;
+  stats->kept = arena->kept;
+  stats->clv_reallocs = arena->takes[ARENA_NODE];
+  stats->clv_allocs = arena->allocs[ARENA_NODE];
+  stats->scaler_reallocs = arena->takes[ARENA_SCALER];
+  stats->scaler_allocs = arena->allocs[ARENA_SCALER];
+  stats->releases = arena->releases;
+  pthread_mutex_unlock(&arena->mutex);
+
+  return PLL_SUCCESS;
+}
+
+PLL_EXPORT void pll_repeats_reset_stats(pll_partition_t * partition)
+{
+  pll_repeats_arena_t * arena;
+
+  if (!pll_repeats_enabled(partition))
+    return;
+
+  arena = partition->repeats->arena;
+
+  pthread_mutex_lock(&arena->mutex);
+  arena->updates = 0;
+  arena->declined = 0;
+  arena->no_gain = 0;
+  arena->kept = 0;
+  memset(arena->takes, 0, sizeof(arena->takes));
+  memset(arena->allocs, 0, sizeof(arena->allocs));
+  arena->releases = 0;
+  pthread_mutex_unlock(&arena->mutex);
+}
+
+/* assigns the parent classes for sites [begin,end) and returns their number.
+   The classes are numbered by first occurrence within the range */
+static unsigned int assign_classes(const pll_repeats_workspace_t * ws,
+                                   const unsigned int * site_id_left,
+                                   const unsigned int * site_id_right,
+                                   unsigned int ids_left,
+                                   unsigned int ids_right,
+                                   unsigned int begin,
+                                   unsigned int end,
+                                   unsigned int * site_id_parent)
+{
+  unsigned int s;
+  unsigned int count = 0;
+
+  if ((unsigned long long) ids_left * ids_right <= ws->lookup_buffer_size)
   {
-    id_site[tip_index][ids + s] = partition->sites + s;
-    repeats->pernode_site_id[tip_index][partition->sites + s] = ids + s;
+    for (s = begin; s < end; ++s)
+      site_id_parent[s] = lookup_class(ws,
+                                       site_id_left[s] +
+                                         site_id_right[s] * ids_left,
+                                       1,
+                                       s,
+                                       &count);
   }
-  unsigned int sizealloc = (ids + additional_sites) * partition->states_padded * 
-                          partition->rate_cats * sizeof(double);
-  free(partition->clv[tip_index]); 
-  
-  partition->clv[tip_index] = pll_aligned_alloc(sizealloc,
-                                        partition->alignment);
-  if (!partition->clv[tip_index]) 
+  else
   {
-    pll_errno = PLL_ERROR_MEM_ALLOC;
-    snprintf(pll_errmsg,
-             200,
-             "Unable to allocate enough memory for repeats structure.");
-    return PLL_FAILURE;
+    for (s = begin; s < end; ++s)
+      site_id_parent[s] = lookup_class(ws,
+                                       site_id_left[s] +
+                                         (unsigned long long) site_id_right[s] *
+                                         ids_left,
+                                       0,
+                                       s,
+                                       &count);
   }
-  /* zero-out CLV vectors to avoid valgrind warnings when using odd number of
-       states with vectorized code */
-   repeats->pernode_allocated_clvs[tip_index] = ids;
-  memset(partition->clv[tip_index],
-          0,
-          sizealloc);
-  return PLL_SUCCESS;
+
+  return count;
 }
 
-PLL_EXPORT void pll_default_reallocate_repeats(pll_partition_t * partition,
-                              unsigned int parent,
-                              int scaler_index,
-                              unsigned int sites_to_alloc)
+/* Parallel class assignment. Every thread assigns classes to its block of
+   sites with its own workspace. The classes of the blocks are then merged
+   in order, which yields the same identifiers as the serial loop, and the
+   threads translate their sites to the merged identifiers */
+
+typedef struct repeats_job_s
 {
-  pll_repeats_t * repeats = partition->repeats;
-  if (sites_to_alloc == repeats->pernode_allocated_clvs[parent]) 
-    return;
-  repeats->pernode_allocated_clvs[parent] = sites_to_alloc; 
-  unsigned int ** id_site = repeats->pernode_id_site;
-  // reallocate clvs
-  pll_aligned_free(partition->clv[parent]);  
-  partition->clv[parent] = pll_aligned_alloc(
-      sites_to_alloc * partition->states_padded 
-      * partition->rate_cats * sizeof(double), 
-      partition->alignment);
-  
-  if (!partition->clv[parent]) 
+  pll_repeats_workspace_t ** workspaces;
+  unsigned int * counts;
+  const unsigned int * site_id_left;
+  const unsigned int * site_id_right;
+  unsigned int ids_left;
+  unsigned int ids_right;
+  unsigned int sites;
+  unsigned int * site_id_parent;
+} repeats_job_t;
+
+static void classes_job(void * data,
+                        unsigned int thread_id,
+                        unsigned int thread_count)
+{
+  repeats_job_t * job = (repeats_job_t *)data;
+  const pll_repeats_workspace_t * ws = job->workspaces[thread_id];
+  unsigned int begin, end;
+
+  pll_thread_site_range(job->sites, thread_id, thread_count, &begin, &end);
+
+  job->counts[thread_id] = assign_classes(ws,
+                                          job->site_id_left,
+                                          job->site_id_right,
+                                          job->ids_left,
+                                          job->ids_right,
+                                          begin,
+                                          end,
+                                          job->site_id_parent);
+
+  /* the representative sites suffice for the merge */
+  reset_lookup(ws, job->counts[thread_id]);
+}
+
+static void translate_job(void * data,
+                          unsigned int thread_id,
+                          unsigned int thread_count)
+{
+  repeats_job_t * job = (repeats_job_t *)data;
+  const unsigned int * merged = job->workspaces[thread_id]->toclean_buffer;
+  unsigned int begin, end, s;
+
+  pll_thread_site_range(job->sites, thread_id, thread_count, &begin, &end);
+
+  for (s = begin; s < end; ++s)
+    job->site_id_parent[s] = merged[job->site_id_parent[s]];
+}
+
+/* returns the number of classes, or EMPTY_ELEMENT if the thread workspaces
+   cannot be allocated */
+static unsigned int assign_classes_parallel(pll_partition_t * partition,
+                                            const pll_repeats_workspace_t * ws,
+                                            const unsigned int * site_id_left,
+                                            const unsigned int * site_id_right,
+                                            unsigned int ids_left,
+                                            unsigned int ids_right,
+                                            unsigned int * site_id_parent)
+{
+  unsigned int threads = pll_thread_pool_size(partition->thread_pool);
+  unsigned int t, i;
+  unsigned int count = 0;
+  int dense = (unsigned long long) ids_left * ids_right <=
+              ws->lookup_buffer_size;
+  repeats_job_t job;
+
+  job.workspaces = pll_repeats_thread_workspaces(partition, threads);
+  job.counts = (unsigned int *)malloc(threads * sizeof(unsigned int));
+  if (!job.workspaces || !job.counts)
   {
-    pll_errno = PLL_ERROR_MEM_ALLOC;
-    snprintf(pll_errmsg,
-             200,
-             "Unable to allocate enough memory for repeats structure.");
-    return;
+    free(job.counts);
+    return EMPTY_ELEMENT;
   }
-  // reallocate scales
-  if (PLL_SCALE_BUFFER_NONE != scaler_index) 
+
+  job.site_id_left = site_id_left;
+  job.site_id_right = site_id_right;
+  job.ids_left = ids_left;
+  job.ids_right = ids_right;
+  job.sites = partition->sites;
+  job.site_id_parent = site_id_parent;
+
+  pll_thread_pool_run(partition->thread_pool, classes_job, &job);
+
+  /* merge the classes of the blocks; the merged identifiers replace the
+     (no longer needed) slots in the thread workspaces */
+  for (t = 0; t < threads; ++t)
   {
-    unsigned int scaler_size = sites_to_alloc;
-    if (partition->attributes & PLL_ATTRIB_RATE_SCALERS) 
-      scaler_size *= partition->rate_cats;
-    free(partition->scale_buffer[scaler_index]);
-    partition->scale_buffer[scaler_index] = calloc(scaler_size, 
-        sizeof(unsigned int));
+    const pll_repeats_workspace_t * tws = job.workspaces[t];
+    for (i = 0; i < job.counts[t]; ++i)
+    {
+      unsigned int s = tws->id_site_buffer[i];
+      tws->toclean_buffer[i] = lookup_class(ws,
+                                            site_id_left[s] +
+                                              (unsigned long long)
+                                              site_id_right[s] * ids_left,
+                                            dense,
+                                            s,
+                                            &count);
+    }
   }
-  // reallocate id to site lookup  
-  free(id_site[parent]);
-  id_site[parent] = malloc(sites_to_alloc * sizeof(unsigned int));
-  // avoid valgrind errors
-  memset(partition->clv[parent], 0, sites_to_alloc);
+
+  pll_thread_pool_run(partition->thread_pool, translate_job, &job);
+
+  free(job.counts);
+
+  return count;
 }
 
-/* Fill the repeat structure in partition for the parent node of op */
-PLL_EXPORT void pll_update_repeats(pll_partition_t * partition,
-                    const pll_operation_t * op) 
+static void count_update(pll_repeats_t * repeats, int declined, int no_gain)
+{
+  pll_repeats_arena_t * arena = repeats->arena;
+
+  pthread_mutex_lock(&arena->mutex);
+  arena->updates++;
+  if (declined)
+    arena->declined++;
+  else if (no_gain)
+    arena->no_gain++;
+  pthread_mutex_unlock(&arena->mutex);
+}
+
+static void update_repeats(pll_partition_t * partition,
+                           const pll_operation_t * op,
+                           const pll_repeats_workspace_t * ws,
+                           int parallel)
 {
-  if (!partition->repeats->lookup_buffer)
-    pll_resize_repeats_lookup(partition, PLL_REPEATS_LOOKUP_SIZE);
-  
   pll_repeats_t * repeats = partition->repeats;
   unsigned int left = op->child1_clv_index;
   unsigned int right = op->child2_clv_index;
@@ -311,18 +1346,19 @@ PLL_EXPORT void pll_update_repeats(pll_partition_t * partition,
   const unsigned int * site_id_left = site_ids[left];
   const unsigned int * site_id_right = site_ids[right];
   const unsigned int ids_left = repeats->pernode_ids[left];
+  const unsigned int ids_right = repeats->pernode_ids[right];
   unsigned int ** id_site = repeats->pernode_id_site;
-  unsigned int * toclean_buffer = repeats->toclean_buffer;
-  unsigned int * id_site_buffer = repeats->id_site_buffer;
-  unsigned int curr_id = 0;
   unsigned int additional_sites = partition->asc_bias_alloc ?
     partition->states : 0;
   unsigned int sites_to_alloc;
   unsigned int s;
   unsigned int ids = 0;
+  int declined = 0;
+  pll_repeats_record_t * record;
   // in case site repeats is activated but not used for this node
   if (!partition->repeats->enable_repeats(partition, left, right))
   {
+    declined = 1;
     sites_to_alloc = partition->sites + additional_sites;
     repeats->pernode_ids[parent] = 0;
     if (op->parent_scaler_index != PLL_SCALE_BUFFER_NONE)
@@ -331,21 +1367,24 @@ PLL_EXPORT void pll_update_repeats(pll_partition_t * partition,
   else
   {
     // fill the parent repeats identifiers
-    for (s = 0; s < partition->sites; ++s) 
-    {
-      unsigned int index_lookup = site_id_left[s] +
-        site_id_right[s] * ids_left;
-      unsigned int id = repeats->lookup_buffer[index_lookup];
-      if (EMPTY_ELEMENT == id) 
-      {
-        toclean_buffer[curr_id] = index_lookup;
-        id_site_buffer[curr_id] = s;
-        id = curr_id;
-        repeats->lookup_buffer[index_lookup] = curr_id++;
-      }
-      site_id_parent[s] = id;
-    }
-    ids = curr_id;
+    ids = EMPTY_ELEMENT;
+    if (parallel)
+      ids = assign_classes_parallel(partition,
+                                    ws,
+                                    site_id_left,
+                                    site_id_right,
+                                    ids_left,
+                                    ids_right,
+                                    site_id_parent);
+    if (ids == EMPTY_ELEMENT)
+      ids = assign_classes(ws,
+                           site_id_left,
+                           site_id_right,
+                           ids_left,
+                           ids_right,
+                           0,
+                           partition->sites,
+                           site_id_parent);
     for (s = 0; s < additional_sites; ++s) 
     {
       site_id_parent[s + partition->sites] = ids + s;
@@ -369,16 +1408,151 @@ PLL_EXPORT void pll_update_repeats(pll_partition_t * partition,
       repeats->perscale_ids[op->parent_scaler_index] = 0;
   }
 
+  count_update(repeats,
+               declined,
+               sites_to_alloc >= partition->sites + additional_sites);
+
   // set id to site lookups
   for (s = 0; s < ids; ++s) 
   {
-    id_site[parent][s] = id_site_buffer[s];
-    repeats->lookup_buffer[toclean_buffer[s]] = EMPTY_ELEMENT;
+    id_site[parent][s] = ws->id_site_buffer[s];
   }
+  reset_lookup(ws, ids);
   for (s = 0; s < additional_sites; ++s) 
   {
     id_site[parent][s + ids] = partition->sites + s;
   }
+
+  record = repeats->pernode_record + parent;
+  record->stamp++;
+  record->child[0] = left;
+  record->child[1] = right;
+  record->child_stamp[0] = repeats->pernode_record[left].stamp;
+  record->child_stamp[1] = repeats->pernode_record[right].stamp;
+  record->scaler_index = op->parent_scaler_index;
+}
+
+/* true if the classes of the parent of op were computed from the current
+   classes of its children. The classes of a node only depend on the set of
+   tips below it, hence the order of the children does not matter */
+static int record_current(const pll_repeats_t * repeats,
+                          const pll_operation_t * op)
+{
+  const pll_repeats_record_t * record =
+    repeats->pernode_record + op->parent_clv_index;
+  unsigned int left = op->child1_clv_index;
+  unsigned int right = op->child2_clv_index;
+  unsigned long left_stamp = repeats->pernode_record[left].stamp;
+  unsigned long right_stamp = repeats->pernode_record[right].stamp;
+
+  if (record->scaler_index != op->parent_scaler_index)
+    return 0;
+
+  if (record->child[0] == left && record->child[1] == right)
+    return record->child_stamp[0] == left_stamp &&
+           record->child_stamp[1] == right_stamp;
+
+  if (record->child[0] == right && record->child[1] == left)
+    return record->child_stamp[0] == right_stamp &&
+           record->child_stamp[1] == left_stamp;
+
+  return 0;
+}
+
+/* Fill the repeat structure in partition for the parent node of op. With a
+   thread pool, the classes of long partitions are assigned in parallel */
+PLL_EXPORT void pll_update_repeats(pll_partition_t * partition,
+                    const pll_operation_t * op) 
+{
+  pll_repeats_workspace_t ws;
+
+  default_workspace(partition->repeats, &ws);
+  update_repeats(partition,
+                 op,
+                 &ws,
+                 partition->thread_pool &&
+                   pll_thread_pool_size(partition->thread_pool) > 1 &&
+                   partition->sites >= REPEATS_PARALLEL_SITES);
+}
+
+/* Incremental update of the repeats after a change of the tree, e.g. a
+   topology move (see pll_utree_rb_clv_indices()). The operations must be in
+   post-order. The classes of the parent of an operation are only recomputed
+   if it is listed in dirty_clvs, or if its children or their classes
+   changed since its last update; all other nodes keep their classes. The
+   CLVs can then be updated with pll_update_partials_rep() without updating
+   the repeats. Returns the number of nodes whose classes were updated */
+PLL_EXPORT unsigned int pll_update_repeats_incremental(pll_partition_t * partition,
+                                          const pll_operation_t * operations,
+                                          unsigned int count,
+                                          const unsigned int * dirty_clvs,
+                                          unsigned int dirty_count)
+{
+  unsigned int i;
+  unsigned int updated = 0;
+  pll_repeats_t * repeats = partition->repeats;
+
+  if (!pll_repeats_enabled(partition))
+    return 0;
+
+  for (i = 0; i < dirty_count; ++i)
+    if (dirty_clvs[i] >= partition->tips && dirty_clvs[i] < partition->nodes)
+      repeats->pernode_record[dirty_clvs[i]].child[0] = EMPTY_ELEMENT;
+
+  for (i = 0; i < count; ++i)
+  {
+    if (record_current(repeats, operations + i))
+      continue;
+
+    pll_update_repeats(partition, operations + i);
+    updated++;
+  }
+
+  pthread_mutex_lock(&repeats->arena->mutex);
+  repeats->arena->kept += count - updated;
+  pthread_mutex_unlock(&repeats->arena->mutex);
+
+  return updated;
+}
+
+/* same as pll_update_repeats() with the scratch buffers of ws, such that the
+   repeats of nodes that do not depend on each other can be updated
+   concurrently */
+PLL_EXPORT void pll_update_repeats_workspace(pll_partition_t * partition,
+                                             const pll_operation_t * op,
+                                             const pll_repeats_workspace_t * ws)
+{
+  update_repeats(partition, op, ws, 0);
+}
+
+/* assigns the classes of the sites of the pair of CLVs clv1 and clv2, as for
+   a node with these children, e.g. to combine the CLVs at the two ends of an
+   edge. Fills site_id (site -> class) and id_site (class -> first site),
+   both of size partition->sites, and returns the number of classes. Both
+   CLVs must be compressed */
+PLL_EXPORT unsigned int pll_repeats_pair_classes(pll_partition_t * partition,
+                                                 unsigned int clv1,
+                                                 unsigned int clv2,
+                                                 unsigned int * site_id,
+                                                 unsigned int * id_site)
+{
+  pll_repeats_t * repeats = partition->repeats;
+  pll_repeats_workspace_t ws;
+  unsigned int ids;
+
+  default_workspace(repeats, &ws);
+  ids = assign_classes(&ws,
+                       repeats->pernode_site_id[clv1],
+                       repeats->pernode_site_id[clv2],
+                       repeats->pernode_ids[clv1],
+                       repeats->pernode_ids[clv2],
+                       0,
+                       partition->sites,
+                       site_id);
+  memcpy(id_site, ws.id_site_buffer, ids * sizeof(unsigned int));
+  reset_lookup(&ws, ids);
+
+  return ids;
 }
 
 PLL_EXPORT void pll_disable_bclv(pll_partition_t *partition)
@@ -539,3 +1713,253 @@ PLL_EXPORT void pll_fill_parent_scaler_repeats_per_rate(unsigned int sites,
   }
 }
 
+/* Site reordering. The sites are sorted lexicographically by the classes of
+   the tips (a stable radix sort over the tips, last tip first), such that
+   the sites of a class of a node are mostly adjacent and the kernels gather
+   the CLV entries of the children in nearly sequential order. The order of
+   the tips should follow the tree, e.g. the tips of a traversal. Internally,
+   all per-site arrays are kept in the new order; repeats->site_order maps
+   each site to the site of the original alignment, and the per-site inputs
+   and outputs of the API are translated */
+
+/* stable counting sort of order by key[order[i]] */
+static void sort_sites(unsigned int sites,
+                       const unsigned int * key,
+                       unsigned int keys,
+                       unsigned int * order,
+                       unsigned int * temp,
+                       unsigned int * count)
+{
+  unsigned int i;
+
+  memset(count, 0, (keys + 1) * sizeof(unsigned int));
+  for (i = 0; i < sites; ++i)
+    count[key[order[i]] + 1]++;
+  for (i = 0; i < keys; ++i)
+    count[i + 1] += count[i];
+  for (i = 0; i < sites; ++i)
+    temp[count[key[order[i]]]++] = order[i];
+
+  memcpy(order, temp, sites * sizeof(unsigned int));
+}
+
+/* permutes the classes of a tip to the new order of the sites, such that
+   the classes are numbered by their first site again */
+static int reorder_tip(pll_partition_t * partition,
+                       unsigned int tip,
+                       const unsigned int * perm,
+                       unsigned int * new_id)
+{
+  pll_repeats_t * repeats = partition->repeats;
+  unsigned int * site_id = repeats->pernode_site_id[tip];
+  unsigned int * id_site = repeats->pernode_id_site[tip];
+  unsigned int ids = repeats->pernode_ids[tip];
+  unsigned int sites = partition->sites;
+  unsigned int additional_sites = partition->asc_bias_alloc ?
+                                  partition->states : 0;
+  size_t span = (size_t)partition->states_padded * partition->rate_cats;
+  unsigned int * temp;
+  unsigned int i, count = 0;
+  double * clv;
+
+  temp = (unsigned int *)malloc(sites * sizeof(unsigned int));
+  clv = (double *)pll_aligned_alloc((ids + additional_sites) * span *
+                                    sizeof(double),
+                                    partition->alignment);
+  if (!temp || !clv)
+  {
+    free(temp);
+    pll_aligned_free(clv);
+    return PLL_FAILURE;
+  }
+
+  for (i = 0; i < ids; ++i)
+    new_id[i] = EMPTY_ELEMENT;
+
+  for (i = 0; i < sites; ++i)
+  {
+    unsigned int old = site_id[perm[i]];
+    if (new_id[old] == EMPTY_ELEMENT)
+    {
+      new_id[old] = count;
+      id_site[count] = i;
+      memcpy(clv + count * span,
+             partition->clv[tip] + old * span,
+             span * sizeof(double));
+      count++;
+    }
+    temp[i] = new_id[old];
+  }
+
+  /* the sites of the ascertainment bias correction remain at the end */
+  memcpy(clv + ids * span,
+         partition->clv[tip] + ids * span,
+         additional_sites * span * sizeof(double));
+
+  memcpy(site_id, temp, sites * sizeof(unsigned int));
+  pll_aligned_free(partition->clv[tip]);
+  partition->clv[tip] = clv;
+  repeats->pernode_record[tip].stamp++;
+
+  free(temp);
+  return PLL_SUCCESS;
+}
+
+/* reorders the sites of the partition by the classes of the tips in
+   tip_order (all tips if NULL). Must be called after the states of all tips
+   are set; the CLVs of the inner nodes must be recomputed afterwards */
+PLL_EXPORT int pll_repeats_reorder_sites(pll_partition_t * partition,
+                                         const unsigned int * tip_order,
+                                         unsigned int count)
+{
+  pll_repeats_t * repeats = partition->repeats;
+  unsigned int sites = partition->sites;
+  unsigned int * perm = NULL;
+  unsigned int * temp = NULL;
+  unsigned int * buffer = NULL;
+  unsigned int i, t;
+  int retval = PLL_FAILURE;
+
+  if (!pll_repeats_enabled(partition))
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200,
+             "Site reordering requires a partition created with "
+             "PLL_ATTRIB_SITE_REPEATS.");
+    return PLL_FAILURE;
+  }
+
+  if (!tip_order)
+    count = partition->tips;
+
+  for (t = 0; t < count; ++t)
+  {
+    if (count > partition->tips || (tip_order && tip_order[t] >= partition->tips))
+    {
+      pll_errno = PLL_ERROR_PARAM_INVALID;
+      snprintf(pll_errmsg, 200, "Invalid tip order.");
+      return PLL_FAILURE;
+    }
+  }
+
+  for (t = 0; t < partition->tips; ++t)
+  {
+    if (!repeats->pernode_ids[t])
+    {
+      pll_errno = PLL_ERROR_PARAM_INVALID;
+      snprintf(pll_errmsg, 200,
+               "The states of all tips must be set before reordering.");
+      return PLL_FAILURE;
+    }
+  }
+
+  perm = (unsigned int *)malloc(sites * sizeof(unsigned int));
+  temp = (unsigned int *)malloc(sites * sizeof(unsigned int));
+  buffer = (unsigned int *)malloc((sites + 1) * sizeof(unsigned int));
+  if (!repeats->site_order)
+  {
+    repeats->site_order = (unsigned int *)malloc(sites * sizeof(unsigned int));
+    if (repeats->site_order)
+      for (i = 0; i < sites; ++i)
+        repeats->site_order[i] = i;
+  }
+  if (!perm || !temp || !buffer || !repeats->site_order)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    goto cleanup;
+  }
+
+  /* new site i is the old site perm[i] */
+  for (i = 0; i < sites; ++i)
+    perm[i] = i;
+  for (t = count; t > 0; --t)
+  {
+    unsigned int tip = tip_order ? tip_order[t-1] : t-1;
+    sort_sites(sites,
+               repeats->pernode_site_id[tip],
+               repeats->pernode_ids[tip],
+               perm,
+               temp,
+               buffer);
+  }
+
+  for (t = 0; t < partition->tips; ++t)
+  {
+    if (!reorder_tip(partition, t, perm, buffer))
+    {
+      pll_errno = PLL_ERROR_MEM_ALLOC;
+      snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+      goto cleanup;
+    }
+  }
+
+  /* per-site arrays */
+  for (i = 0; i < sites; ++i)
+    temp[i] = partition->pattern_weights[perm[i]];
+  memcpy(partition->pattern_weights, temp, sites * sizeof(unsigned int));
+
+  if (partition->invariant)
+  {
+    int * invariant = (int *)temp;
+    for (i = 0; i < sites; ++i)
+      invariant[i] = partition->invariant[perm[i]];
+    memcpy(partition->invariant, invariant, sites * sizeof(int));
+  }
+
+  if (partition->tipchars)
+  {
+    unsigned char * chars = (unsigned char *)temp;
+    for (t = 0; t < partition->tips; ++t)
+    {
+      for (i = 0; i < sites; ++i)
+        chars[i] = partition->tipchars[t][perm[i]];
+      memcpy(partition->tipchars[t], chars, sites);
+    }
+  }
+
+  for (i = 0; i < sites; ++i)
+    temp[i] = repeats->site_order[perm[i]];
+  memcpy(repeats->site_order, temp, sites * sizeof(unsigned int));
+
+  retval = PLL_SUCCESS;
+
+cleanup:
+  free(perm);
+  free(temp);
+  free(buffer);
+  return retval;
+}
+
+/* moves per-site values (width values per site), computed in the site order
+   of the partition, to the original order of the sites */
+PLL_EXPORT int pll_repeats_restore_site_order(const pll_partition_t * partition,
+                                              double * values,
+                                              unsigned int width)
+{
+  unsigned int i;
+  unsigned int sites = partition->sites;
+  const unsigned int * site_order;
+  double * temp;
+
+  if (!pll_repeats_enabled(partition) || !partition->repeats->site_order)
+    return PLL_SUCCESS;
+
+  site_order = partition->repeats->site_order;
+  temp = (double *)malloc((size_t)sites * width * sizeof(double));
+  if (!temp)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    return PLL_FAILURE;
+  }
+
+  memcpy(temp, values, (size_t)sites * width * sizeof(double));
+  for (i = 0; i < sites; ++i)
+    memcpy(values + (size_t)site_order[i] * width,
+           temp + (size_t)i * width,
+           width * sizeof(double));
+
+  free(temp);
+  return PLL_SUCCESS;
+}
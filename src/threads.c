@@ -0,0 +1,251 @@
+/*
+    Copyright (C) 2015-2020 Tomas Flouri, Diego Darriba, Alexey Kozlov
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <Tomas.Flouri@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+#include <pthread.h>
+#include "pll.h"
+
+/* Persistent pool of worker threads. The calling thread acts as worker 0,
+   hence a pool of n threads spawns n-1 additional threads which sleep on a
+   condition variable between jobs. A job is started by bumping the
+   generation counter and completes once all workers have checked in, i.e.
+   there is exactly one synchronization point per job. */
+
+struct pll_thread_pool
+{
+  unsigned int count;
+  pthread_t * workers;
+  struct pll_thread_arg * args;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t cond_start;
+  pthread_cond_t cond_done;
+
+  unsigned long generation;
+  unsigned int pending;
+  int terminate;
+
+  /* current job */
+  pll_thread_job_t job;
+  void * data;
+
+  /* hardware flags of the calling thread, since pll_hardware is thread-local
+     and workers must dispatch to the same kernels */
+  pll_hardware_t hardware;
+};
+
+struct pll_thread_arg
+{
+  pll_thread_pool_t * pool;
+  unsigned int thread_id;
+};
+
+static void * worker_main(void * arg)
+{
+  struct pll_thread_arg * targ = (struct pll_thread_arg *)arg;
+  pll_thread_pool_t * pool = targ->pool;
+  unsigned long seen = 0;
+
+  while (1)
+  {
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->generation == seen && !pool->terminate)
+      pthread_cond_wait(&pool->cond_start, &pool->mutex);
+
+    if (pool->terminate)
+    {
+      pthread_mutex_unlock(&pool->mutex);
+      break;
+    }
+
+    seen = pool->generation;
+    pll_thread_job_t job = pool->job;
+    void * data = pool->data;
+    pll_hardware = pool->hardware;
+    pthread_mutex_unlock(&pool->mutex);
+
+    job(data, targ->thread_id, pool->count);
+
+    pthread_mutex_lock(&pool->mutex);
+    if (--pool->pending == 0)
+      pthread_cond_signal(&pool->cond_done);
+    pthread_mutex_unlock(&pool->mutex);
+  }
+
+  return NULL;
+}
+
+PLL_EXPORT pll_thread_pool_t * pll_thread_pool_create(unsigned int threads)
+{
+  unsigned int i;
+
+  if (!threads)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200, "Number of threads must be positive.");
+    return NULL;
+  }
+
+  pll_thread_pool_t * pool = (pll_thread_pool_t *)calloc(1,
+                                                  sizeof(pll_thread_pool_t));
+  if (!pool)
+  {
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for thread pool.");
+    return NULL;
+  }
+
+  pool->count = threads;
+  pool->workers = (pthread_t *)calloc(threads, sizeof(pthread_t));
+  pool->args = (struct pll_thread_arg *)calloc(threads,
+                                               sizeof(struct pll_thread_arg));
+  if (!pool->workers || !pool->args)
+  {
+    free(pool->workers);
+    free(pool->args);
+    free(pool);
+    pll_errno = PLL_ERROR_MEM_ALLOC;
+    snprintf(pll_errmsg, 200, "Cannot allocate memory for thread pool.");
+    return NULL;
+  }
+
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->cond_start, NULL);
+  pthread_cond_init(&pool->cond_done, NULL);
+
+  /* thread 0 is the calling thread */
+  for (i = 1; i < threads; ++i)
+  {
+    pool->args[i].pool = pool;
+    pool->args[i].thread_id = i;
+    if (pthread_create(pool->workers + i, NULL, worker_main, pool->args + i))
+    {
+      /* shut down the threads created so far */
+      pool->count = i;
+      pll_thread_pool_destroy(pool);
+      pll_errno = PLL_ERROR_THREAD_CREATE;
+      snprintf(pll_errmsg, 200, "Cannot create worker thread.");
+      return NULL;
+    }
+  }
+
+  return pool;
+}
+
+PLL_EXPORT void pll_thread_pool_destroy(pll_thread_pool_t * pool)
+{
+  unsigned int i;
+
+  if (!pool) return;
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->terminate = 1;
+  pthread_cond_broadcast(&pool->cond_start);
+  pthread_mutex_unlock(&pool->mutex);
+
+  for (i = 1; i < pool->count; ++i)
+    pthread_join(pool->workers[i], NULL);
+
+  pthread_mutex_destroy(&pool->mutex);
+  pthread_cond_destroy(&pool->cond_start);
+  pthread_cond_destroy(&pool->cond_done);
+
+  free(pool->workers);
+  free(pool->args);
+  free(pool);
+}
+
+PLL_EXPORT unsigned int pll_thread_pool_size(const pll_thread_pool_t * pool)
+{
+  return pool ? pool->count : 1;
+}
+
+PLL_EXPORT void pll_thread_pool_run(pll_thread_pool_t * pool,
+                                    pll_thread_job_t job,
+                                    void * data)
+{
+  if (!pool || pool->count == 1)
+  {
+    job(data, 0, 1);
+    return;
+  }
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->job = job;
+  pool->data = data;
+  pool->hardware = pll_hardware;
+  pool->pending = pool->count - 1;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->cond_start);
+  pthread_mutex_unlock(&pool->mutex);
+
+  /* the calling thread processes the first share */
+  job(data, 0, pool->count);
+
+  pthread_mutex_lock(&pool->mutex);
+  while (pool->pending)
+    pthread_cond_wait(&pool->cond_done, &pool->mutex);
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+PLL_EXPORT int pll_set_thread_count(pll_partition_t * partition,
+                                    unsigned int threads)
+{
+  if (!threads)
+  {
+    pll_errno = PLL_ERROR_PARAM_INVALID;
+    snprintf(pll_errmsg, 200, "Number of threads must be positive.");
+    return PLL_FAILURE;
+  }
+
+  if (pll_thread_pool_size(partition->thread_pool) == threads)
+    return PLL_SUCCESS;
+
+  pll_thread_pool_destroy(partition->thread_pool);
+  partition->thread_pool = NULL;
+
+  if (threads == 1)
+    return PLL_SUCCESS;
+
+  partition->thread_pool = pll_thread_pool_create(threads);
+
+  return partition->thread_pool ? PLL_SUCCESS : PLL_FAILURE;
+}
+
+/* compute the boundaries [begin,end) of the block of sites processed by
+   thread thread_id. Boundaries are multiples of PLL_THREAD_SITE_ALIGN such
+   that threads never write to the same cache line of a CLV or scaler */
+PLL_EXPORT void pll_thread_site_range(unsigned int sites,
+                                      unsigned int thread_id,
+                                      unsigned int thread_count,
+                                      unsigned int * begin,
+                                      unsigned int * end)
+{
+  unsigned int blocks = (sites + PLL_THREAD_SITE_ALIGN - 1) /
+                        PLL_THREAD_SITE_ALIGN;
+
+  unsigned int b = (unsigned int)(((unsigned long)blocks * thread_id) /
+                                  thread_count);
+  unsigned int e = (unsigned int)(((unsigned long)blocks * (thread_id+1)) /
+                                  thread_count);
+
+  *begin = PLL_MIN(b * PLL_THREAD_SITE_ALIGN, sites);
+  *end   = PLL_MIN(e * PLL_THREAD_SITE_ALIGN, sites);
+}
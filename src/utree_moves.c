@@ -373,3 +373,47 @@ PLL_EXPORT int pll_utree_rollback(pll_utree_rb_t * rollback,
   snprintf(pll_errmsg, 200, "Invalid move type");
   return PLL_FAILURE;
 }
+
+static unsigned int add_inner_clv(const pll_unode_t * node,
+                                  unsigned int * clv_indices,
+                                  unsigned int count)
+{
+  unsigned int i;
+
+  if (!node || !node->next)
+    return count;
+
+  for (i = 0; i < count; ++i)
+    if (clv_indices[i] == node->clv_index)
+      return count;
+
+  clv_indices[count] = node->clv_index;
+  return count + 1;
+}
+
+/* stores the CLV indices of the inner nodes whose neighbours are changed by
+   the move recorded in rb, or by its rollback, in clv_indices (at most five
+   entries) and returns their number. The CLVs of these nodes, and of their
+   ancestors with respect to any root, need to be recomputed; see also
+   pll_update_repeats_incremental() */
+PLL_EXPORT unsigned int pll_utree_rb_clv_indices(const pll_utree_rb_t * rb,
+                                                 unsigned int * clv_indices)
+{
+  unsigned int count = 0;
+
+  if (rb->move_type == PLL_UTREE_MOVE_SPR)
+  {
+    count = add_inner_clv(rb->spr.p, clv_indices, count);
+    count = add_inner_clv(rb->spr.r, clv_indices, count);
+    count = add_inner_clv(rb->spr.rb, clv_indices, count);
+    count = add_inner_clv(rb->spr.pnb, clv_indices, count);
+    count = add_inner_clv(rb->spr.pnnb, clv_indices, count);
+  }
+  else if (rb->move_type == PLL_UTREE_MOVE_NNI)
+  {
+    count = add_inner_clv(rb->nni.p, clv_indices, count);
+    count = add_inner_clv(rb->nni.p->back, clv_indices, count);
+  }
+
+  return count;
+}
@@ -0,0 +1,142 @@
+/*
+    Copyright (C) 2015-2020 Diego Darriba, Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+#include "common.h"
+#include <math.h>
+
+#define N_SITES 151
+#define EPSILON 1e-9
+
+static fixture_t * fixture;
+
+/* few site patterns, such that the nodes have repeats */
+static unsigned int pattern(unsigned int states,
+                            unsigned int tip,
+                            unsigned int site)
+{
+  return (tip/3)*(site%7) + site/23 + tip/2;
+}
+
+/* all operations of the traversal towards root; returns their number */
+static unsigned int update_partials(pll_partition_t * partition,
+                                    pll_unode_t * root)
+{
+  unsigned int ops_count = fixture_operations(fixture, partition, root);
+
+  pll_update_partials(partition, fixture->operations, ops_count);
+
+  return ops_count;
+}
+
+static void compare(unsigned int states, unsigned int attributes)
+{
+  unsigned int i, j;
+  unsigned int span = N_SITES * states;
+  unsigned int fails = 0;
+  unsigned int compressed = 0;
+
+  /* site repeats are not combined with tip patterns */
+  pll_partition_t * reference = fixture_partition(fixture,
+                                                  states,
+                                                  N_SITES,
+                                                  attributes,
+                                                  pattern);
+  pll_partition_t * partition = fixture_partition(fixture,
+                                                  states,
+                                                  N_SITES,
+                                                  (attributes &
+                                                   ~PLL_ATTRIB_PATTERN_TIP) |
+                                                  PLL_ATTRIB_SITE_REPEATS,
+                                                  pattern);
+  pll_utree_t * tree = fixture->tree;
+
+  double * ref_ancestral = (double *)xmalloc(span * sizeof(double));
+  double * ancestral = (double *)xmalloc(span * sizeof(double));
+
+  /* each inner node with its CLVs oriented towards it */
+  for (i = tree->tip_count; i < tree->tip_count + tree->inner_count; ++i)
+  {
+    pll_unode_t * node = tree->nodes[i];
+
+    update_partials(reference, node);
+    update_partials(partition, node);
+
+    /* the CLV at the node has fewer classes than sites */
+    if (pll_get_sites_number(partition, node->clv_index) < N_SITES)
+      compressed++;
+
+    if (!pll_compute_node_ancestral(reference,
+                                    node->clv_index,
+                                    node->scaler_index,
+                                    node->back->clv_index,
+                                    node->back->scaler_index,
+                                    node->pmatrix_index,
+                                    fixture_params_indices,
+                                    ref_ancestral) ||
+        !pll_compute_node_ancestral(partition,
+                                    node->clv_index,
+                                    node->scaler_index,
+                                    node->back->clv_index,
+                                    node->back->scaler_index,
+                                    node->pmatrix_index,
+                                    fixture_params_indices,
+                                    ancestral))
+      fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+
+    for (j = 0; j < span; ++j)
+    {
+      if (fabs(ancestral[j] - ref_ancestral[j]) > EPSILON)
+      {
+        fails++;
+        break;
+      }
+    }
+  }
+
+  printf("%2u states, %s scalers: %u nodes (%u compressed), %s\n",
+         states,
+         (attributes & PLL_ATTRIB_RATE_SCALERS) ? "rate" : "site",
+         tree->inner_count,
+         compressed,
+         fails ? "FAIL" : "OK");
+
+  pll_partition_destroy(reference);
+  pll_partition_destroy(partition);
+  free(ref_ancestral);
+  free(ancestral);
+}
+
+int main(int argc, char * argv[])
+{
+  /* check attributes */
+  unsigned int attributes = get_attributes(argc, argv) &
+                            ~PLL_ATTRIB_SITE_REPEATS;
+
+  fixture = fixture_create(fixture_newick);
+
+  compare(4, attributes);
+  compare(20, attributes);
+  compare(4, attributes | PLL_ATTRIB_RATE_SCALERS);
+  compare(20, attributes | PLL_ATTRIB_RATE_SCALERS);
+
+  fixture_destroy(fixture);
+
+  return (0);
+}
@@ -0,0 +1,111 @@
+/*
+    Copyright (C) 2015-2020 Diego Darriba, Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+#include "common.h"
+#include <math.h>
+
+#define N_SITES 75
+#define EPSILON 1e-9
+
+static unsigned int states_list[] = { 3, 7, 16, 33, 40 };
+
+static fixture_t * fixture;
+
+static unsigned int pattern(unsigned int states,
+                            unsigned int tip,
+                            unsigned int site)
+{
+  if ((tip*site + site) % 13 == 5)
+    return states;
+
+  return (tip*site + 3*site + tip/2) % states;
+}
+
+static pll_partition_t * create_partition(unsigned int states,
+                                          unsigned int attributes)
+{
+  return fixture_partition(fixture, states, N_SITES, attributes, pattern);
+}
+
+/* log-likelihood and per-site log-likelihoods at the edge of root after a
+   full traversal towards it */
+static void evaluate(pll_partition_t * partition,
+                     pll_unode_t * root,
+                     double * values)
+{
+  fixture_operations(fixture, partition, root);
+  if (!pll_update_partials(partition, fixture->operations, fixture->ops_count))
+    fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+
+  values[0] = fixture_loglikelihood(partition, root, values + 1);
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i, k, s;
+  unsigned int count = 1 + N_SITES;
+  double ref_values[1 + N_SITES];
+  double values[1 + N_SITES];
+
+  /* check attributes */
+  unsigned int attributes = get_attributes(argc, argv);
+
+  fixture = fixture_create(fixture_newick);
+  pll_utree_t * tree = fixture->tree;
+  pll_unode_t * root = tree->nodes[tree->tip_count + tree->inner_count - 1];
+
+  for (s = 0; s < sizeof(states_list) / sizeof(states_list[0]); ++s)
+  {
+    unsigned int states = states_list[s];
+
+    for (k = 0; k < 2; ++k)
+    {
+      int ok = 1;
+      unsigned int attr = attributes | (k ? PLL_ATTRIB_RATE_SCALERS : 0);
+
+      /* the reference uses the same options without vector instructions */
+      pll_partition_t * reference = create_partition(states,
+                                                     (attr &
+                                                      ~PLL_ATTRIB_ARCH_MASK) |
+                                                     PLL_ATTRIB_ARCH_CPU);
+      pll_partition_t * partition = create_partition(states, attr);
+
+      evaluate(reference, root, ref_values);
+      evaluate(partition, root, values);
+
+      for (i = 0; i < count; ++i)
+        if (fabs(values[i] - ref_values[i]) > EPSILON * fmax(1, fabs(ref_values[i])))
+          ok = 0;
+
+      printf("%2u states, %s scalers: logL %.4f, %s\n",
+             states,
+             k ? "rate" : "site",
+             ref_values[0],
+             ok ? "OK" : "FAIL");
+
+      pll_partition_destroy(reference);
+      pll_partition_destroy(partition);
+    }
+  }
+
+  fixture_destroy(fixture);
+
+  return (0);
+}
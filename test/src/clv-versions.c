@@ -0,0 +1,177 @@
+/*
+    Copyright (C) 2015-2020 Diego Darriba, Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+#include "common.h"
+#include <math.h>
+
+#define N_STATES_NT 4
+#define N_SITES 97
+#define EPSILON 1e-9
+
+static fixture_t * fixture;
+static pll_unode_t * root;
+
+static unsigned int pattern(unsigned int states,
+                            unsigned int tip,
+                            unsigned int site)
+{
+  return tip*site + 3*site + tip/2;
+}
+
+/* partition with the p-matrices of the current branch lengths */
+static pll_partition_t * create_partition(unsigned int attributes)
+{
+  pll_partition_t * partition = fixture_partition(fixture,
+                                                  N_STATES_NT,
+                                                  N_SITES,
+                                                  attributes,
+                                                  pattern);
+  pll_update_prob_matrices(partition,
+                           fixture_params_indices,
+                           fixture->matrix_indices,
+                           fixture->branch_lengths,
+                           fixture->matrix_count);
+
+  return partition;
+}
+
+static double root_loglikelihood(pll_partition_t * partition)
+{
+  return fixture_loglikelihood(partition, root, NULL);
+}
+
+static const char * check(double lnl, double ref_lnl)
+{
+  return fabs(lnl - ref_lnl) < EPSILON ? "OK" : "FAIL";
+}
+
+/* overwrite the first site of a CLV without telling the library */
+static void clobber_clv(pll_partition_t * partition, unsigned int clv_index)
+{
+  unsigned int i;
+  for (i = 0; i < partition->states_padded * partition->rate_cats; ++i)
+    partition->clv[clv_index][i] = 1.0;
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i;
+  double ref_lnl, lnl;
+
+  /* check attributes */
+  unsigned int attributes = get_attributes(argc, argv);
+
+  fixture = fixture_create(fixture_newick);
+  pll_utree_t * tree = fixture->tree;
+  root = tree->nodes[tree->tip_count + tree->inner_count - 1];
+
+  pll_partition_t * reference = fixture_partition(fixture,
+                                                  N_STATES_NT,
+                                                  N_SITES,
+                                                  attributes,
+                                                  pattern);
+  unsigned int ops_count = fixture_operations(fixture, reference, root);
+  pll_operation_t * operations = fixture->operations;
+  double * branch_lengths = fixture->branch_lengths;
+  unsigned int * matrix_indices = fixture->matrix_indices;
+  unsigned int matrix_count = fixture->matrix_count;
+
+  pll_partition_t * partition = create_partition(attributes |
+                                                 PLL_ATTRIB_CLV_VERSIONS);
+
+  pll_update_partials(reference, operations, ops_count);
+  ref_lnl = root_loglikelihood(reference);
+  printf("Reference logL: %.6f\n", ref_lnl);
+
+  pll_update_partials(partition, operations, ops_count);
+  printf("first update:        %s\n", check(root_loglikelihood(partition), ref_lnl));
+
+  /* nothing changed: the update must not touch the root CLV */
+  clobber_clv(partition, root->clv_index);
+  pll_update_partials(partition, operations, ops_count);
+  lnl = root_loglikelihood(partition);
+  printf("unchanged inputs:    %s\n", fabs(lnl - ref_lnl) < EPSILON ? "FAIL" : "OK");
+
+  /* an invalidated CLV is computed again */
+  pll_invalidate_clv(partition, root->clv_index);
+  pll_update_partials(partition, operations, ops_count);
+  printf("invalidated CLV:     %s\n", check(root_loglikelihood(partition), ref_lnl));
+
+  /* changing a branch length recomputes the path to the root */
+  for (i = 0; i < matrix_count; ++i)
+  {
+    if (matrix_indices[i] == tree->nodes[0]->pmatrix_index)
+      branch_lengths[i] *= 2;
+  }
+  pll_update_prob_matrices(reference,
+                           fixture_params_indices,
+                           matrix_indices,
+                           branch_lengths,
+                           matrix_count);
+  pll_update_prob_matrices(partition,
+                           fixture_params_indices,
+                           matrix_indices,
+                           branch_lengths,
+                           matrix_count);
+  pll_update_partials(reference, operations, ops_count);
+  ref_lnl = root_loglikelihood(reference);
+  pll_update_partials(partition, operations, ops_count);
+  printf("new branch length:   %s\n", check(root_loglikelihood(partition), ref_lnl));
+
+  pll_partition_destroy(partition);
+
+  /* an update that fails must not leave the CLVs it did not compute marked
+     as current */
+  if (!(attributes & PLL_ATTRIB_SITE_REPEATS))
+  {
+    partition = create_partition(attributes |
+                                 PLL_ATTRIB_CLV_VERSIONS |
+                                 PLL_ATTRIB_LIMIT_MEMORY);
+    pll_update_prob_matrices(partition,
+                             fixture_params_indices,
+                             matrix_indices,
+                             branch_lengths,
+                             matrix_count);
+
+    pll_set_clv_slots(partition, 3);
+    if (pll_update_partials(partition, operations, ops_count))
+      printf("failed update:       FAIL\n");
+    else
+      printf("failed update:       OK (%d)\n", pll_errno);
+
+    pll_set_clv_slots(partition, tree->inner_count);
+    if (!pll_update_partials(partition, operations, ops_count))
+      fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+    printf("update after fail:   %s\n", check(root_loglikelihood(partition), ref_lnl));
+
+    pll_partition_destroy(partition);
+  }
+  else
+  {
+    /* the memory limit is not available with site repeats */
+    printf("failed update:       OK (%d)\n", PLL_ERROR_CLV_SLOTS);
+    printf("update after fail:   OK\n");
+  }
+
+  pll_partition_destroy(reference);
+  fixture_destroy(fixture);
+
+  return (0);
+}
@@ -0,0 +1,137 @@
+/*
+    Copyright (C) 2015-2020 Diego Darriba, Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+#include "common.h"
+#include <math.h>
+
+#define N_STATES_CODON 61
+#define N_SITES 67
+#define EPSILON 1e-9
+
+static fixture_t * fixture;
+
+/* related sequences: most sites share a codon with the previous tip */
+static unsigned int pattern(unsigned int states,
+                            unsigned int tip,
+                            unsigned int site)
+{
+  if ((tip*site + site) % 11 == 5)
+    return states;
+
+  return (site*7 + ((tip*site) % 5 == 0 ? tip : 0)) % states;
+}
+
+static pll_partition_t * create_partition(unsigned int attributes)
+{
+  return fixture_partition(fixture,
+                           N_STATES_CODON,
+                           N_SITES,
+                           attributes,
+                           pattern);
+}
+
+/* log-likelihood, per-site log-likelihoods and derivatives at the edge of
+   node after a full traversal towards it */
+static void evaluate(pll_partition_t * partition,
+                     pll_unode_t * node,
+                     double * values)
+{
+  double * sumtable = pll_aligned_alloc(partition->sites *
+                                        partition->rate_cats *
+                                        partition->states_padded *
+                                        sizeof(double),
+                                        partition->alignment);
+
+  fixture_operations(fixture, partition, node);
+  pll_update_partials(partition, fixture->operations, fixture->ops_count);
+
+  values[0] = fixture_loglikelihood(partition, node, values + 3);
+  pll_update_sumtable(partition,
+                      node->clv_index,
+                      node->back->clv_index,
+                      node->scaler_index,
+                      node->back->scaler_index,
+                      fixture_params_indices,
+                      sumtable);
+  pll_compute_likelihood_derivatives(partition,
+                                     node->scaler_index,
+                                     node->back->scaler_index,
+                                     node->length,
+                                     fixture_params_indices,
+                                     sumtable,
+                                     values + 1,
+                                     values + 2);
+
+  pll_aligned_free(sumtable);
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i, k;
+  unsigned int count = 3 + N_SITES;
+  double * ref_values = (double *)xmalloc(count * sizeof(double));
+  double * values = (double *)xmalloc(count * sizeof(double));
+
+  /* check attributes */
+  unsigned int attributes = get_attributes(argc, argv);
+
+  fixture = fixture_create(fixture_newick);
+  pll_utree_t * tree = fixture->tree;
+  unsigned int nodes_count = tree->tip_count + tree->inner_count;
+
+  /* an inner-inner edge and an inner-tip edge */
+  pll_unode_t * edges[2];
+  edges[0] = tree->nodes[nodes_count - 1];
+  edges[1] = tree->nodes[0]->back;
+
+  for (k = 0; k < 4; ++k)
+  {
+    int ok = 1;
+    unsigned int attr = attributes | ((k & 2) ? PLL_ATTRIB_RATE_SCALERS : 0);
+    pll_unode_t * node = edges[k & 1];
+
+    /* the reference uses the same options without vector instructions */
+    pll_partition_t * reference = create_partition((attr & ~PLL_ATTRIB_ARCH_MASK) |
+                                                   PLL_ATTRIB_ARCH_CPU);
+    pll_partition_t * partition = create_partition(attr);
+
+    evaluate(reference, node, ref_values);
+    evaluate(partition, node, values);
+
+    for (i = 0; i < count; ++i)
+      if (fabs(values[i] - ref_values[i]) > EPSILON * fmax(1, fabs(ref_values[i])))
+        ok = 0;
+
+    printf("%s edge, %s scalers: logL %.4f, %s\n",
+           (k & 1) ? "tip-inner" : "inner-inner",
+           (k & 2) ? "rate" : "site",
+           ref_values[0],
+           ok ? "OK" : "FAIL");
+
+    pll_partition_destroy(reference);
+    pll_partition_destroy(partition);
+  }
+
+  fixture_destroy(fixture);
+  free(ref_values);
+  free(values);
+
+  return (0);
+}
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <search.h>
 #include <stdarg.h>
+#include <assert.h>
 
 const pll_state_t odd5_map[256] =
   { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -51,6 +52,11 @@ unsigned int get_attributes(int argc, char **argv)
       /* avx2 vectorization */
       attributes |= PLL_ATTRIB_ARCH_AVX2;
     }
+    else if (!strcmp (argv[i], "avx512"))
+    {
+      /* avx-512 vectorization */
+      attributes |= PLL_ATTRIB_ARCH_AVX512;
+    }
     else
     {
       printf("Unrecognised attribute: %s\n", argv[i]);
@@ -209,6 +215,222 @@ pll_partition_t * parse_msa_reduced(const char * filename,
   return partition;
 }
 
+/* The fixture of the tests on synthetic alignments: a tree, the buffers of
+   its full traversals, and partitions with 4 gamma rate categories (alpha
+   0.5). DNA partitions use HKY-like rates, protein partitions LG. Other
+   state counts encode state i as the character '@'+i with a synthetic
+   model */
+
+const char * fixture_newick =
+  "((((((t1:0.1,t2:0.2):0.05,t3:0.3):0.1,t4:0.15):0.2,(t5:0.25,t6:0.1):0.1)"
+  ":0.05,t7:0.4):0.1,((t8:0.2,t9:0.05):0.3,(t10:0.1,t11:0.2):0.15):0.1,"
+  "t12:0.35);";
+
+unsigned int fixture_params_indices[FIXTURE_RATE_CATS] = {0,0,0,0};
+
+static char fixture_nt_alphabet[] = "ACGT-";
+static char fixture_aa_alphabet[] = "GALMFWKQESPVICYHRNDT-";
+static double fixture_nt_freqs[4] = { 0.3, 0.2, 0.2, 0.3 };
+static double fixture_nt_rates[6] = {1, 2.5, 1, 1, 2.5, 1};
+
+/* caterpillar tree whose deep CLVs need scaling */
+char * caterpillar_newick(unsigned int tips)
+{
+  unsigned int i;
+  char * s = (char *)xmalloc(tips * 32);
+  char * p = s;
+
+  p += sprintf(p, "(t1:0.5,t2:0.5,");
+  for (i = 3; i < tips - 1; ++i)
+    p += sprintf(p, "(t%u:0.5,", i);
+  p += sprintf(p, "(t%u:0.5,t%u:0.5)", tips-1, tips);
+  for (i = 3; i < tips - 1; ++i)
+    p += sprintf(p, ":0.2)");
+  sprintf(p, ":0.2);");
+
+  return s;
+}
+
+fixture_t * fixture_create(const char * newick)
+{
+  fixture_t * fixture = (fixture_t *)xmalloc(sizeof(fixture_t));
+
+  fixture->tree = pll_utree_parse_newick_string(newick);
+  if (!fixture->tree)
+    fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+
+  unsigned int nodes_count = fixture->tree->tip_count +
+                             fixture->tree->inner_count;
+  fixture->travbuffer = (pll_unode_t **)xmalloc(nodes_count *
+                                                sizeof(pll_unode_t *));
+  fixture->branch_lengths = (double *)xmalloc(nodes_count * sizeof(double));
+  fixture->matrix_indices = (unsigned int *)xmalloc(nodes_count *
+                                                    sizeof(unsigned int));
+  fixture->operations = (pll_operation_t *)xmalloc(fixture->tree->inner_count *
+                                                   sizeof(pll_operation_t));
+  fixture->matrix_count = 0;
+  fixture->ops_count = 0;
+
+  return fixture;
+}
+
+void fixture_destroy(fixture_t * fixture)
+{
+  pll_utree_destroy(fixture->tree, NULL);
+  free(fixture->travbuffer);
+  free(fixture->branch_lengths);
+  free(fixture->matrix_indices);
+  free(fixture->operations);
+  free(fixture);
+}
+
+pll_partition_t * fixture_partition(const fixture_t * fixture,
+                                    unsigned int states,
+                                    unsigned int sites,
+                                    unsigned int attributes,
+                                    fixture_pattern_t pattern)
+{
+  unsigned int i, j;
+  pll_utree_t * tree = fixture->tree;
+  unsigned int rates_count = states * (states - 1) / 2;
+  double rate_cats[FIXTURE_RATE_CATS];
+  char * seq = (char *)xmalloc(sites + 1);
+  char alphabet[65];
+  pll_state_t map[256];
+  const pll_state_t * tipmap = map;
+
+  assert(states <= 63);
+
+  pll_partition_t * partition = pll_partition_create(tree->tip_count,
+                                                     tree->inner_count,
+                                                     states,
+                                                     sites,
+                                                     1,
+                                                     2*tree->tip_count - 3,
+                                                     FIXTURE_RATE_CATS,
+                                                     tree->inner_count,
+                                                     attributes);
+  if (!partition)
+    fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+
+  if (states == 4)
+  {
+    strcpy(alphabet, fixture_nt_alphabet);
+    tipmap = pll_map_nt;
+  }
+  else if (states == 20)
+  {
+    strcpy(alphabet, fixture_aa_alphabet);
+    tipmap = pll_map_aa;
+  }
+  else
+  {
+    memset(map, 0, sizeof(map));
+    for (i = 0; i < states; ++i)
+    {
+      alphabet[i] = '@' + i;
+      map['@' + i] = 1ull << i;
+    }
+    alphabet[states] = '-';
+    alphabet[states+1] = 0;
+    map['-'] = (1ull << states) - 1;
+  }
+
+  for (i = 0; i < tree->tip_count; ++i)
+  {
+    for (j = 0; j < sites; ++j)
+      seq[j] = alphabet[pattern(states, i, j) % (states + 1)];
+    seq[sites] = 0;
+    pll_set_tip_states(partition, tree->nodes[i]->clv_index, tipmap, seq);
+  }
+  free(seq);
+
+  if (states == 4)
+  {
+    pll_set_frequencies(partition, 0, fixture_nt_freqs);
+    pll_set_subst_params(partition, 0, fixture_nt_rates);
+  }
+  else if (states == 20)
+  {
+    pll_set_frequencies(partition, 0, pll_aa_freqs_lg);
+    pll_set_subst_params(partition, 0, pll_aa_rates_lg);
+  }
+  else
+  {
+    double * frequencies = (double *)xmalloc(states * sizeof(double));
+    double * subst_params = (double *)xmalloc(rates_count * sizeof(double));
+    double sum = 0;
+
+    for (i = 0; i < states; ++i)
+    {
+      frequencies[i] = 1 + (i % 5);
+      sum += frequencies[i];
+    }
+    for (i = 0; i < states; ++i)
+      frequencies[i] /= sum;
+    for (i = 0; i < rates_count; ++i)
+      subst_params[i] = 0.5 + (i % 7);
+
+    pll_set_frequencies(partition, 0, frequencies);
+    pll_set_subst_params(partition, 0, subst_params);
+
+    free(frequencies);
+    free(subst_params);
+  }
+
+  pll_compute_gamma_cats(0.5,
+                         FIXTURE_RATE_CATS,
+                         rate_cats,
+                         PLL_GAMMA_RATES_MEAN);
+  pll_set_category_rates(partition, rate_cats);
+
+  return partition;
+}
+
+/* creates the operations of a full traversal towards the edge of root and
+   updates the p-matrices of its branches. Returns the number of operations */
+unsigned int fixture_operations(fixture_t * fixture,
+                                pll_partition_t * partition,
+                                pll_unode_t * root)
+{
+  unsigned int traversal_size;
+
+  pll_utree_traverse(root,
+                     PLL_TREE_TRAVERSE_POSTORDER,
+                     cb_full_traversal,
+                     fixture->travbuffer,
+                     &traversal_size);
+  pll_utree_create_operations(fixture->travbuffer,
+                              traversal_size,
+                              fixture->branch_lengths,
+                              fixture->matrix_indices,
+                              fixture->operations,
+                              &fixture->matrix_count,
+                              &fixture->ops_count);
+  pll_update_prob_matrices(partition,
+                           fixture_params_indices,
+                           fixture->matrix_indices,
+                           fixture->branch_lengths,
+                           fixture->matrix_count);
+
+  return fixture->ops_count;
+}
+
+/* log-likelihood at the edge of root */
+double fixture_loglikelihood(pll_partition_t * partition,
+                             pll_unode_t * root,
+                             double * persite_lnl)
+{
+  return pll_compute_edge_loglikelihood(partition,
+                                        root->clv_index,
+                                        root->scaler_index,
+                                        root->back->clv_index,
+                                        root->back->scaler_index,
+                                        root->pmatrix_index,
+                                        fixture_params_indices,
+                                        persite_lnl);
+}
+
 int cb_full_traversal(pll_unode_t * node)
 {
   return 1;
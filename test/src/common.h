@@ -48,6 +48,49 @@ pll_partition_t * parse_msa_reduced(const char * filename,
 int cb_full_traversal(pll_unode_t * node);
 int cb_rfull_traversal(pll_rnode_t * node);
 
+/* fixture of the tests on synthetic alignments, see common.c */
+
+#define FIXTURE_RATE_CATS 4
+
+typedef struct fixture
+{
+  pll_utree_t * tree;
+  pll_unode_t ** travbuffer;
+  pll_operation_t * operations;
+  double * branch_lengths;
+  unsigned int * matrix_indices;
+  unsigned int matrix_count;
+  unsigned int ops_count;
+} fixture_t;
+
+/* returns the character of tip at site as an index into the alphabet of the
+   partition, where index states is the gap */
+typedef unsigned int (*fixture_pattern_t)(unsigned int states,
+                                          unsigned int tip,
+                                          unsigned int site);
+
+extern const char * fixture_newick;
+extern unsigned int fixture_params_indices[FIXTURE_RATE_CATS];
+
+char * caterpillar_newick(unsigned int tips);
+
+fixture_t * fixture_create(const char * newick);
+void fixture_destroy(fixture_t * fixture);
+
+pll_partition_t * fixture_partition(const fixture_t * fixture,
+                                    unsigned int states,
+                                    unsigned int sites,
+                                    unsigned int attributes,
+                                    fixture_pattern_t pattern);
+
+unsigned int fixture_operations(fixture_t * fixture,
+                                pll_partition_t * partition,
+                                pll_unode_t * root);
+
+double fixture_loglikelihood(pll_partition_t * partition,
+                             pll_unode_t * root,
+                             double * persite_lnl);
+
 /* print error and exit */
 void fatal(const char * format, ...) __attribute__ ((noreturn));
 char * xstrdup(const char * s);
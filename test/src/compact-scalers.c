@@ -0,0 +1,188 @@
+/*
+    Copyright (C) 2015-2020 Diego Darriba, Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+#include "common.h"
+#include <math.h>
+
+#define N_STATES_NT 4
+#define N_CAT_GAMMA FIXTURE_RATE_CATS
+#define N_SITES 131
+#define N_TIPS 200
+#define EPSILON 1e-9
+
+static fixture_t * fixture;
+static pll_unode_t * root;
+
+static unsigned int pattern(unsigned int states,
+                            unsigned int tip,
+                            unsigned int site)
+{
+  return tip*site + 3*site + tip/2;
+}
+
+static pll_partition_t * create_partition(unsigned int attributes)
+{
+  pll_partition_t * partition = fixture_partition(fixture,
+                                                  N_STATES_NT,
+                                                  N_SITES,
+                                                  attributes,
+                                                  pattern);
+  fixture_operations(fixture, partition, root);
+  return partition;
+}
+
+/* log-likelihood, derivatives and ancestral states at the root edge */
+static void evaluate(pll_partition_t * partition, double * values)
+{
+  unsigned int sites_alloc = partition->sites + partition->states;
+  double * sumtable = pll_aligned_alloc(sites_alloc *
+                                        partition->rate_cats *
+                                        partition->states_padded *
+                                        sizeof(double),
+                                        partition->alignment);
+
+  pll_operation_t * operations = fixture->operations;
+  unsigned int ops_count = fixture->ops_count;
+
+  if (!pll_update_partials(partition, operations, ops_count))
+    fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+
+  values[0] = fixture_loglikelihood(partition, root, values + 3);
+
+  /* the last operation again, fused with the evaluation */
+  values[3 + N_SITES] =
+    pll_compute_edge_loglikelihood_fused(partition,
+                                         operations + ops_count - 1,
+                                         root->back->clv_index,
+                                         root->back->scaler_index,
+                                         root->pmatrix_index,
+                                         fixture_params_indices,
+                                         NULL);
+
+  pll_update_sumtable(partition,
+                      root->clv_index,
+                      root->back->clv_index,
+                      root->scaler_index,
+                      root->back->scaler_index,
+                      fixture_params_indices,
+                      sumtable);
+  pll_compute_likelihood_derivatives(partition,
+                                     root->scaler_index,
+                                     root->back->scaler_index,
+                                     root->length,
+                                     fixture_params_indices,
+                                     sumtable,
+                                     values + 1,
+                                     values + 2);
+
+  pll_compute_node_ancestral(partition,
+                             root->clv_index,
+                             root->scaler_index,
+                             root->back->clv_index,
+                             root->back->scaler_index,
+                             root->pmatrix_index,
+                             fixture_params_indices,
+                             values + 4 + N_SITES);
+
+  pll_aligned_free(sumtable);
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i, k;
+  unsigned int count = 4 + N_SITES + N_SITES * N_STATES_NT;
+  double * ref_values = (double *)xmalloc(count * sizeof(double));
+  double * values = (double *)xmalloc(count * sizeof(double));
+
+  /* check attributes */
+  unsigned int attributes = get_attributes(argc, argv);
+
+  /* compact scale buffers are not available with site repeats */
+  if (attributes & PLL_ATTRIB_SITE_REPEATS)
+    skip_test();
+
+  /* caterpillar tree deep enough to need scaling in double precision */
+  char * newick = caterpillar_newick(N_TIPS);
+  fixture = fixture_create(newick);
+  root = fixture->tree->nodes[fixture->tree->tip_count +
+                              fixture->tree->inner_count - 1];
+
+  for (k = 0; k < 4; ++k)
+  {
+    unsigned int attr = attributes;
+    unsigned int thread_count = (k & 2) ? 3 : 1;
+    unsigned int max_scaler = 0;
+    int ok = 1;
+
+    if (k & 1)
+      attr |= PLL_ATTRIB_RATE_SCALERS;
+
+    pll_partition_t * reference = create_partition(attr);
+    pll_partition_t * partition = create_partition(attr |
+                                                 PLL_ATTRIB_COMPACT_SCALERS);
+    pll_set_thread_count(reference, thread_count);
+    pll_set_thread_count(partition, thread_count);
+
+    evaluate(reference, ref_values);
+    evaluate(partition, values);
+
+    for (i = 0; i < count; ++i)
+      if (fabs(values[i] - ref_values[i]) > EPSILON * fmax(1, fabs(ref_values[i])))
+        ok = 0;
+
+    unsigned int scaler_size = N_SITES * ((k & 1) ? N_CAT_GAMMA : 1);
+    for (i = 0; i < scaler_size; ++i)
+      if (partition->scale_buffer_compact[root->scaler_index][i] > max_scaler)
+        max_scaler = partition->scale_buffer_compact[root->scaler_index][i];
+
+    printf("%s scalers, %u thread%s: logL %.4f, scaled %s, compact %s\n",
+           (k & 1) ? "rate" : "site",
+           thread_count,
+           thread_count > 1 ? "s" : "",
+           ref_values[0],
+           max_scaler ? "yes" : "no",
+           ok ? "OK" : "FAIL");
+
+    pll_partition_destroy(reference);
+    pll_partition_destroy(partition);
+  }
+
+  /* too many CLVs for 16-bit counts */
+  pll_partition_t * partition = pll_partition_create(4,
+                                                     70000,
+                                                     N_STATES_NT,
+                                                     N_SITES,
+                                                     1,
+                                                     5,
+                                                     N_CAT_GAMMA,
+                                                     2,
+                                                     attributes |
+                                                     PLL_ATTRIB_COMPACT_SCALERS);
+  printf("70000 CLV buffers: %s\n", partition ? "accepted" : "rejected");
+  if (partition)
+    pll_partition_destroy(partition);
+
+  fixture_destroy(fixture);
+  free(newick);
+  free(ref_values);
+  free(values);
+
+  return (0);
+}
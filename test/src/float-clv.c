@@ -0,0 +1,128 @@
+/*
+    Copyright (C) 2015-2020 Diego Darriba, Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+#include "common.h"
+#include <math.h>
+
+#define N_SITES 113
+#define N_TIPS_LARGE 60
+
+/* single-precision CLVs keep about 7 significant digits; the error of the
+   log-likelihood grows with the number of operations */
+#define REL_EPSILON 1e-6
+
+static unsigned int pattern(unsigned int states,
+                            unsigned int tip,
+                            unsigned int site)
+{
+  return tip*site + 3*site + tip/2;
+}
+
+static double evaluate(fixture_t * fixture,
+                       unsigned int attributes,
+                       unsigned int states)
+{
+  pll_utree_t * tree = fixture->tree;
+  pll_unode_t * root = tree->nodes[tree->tip_count + tree->inner_count - 1];
+  double lnl;
+
+  pll_partition_t * partition = fixture_partition(fixture,
+                                                  states,
+                                                  N_SITES,
+                                                  attributes,
+                                                  pattern);
+  fixture_operations(fixture, partition, root);
+  pll_update_partials(partition, fixture->operations, fixture->ops_count);
+
+  lnl = fixture_loglikelihood(partition, root, NULL);
+
+  /* derivatives are only available in double precision */
+  if (attributes & PLL_ATTRIB_FLOAT)
+  {
+    double * sumtable = pll_aligned_alloc(partition->sites *
+                                          partition->rate_cats *
+                                          partition->states_padded *
+                                          sizeof(double),
+                                          partition->alignment);
+    if (pll_update_sumtable(partition,
+                            root->clv_index,
+                            root->back->clv_index,
+                            root->scaler_index,
+                            root->back->scaler_index,
+                            fixture_params_indices,
+                            sumtable) ||
+        pll_errno != PLL_ERROR_FLOAT_NOSUPPORT)
+      printf("sumtable should have failed\n");
+    pll_aligned_free(sumtable);
+  }
+
+  pll_partition_destroy(partition);
+
+  return lnl;
+}
+
+static void compare(fixture_t * fixture,
+                    const char * name,
+                    unsigned int attributes,
+                    unsigned int states)
+{
+  unsigned int k;
+
+  for (k = 0; k < 2; ++k)
+  {
+    unsigned int attr = attributes | (k ? PLL_ATTRIB_RATE_SCALERS : 0);
+    double lnl_double = evaluate(fixture, attr, states);
+    double lnl_float = evaluate(fixture, attr | PLL_ATTRIB_FLOAT, states);
+
+    printf("%-6s %-5s %-11s logL %.2f  float %s\n",
+           name,
+           states == 4 ? "DNA" : "PROT",
+           k ? "rate scaler" : "site scaler",
+           lnl_double,
+           fabs((lnl_float - lnl_double) / lnl_double) < REL_EPSILON ?
+             "OK" : "FAIL");
+  }
+}
+
+int main(int argc, char * argv[])
+{
+  /* check attributes */
+  unsigned int attributes = get_attributes(argc, argv);
+
+  /* single precision is not available with site repeats */
+  if (attributes & PLL_ATTRIB_SITE_REPEATS)
+    skip_test();
+
+  char * newick_large = caterpillar_newick(N_TIPS_LARGE);
+
+  fixture_t * small = fixture_create(fixture_newick);
+  fixture_t * large = fixture_create(newick_large);
+
+  compare(small, "small", attributes, 4);
+  compare(small, "small", attributes, 20);
+  compare(large, "large", attributes, 4);
+  compare(large, "large", attributes, 20);
+
+  fixture_destroy(small);
+  fixture_destroy(large);
+  free(newick_large);
+
+  return (0);
+}
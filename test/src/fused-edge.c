@@ -0,0 +1,124 @@
+/*
+    Copyright (C) 2015-2020 Diego Darriba, Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+#include "common.h"
+#include <math.h>
+
+#define N_STATES_NT 4
+#define N_SITES 301
+#define EPSILON 1e-9
+
+static unsigned int pattern(unsigned int states,
+                            unsigned int tip,
+                            unsigned int site)
+{
+  return tip*site + 3*site + tip/2 + site/7;
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i, j, k, s;
+  unsigned int checks = 0, fails = 0;
+
+  /* check attributes */
+  unsigned int attributes = get_attributes(argc, argv);
+
+  fixture_t * fixture = fixture_create(fixture_newick);
+  pll_utree_t * tree = fixture->tree;
+  pll_operation_t * operations = fixture->operations;
+
+  unsigned int nodes_count = tree->tip_count + tree->inner_count;
+  double * persite_ref = (double *)xmalloc(N_SITES * sizeof(double));
+  double * persite_fused = (double *)xmalloc(N_SITES * sizeof(double));
+
+  for (k = 0; k < 4; ++k)
+  {
+    unsigned int attr = attributes;
+    unsigned int thread_count = (k & 2) ? 3 : 1;
+    if (k & 1)
+      attr |= PLL_ATTRIB_RATE_SCALERS;
+
+    pll_partition_t * reference = fixture_partition(fixture,
+                                                    N_STATES_NT,
+                                                    N_SITES,
+                                                    attr,
+                                                    pattern);
+    pll_partition_t * partition = fixture_partition(fixture,
+                                                    N_STATES_NT,
+                                                    N_SITES,
+                                                    attr,
+                                                    pattern);
+    pll_set_thread_count(reference, thread_count);
+    pll_set_thread_count(partition, thread_count);
+
+    /* fuse the last operation towards every directed edge of the tree */
+    for (i = tree->tip_count; i < nodes_count; ++i)
+    {
+      pll_unode_t * node = tree->nodes[i];
+      for (j = 0; j < 3; ++j, node = node->next)
+      {
+        unsigned int ops_count = fixture_operations(fixture, reference, node);
+        fixture_operations(fixture, partition, node);
+        const pll_operation_t * last = operations + ops_count - 1;
+
+        pll_update_partials(reference, operations, ops_count);
+        double ref_lnl = fixture_loglikelihood(reference, node, persite_ref);
+
+        pll_update_partials(partition, operations, ops_count - 1);
+        double lnl =
+          pll_compute_edge_loglikelihood_fused(partition,
+                                               last,
+                                               node->back->clv_index,
+                                               node->back->scaler_index,
+                                               node->pmatrix_index,
+                                               fixture_params_indices,
+                                               persite_fused);
+
+        int ok = fabs(lnl - ref_lnl) < EPSILON;
+        for (s = 0; s < N_SITES; ++s)
+          if (fabs(persite_fused[s] - persite_ref[s]) > EPSILON)
+            ok = 0;
+
+        ++checks;
+        if (!ok)
+        {
+          ++fails;
+          printf("FAIL at CLV %u: %f %f\n", node->clv_index, lnl, ref_lnl);
+        }
+      }
+    }
+
+    printf("%s, %u thread%s: %u edges, %u failed\n",
+           (k & 1) ? "rate scalers" : "site scalers",
+           thread_count,
+           thread_count > 1 ? "s" : "",
+           checks, fails);
+    checks = fails = 0;
+
+    pll_partition_destroy(reference);
+    pll_partition_destroy(partition);
+  }
+
+  fixture_destroy(fixture);
+  free(persite_ref);
+  free(persite_fused);
+
+  return (0);
+}
@@ -0,0 +1,119 @@
+/*
+    Copyright (C) 2015-2020 Diego Darriba, Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+#include "common.h"
+#include <math.h>
+
+#define N_STATES_NT 4
+#define N_SITES 97
+#define EPSILON 1e-9
+
+static fixture_t * fixture;
+static pll_unode_t * root;
+
+static unsigned int pattern(unsigned int states,
+                            unsigned int tip,
+                            unsigned int site)
+{
+  return tip*site + 3*site + tip/2;
+}
+
+static pll_partition_t * create_partition(unsigned int attributes)
+{
+  pll_partition_t * partition = fixture_partition(fixture,
+                                                  N_STATES_NT,
+                                                  N_SITES,
+                                                  attributes,
+                                                  pattern);
+  fixture_operations(fixture, partition, root);
+  return partition;
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int slots, i;
+  double ref_lnl, lnl;
+
+  /* check attributes */
+  unsigned int attributes = get_attributes(argc, argv);
+
+  if (attributes & PLL_ATTRIB_SITE_REPEATS)
+    skip_test();
+
+  fixture = fixture_create(fixture_newick);
+  pll_utree_t * tree = fixture->tree;
+  pll_operation_t * operations = fixture->operations;
+  root = tree->nodes[tree->tip_count + tree->inner_count - 1];
+
+  pll_partition_t * reference = create_partition(attributes);
+  pll_update_partials(reference, operations, fixture->ops_count);
+  ref_lnl = fixture_loglikelihood(reference, root, NULL);
+  printf("Reference logL: %.6f\n", ref_lnl);
+
+  for (slots = 2; slots <= tree->inner_count; ++slots)
+  {
+    pll_partition_t * partition = create_partition(attributes |
+                                                   PLL_ATTRIB_LIMIT_MEMORY);
+
+    printf("slots %2u: ", slots);
+    if (!pll_set_clv_slots(partition, slots))
+    {
+      printf("set slots failed (%d)\n", pll_errno);
+      pll_partition_destroy(partition);
+      continue;
+    }
+
+    if (!pll_update_partials(partition, operations, fixture->ops_count))
+    {
+      lnl = fixture_loglikelihood(partition, root, NULL);
+      printf("update failed (%d), logL %s",
+             pll_errno, isinf(lnl) ? "-inf" : "finite");
+
+      /* with enough slots the same operations succeed */
+      pll_set_clv_slots(partition, tree->inner_count);
+      if (!pll_update_partials(partition, operations, fixture->ops_count))
+        fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+      lnl = fixture_loglikelihood(partition, root, NULL);
+      printf("  retry %s\n", fabs(lnl - ref_lnl) < EPSILON ? "OK" : "FAIL");
+      pll_partition_destroy(partition);
+      continue;
+    }
+
+    lnl = fixture_loglikelihood(partition, root, NULL);
+    printf("logL %s", fabs(lnl - ref_lnl) < EPSILON ? "OK" : "FAIL");
+
+    /* evaluate again: the CLVs of the root edge are read a second time */
+    lnl = fixture_loglikelihood(partition, root, NULL);
+    printf("  again %s", fabs(lnl - ref_lnl) < EPSILON ? "OK" : "FAIL");
+
+    /* no more CLVs are kept than there are slots */
+    unsigned int resident = 0;
+    for (i = tree->tip_count; i < tree->tip_count + tree->inner_count; ++i)
+      resident += pll_clv_resident(partition, i) ? 1 : 0;
+    printf("  resident %s\n", resident <= slots ? "OK" : "FAIL");
+
+    pll_partition_destroy(partition);
+  }
+
+  pll_partition_destroy(reference);
+  fixture_destroy(fixture);
+
+  return (0);
+}
@@ -0,0 +1,167 @@
+/*
+    Copyright (C) 2015-2020 Diego Darriba, Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+#include "common.h"
+#include <math.h>
+
+#define N_PARTITIONS 5
+#define EPSILON 1e-9
+
+/* partitions of different size, data type and scaling mode */
+static unsigned int sites[N_PARTITIONS]  = { 7, 1000, 61, 333, 2050 };
+static unsigned int states[N_PARTITIONS] = { 4, 4, 20, 20, 4 };
+static double alphas[N_PARTITIONS] = { 0.5, 1.0, 0.3, 2.0, 0.1 };
+static unsigned int rate_scalers[N_PARTITIONS] = { 0, 1, 0, 1, 0 };
+static unsigned int pool_threads[] = { 0, 1, 2, 4 };
+
+static fixture_t * fixture;
+static pll_unode_t * root;
+static unsigned int pattern_index;
+
+/* shifted by the partition index, such that the partitions differ */
+static unsigned int pattern(unsigned int states,
+                            unsigned int tip,
+                            unsigned int site)
+{
+  return tip*site + 3*site + tip/2 + pattern_index;
+}
+
+static pll_partition_t * create_partition(unsigned int index,
+                                          unsigned int attributes)
+{
+  double rate_cats[FIXTURE_RATE_CATS];
+
+  if (rate_scalers[index])
+    attributes |= PLL_ATTRIB_RATE_SCALERS;
+
+  pattern_index = index;
+  pll_partition_t * partition = fixture_partition(fixture,
+                                                  states[index],
+                                                  sites[index],
+                                                  attributes,
+                                                  pattern);
+
+  pll_compute_gamma_cats(alphas[index],
+                         FIXTURE_RATE_CATS,
+                         rate_cats,
+                         PLL_GAMMA_RATES_MEAN);
+  pll_set_category_rates(partition, rate_cats);
+
+  fixture_operations(fixture, partition, root);
+
+  return partition;
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i, p, s;
+  pll_partition_t * partitions[N_PARTITIONS];
+  pll_partition_task_t tasks[N_PARTITIONS];
+  double * persite_ref[N_PARTITIONS];
+  double ref_lnl[N_PARTITIONS];
+  double partition_lnl[N_PARTITIONS];
+  double ref_total = 0;
+
+  /* check attributes */
+  unsigned int attributes = get_attributes(argc, argv);
+
+  fixture = fixture_create(fixture_newick);
+  root = fixture->tree->nodes[fixture->tree->tip_count +
+                              fixture->tree->inner_count - 1];
+
+  /* serial evaluation */
+  for (p = 0; p < N_PARTITIONS; ++p)
+  {
+    partitions[p] = create_partition(p, attributes);
+    persite_ref[p] = (double *)xmalloc(sites[p] * sizeof(double));
+
+    pll_update_partials(partitions[p],
+                        fixture->operations,
+                        fixture->ops_count);
+    ref_lnl[p] = fixture_loglikelihood(partitions[p], root, persite_ref[p]);
+    ref_total += ref_lnl[p];
+    printf("partition %u: %4u sites, %2u states, logL %.4f\n",
+           p, sites[p], states[p], ref_lnl[p]);
+  }
+  printf("total logL: %.4f\n", ref_total);
+
+  for (p = 0; p < N_PARTITIONS; ++p)
+  {
+    tasks[p].partition = partitions[p];
+    tasks[p].operations = fixture->operations;
+    tasks[p].operations_count = fixture->ops_count;
+    tasks[p].parent_clv_index = root->clv_index;
+    tasks[p].parent_scaler_index = root->scaler_index;
+    tasks[p].child_clv_index = root->back->clv_index;
+    tasks[p].child_scaler_index = root->back->scaler_index;
+    tasks[p].matrix_index = root->pmatrix_index;
+    tasks[p].freqs_indices = fixture_params_indices;
+    tasks[p].persite_lnl = (double *)xmalloc(sites[p] * sizeof(double));
+  }
+
+  /* the same partitions evaluated together, without a pool and on pools of
+     different size */
+  for (i = 0; i < sizeof(pool_threads) / sizeof(unsigned int); ++i)
+  {
+    pll_thread_pool_t * pool = NULL;
+    int ok = 1;
+
+    if (pool_threads[i])
+    {
+      pool = pll_thread_pool_create(pool_threads[i]);
+      if (!pool)
+        fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+    }
+
+    double total = pll_compute_partitions_loglikelihood(pool,
+                                                        tasks,
+                                                        N_PARTITIONS,
+                                                        partition_lnl);
+
+    if (fabs(total - ref_total) > EPSILON)
+      ok = 0;
+    for (p = 0; p < N_PARTITIONS; ++p)
+    {
+      if (fabs(partition_lnl[p] - ref_lnl[p]) > EPSILON)
+        ok = 0;
+      for (s = 0; s < sites[p]; ++s)
+        if (fabs(tasks[p].persite_lnl[s] - persite_ref[p][s]) > EPSILON)
+          ok = 0;
+    }
+
+    if (pool)
+      printf("pool of %u threads: %s\n", pool_threads[i], ok ? "OK" : "FAIL");
+    else
+      printf("no pool: %s\n", ok ? "OK" : "FAIL");
+
+    if (pool)
+      pll_thread_pool_destroy(pool);
+  }
+
+  for (p = 0; p < N_PARTITIONS; ++p)
+  {
+    pll_partition_destroy(partitions[p]);
+    free(tasks[p].persite_lnl);
+    free(persite_ref[p]);
+  }
+  fixture_destroy(fixture);
+
+  return (0);
+}
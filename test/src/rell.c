@@ -0,0 +1,182 @@
+/*
+    Copyright (C) 2015-2020 Diego Darriba, Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+#include "common.h"
+#include <math.h>
+
+#define N_STATES_NT 4
+#define N_SITES 257
+#define N_REPLICATES 9
+#define EPSILON 1e-8
+
+static fixture_t * fixture;
+static pll_unode_t * root;
+static double root_branch_length;
+
+/* no constant sites and no gaps, such that the Lewis correction is well
+   defined */
+static unsigned int pattern(unsigned int states,
+                            unsigned int tip,
+                            unsigned int site)
+{
+  return (tip < 2 ? tip + site : tip*site + 3*site + tip/2) % 4;
+}
+
+static pll_partition_t * create_partition(unsigned int attributes)
+{
+  pll_partition_t * partition = fixture_partition(fixture,
+                                                  N_STATES_NT,
+                                                  N_SITES,
+                                                  attributes,
+                                                  pattern);
+  fixture_operations(fixture, partition, root);
+  root_branch_length = root->length;
+
+  return partition;
+}
+
+static int close_to(double a, double b)
+{
+  return fabs(a - b) <= EPSILON * fmax(1.0, fabs(b));
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int r, s, k;
+  unsigned int * weights;
+  unsigned int ones[N_SITES];
+  double edge_lnl[N_REPLICATES];
+  double root_lnl[N_REPLICATES];
+  double d_f[N_REPLICATES];
+  double dd_f[N_REPLICATES];
+
+  /* check attributes */
+  unsigned int attributes = get_attributes(argc, argv);
+
+  fixture = fixture_create(fixture_newick);
+  root = fixture->tree->nodes[fixture->tree->tip_count +
+                              fixture->tree->inner_count - 1];
+
+  /* replicate 0 keeps every site once, the others resample them */
+  weights = (unsigned int *)xmalloc(N_REPLICATES * N_SITES *
+                                    sizeof(unsigned int));
+  for (r = 0; r < N_REPLICATES; ++r)
+    for (s = 0; s < N_SITES; ++s)
+      weights[r*N_SITES + s] = r ? (r*s*7 + s/3 + r) % 4 : 1;
+  for (s = 0; s < N_SITES; ++s)
+    ones[s] = 1;
+
+  pll_partition_t * partition = create_partition(attributes |
+                                                 PLL_ATTRIB_AB_FLAG);
+  double * sumtable = pll_aligned_alloc((partition->sites + partition->states) *
+                                        partition->rate_cats *
+                                        partition->states_padded *
+                                        sizeof(double),
+                                        partition->alignment);
+
+  for (k = 0; k < 2; ++k)
+  {
+    unsigned int edge_fails = 0, root_fails = 0, deriv_fails = 0;
+
+    pll_set_asc_bias_type(partition, k ? PLL_ATTRIB_AB_LEWIS : 0);
+    pll_update_partials(partition, fixture->operations, fixture->ops_count);
+    pll_update_sumtable(partition,
+                        root->clv_index,
+                        root->back->clv_index,
+                        root->scaler_index,
+                        root->back->scaler_index,
+                        fixture_params_indices,
+                        sumtable);
+
+    if (!pll_compute_edge_loglikelihood_replicates(partition,
+                                                   root->clv_index,
+                                                   root->scaler_index,
+                                                   root->back->clv_index,
+                                                   root->back->scaler_index,
+                                                   root->pmatrix_index,
+                                                   fixture_params_indices,
+                                                   weights,
+                                                   N_REPLICATES,
+                                                   edge_lnl) ||
+        !pll_compute_root_loglikelihood_replicates(partition,
+                                                   root->clv_index,
+                                                   root->scaler_index,
+                                                   fixture_params_indices,
+                                                   weights,
+                                                   N_REPLICATES,
+                                                   root_lnl) ||
+        !pll_compute_likelihood_derivatives_replicates(partition,
+                                                       root->scaler_index,
+                                                       root->back->scaler_index,
+                                                       root_branch_length,
+                                                       fixture_params_indices,
+                                                       sumtable,
+                                                       weights,
+                                                       N_REPLICATES,
+                                                       d_f,
+                                                       dd_f))
+      fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+
+    /* each replicate evaluated on its own with the weights as pattern
+       weights */
+    for (r = 0; r < N_REPLICATES; ++r)
+    {
+      double ref_d_f, ref_dd_f;
+
+      pll_set_pattern_weights(partition, weights + r*N_SITES);
+
+      double ref_edge = fixture_loglikelihood(partition, root, NULL);
+      double ref_root = pll_compute_root_loglikelihood(partition,
+                                                       root->clv_index,
+                                                       root->scaler_index,
+                                                       fixture_params_indices,
+                                                       NULL);
+      pll_compute_likelihood_derivatives(partition,
+                                         root->scaler_index,
+                                         root->back->scaler_index,
+                                         root_branch_length,
+                                         fixture_params_indices,
+                                         sumtable,
+                                         &ref_d_f,
+                                         &ref_dd_f);
+
+      if (!close_to(edge_lnl[r], ref_edge))
+        ++edge_fails;
+      if (!close_to(root_lnl[r], ref_root))
+        ++root_fails;
+      if (!close_to(d_f[r], ref_d_f) || !close_to(dd_f[r], ref_dd_f))
+        ++deriv_fails;
+
+      if (!r)
+        printf("%-10s logL %.6f\n", k ? "Lewis:" : "no asc:", ref_edge);
+    }
+    pll_set_pattern_weights(partition, ones);
+
+    printf("  %u replicates: edge %u, root %u, derivatives %u failed\n",
+           N_REPLICATES, edge_fails, root_fails, deriv_fails);
+  }
+
+  pll_aligned_free(sumtable);
+  pll_partition_destroy(partition);
+  fixture_destroy(fixture);
+  free(weights);
+
+  return (0);
+}
@@ -0,0 +1,132 @@
+/*
+    Copyright (C) 2015-2020 Diego Darriba, Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+#include "common.h"
+#include <math.h>
+
+#define N_STATES_NT 4
+#define N_SITES 173
+#define N_ROUNDS 5
+#define N_SAMPLES 6
+#define EPSILON 1e-9
+
+static fixture_t * fixture;
+
+/* few site patterns, such that the nodes have repeats */
+static unsigned int pattern(unsigned int states,
+                            unsigned int tip,
+                            unsigned int site)
+{
+  return (tip/3)*(site%11) + (site*site)/97 + tip/2;
+}
+
+static pll_partition_t * create_partition(unsigned int attributes)
+{
+  return fixture_partition(fixture, N_STATES_NT, N_SITES, attributes, pattern);
+}
+
+/* full traversal towards the edge of root and its log-likelihood */
+static double loglikelihood(pll_partition_t * partition, pll_unode_t * root)
+{
+  unsigned int ops_count = fixture_operations(fixture, partition, root);
+
+  if (!pll_update_partials(partition, fixture->operations, ops_count))
+    fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+
+  return fixture_loglikelihood(partition, root, NULL);
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int r;
+  unsigned int updates = 0;
+  pll_repeats_adaptive_stats_t stats;
+
+  /* check attributes. Site repeats are not combined with tip patterns */
+  unsigned int attributes = (get_attributes(argc, argv) &
+                             ~PLL_ATTRIB_PATTERN_TIP) |
+                            PLL_ATTRIB_SITE_REPEATS;
+
+  fixture = fixture_create(fixture_newick);
+  pll_utree_t * tree = fixture->tree;
+
+  /* the adaptive policy requires site repeats */
+  pll_partition_t * plain = create_partition(attributes &
+                                             ~PLL_ATTRIB_SITE_REPEATS);
+  printf("without site repeats: %s\n",
+         !pll_repeats_set_adaptive(plain, N_SAMPLES) &&
+         pll_errno == PLL_ERROR_PARAM_INVALID ? "rejected" : "accepted");
+
+  pll_partition_t * reference = create_partition(attributes);
+  pll_partition_t * partition = create_partition(attributes);
+
+  printf("stats before enabling: %s\n",
+         pll_repeats_adaptive_stats(partition, &stats) ? "available" :
+                                                         "unavailable");
+
+  if (!pll_repeats_set_adaptive(partition, N_SAMPLES))
+    fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+
+  /* the decisions only affect the speed, never the log-likelihood */
+  for (r = 0; r < N_ROUNDS; ++r)
+  {
+    pll_unode_t * root = tree->nodes[tree->tip_count +
+                                     (3 * r) % tree->inner_count];
+    double ref_lnl = loglikelihood(plain, root);
+    double lnl = loglikelihood(partition, root);
+    double rep_lnl = loglikelihood(reference, root);
+
+    updates += tree->inner_count;
+    printf("round %u: logL %.6f, adaptive %s, repeats %s\n",
+           r,
+           ref_lnl,
+           fabs(lnl - ref_lnl) < EPSILON * fabs(ref_lnl) ? "OK" : "FAIL",
+           fabs(rep_lnl - ref_lnl) < EPSILON * fabs(ref_lnl) ? "OK" : "FAIL");
+  }
+
+  if (!pll_repeats_adaptive_stats(partition, &stats))
+    fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+
+  /* every node update is timed; the first decisions alternate */
+  printf("samples %s, decisions %s, sampled both modes %s, calibrated %s, "
+         "break-even %s\n",
+         stats.samples_plain + stats.samples_repeats == updates ? "OK" : "FAIL",
+         stats.decisions_plain + stats.decisions_repeats >= N_SAMPLES &&
+         stats.decisions_plain + stats.decisions_repeats <= updates ?
+           "OK" : "FAIL",
+         stats.decisions_plain >= N_SAMPLES / 2 &&
+         stats.decisions_repeats >= N_SAMPLES / 2 ? "OK" : "FAIL",
+         stats.calibrated ? "yes" : "no",
+         stats.break_even >= 0 && stats.break_even <= 1 ? "OK" : "FAIL");
+
+  pll_repeats_adaptive_destroy(partition);
+  printf("after destroy: stats %s, default policy %s\n",
+         pll_repeats_adaptive_stats(partition, &stats) ? "available" :
+                                                         "unavailable",
+         partition->repeats->enable_repeats == pll_default_enable_repeats ?
+           "OK" : "FAIL");
+
+  pll_partition_destroy(plain);
+  pll_partition_destroy(reference);
+  pll_partition_destroy(partition);
+  fixture_destroy(fixture);
+
+  return (0);
+}
@@ -0,0 +1,145 @@
+/*
+    Copyright (C) 2015-2020 Diego Darriba, Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+#include "common.h"
+#include <math.h>
+
+#define N_STATES_NT 4
+#define N_SITES 157
+#define N_MOVES 12
+#define EPSILON 1e-9
+
+static fixture_t * fixture;
+
+/* few site patterns, such that the nodes have repeats */
+static unsigned int pattern(unsigned int states,
+                            unsigned int tip,
+                            unsigned int site)
+{
+  return (tip/3)*(site%13) + site/29 + tip/2;
+}
+
+static pll_partition_t * create_partition(unsigned int attributes)
+{
+  return fixture_partition(fixture, N_STATES_NT, N_SITES, attributes, pattern);
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i, m, k;
+  unsigned int ops_count;
+  unsigned int dirty[5];
+  unsigned int dirty_count;
+  unsigned int updated;
+  pll_utree_rb_t rb;
+
+  /* check attributes. Site repeats are not combined with tip patterns */
+  unsigned int attributes = (get_attributes(argc, argv) &
+                             ~PLL_ATTRIB_PATTERN_TIP) |
+                            PLL_ATTRIB_SITE_REPEATS;
+
+  fixture = fixture_create(fixture_newick);
+  pll_utree_t * tree = fixture->tree;
+  pll_operation_t * operations = fixture->operations;
+
+  /* classes recomputed for every operation */
+  pll_partition_t * full = create_partition(attributes);
+  /* classes updated incrementally */
+  pll_partition_t * partition = create_partition(attributes);
+
+  pll_unode_t * root = tree->nodes[tree->tip_count + tree->inner_count - 1];
+  dirty_count = 0;
+
+  for (m = 0; m <= N_MOVES; ++m)
+  {
+    int ok = 1;
+
+    if (m)
+    {
+      /* NNI at the m-th inner edge, undone every third move */
+      pll_unode_t * p = tree->nodes[tree->tip_count + m % tree->inner_count];
+      while (!p->back->next)
+        p = p->next;
+
+      if (m % 3 == 0)
+      {
+        if (!pll_utree_rollback(&rb, NULL, NULL))
+          fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+        printf("rollback  ");
+      }
+      else
+      {
+        if (!pll_utree_nni(p, (m & 1) ? PLL_UTREE_MOVE_NNI_LEFT :
+                                        PLL_UTREE_MOVE_NNI_RIGHT, &rb))
+          fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+        printf("nni %s ", (m & 1) ? "left " : "right");
+      }
+      dirty_count = pll_utree_rb_clv_indices(&rb, dirty);
+
+      /* evaluate at another edge from time to time */
+      if (m % 4 == 0)
+        root = tree->nodes[tree->tip_count + (m / 4) % tree->inner_count];
+    }
+    else
+      printf("initial   ");
+
+    ops_count = fixture_operations(fixture, full, root);
+    pll_update_prob_matrices(partition,
+                             fixture_params_indices,
+                             fixture->matrix_indices,
+                             fixture->branch_lengths,
+                             fixture->matrix_count);
+
+    if (!pll_update_partials(full, operations, ops_count))
+      fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+
+    updated = pll_update_repeats_incremental(partition,
+                                             operations,
+                                             ops_count,
+                                             dirty,
+                                             dirty_count);
+    if (!pll_update_partials_rep(partition, operations, ops_count, 0))
+      fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+
+    /* the classes of the inner nodes match those of full updates */
+    for (k = 0; k < ops_count; ++k)
+    {
+      i = operations[k].parent_clv_index;
+      if (pll_get_sites_number(partition, i) != pll_get_sites_number(full, i))
+        ok = 0;
+    }
+
+    double ref_lnl = fixture_loglikelihood(full, root, NULL);
+    double lnl = fixture_loglikelihood(partition, root, NULL);
+
+    printf("updated %2u of %2u nodes: logL %.6f, classes %s, logL %s\n",
+           updated,
+           ops_count,
+           ref_lnl,
+           ok ? "OK" : "FAIL",
+           fabs(lnl - ref_lnl) < EPSILON * fabs(ref_lnl) ? "OK" : "FAIL");
+  }
+
+  pll_partition_destroy(full);
+  pll_partition_destroy(partition);
+  fixture_destroy(fixture);
+
+  return (0);
+}
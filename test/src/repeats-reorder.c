@@ -0,0 +1,206 @@
+/*
+    Copyright (C) 2015-2020 Diego Darriba, Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+#include "common.h"
+#include <math.h>
+
+#define N_STATES_NT 4
+#define N_SITES 173
+#define EPSILON 1e-9
+
+static char nt_alphabet[] = "ACGT-";
+
+static fixture_t * fixture;
+static pll_unode_t * root;
+
+/* few site patterns, such that the tips have repeats */
+static unsigned int pattern(unsigned int states,
+                            unsigned int tip,
+                            unsigned int site)
+{
+  return (tip/3)*(site%11) + (site*site)/97 + tip/2;
+}
+
+static void set_tip(pll_partition_t * partition, unsigned int tip, unsigned int shift)
+{
+  unsigned int j;
+  char seq[N_SITES+1];
+
+  for (j = 0; j < N_SITES; ++j)
+    seq[j] = nt_alphabet[(pattern(N_STATES_NT, tip, j) + shift) % 5];
+  seq[N_SITES] = 0;
+  if (!pll_set_tip_states(partition,
+                          fixture->tree->nodes[tip]->clv_index,
+                          pll_map_nt,
+                          seq))
+    fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+}
+
+/* tip_count is 0 for the original site order, or the number of entries of
+   tip_order (all tips if tip_order is NULL) */
+static pll_partition_t * create_partition(unsigned int attributes,
+                                          const unsigned int * tip_order,
+                                          unsigned int tip_count)
+{
+  unsigned int i;
+  unsigned int weights[N_SITES];
+
+  pll_partition_t * partition = fixture_partition(fixture,
+                                                  N_STATES_NT,
+                                                  N_SITES,
+                                                  attributes,
+                                                  pattern);
+
+  if (tip_count && !pll_repeats_reorder_sites(partition, tip_order, tip_count))
+    fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+
+  /* states and weights are given in the original order of the sites */
+  set_tip(partition, 4, 1);
+  for (i = 0; i < N_SITES; ++i)
+    weights[i] = 1 + (i % 3);
+  pll_set_pattern_weights(partition, weights);
+
+  fixture_operations(fixture, partition, root);
+  if (!pll_update_partials(partition,
+                           fixture->operations,
+                           fixture->ops_count))
+    fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+
+  return partition;
+}
+
+/* log-likelihood, derivatives, per-site log-likelihoods and ancestral
+   states at the root edge */
+static void evaluate(pll_partition_t * partition, double * values)
+{
+  double * sumtable = pll_aligned_alloc(partition->sites *
+                                        partition->rate_cats *
+                                        partition->states_padded *
+                                        sizeof(double),
+                                        partition->alignment);
+
+  values[0] = fixture_loglikelihood(partition, root, values + 3);
+  pll_update_sumtable(partition,
+                      root->clv_index,
+                      root->back->clv_index,
+                      root->scaler_index,
+                      root->back->scaler_index,
+                      fixture_params_indices,
+                      sumtable);
+  pll_compute_likelihood_derivatives(partition,
+                                     root->scaler_index,
+                                     root->back->scaler_index,
+                                     root->length,
+                                     fixture_params_indices,
+                                     sumtable,
+                                     values + 1,
+                                     values + 2);
+  if (!pll_compute_node_ancestral(partition,
+                                  root->clv_index,
+                                  root->scaler_index,
+                                  root->back->clv_index,
+                                  root->back->scaler_index,
+                                  root->pmatrix_index,
+                                  fixture_params_indices,
+                                  values + 3 + N_SITES))
+    fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+
+  pll_aligned_free(sumtable);
+}
+
+static int compare(const double * values,
+                   const double * ref_values,
+                   unsigned int begin,
+                   unsigned int end)
+{
+  unsigned int i;
+
+  for (i = begin; i < end; ++i)
+    if (fabs(values[i] - ref_values[i]) > EPSILON * fmax(1, fabs(ref_values[i])))
+      return 0;
+
+  return 1;
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int i, k;
+  unsigned int count = 3 + N_SITES + N_SITES * N_STATES_NT;
+  unsigned int tip_order[3] = { 11, 3, 7 };
+  unsigned int bad_order[2] = { 0, 12 };
+
+  /* check attributes. Site repeats are not combined with tip patterns */
+  unsigned int attributes = (get_attributes(argc, argv) &
+                             ~PLL_ATTRIB_PATTERN_TIP) |
+                            PLL_ATTRIB_SITE_REPEATS;
+
+  fixture = fixture_create(fixture_newick);
+  pll_utree_t * tree = fixture->tree;
+
+  unsigned int nodes_count = tree->tip_count + tree->inner_count;
+  root = tree->nodes[nodes_count - 1];
+
+  double * ref_values = (double *)xmalloc(count * sizeof(double));
+  double * values = (double *)xmalloc(count * sizeof(double));
+
+  pll_partition_t * reference = create_partition(attributes, NULL, 0);
+  evaluate(reference, ref_values);
+  printf("Reference logL: %.6f\n", ref_values[0]);
+
+  for (k = 0; k < 2; ++k)
+  {
+    unsigned int classes = 0;
+    unsigned int ref_classes = 0;
+    pll_partition_t * partition = create_partition(attributes,
+                                                   k ? tip_order : NULL,
+                                                   k ? 3 : tree->tip_count);
+    evaluate(partition, values);
+
+    /* reordering does not change the number of classes */
+    for (i = tree->tip_count; i < nodes_count; ++i)
+    {
+      classes += pll_get_sites_number(partition, i);
+      ref_classes += pll_get_sites_number(reference, i);
+    }
+
+    printf("%s: logL %s, derivatives %s, per-site %s, ancestral %s, "
+           "classes %s\n",
+           k ? "tips 11,3,7" : "all tips   ",
+           compare(values, ref_values, 0, 1) ? "OK" : "FAIL",
+           compare(values, ref_values, 1, 3) ? "OK" : "FAIL",
+           compare(values, ref_values, 3, 3 + N_SITES) ? "OK" : "FAIL",
+           compare(values, ref_values, 3 + N_SITES, count) ? "OK" : "FAIL",
+           classes == ref_classes ? "OK" : "FAIL");
+
+    if (k)
+      printf("invalid tip order %s\n",
+             !pll_repeats_reorder_sites(partition, bad_order, 2) &&
+             pll_errno == PLL_ERROR_PARAM_INVALID ? "rejected" : "accepted");
+
+    pll_partition_destroy(partition);
+  }
+
+  pll_partition_destroy(reference);
+  fixture_destroy(fixture);
+  free(ref_values);
+  free(values);
+
+  return (0);
+}
@@ -0,0 +1,146 @@
+/*
+    Copyright (C) 2015-2020 Diego Darriba, Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+#include "common.h"
+#include <math.h>
+
+#define N_STATES_NT 4
+#define N_SITES 173
+
+static fixture_t * fixture;
+
+/* few site patterns, such that the nodes have repeats */
+static unsigned int pattern(unsigned int states,
+                            unsigned int tip,
+                            unsigned int site)
+{
+  return (tip/3)*(site%11) + (site*site)/97 + tip/2;
+}
+
+static pll_partition_t * create_partition(unsigned int attributes)
+{
+  return fixture_partition(fixture, N_STATES_NT, N_SITES, attributes, pattern);
+}
+
+/* full traversal towards the edge of root and its log-likelihood */
+static double loglikelihood(pll_partition_t * partition, pll_unode_t * root)
+{
+  unsigned int ops_count = fixture_operations(fixture, partition, root);
+
+  if (!pll_update_partials(partition, fixture->operations, ops_count))
+    fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+
+  return fixture_loglikelihood(partition, root, NULL);
+}
+
+/* the node figures of pll_repeats_stats() agree with those of the nodes */
+static void check_nodes(pll_partition_t * partition)
+{
+  unsigned int i;
+  unsigned int nodes = 0;
+  unsigned int compressed = 0;
+  size_t bytes = 0;
+  int ok = 1;
+  pll_repeats_stats_t stats;
+  pll_repeats_node_stats_t node;
+
+  if (!pll_repeats_stats(partition, &stats))
+    fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+
+  for (i = fixture->tree->tip_count; i < partition->nodes; ++i)
+  {
+    if (!pll_repeats_node_stats(partition, i, &node))
+      fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+
+    bytes += node.bytes;
+    nodes += node.updates ? 1 : 0;
+    compressed += (node.updates && node.classes) ? 1 : 0;
+    if (node.classes && (node.sites != node.classes ||
+                         node.sites != pll_get_sites_number(partition, i) ||
+                         node.capacity < node.sites))
+      ok = 0;
+  }
+
+  printf("node stats %s\n",
+         ok && nodes == stats.nodes && compressed == stats.compressed &&
+         bytes == stats.clv_bytes ? "OK" : "FAIL");
+}
+
+int main(int argc, char * argv[])
+{
+  pll_repeats_stats_t stats;
+  pll_repeats_node_stats_t node;
+  pll_utree_rb_t rb;
+
+  /* check attributes. Site repeats are not combined with tip patterns */
+  unsigned int attributes = (get_attributes(argc, argv) &
+                             ~PLL_ATTRIB_PATTERN_TIP) |
+                            PLL_ATTRIB_SITE_REPEATS;
+
+  fixture = fixture_create(fixture_newick);
+  pll_utree_t * tree = fixture->tree;
+
+  unsigned int nodes_count = tree->tip_count + tree->inner_count;
+  pll_unode_t * root = tree->nodes[nodes_count - 1];
+
+  /* statistics require site repeats */
+  pll_partition_t * plain = create_partition(attributes &
+                                             ~PLL_ATTRIB_SITE_REPEATS);
+  printf("without site repeats: %s\n",
+         !pll_repeats_stats(plain, &stats) &&
+         pll_errno == PLL_ERROR_PARAM_INVALID ? "rejected" : "accepted");
+  pll_partition_destroy(plain);
+
+  pll_partition_t * partition = create_partition(attributes);
+
+  printf("invalid CLV index: %s\n",
+         !pll_repeats_node_stats(partition, nodes_count, &node) &&
+         pll_errno == PLL_ERROR_PARAM_INVALID ? "rejected" : "accepted");
+
+  printf("\nTips only\n");
+  pll_show_repeats_stats(partition);
+  check_nodes(partition);
+
+  printf("\nFull traversal, logL %.6f\n", loglikelihood(partition, root));
+  pll_show_repeats_stats(partition);
+  check_nodes(partition);
+
+  /* a move changes the classes of some of the nodes */
+  pll_unode_t * p = tree->nodes[tree->tip_count + 2];
+  while (!p->back->next)
+    p = p->next;
+  if (!pll_utree_nni(p, PLL_UTREE_MOVE_NNI_LEFT, &rb))
+    fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+  printf("\nNNI and full traversal, logL %.6f\n",
+         loglikelihood(partition, root));
+  pll_show_repeats_stats(partition);
+  check_nodes(partition);
+
+  /* the counters are reset, the figures of the nodes are kept */
+  pll_repeats_reset_stats(partition);
+  printf("\nReset\n");
+  pll_show_repeats_stats(partition);
+  check_nodes(partition);
+
+  pll_partition_destroy(partition);
+  fixture_destroy(fixture);
+
+  return (0);
+}
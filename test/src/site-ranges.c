@@ -0,0 +1,146 @@
+/*
+    Copyright (C) 2015-2020 Diego Darriba, Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+#include "common.h"
+#include <math.h>
+
+#define N_STATES_NT 4
+#define N_STATES_AA 20
+#define N_SITES 211
+#define EPSILON 1e-9
+
+/* range boundaries, including an empty range */
+static unsigned int bounds[] = { 0, 1, 17, 17, 64, 130, 131, N_SITES };
+
+static fixture_t * fixture;
+static pll_unode_t * root;
+
+static unsigned int pattern(unsigned int states,
+                            unsigned int tip,
+                            unsigned int site)
+{
+  return tip*site + 3*site + tip/2;
+}
+
+static pll_partition_t * create_partition(unsigned int states,
+                                          unsigned int attributes)
+{
+  pll_partition_t * partition = fixture_partition(fixture,
+                                                  states,
+                                                  N_SITES,
+                                                  attributes,
+                                                  pattern);
+  fixture_operations(fixture, partition, root);
+  return partition;
+}
+
+static void check_ranges(unsigned int states, unsigned int attributes)
+{
+  unsigned int i, r;
+  unsigned int ranges_count = sizeof(bounds) / sizeof(bounds[0]) - 1;
+  double ref_lnl, lnl;
+  double * persite_ref = (double *)xmalloc(N_SITES * sizeof(double));
+  double * persite = (double *)xmalloc(N_SITES * sizeof(double));
+  int ok = 1;
+
+  pll_partition_t * reference = create_partition(states, attributes);
+  pll_partition_t * partition = create_partition(states, attributes);
+  pll_operation_t * operations = fixture->operations;
+  unsigned int ops_count = fixture->ops_count;
+
+  if (!pll_update_partials(reference, operations, ops_count))
+    fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+  ref_lnl = fixture_loglikelihood(reference, root, persite_ref);
+
+  /* ranges are independent: update them last to first */
+  lnl = 0;
+  for (r = ranges_count; r > 0; --r)
+  {
+    if (!pll_update_partials_range(partition,
+                                   operations,
+                                   ops_count,
+                                   bounds[r-1],
+                                   bounds[r]))
+      fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+    lnl += pll_compute_edge_loglikelihood_range(partition,
+                                                bounds[r-1],
+                                                bounds[r],
+                                                root->clv_index,
+                                                root->scaler_index,
+                                                root->back->clv_index,
+                                                root->back->scaler_index,
+                                                root->pmatrix_index,
+                                                fixture_params_indices,
+                                                persite);
+  }
+
+  for (i = 0; i < N_SITES; ++i)
+    if (fabs(persite[i] - persite_ref[i]) > EPSILON * fmax(1, fabs(persite_ref[i])))
+      ok = 0;
+
+  printf("%2u states, %u ranges: logL %.4f, total %s, per-site %s",
+         states,
+         ranges_count,
+         ref_lnl,
+         fabs(lnl - ref_lnl) < EPSILON * fabs(ref_lnl) ? "OK" : "FAIL",
+         ok ? "OK" : "FAIL");
+
+  /* invalid ranges are rejected */
+  printf(", invalid %s\n",
+         (!pll_update_partials_range(partition, operations, ops_count, 5, 4) &&
+          pll_errno == PLL_ERROR_PARAM_INVALID &&
+          isinf(pll_compute_edge_loglikelihood_range(partition,
+                                                     0,
+                                                     N_SITES + 1,
+                                                     root->clv_index,
+                                                     root->scaler_index,
+                                                     root->back->clv_index,
+                                                     root->back->scaler_index,
+                                                     root->pmatrix_index,
+                                                     fixture_params_indices,
+                                                     NULL))) ? "OK" : "FAIL");
+
+  pll_partition_destroy(reference);
+  pll_partition_destroy(partition);
+  free(persite_ref);
+  free(persite);
+}
+
+int main(int argc, char * argv[])
+{
+  /* check attributes */
+  unsigned int attributes = get_attributes(argc, argv);
+
+  if (attributes & PLL_ATTRIB_SITE_REPEATS)
+    skip_test();
+
+  fixture = fixture_create(fixture_newick);
+  root = fixture->tree->nodes[fixture->tree->tip_count +
+                              fixture->tree->inner_count - 1];
+
+  check_ranges(N_STATES_NT, attributes);
+  check_ranges(N_STATES_AA, attributes);
+  check_ranges(N_STATES_NT, attributes | PLL_ATTRIB_RATE_SCALERS);
+  check_ranges(N_STATES_AA, attributes | PLL_ATTRIB_RATE_SCALERS);
+
+  fixture_destroy(fixture);
+
+  return (0);
+}
@@ -0,0 +1,137 @@
+/*
+    Copyright (C) 2015-2020 Diego Darriba, Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+#include "common.h"
+#include <math.h>
+
+#define N_SITES 1013
+#define EPSILON 1e-9
+
+static unsigned int thread_counts[] = { 1, 2, 3, 4, 7 };
+
+static fixture_t * fixture;
+static pll_unode_t * root;
+
+/* blocks of similar columns, such that site repeats find classes */
+static unsigned int pattern(unsigned int states,
+                            unsigned int tip,
+                            unsigned int site)
+{
+  return tip*(site/9) + 3*(site%7) + tip/2;
+}
+
+static pll_partition_t * create_partition(unsigned int states,
+                                          unsigned int attributes)
+{
+  pll_partition_t * partition = fixture_partition(fixture,
+                                                  states,
+                                                  N_SITES,
+                                                  attributes,
+                                                  pattern);
+  fixture_operations(fixture, partition, root);
+  return partition;
+}
+
+/* log-likelihood, per-site log-likelihoods and derivatives at the root */
+static void evaluate(pll_partition_t * partition, double * values)
+{
+  double * sumtable = pll_aligned_alloc(partition->sites *
+                                        partition->rate_cats *
+                                        partition->states_padded *
+                                        sizeof(double),
+                                        partition->alignment);
+
+  pll_update_partials(partition, fixture->operations, fixture->ops_count);
+  values[0] = fixture_loglikelihood(partition, root, values + 3);
+  pll_update_sumtable(partition,
+                      root->clv_index,
+                      root->back->clv_index,
+                      root->scaler_index,
+                      root->back->scaler_index,
+                      fixture_params_indices,
+                      sumtable);
+  pll_compute_likelihood_derivatives(partition,
+                                     root->scaler_index,
+                                     root->back->scaler_index,
+                                     root->length,
+                                     fixture_params_indices,
+                                     sumtable,
+                                     values + 1,
+                                     values + 2);
+
+  pll_aligned_free(sumtable);
+}
+
+static void compare(unsigned int states, unsigned int attributes)
+{
+  unsigned int i, t;
+  unsigned int count = 3 + N_SITES;
+  double * ref_values = (double *)xmalloc(count * sizeof(double));
+  double * values = (double *)xmalloc(count * sizeof(double));
+
+  pll_partition_t * reference = create_partition(states, attributes);
+  evaluate(reference, ref_values);
+  pll_partition_destroy(reference);
+
+  printf("%2u states, %s scalers: logL %.4f, threads",
+         states,
+         (attributes & PLL_ATTRIB_RATE_SCALERS) ? "rate" : "site",
+         ref_values[0]);
+
+  for (t = 0; t < sizeof(thread_counts) / sizeof(unsigned int); ++t)
+  {
+    int ok = 1;
+    pll_partition_t * partition = create_partition(states, attributes);
+
+    if (!pll_set_thread_count(partition, thread_counts[t]))
+      fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+    evaluate(partition, values);
+
+    for (i = 0; i < count; ++i)
+      if (fabs(values[i] - ref_values[i]) > EPSILON * fmax(1, fabs(ref_values[i])))
+        ok = 0;
+
+    printf(" %u %s", thread_counts[t], ok ? "OK" : "FAIL");
+    pll_partition_destroy(partition);
+  }
+  printf("\n");
+
+  free(ref_values);
+  free(values);
+}
+
+int main(int argc, char * argv[])
+{
+  /* check attributes */
+  unsigned int attributes = get_attributes(argc, argv);
+
+  fixture = fixture_create(fixture_newick);
+  root = fixture->tree->nodes[fixture->tree->tip_count +
+                              fixture->tree->inner_count - 1];
+
+  compare(4, attributes);
+  compare(4, attributes | PLL_ATTRIB_RATE_SCALERS);
+  compare(20, attributes);
+  compare(20, attributes | PLL_ATTRIB_RATE_SCALERS);
+
+  fixture_destroy(fixture);
+
+  return (0);
+}
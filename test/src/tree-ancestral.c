@@ -0,0 +1,151 @@
+/*
+    Copyright (C) 2015-2020 Diego Darriba, Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+#include "common.h"
+#include <math.h>
+
+#define N_SITES 83
+#define EPSILON 1e-9
+
+static fixture_t * fixture;
+
+static unsigned int pattern(unsigned int states,
+                            unsigned int tip,
+                            unsigned int site)
+{
+  return tip*site + 3*site + tip/2 + site/5;
+}
+
+static pll_partition_t * create_partition(unsigned int states,
+                                          unsigned int attributes)
+{
+  return fixture_partition(fixture, states, N_SITES, attributes, pattern);
+}
+
+/* all operations of the traversal towards root; returns their number */
+static unsigned int update_partials(pll_partition_t * partition,
+                                    pll_unode_t * root)
+{
+  unsigned int ops_count = fixture_operations(fixture, partition, root);
+
+  pll_update_partials(partition, fixture->operations, ops_count);
+
+  return ops_count;
+}
+
+static void compare(unsigned int states,
+                    unsigned int attributes,
+                    unsigned int thread_count)
+{
+  unsigned int i, j, n;
+  unsigned int span = N_SITES * states;
+  unsigned int fails = 0;
+  double sum_max = 0;
+
+  pll_partition_t * reference = create_partition(states, attributes);
+  pll_partition_t * partition = create_partition(states, attributes);
+  pll_utree_t * tree = fixture->tree;
+  pll_set_thread_count(partition, thread_count);
+
+  double * ref_ancestral = (double *)xmalloc(tree->inner_count * span *
+                                             sizeof(double));
+  double * ancestral = (double *)xmalloc(tree->inner_count * span *
+                                         sizeof(double));
+
+  /* each inner node on its own, with its CLVs oriented towards it */
+  for (i = tree->tip_count; i < tree->tip_count + tree->inner_count; ++i)
+  {
+    pll_unode_t * node = tree->nodes[i];
+    update_partials(reference, node);
+    if (!pll_compute_node_ancestral(reference,
+                                    node->clv_index,
+                                    node->scaler_index,
+                                    node->back->clv_index,
+                                    node->back->scaler_index,
+                                    node->pmatrix_index,
+                                    fixture_params_indices,
+                                    ref_ancestral +
+                                      (node->clv_index - tree->tip_count)*span))
+      fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+  }
+
+  for (i = 0; i < span * tree->inner_count; i += states)
+  {
+    double max = 0;
+    for (j = 0; j < states; ++j)
+      max = fmax(max, ref_ancestral[i+j]);
+    sum_max += max;
+  }
+
+  /* all inner nodes at once, from different roots */
+  for (n = 0; n < 3; ++n)
+  {
+    pll_unode_t * root = tree->nodes[tree->tip_count + n*3];
+
+    update_partials(partition, root);
+    if (!pll_compute_tree_ancestral(partition,
+                                    root,
+                                    fixture_params_indices,
+                                    ancestral))
+      fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+
+    for (i = 0; i < span * tree->inner_count; ++i)
+      if (fabs(ancestral[i] - ref_ancestral[i]) > EPSILON)
+      {
+        ++fails;
+        break;
+      }
+  }
+
+  printf("%2u states, %s scalers, %u thread%s: mean max probability %.6f, %s\n",
+         states,
+         (attributes & PLL_ATTRIB_RATE_SCALERS) ? "rate" : "site",
+         thread_count,
+         thread_count > 1 ? "s" : "",
+         sum_max / (N_SITES * tree->inner_count),
+         fails ? "FAIL" : "OK");
+
+  free(ref_ancestral);
+  free(ancestral);
+  pll_partition_destroy(reference);
+  pll_partition_destroy(partition);
+}
+
+int main(int argc, char * argv[])
+{
+  /* check attributes */
+  unsigned int attributes = get_attributes(argc, argv);
+
+  /* whole-tree reconstruction is not available with site repeats */
+  if (attributes & PLL_ATTRIB_SITE_REPEATS)
+    skip_test();
+
+  fixture = fixture_create(fixture_newick);
+
+  compare(4, attributes, 1);
+  compare(4, attributes | PLL_ATTRIB_RATE_SCALERS, 1);
+  compare(4, attributes, 3);
+  compare(20, attributes, 1);
+  compare(20, attributes, 3);
+
+  fixture_destroy(fixture);
+
+  return (0);
+}
@@ -0,0 +1,191 @@
+/*
+    Copyright (C) 2015-2020 Diego Darriba, Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+#include "common.h"
+#include <math.h>
+
+#define N_SITES 83
+#define EPSILON 1e-8
+
+/* step and tolerance of the central differences */
+#define FD_STEP 1e-4
+#define FD_EPSILON 1e-4
+
+static fixture_t * fixture;
+
+static unsigned int pattern(unsigned int states,
+                            unsigned int tip,
+                            unsigned int site)
+{
+  return tip*site + 3*site + tip/2 + site/5;
+}
+
+/* updates the CLVs towards the edge of root */
+static void update_partials(pll_partition_t * partition, pll_unode_t * root)
+{
+  unsigned int ops_count = fixture_operations(fixture, partition, root);
+
+  pll_update_partials(partition, fixture->operations, ops_count);
+}
+
+/* log-likelihood with the branch of node set to length */
+static double edge_loglikelihood(pll_partition_t * partition,
+                                 pll_unode_t * node,
+                                 double length)
+{
+  update_partials(partition, node);
+  pll_update_prob_matrices(partition,
+                           fixture_params_indices,
+                           &node->pmatrix_index,
+                           &length,
+                           1);
+  return fixture_loglikelihood(partition, node, NULL);
+}
+
+static int close_to(double a, double b, double epsilon)
+{
+  return fabs(a - b) <= epsilon * fmax(1.0, fabs(b));
+}
+
+static void compare(unsigned int states,
+                    unsigned int attributes,
+                    unsigned int thread_count)
+{
+  unsigned int i, j;
+  pll_utree_t * tree = fixture->tree;
+  unsigned int branch_count = 2*tree->tip_count - 3;
+  unsigned int exact_fails = 0, fd_fails = 0;
+  double sum_d_f = 0;
+
+  pll_partition_t * partition = fixture_partition(fixture,
+                                                  states,
+                                                  N_SITES,
+                                                  attributes,
+                                                  pattern);
+  pll_set_thread_count(partition, thread_count);
+
+  double * d_f = (double *)xmalloc(branch_count * sizeof(double));
+  double * dd_f = (double *)xmalloc(branch_count * sizeof(double));
+  int * seen = (int *)calloc(branch_count, sizeof(int));
+  double * sumtable = pll_aligned_alloc(partition->sites *
+                                        partition->rate_cats *
+                                        partition->states_padded *
+                                        sizeof(double),
+                                        partition->alignment);
+
+  pll_unode_t * root = tree->nodes[tree->tip_count + tree->inner_count - 1];
+  update_partials(partition, root);
+  if (!pll_compute_tree_derivatives(partition,
+                                    root,
+                                    fixture_params_indices,
+                                    d_f,
+                                    dd_f))
+    fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+
+  for (i = 0; i < tree->tip_count + tree->inner_count; ++i)
+  {
+    pll_unode_t * node = tree->nodes[i];
+    unsigned int degree = node->next ? 3 : 1;
+    for (j = 0; j < degree; ++j, node = node->next)
+    {
+      /* traversals start at inner nodes */
+      pll_unode_t * edge = node->next ? node : node->back;
+      unsigned int m = edge->pmatrix_index;
+      double length = edge->length;
+      double ref_d_f, ref_dd_f;
+
+      if (seen[m])
+        continue;
+      seen[m] = 1;
+
+      /* the same branch on its own */
+      update_partials(partition, edge);
+      pll_update_sumtable(partition,
+                          edge->clv_index,
+                          edge->back->clv_index,
+                          edge->scaler_index,
+                          edge->back->scaler_index,
+                          fixture_params_indices,
+                          sumtable);
+      pll_compute_likelihood_derivatives(partition,
+                                         edge->scaler_index,
+                                         edge->back->scaler_index,
+                                         length,
+                                         fixture_params_indices,
+                                         sumtable,
+                                         &ref_d_f,
+                                         &ref_dd_f);
+      if (!close_to(d_f[m], ref_d_f, EPSILON) ||
+          !close_to(dd_f[m], ref_dd_f, EPSILON))
+        ++exact_fails;
+
+      /* central differences of the negative log-likelihood */
+      double lnl = edge_loglikelihood(partition, edge, length);
+      double lnl_plus = edge_loglikelihood(partition, edge, length + FD_STEP);
+      double lnl_minus = edge_loglikelihood(partition, edge, length - FD_STEP);
+      double fd_d_f = -(lnl_plus - lnl_minus) / (2 * FD_STEP);
+      double fd_dd_f = -(lnl_plus - 2*lnl + lnl_minus) / (FD_STEP * FD_STEP);
+
+      if (!close_to(d_f[m], fd_d_f, FD_EPSILON) ||
+          !close_to(dd_f[m], fd_dd_f, FD_EPSILON))
+        ++fd_fails;
+
+      sum_d_f += d_f[m];
+    }
+  }
+
+  printf("%2u states, %s scalers, %u thread%s: sum of d_f %.4f, "
+         "single branch %s, central differences %s\n",
+         states,
+         (attributes & PLL_ATTRIB_RATE_SCALERS) ? "rate" : "site",
+         thread_count,
+         thread_count > 1 ? "s" : "",
+         sum_d_f,
+         exact_fails ? "FAIL" : "OK",
+         fd_fails ? "FAIL" : "OK");
+
+  pll_aligned_free(sumtable);
+  free(d_f);
+  free(dd_f);
+  free(seen);
+  pll_partition_destroy(partition);
+}
+
+int main(int argc, char * argv[])
+{
+  /* check attributes */
+  unsigned int attributes = get_attributes(argc, argv);
+
+  /* the derivatives of all branches are not available with site repeats */
+  if (attributes & PLL_ATTRIB_SITE_REPEATS)
+    skip_test();
+
+  fixture = fixture_create(fixture_newick);
+
+  compare(4, attributes, 1);
+  compare(4, attributes | PLL_ATTRIB_RATE_SCALERS, 1);
+  compare(4, attributes, 3);
+  compare(20, attributes, 1);
+  compare(20, attributes, 3);
+
+  fixture_destroy(fixture);
+
+  return (0);
+}
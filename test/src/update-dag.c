@@ -0,0 +1,131 @@
+/*
+    Copyright (C) 2015-2020 Diego Darriba, Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Diego Darriba <Diego.Darriba@h-its.org>,
+    Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+    Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+#include "common.h"
+#include <math.h>
+
+#define N_STATES_NT 4
+#define N_SITES 331
+#define EPSILON 1e-9
+
+static unsigned int thread_counts[] = { 1, 2, 4 };
+
+static fixture_t * fixture;
+
+static unsigned int pattern(unsigned int states,
+                            unsigned int tip,
+                            unsigned int site)
+{
+  return tip*(site/9) + 3*(site%7) + tip/2;
+}
+
+static pll_partition_t * create_partition(unsigned int attributes)
+{
+  return fixture_partition(fixture, N_STATES_NT, N_SITES, attributes, pattern);
+}
+
+/* appends the operations of the traversal towards root to operations and
+   returns their number */
+static unsigned int create_operations(pll_partition_t * partition,
+                                      pll_unode_t * root,
+                                      pll_operation_t * operations)
+{
+  unsigned int ops_count = fixture_operations(fixture, partition, root);
+
+  memcpy(operations, fixture->operations, ops_count * sizeof(pll_operation_t));
+  return ops_count;
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int k, s, t;
+  double persite_ref[N_SITES];
+  double persite_lnl[N_SITES];
+
+  /* check attributes */
+  unsigned int attributes = get_attributes(argc, argv);
+
+  fixture = fixture_create(fixture_newick);
+  pll_utree_t * tree = fixture->tree;
+
+  unsigned int nodes_count = tree->tip_count + tree->inner_count;
+  pll_operation_t * operations = (pll_operation_t *)xmalloc(
+                              2 * tree->inner_count * sizeof(pll_operation_t));
+
+  /* two traversals in one batch: the second one overwrites CLVs that the
+     first one writes and reads */
+  pll_unode_t * root_a = tree->nodes[nodes_count - 1];
+  pll_unode_t * root_b = tree->nodes[tree->tip_count];
+
+  for (k = 0; k < 2; ++k)
+  {
+    unsigned int attr = attributes | (k ? PLL_ATTRIB_RATE_SCALERS : 0);
+
+    pll_partition_t * reference = create_partition(attr);
+    unsigned int count_a = create_operations(reference, root_a, operations);
+    unsigned int count_b = create_operations(reference,
+                                             root_b,
+                                             operations + count_a);
+
+    pll_update_partials(reference, operations, count_a);
+    double ref_lnl_a = fixture_loglikelihood(reference, root_a, NULL);
+    pll_update_partials(reference, operations, count_a + count_b);
+    double ref_lnl_b = fixture_loglikelihood(reference, root_b, persite_ref);
+
+    printf("%s scalers: logL %.4f, threads",
+           k ? "rate" : "site", ref_lnl_b);
+
+    for (t = 0; t < sizeof(thread_counts) / sizeof(unsigned int); ++t)
+    {
+      int ok = 1;
+      pll_partition_t * partition = create_partition(attr);
+      pll_set_thread_count(partition, thread_counts[t]);
+      create_operations(partition, root_a, operations);
+
+      /* a single traversal */
+      if (!pll_update_partials_dag(partition, operations, count_a))
+        fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+      if (fabs(fixture_loglikelihood(partition, root_a, NULL) - ref_lnl_a) >
+          EPSILON * fabs(ref_lnl_a))
+        ok = 0;
+
+      /* both traversals */
+      if (!pll_update_partials_dag(partition, operations, count_a + count_b))
+        fatal("Error %d: %s\n", pll_errno, pll_errmsg);
+      if (fabs(fixture_loglikelihood(partition, root_b, persite_lnl) -
+               ref_lnl_b) > EPSILON * fabs(ref_lnl_b))
+        ok = 0;
+      for (s = 0; s < N_SITES; ++s)
+        if (fabs(persite_lnl[s] - persite_ref[s]) > EPSILON)
+          ok = 0;
+
+      printf(" %u %s", thread_counts[t], ok ? "OK" : "FAIL");
+      pll_partition_destroy(partition);
+    }
+    printf("\n");
+
+    pll_partition_destroy(reference);
+  }
+
+  fixture_destroy(fixture);
+  free(operations);
+
+  return (0);
+}